@@ -11,10 +11,16 @@ LoadLib("lib/writer.lua")
 
 Exporter = {}
 
-function Exporter.new(sprite)
+Exporter.SPAN_MIN_RUN = 32
+-- spans only beat one masked blit when opaque spans cover nearly all of the image (PDANI_SPAN_MIN_OPAQUE in pdani.c)
+Exporter.SPAN_MIN_OPAQUE = 240
+
+function Exporter.new(sprite, options)
     local obj = {}
     obj.raw = sprite
     obj.images = {}
+    obj.imageBuckets = {}
+    obj.options = options or {}
     setmetatable(obj, { __index = Exporter })
     return obj
 end
@@ -62,13 +68,21 @@ function Exporter.flattenLayers(layers)
 end
 
 
+-- equal images have equal sizes, so only images of the same size are compared
 function Exporter:registerImage(image)
-    for idx, img in ipairs(self.images) do
-        if img:isEqual(image) then
+    local key = image.width .. "x" .. image.height
+    local bucket = self.imageBuckets[key]
+    if bucket == nil then
+        bucket = {}
+        self.imageBuckets[key] = bucket
+    end
+    for i, idx in ipairs(bucket) do
+        if self.images[idx]:isEqual(image) then
             return idx - 1
         end
     end
     table.insert(self.images, image)
+    table.insert(bucket, #self.images)
     return #self.images - 1
 end
 
@@ -77,10 +91,14 @@ function Exporter:export(path)
     local prefix = string.gsub(app.fs.fileName(path), "%..+$", "")
     self.stringOffset = 1
     self.strings = {}
+    self.stringOffsets = {}
     self.cels = {}
+    self.celIndices = {}
     self.colliders = {}
+    self.colliderIndices = {}
 
-    local w = Writer.new("PANI", 1)
+    local w = Writer.new("PANI", 2)
+    w.compressed = self.options.compress == true
 
     local info = w:makeChunk("INFO")
     info.misc = string.pack("I2 I2 I2", self.raw.width, self.raw.height, #self.raw.frames)
@@ -88,10 +106,14 @@ function Exporter:export(path)
     self:exportTags(w)
     self:exportLayers(w)
     self:exportFrames(w)
+    self:exportVariants(w)
 
     self:exportCelTable(w)
     self:exportColliderTable(w)
     self:exportImages(w, dir, prefix)
+    if self.options.spans == true then
+        self:exportSpans(w)
+    end
     self:exportStringTable(w)
 
     local f = io.open(path, 'w+')
@@ -102,14 +124,14 @@ function Exporter:export(path)
 end
 
 function Exporter:registerString(s)
-    for i, v in ipairs(self.strings) do
-        if v.string == s then
-            return v.offset
-        end
+    local found = self.stringOffsets[s]
+    if found ~= nil then
+        return found
     end
 
     local offset = self.stringOffset
     table.insert(self.strings, { offset = offset, string = s })
+    self.stringOffsets[s] = offset
     self.stringOffset = self.stringOffset + #s + 1
 
     return offset
@@ -117,50 +139,52 @@ end
 
 function Exporter:exportStringTable(w)
     local chunk = w:makeChunk("STRG")
-    local bin = string.pack("z", "")
+    local bin = { string.pack("z", "") }
     for i, v in ipairs(self.strings) do
-        bin = bin .. string.pack("z", v.string)
+        table.insert(bin, string.pack("z", v.string))
     end
-    chunk.data = bin
+    chunk.data = table.concat(bin)
 end
 
 function Exporter:registerCel(cel)
-    for i, c in ipairs(self.cels) do
-        if cel.image == c.image and cel.x == c.x and cel.y == c.y and cel.w == c.w and cel.h == c.h then
-            return i - 1
-        end
+    local key = string.format("%d %d %d %d %d", cel.image, cel.x, cel.y, cel.w, cel.h)
+    local found = self.celIndices[key]
+    if found ~= nil then
+        return found
     end
     table.insert(self.cels, cel)
+    self.celIndices[key] = #self.cels - 1
     return #self.cels - 1
 end
 
 function Exporter:registerCollider(col)
-    for i, c in ipairs(self.colliders) do
-        if col.x == c.x and col.y == c.y and col.w == c.w and col.h == c.h then
-            return i - 1
-        end
+    local key = string.format("%d %d %d %d", col.x, col.y, col.w, col.h)
+    local found = self.colliderIndices[key]
+    if found ~= nil then
+        return found
     end
     table.insert(self.colliders, col)
+    self.colliderIndices[key] = #self.colliders - 1
     return #self.colliders - 1
 end
 
 function Exporter:exportCelTable(w)
     local chunk = w:makeChunk("CELS")
-    local bin = ''
+    local bin = {}
     for i, c in ipairs(self.cels) do
-        bin = bin .. string.pack("I2 i2 i2", c.image, c.x, c.y)
+        table.insert(bin, string.pack("I2 i2 i2", c.image, c.x, c.y))
     end
-    chunk.data = bin
+    chunk.data = table.concat(bin)
     chunk.misc = string.pack("I2", #self.cels)
 end
 
 function Exporter:exportColliderTable(w)
     local chunk = w:makeChunk("COLS")
-    local bin = ''
+    local bin = {}
     for i, c in ipairs(self.colliders) do
-        bin = bin .. string.pack("i2 i2 I2 I2", c.x, c.y, c.w, c.h)
+        table.insert(bin, string.pack("i2 i2 I2 I2", c.x, c.y, c.w, c.h))
     end
-    chunk.data = bin
+    chunk.data = table.concat(bin)
     chunk.misc = string.pack("I2", #self.colliders)
 end
 
@@ -178,7 +202,7 @@ end
 
 function Exporter:exportLayers(w)
     local chunk = w:makeChunk("LAYS")
-    local bin = ''
+    local bin = {}
     local layers = self.flattenLayers(self.raw.layers)
     chunk.misc = string.pack("I2", #layers)
 
@@ -189,13 +213,13 @@ function Exporter:exportLayers(w)
         if not layer.isGroup then
             local collider = string.match(layer.name, "^@") ~= nil
             local t = collider and 'C' or 'L'
-            bin = bin .. string.pack("c1 i1 I2 I2", t, parentIndex, self:registerString(layer.name), 0)
+            table.insert(bin, string.pack("c1 i1 I2 I2", t, parentIndex, self:registerString(layer.name), 0))
         else
-            bin = bin .. string.pack("c1 i1 I2 I2", 'G', parentIndex, self:registerString(layer.name), #layer.layers)
+            table.insert(bin, string.pack("c1 i1 I2 I2", 'G', parentIndex, self:registerString(layer.name), #layer.layers))
         end
     end
 
-    chunk.data = bin
+    chunk.data = table.concat(bin)
 end
 
 function Exporter:exportFrames(w)
@@ -203,29 +227,26 @@ function Exporter:exportFrames(w)
     chunk.misc = string.pack("I2", #self.raw.frames)
 
     local data = {}
+    local layers = self.flattenLayers(self.raw.layers)
     for i, frame in ipairs(self.raw.frames) do
-        local bin = ''
         local duration = math.tointeger(frame.duration * 1000.0)
         assert(duration ~= nil)
-        bin = bin .. string.pack("I2", duration)
-        bin = bin .. self:exportFrameLayers(w, frame)
-        table.insert(data, bin)
+        table.insert(data, string.pack("I2", duration) .. self:exportFrameLayers(w, frame, layers))
     end
 
-    chunk:setDataAsJumpTable(2, data)
+    chunk:setDataAsJumpTable(w:getOffsetSize(), data)
 end
 
-function Exporter:exportFrameLayers(w, frame)
-    local bin = ''
-    local layers = self.flattenLayers(frame.sprite.layers)
+function Exporter:exportFrameLayers(w, frame, layers)
+    local bin = {}
     for i, layer in ipairs(layers) do
         if not layer.isGroup then
             local collider = string.match(layer.name, "^@") ~= nil
             local cel, cb = self:exportCels(w, frame, layer.cels, collider)
-            bin = bin .. string.pack("I2 i2", cb, cel)
+            table.insert(bin, string.pack("I2 i2", cb, cel))
         end
     end
-    return bin
+    return table.concat(bin)
 end
 
 function Exporter:exportCels(w, frame, cels, collider)
@@ -242,6 +263,13 @@ function Exporter:exportCels(w, frame, cels, collider)
         return -1, 0
     end 
     local rc = outputCel.bounds
+    local image, tx, ty = outputCel.image, 0, 0
+    if not collider then
+        image, tx, ty = Exporter.trimImage(image)
+        if image == nil then
+            return -1, 0
+        end
+    end
     local usercb = 0
     if string.len(outputCel.data) > 0 then
         usercb = self:registerString(outputCel.data)
@@ -250,12 +278,176 @@ function Exporter:exportCels(w, frame, cels, collider)
         local tmp = { x = rc.x, y = rc.y, w = rc.width, h = rc.height }
         return self:registerCollider(tmp), usercb
     else
-        local imageIndex = self:registerImage(outputCel.image)
-        local tmp = { image = imageIndex, x = rc.x, y = rc.y, w = rc.width, h = rc.height }
+        -- the trimmed margins move into the cel position, so the runtime draws the same pixels
+        local imageIndex = self:registerImage(image)
+        local tmp = { image = imageIndex, x = rc.x + tx, y = rc.y + ty, w = image.width, h = image.height }
         return self:registerCel(tmp), usercb
     end
 end
 
+-- rotation / scale variants (options.rotations headings x options.scales levels), baked from the composited frame.
+-- VARS: the scale levels (x256, the first is 1.0), then a cel per (variant, frame) for every variant but the first;
+-- -1 where the frame is not baked (options.bakeTags) and -2 where nothing is left to draw
+Exporter.VARIANT_NOT_BAKED = -1
+Exporter.VARIANT_EMPTY = -2
+
+function Exporter:exportVariants(w)
+    local angles = math.max(self.options.rotations or 0, 1)
+    local scales = { 256 }
+    for i, v in ipairs(self.options.scales or {}) do
+        local s = math.floor(v * 256 + 0.5)
+        if s > 0 and s ~= 256 then
+            table.insert(scales, s)
+        end
+    end
+    if angles * #scales == 1 then
+        return
+    end
+
+    local baked = {}
+    for i, frame in ipairs(self.raw.frames) do
+        baked[i] = self.options.bakeTags == nil or #self.options.bakeTags == 0
+    end
+    for i, tag in ipairs(self.raw.tags) do
+        if Exporter.findTableKey(self.options.bakeTags or {}, tag.name) ~= nil then
+            for f = tag.fromFrame.frameNumber, tag.toFrame.frameNumber do
+                baked[f] = true
+            end
+        end
+    end
+
+    local chunk = w:makeChunk("VARS")
+    chunk.misc = string.pack("I2 I2", angles, #scales)
+    local bin = {}
+    for i, s in ipairs(scales) do
+        table.insert(bin, string.pack("I2", s))
+    end
+    local layers = self.flattenLayers(self.raw.layers)
+    local composites = {}
+    for v = 1, angles * #scales - 1 do
+        for i, frame in ipairs(self.raw.frames) do
+            local cel = Exporter.VARIANT_NOT_BAKED
+            if baked[i] then
+                composites[i] = composites[i] or self:compositeFrame(frame, layers)
+                cel = self:bakeVariant(composites[i], v % angles, angles, scales[v // angles + 1])
+            end
+            table.insert(bin, string.pack("i2", cel))
+        end
+    end
+    chunk.data = table.concat(bin)
+end
+
+-- the drawn layers of a frame stacked like the runtime draws them (opaque pixels of upper cels win), or nil if nothing is drawn
+function Exporter:compositeFrame(frame, layers)
+    local cels = {}
+    local x0, y0, x1, y1 = math.maxinteger, math.maxinteger, math.mininteger, math.mininteger
+    for i, layer in ipairs(layers) do
+        if not layer.isGroup and string.match(layer.name, "^@") == nil then
+            for j, cel in ipairs(layer.cels) do
+                if cel.frameNumber == frame.frameNumber then
+                    if (cel.image ~= nil) and (not cel.bounds.isEmpty) and (not cel.image:isEmpty()) then
+                        local rc = cel.bounds
+                        table.insert(cels, cel)
+                        x0, y0 = math.min(x0, rc.x), math.min(y0, rc.y)
+                        x1, y1 = math.max(x1, rc.x + rc.width), math.max(y1, rc.y + rc.height)
+                    end
+                    break
+                end
+            end
+        end
+    end
+    if #cels == 0 then
+        return nil
+    end
+
+    local sprite = app.activeSprite
+    local img = Image(ImageSpec{ width = x1 - x0, height = y1 - y0, colorMode = sprite.colorMode, transparentColor = sprite.transparentColor })
+    img:clear()
+    for i, cel in ipairs(cels) do
+        local src, rc = cel.image, cel.bounds
+        for y = 0, src.height - 1 do
+            for x = 0, src.width - 1 do
+                local white, opaque = Exporter.pixelBits(src, x, y)
+                if opaque then
+                    img:putPixel(rc.x - x0 + x, rc.y - y0 + y, src:getPixel(x, y))
+                end
+            end
+        end
+    end
+    return { image = img, x = x0, y = y0 }
+end
+
+-- the composite turned clockwise by angle / angles of a full turn and scaled by scale / 256 around the canvas center
+-- (nearest sampling in integers, so the converter bakes the same pixels); returns the cel index
+function Exporter:bakeVariant(composite, angle, angles, scale)
+    if composite == nil then
+        return Exporter.VARIANT_EMPTY
+    end
+    local W, H = self.raw.width, self.raw.height
+    local theta = 2 * math.pi * angle / angles
+    local c = math.floor(math.cos(theta) * 65536 + 0.5)
+    local s = math.floor(math.sin(theta) * 65536 + 0.5)
+    local one = 65536 * 256
+    local src = composite.image
+
+    -- destination box from the turned corners (positions are doubled and relative to the canvas center)
+    local minX, minY, maxX, maxY = math.maxinteger, math.maxinteger, math.mininteger, math.mininteger
+    for i, corner in ipairs({ { 0, 0 }, { src.width, 0 }, { 0, src.height }, { src.width, src.height } }) do
+        local ux, uy = 2 * (composite.x + corner[1]) - W, 2 * (composite.y + corner[2]) - H
+        local fx, fy = (c * ux - s * uy) * scale // one, (s * ux + c * uy) * scale // one
+        minX, maxX = math.min(minX, fx), math.max(maxX, fx)
+        minY, maxY = math.min(minY, fy), math.max(maxY, fy)
+    end
+    local bx, by = (minX + W) // 2 - 1, (minY + H) // 2 - 1
+    local bw, bh = (maxX + W) // 2 + 2 - bx, (maxY + H) // 2 + 2 - by
+
+    local img = Image(ImageSpec{ width = bw, height = bh, colorMode = src.colorMode, transparentColor = src.spec.transparentColor })
+    img:clear()
+    local den = scale * 65536
+    for y = 0, bh - 1 do
+        local vy = 2 * (by + y) + 1 - H
+        for x = 0, bw - 1 do
+            local vx = 2 * (bx + x) + 1 - W
+            local sx = ((c * vx + s * vy) * 256 + W * den) // (2 * den) - composite.x
+            local sy = ((c * vy - s * vx) * 256 + H * den) // (2 * den) - composite.y
+            if sx >= 0 and sy >= 0 and sx < src.width and sy < src.height then
+                img:putPixel(x, y, src:getPixel(sx, sy))
+            end
+        end
+    end
+
+    local trimmed, tx, ty = Exporter.trimImage(img)
+    if trimmed == nil then
+        return Exporter.VARIANT_EMPTY
+    end
+    local imageIndex = self:registerImage(trimmed)
+    return self:registerCel({ image = imageIndex, x = bx + tx, y = by + ty, w = trimmed.width, h = trimmed.height })
+end
+
+-- the image without its fully transparent rows and columns, and the offset of what is left (nil if nothing is visible)
+function Exporter.trimImage(img)
+    local x0, y0, x1, y1 = img.width, img.height, -1, -1
+    for y = 0, img.height - 1 do
+        for x = 0, img.width - 1 do
+            if Exporter.pixelOpacity(img, x, y) ~= 0 then
+                x0, x1 = math.min(x0, x), math.max(x1, x)
+                y0, y1 = math.min(y0, y), math.max(y1, y)
+            end
+        end
+    end
+    if x1 < 0 then
+        return nil
+    end
+    local w, h = x1 - x0 + 1, y1 - y0 + 1
+    if w == img.width and h == img.height then
+        return img, 0, 0
+    end
+    local trimmed = Image(ImageSpec{ width = w, height = h, colorMode = img.colorMode, transparentColor = img.spec.transparentColor })
+    trimmed:clear()
+    trimmed:drawImage(img, -x0, -y0)
+    return trimmed, x0, y0
+end
+
 function Exporter:exportImages(w, dir, prefix)
     local rects = {}
     for i, img in ipairs(self.images) do
@@ -265,33 +457,230 @@ function Exporter:exportImages(w, dir, prefix)
         rc:alignSize(8, 0)
         table.insert(rects, rc)
     end
-    local packer = Packer.new()
+    local packer = Packer.new({ width = self.options.atlasWidth })
     local width, height = packer:pack(rects, 0)
 
-    local outputImage = Image(width, height, app.activeSprite.colorMode)
+    local sprite = app.activeSprite
+    local outputImage = Image(ImageSpec{ width = width, height = height, colorMode = sprite.colorMode, transparentColor = sprite.transparentColor })
     outputImage:clear()
     for i, v in ipairs(rects) do
         outputImage:drawImage(v.object, v.x, v.y)
     end
-    outputImage:saveAs(app.fs.joinPath(dir, prefix..".png"))
+    if self.options.compress then
+        -- the atlas travels inside the compressed .ani instead of a PNG
+        self:exportAtlas(w, outputImage)
+    else
+        outputImage:saveAs(app.fs.joinPath(dir, prefix..".png"))
+    end
 
     local chunk = w:makeChunk("IMAG")
     chunk.misc = string.pack("I2", #self.images)
-    local bin = ''
+    local placed = {}
+    for i, rc in ipairs(rects) do
+        placed[rc.object] = rc
+    end
+    local bin = {}
+    for i, img in ipairs(self.images) do
+        local rc = placed[img]
+        table.insert(bin, string.pack("i2 i2 I2 I2", rc.x, rc.y, rc.originalWidth, rc.h))
+    end
+    chunk.data = table.concat(bin)
+end
+
+-- white and opaque bits of a pixel, thresholded at 128 like pdc
+function Exporter.pixelBits(img, x, y)
+    local px = img:getPixel(x, y)
+    local value, alpha = 0, 255
+    if img.colorMode == ColorMode.RGB then
+        local r, g, b = app.pixelColor.rgbaR(px), app.pixelColor.rgbaG(px), app.pixelColor.rgbaB(px)
+        value = (r * 299 + g * 587 + b * 114) // 1000
+        alpha = app.pixelColor.rgbaA(px)
+    elseif img.colorMode == ColorMode.GRAY then
+        value = app.pixelColor.grayaV(px)
+        alpha = app.pixelColor.grayaA(px)
+    elseif img.colorMode == ColorMode.INDEXED then
+        local c = app.activeSprite.palettes[1]:getColor(px)
+        value = (c.red * 299 + c.green * 587 + c.blue * 114) // 1000
+        alpha = (px == img.spec.transparentColor) and 0 or c.alpha
+    end
+    return value >= 128, alpha >= 128
+end
+
+-- 1bit texel rows then mask rows, 32bit aligned like LCDBitmap
+function Exporter:exportAtlas(w, img)
+    local rowbytes = ((img.width + 31) // 32) * 4
+    local texel = {}
+    local mask = {}
+    for y = 0, img.height - 1 do
+        for bx = 0, rowbytes - 1 do
+            local t, m = 0, 0
+            for b = 0, 7 do
+                local x = bx * 8 + b
+                if x < img.width then
+                    local white, opaque = Exporter.pixelBits(img, x, y)
+                    if white then
+                        t = t | (0x80 >> b)
+                    end
+                    if opaque then
+                        m = m | (0x80 >> b)
+                    end
+                end
+            end
+            table.insert(texel, string.char(t))
+            table.insert(mask, string.char(m))
+        end
+    end
+
+    local chunk = w:makeChunk("ATLS")
+    chunk.misc = string.pack("I2 I2 I2", img.width, img.height, rowbytes)
+    chunk.data = table.concat(texel) .. table.concat(mask)
+end
+
+-- 0: transparent, 1: partially visible, 2: opaque
+function Exporter.pixelOpacity(img, x, y)
+    local px = img:getPixel(x, y)
+    local alpha = 255
+    if img.colorMode == ColorMode.RGB then
+        alpha = app.pixelColor.rgbaA(px)
+    elseif img.colorMode == ColorMode.GRAY then
+        alpha = app.pixelColor.grayaA(px)
+    elseif img.colorMode == ColorMode.INDEXED then
+        alpha = (px == img.spec.transparentColor) and 0 or 255
+    end
+    if alpha == 0 then
+        return 0
+    elseif alpha == 255 then
+        return 2
+    end
+    return 1
+end
+
+-- split an image into opaque rects (drawn without the mask) and masked rects; transparent areas are left out
+function Exporter.makeSpans(img)
+    local spans = {}
+    local w, h = img.width, img.height
+    local opacity = {}
+    for y = 0, h - 1 do
+        local row = {}
+        for x = 0, w - 1 do
+            row[x] = Exporter.pixelOpacity(img, x, y)
+        end
+        opacity[y] = row
+    end
+
+    local function closeGroup(ys, ye, runs)
+        for g = 0, #runs do
+            local ga = (g == 0) and 0 or runs[g].b
+            local gb = (g == #runs) and w or runs[g + 1].a
+            local minx, maxx = gb, ga - 1
+            for y = ys, ye - 1 do
+                for x = ga, gb - 1 do
+                    if opacity[y][x] ~= 0 then
+                        minx = math.min(minx, x)
+                        maxx = math.max(maxx, x)
+                    end
+                end
+            end
+            if minx <= maxx then
+                table.insert(spans, { kind = 'M', x = minx, y = ys, w = maxx - minx + 1, h = ye - ys })
+            end
+            if g < #runs then
+                table.insert(spans, { kind = 'O', x = runs[g + 1].a, y = ys, w = runs[g + 1].b - runs[g + 1].a, h = ye - ys })
+            end
+        end
+    end
+
+    local group = nil
+    local ys = -1
+    for y = 0, h do
+        local runs = {}
+        local content = false
+        if y < h then
+            local x = 0
+            while x < w do
+                local p = opacity[y][x]
+                if p ~= 0 then
+                    content = true
+                end
+                if p ~= 2 then
+                    x = x + 1
+                else
+                    local e = x
+                    while e < w and opacity[y][e] == 2 do
+                        e = e + 1
+                    end
+                    if e - x >= Exporter.SPAN_MIN_RUN then
+                        table.insert(runs, { a = x, b = e })
+                    end
+                    x = e
+                end
+            end
+        end
+
+        local merged = false
+        if ys >= 0 then
+            local merge = content and #runs == #group
+            for i = 1, #runs do
+                if not merge then
+                    break
+                end
+                merge = math.max(group[i].a, runs[i].a) + Exporter.SPAN_MIN_RUN <= math.min(group[i].b, runs[i].b)
+            end
+            if merge then
+                for i = 1, #runs do
+                    group[i].a = math.max(group[i].a, runs[i].a)
+                    group[i].b = math.min(group[i].b, runs[i].b)
+                end
+                merged = true
+            else
+                closeGroup(ys, y, group)
+                ys = -1
+            end
+        end
+        if not merged and content then
+            ys = y
+            group = runs
+        end
+    end
+    return spans
+end
+
+-- only images whose opaque spans cover nearly all of them get spans; without any, no SPAN chunk is written
+function Exporter:exportSpans(w)
+    local offsetFormat = string.format("I%d", w:getOffsetSize())
+    local table_ = {}
+    local bodies = {}
+    local start = 0
+    table.insert(table_, string.pack(offsetFormat, start))
     for i, img in ipairs(self.images) do
-        for i, rc in ipairs(rects) do
-            if rc.object == img then
-                bin = bin .. string.pack("i2 i2 I2 I2", rc.x, rc.y, rc.originalWidth, rc.h)
+        local spans = Exporter.makeSpans(img)
+        local opaque = 0
+        for j, span in ipairs(spans) do
+            if span.kind == 'O' then
+                opaque = opaque + span.w * span.h
+            end
+        end
+        if #spans > 0 and opaque * 256 >= img.width * img.height * Exporter.SPAN_MIN_OPAQUE then
+            for j, span in ipairs(spans) do
+                table.insert(bodies, string.pack("c1 x I2 I2 I2 I2", span.kind, span.x, span.y, span.w, span.h))
             end
+            start = start + #spans
         end
+        table.insert(table_, string.pack(offsetFormat, start))
+    end
+    if start == 0 then
+        return
     end
-    chunk.data = bin
+    local chunk = w:makeChunk("SPAN")
+    chunk.misc = string.pack("I2", #self.images)
+    chunk.data = table.concat(table_) .. table.concat(bodies)
 end
 
 -- dump
 function Exporter:dump(path)
     local yaml = ''
     self.images = {}
+    self.imageBuckets = {}
 
     yaml = self:dumpInfo(yaml)
     yaml = self:dumpFrames(yaml)
@@ -1,10 +1,12 @@
 Packer = {}
 Packer.Rect = {}
-Packer.Node = {}
+Packer.MaxRects = {}
 
-function Packer.new()
+-- options.width: "auto" (the smallest atlas of a few widths around the square), "pot" (power of two sizes) or a width in pixels
+function Packer.new(options)
     local obj = {}
     setmetatable(obj, { __index = Packer })
+    obj.options = options or {}
     return obj
 end
 
@@ -26,100 +28,186 @@ end
 
 function Packer.Rect:alignSize(aw, ah)
     if aw > 0 then
-        self.w = math.tointeger((self.w + aw - 1) / aw) * aw
+        self.w = Packer.align(self.w, aw)
     end
     if ah > 0 then
-        self.h = math.tointeger((self.h + ah - 1) / ah) * ah
+        self.h = Packer.align(self.h, ah)
     end
 end
 
--- class Packer.Node
-function Packer.Node.new(rc)
+function Packer.Rect:contains(rc)
+    return rc.x >= self.x and rc.y >= self.y and rc.x + rc.w <= self.x + self.w and rc.y + rc.h <= self.y + self.h
+end
+
+function Packer.Rect:intersects(x, y, w, h)
+    return x < self.x + self.w and x + w > self.x and y < self.y + self.h and y + h > self.y
+end
+
+-- class Packer.MaxRects (free rectangles of one bin)
+function Packer.MaxRects.new(w, h)
     local obj = {}
-    setmetatable(obj, { __index = Packer.Node })
-    obj.left = nil
-    obj.right = nil
-    obj.rect = rc
+    setmetatable(obj, { __index = Packer.MaxRects })
+    obj.free = { Packer.Rect.new(0, 0, w, h) }
     return obj
 end
 
-function Packer.Node:insert(rc, margin)
-    if self.rect == nil then
-        if self.left:insert(rc, margin) then
-            return true
+-- best short side fit; ties go to the smaller long side, then to the earlier free rect
+function Packer.MaxRects:find(w, h)
+    local best = nil
+    local bestShort, bestLong = math.maxinteger, math.maxinteger
+    for i, fr in ipairs(self.free) do
+        if w <= fr.w and h <= fr.h then
+            local dw, dh = fr.w - w, fr.h - h
+            local short, long = math.min(dw, dh), math.max(dw, dh)
+            if short < bestShort or (short == bestShort and long < bestLong) then
+                best = fr
+                bestShort, bestLong = short, long
+            end
         end
-        return self.right:insert(rc, margin)
-    end
-    if (rc.w + margin > self.rect.w) or (rc.h + margin > self.rect.h) then
-        return false
-    end
-    rc.x = self.rect.x
-    rc.y = self.rect.y
-    local w = rc.w + margin
-    local h = rc.h + margin
-    local dw = self.rect.w - w
-    local dh = self.rect.h - h
-    if dw > dh then
-        self.left = Packer.Node.new(Packer.Rect.new(self.rect.x, self.rect.y + h, w, dh))
-        self.right = Packer.Node.new(Packer.Rect.new(self.rect.x + w, self.rect.y, dw, self.rect.h))
-    else
-        self.left = Packer.Node.new(Packer.Rect.new(self.rect.x + w, self.rect.y, dw, h))
-        self.right = Packer.Node.new(Packer.Rect.new(self.rect.x, self.rect.y + h, self.rect.w, dh))
     end
-    self.rect = nil
-    return true
+    return best
 end
 
-function Packer:pack(image_rects, margin)
-    table.sort(image_rects, function(a, b) return math.max(b.w, b.h) < math.max(a.w, a.h) end)
-    local w, h = self.calcInitialRect(image_rects)
-    while true do
-        local root = Packer.Node.new(Packer.Rect.new(0, 0, w, h))
-        local result = self:insertImagesToRoot(image_rects, root, margin)
-        if result then
-            return w, h
-        end
-        if w > h then
-            h = h + 8
+-- split every free rect overlapping the placed one, then drop free rects inside others
+function Packer.MaxRects:place(x, y, w, h)
+    local free = {}
+    for i, fr in ipairs(self.free) do
+        if not fr:intersects(x, y, w, h) then
+            table.insert(free, fr)
         else
-            w = w + 8
+            if y > fr.y then
+                table.insert(free, Packer.Rect.new(fr.x, fr.y, fr.w, y - fr.y))
+            end
+            if y + h < fr.y + fr.h then
+                table.insert(free, Packer.Rect.new(fr.x, y + h, fr.w, fr.y + fr.h - (y + h)))
+            end
+            if x > fr.x then
+                table.insert(free, Packer.Rect.new(fr.x, fr.y, x - fr.x, fr.h))
+            end
+            if x + w < fr.x + fr.w then
+                table.insert(free, Packer.Rect.new(x + w, fr.y, fr.x + fr.w - (x + w), fr.h))
+            end
+        end
+    end
+
+    self.free = {}
+    for i, a in ipairs(free) do
+        local redundant = false
+        for j, b in ipairs(free) do
+            -- of two equal rects the first one stays
+            if i ~= j and b:contains(a) and (j < i or not a:contains(b)) then
+                redundant = true
+                break
+            end
+        end
+        if not redundant then
+            table.insert(self.free, a)
         end
     end
 end
 
-function Packer:insertImagesToRoot(image_rects, root, margin)
+function Packer:pack(image_rects, margin)
+    if #image_rects == 0 then
+        return 0, 0
+    end
+    for i, v in ipairs(image_rects) do
+        v.order = v.order or i
+    end
+    table.sort(image_rects, Packer.larger)
+
+    local total, maxWidth = 0, 0
     for _, v in ipairs(image_rects) do
-        if root:insert(v, margin) == false then
-            return false
+        total = total + (v.w + margin) * (v.h + margin)
+        maxWidth = math.max(maxWidth, v.w + margin)
+    end
+
+    local policy = self.options.width or "auto"
+    local candidates = {}
+    if type(policy) == "number" then
+        candidates = { policy }
+    else
+        local side = math.floor(math.sqrt(total))
+        candidates = { side, side * 5 // 4, side * 3 // 2, side * 2 }
+    end
+
+    local bestWidth, bestHeight = nil, nil
+    local tried = {}
+    for _, c in ipairs(candidates) do
+        local w = Packer.align(math.max(c, maxWidth), 8)
+        if policy == "pot" then
+            w = Packer.nextPowerOfTwo(w)
+        end
+        if not tried[w] then
+            tried[w] = true
+            local h = self:packWidth(image_rects, margin, w, total)
+            if policy == "pot" then
+                h = Packer.nextPowerOfTwo(h)
+            end
+            if bestWidth == nil or w * h < bestWidth * bestHeight then
+                bestWidth, bestHeight = w, h
+            end
         end
     end
-    return true
-end
 
-function Packer.calcInitialRect(image_rects)
-    local total = Packer.calcTotalPixel(image_rects)
-    local len = math.floor(math.sqrt(total)) / 2
-    local w = Packer.align(len, 8)
-    local h = len
+    -- place the rects again at the chosen width
+    self:packWidth(image_rects, margin, bestWidth, total)
+    return bestWidth, bestHeight
+end
 
-    while w * h < total do
-        if w > h then
-            h = h + 8
-        else
-            w = w + 8
+-- packs into a bin of the given width, growing its height by 1/8 until everything fits; returns the used height
+function Packer:packWidth(image_rects, margin, width, total)
+    local height = (total + width - 1) // width
+    for _, v in ipairs(image_rects) do
+        height = math.max(height, v.h + margin)
+    end
+    while true do
+        local used = self:insertImagesToBin(image_rects, margin, width, height)
+        if used ~= nil then
+            return used
         end
+        height = height + math.max(8, height // 8)
     end
-    return w, h
 end
 
-function Packer.calcTotalPixel(image_rects)
-    local total = 0
+function Packer:insertImagesToBin(image_rects, margin, width, height)
+    local bin = Packer.MaxRects.new(width, height)
+    local used = 0
     for _, v in ipairs(image_rects) do
-        total = total + v.w * v.h
+        local w, h = v.w + margin, v.h + margin
+        local fr = bin:find(w, h)
+        if fr == nil then
+            return nil
+        end
+        v.x, v.y = fr.x, fr.y
+        bin:place(v.x, v.y, w, h)
+        used = math.max(used, v.y + v.h)
     end
-    return total
+    return used
+end
+
+-- larger side first, then taller, then wider, then the original order (a strict order, so table.sort is deterministic)
+function Packer.larger(a, b)
+    local am, bm = math.max(a.w, a.h), math.max(b.w, b.h)
+    if am ~= bm then
+        return am > bm
+    end
+    if a.h ~= b.h then
+        return a.h > b.h
+    end
+    if a.w ~= b.w then
+        return a.w > b.w
+    end
+    return a.order < b.order
 end
 
 function Packer.align(x, a)
-    return math.tointeger((x + a - 1) / a) * a
+    return (x + a - 1) // a * a
+end
+
+function Packer.nextPowerOfTwo(x)
+    local n = 8
+    while n < x do
+        n = n * 2
+    end
+    return n
 end
@@ -1,31 +1,85 @@
 Writer = {}
 Writer.Chunk = {}
 
+-- v2: order of the chunk directory (same as enum pdani_chunk_type)
+Writer.CHUNK_ORDER = { "INFO", "TAGS", "LAYS", "FRAM", "CELS", "COLS", "IMAG", "STRG", "SPAN", "ATLS", "VARS" }
+Writer.ALIGNMENT = 16
+-- v2 header flags (enum pdani_header_flags)
+Writer.FLAG_COMPRESSED = 1
+
 function Writer.new(id, version)
     local obj = {}
     setmetatable(obj, { __index = Writer })
     obj.id = id
     obj.version = version
     obj.chunks = {}
+    obj.compressed = false
     return obj
 end
 
+-- size of FRAM jump table / SPAN start table entries
+function Writer:getOffsetSize()
+    if self.version >= 2 then
+        return 4
+    end
+    return 2
+end
+
 function Writer:toString()
-    local bin = self:makeHeader()
-    local offset = #bin
+    if self.version >= 2 then
+        return self:toStringWithDirectory()
+    end
+
+    local bin = { self:makeHeader() }
+    local offset = #bin[1]
 
     for i = 1, #self.chunks - 1 do
         offset = offset + #self.chunks[i]:toString()
         self.chunks[i].next = offset
     end
     for i, c in ipairs(self.chunks) do
-        bin = bin .. c:toString()
+        table.insert(bin, c:toString())
+    end
+
+    return table.concat(bin)
+end
+
+-- v2: header, fixed chunk directory, then chunks with 32bit sizes
+function Writer:toStringWithDirectory()
+    local header = self:makeHeader()
+    local directorySize = #Writer.padding(string.rep("\0", 8 * #Writer.CHUNK_ORDER), Writer.ALIGNMENT)
+
+    local offsets = {}
+    local bodies = {}
+    local offset = #header + directorySize
+    for i, c in ipairs(self.chunks) do
+        local bin = c:toStringV2()
+        offsets[c.id] = offset
+        table.insert(bodies, bin)
+        offset = offset + #bin
+    end
+
+    local entries = {}
+    for i, id in ipairs(Writer.CHUNK_ORDER) do
+        table.insert(entries, string.pack("c4 I4", id, offsets[id] or 0))
     end
+    local directory = table.concat(entries)
 
-    return bin
+    local body = table.concat(bodies)
+    if self.compressed then
+        -- struct pdani_compressed_block, then the LZ4 block; offsets above point into the decompressed body
+        local packed = Writer.compress(body)
+        body = string.pack("I4 I4 xxxxxxxx", #body, #packed) .. packed
+    end
+
+    return header .. Writer.padding(directory, Writer.ALIGNMENT) .. body
 end
 
 function Writer:makeHeader()
+    if self.version >= 2 then
+        local flags = self.compressed and Writer.FLAG_COMPRESSED or 0
+        return string.pack("c4 I4 I2 I2 I2 xx", self.id, self.version, #Writer.CHUNK_ORDER, Writer.ALIGNMENT, flags)
+    end
     return string.pack("c4 I4 xxxx xxxx", self.id, self.version)
 end
 
@@ -49,28 +103,82 @@ function Writer.Chunk:toString()
     return string.pack("c4 I2 I2 c8", self.id, #self.data, self.next >> 4, self.misc) .. Writer.padding(self.data, 16)
 end
 
+function Writer.Chunk:toStringV2()
+    return string.pack("c4 I4 c8", self.id, #self.data, self.misc) .. Writer.padding(self.data, Writer.ALIGNMENT)
+end
+
 function Writer.Chunk:concatData(list)
-    local bin = ''
-    for i, data in ipairs(list) do
-        bin = bin .. data
-    end
-    self.data = bin
+    self.data = table.concat(list)
 end
 
 function Writer.Chunk:setDataAsJumpTable(jumpTableSize, bodies)
-    local bin = ''
+    local jumpTable = {}
 
     local offset = jumpTableSize * #bodies
     for i, data in ipairs(bodies) do
-        bin = bin .. string.pack(string.format("I%d", jumpTableSize), offset)
+        table.insert(jumpTable, string.pack(string.format("I%d", jumpTableSize), offset))
         offset = offset + #data
     end
 
-    for i, data in ipairs(bodies) do
-        bin = bin .. data
+    self.data = table.concat(jumpTable) .. table.concat(bodies)
+end
+
+-- greedy LZ4 block compressor; the runtime decompresses it in place (lzDecompress in pdani.c).
+-- the last match starts at least 12 bytes before the end and the last 5 bytes are literals
+function Writer.compress(data)
+    local n = #data
+    local out = {}
+    local last = {}
+    local anchor = 1
+
+    local function putLength(len)
+        len = len - 15
+        while len >= 255 do
+            table.insert(out, "\255")
+            len = len - 255
+        end
+        table.insert(out, string.char(len))
+    end
+
+    local function emit(literalEnd, matchLength, offset)
+        local literals = literalEnd - anchor
+        local token = math.min(literals, 15) << 4
+        if matchLength ~= nil then
+            token = token | math.min(matchLength - 4, 15)
+        end
+        table.insert(out, string.char(token))
+        if literals >= 15 then
+            putLength(literals)
+        end
+        table.insert(out, string.sub(data, anchor, literalEnd - 1))
+        if matchLength ~= nil then
+            table.insert(out, string.pack("<I2", offset))
+            if matchLength - 4 >= 15 then
+                putLength(matchLength - 4)
+            end
+        end
+    end
+
+    local i = 1
+    while i + 11 <= n do
+        local key = string.sub(data, i, i + 3)
+        local ref = last[key]
+        last[key] = i
+        if ref ~= nil and i - ref <= 65535 then
+            local len = 4
+            while i + len < n - 4 and string.byte(data, ref + len) == string.byte(data, i + len) do
+                len = len + 1
+            end
+            emit(i, len, i - ref)
+            i = i + len
+            anchor = i
+        else
+            i = i + 1
+        end
     end
+    emit(n + 1, nil, nil)
 
-    self.data = bin
+    return table.concat(out)
 end
 
 function Writer.padding(bin, align)
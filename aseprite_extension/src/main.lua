@@ -4,22 +4,53 @@ function LoadLib(filename)
     dofile(path)
 end
 
-function OutputFile(filename, log)
+function OutputFile(filename, log, options)
     filename = app.fs.normalizePath(filename)
-    local exp = Exporter.new(app.activeSprite)
+    local exp = Exporter.new(app.activeSprite, options)
     exp:export(filename)
     if log then
         exp:dump(filename)
     end
 end
 
+-- "a, b" -> { "a", "b" } (through convert if given; entries it rejects are dropped)
+function SplitList(text, convert)
+    local list = {}
+    for item in string.gmatch(text or "", "[^,]+") do
+        item = string.match(item, "^%s*(.-)%s*$")
+        if convert ~= nil then
+            item = convert(item)
+        end
+        if item ~= nil and item ~= "" then
+            table.insert(list, item)
+        end
+    end
+    return list
+end
+
 if app.params['output'] ~= nil and app.activeSprite ~= nil then
     print("Batch export: "..app.params["output"])
     LoadLib("lib/exporter.lua")
-    OutputFile(app.params['output'])
+    OutputFile(app.params['output'], false, {
+        spans = app.params['spans'] == 'true',
+        compress = app.params['compress'] == 'true',
+        atlasWidth = tonumber(app.params['atlas_width']) or app.params['atlas_width'],
+        rotations = tonumber(app.params['rotations']),
+        scales = SplitList(app.params['scales'], tonumber),
+        bakeTags = SplitList(app.params['bake_tags']),
+    })
     return
 end
 
+local ATLAS_WIDTHS = { "Auto", "Power of two", "128", "256", "512" }
+
+function AtlasWidthOption(text)
+    if text == "Power of two" then
+        return "pot"
+    end
+    return tonumber(text) or "auto"
+end
+
 local Plugin
 
 function Execute()
@@ -57,6 +88,38 @@ function Execute()
             text = "Output Log",
             selected = Plugin.preferences.output_log
         })
+        :check({
+            id = "spans",
+            text = "Span Encoding (nearly opaque images only)",
+            selected = Plugin.preferences.spans == true
+        })
+        :check({
+            id = "compress",
+            text = "Compress (embeds the atlas, no .png)",
+            selected = Plugin.preferences.compress == true
+        })
+        :combobox({
+            id = "atlaswidth",
+            label = "Atlas Width",
+            option = Plugin.preferences.atlas_width or ATLAS_WIDTHS[1],
+            options = ATLAS_WIDTHS
+        })
+        :number({
+            id = "rotations",
+            label = "Baked Rotations",
+            text = tostring(Plugin.preferences.rotations or 0),
+            decimals = 0
+        })
+        :entry({
+            id = "scales",
+            label = "Baked Scales",
+            text = Plugin.preferences.scales or ""
+        })
+        :entry({
+            id = "baketags",
+            label = "Bake Tags (all if empty)",
+            text = Plugin.preferences.bake_tags or ""
+        })
         :button({
             id = "cancel",
             text = "Cancel",
@@ -82,11 +145,24 @@ function Execute()
     end
 
     Plugin.preferences.output_log = dialog.data.outputlog
+    Plugin.preferences.spans = dialog.data.spans
+    Plugin.preferences.compress = dialog.data.compress
+    Plugin.preferences.atlas_width = dialog.data.atlaswidth
+    Plugin.preferences.rotations = dialog.data.rotations
+    Plugin.preferences.scales = dialog.data.scales
+    Plugin.preferences.bake_tags = dialog.data.baketags
 
     local filename = dialog.data.savedialog
 
     if string.len(filename) > 0 then
-        OutputFile(filename, dialog.data.outputlog)
+        OutputFile(filename, dialog.data.outputlog, {
+            spans = dialog.data.spans,
+            compress = dialog.data.compress,
+            atlasWidth = AtlasWidthOption(dialog.data.atlaswidth),
+            rotations = math.floor(dialog.data.rotations),
+            scales = SplitList(dialog.data.scales, tonumber),
+            bakeTags = SplitList(dialog.data.baketags),
+        })
         app.alert("Exported")
     end
 end
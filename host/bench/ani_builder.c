@@ -0,0 +1,382 @@
+#include "ani_builder.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+static size_t align_size(size_t v, size_t a)
+{
+    return (v + a - 1) / a * a;
+}
+
+// mirrors Writer.CHUNK_ORDER
+static const char *chunk_order[] = { "INFO", "TAGS", "LAYS", "FRAM", "CELS", "COLS", "IMAG", "STRG", "SPAN", "ATLS", "VARS" };
+#define CHUNK_ORDER_COUNT ((int)(sizeof(chunk_order) / sizeof(chunk_order[0])))
+
+void ani_builder_initialize(struct ani_builder *builder, uint32_t version)
+{
+    memset(builder, 0, sizeof(struct ani_builder));
+    builder->version = version;
+    // offset 0 is the empty string
+    builder->strings = calloc(1, 1);
+    builder->strings_size = 1;
+}
+
+void ani_builder_finalize(struct ani_builder *builder)
+{
+    for (int i = 0; i < builder->chunk_count; ++i) {
+        free(builder->chunks[i].data);
+    }
+    free(builder->strings);
+    memset(builder, 0, sizeof(struct ani_builder));
+}
+
+struct ani_builder_chunk* ani_builder_make_chunk(struct ani_builder *builder, const char *id)
+{
+    struct ani_builder_chunk *chunk = &builder->chunks[builder->chunk_count++];
+    memset(chunk, 0, sizeof(struct ani_builder_chunk));
+    memcpy(chunk->id, id, 4);
+    return chunk;
+}
+
+void ani_builder_chunk_append(struct ani_builder_chunk *chunk, const void *data, size_t size)
+{
+    chunk->data = realloc(chunk->data, chunk->size + size);
+    memcpy(chunk->data + chunk->size, data, size);
+    chunk->size += size;
+}
+
+void ani_builder_chunk_set_misc_u16(struct ani_builder_chunk *chunk, int index, uint16_t value)
+{
+    memcpy(&chunk->misc[index * 2], &value, 2);
+}
+
+void ani_builder_chunk_append_offset(const struct ani_builder *builder, struct ani_builder_chunk *chunk, uint32_t value)
+{
+    if (builder->version >= 2) {
+        ani_builder_chunk_append(chunk, &value, sizeof(uint32_t));
+    } else {
+        const uint16_t v = (uint16_t)value;
+        ani_builder_chunk_append(chunk, &v, sizeof(uint16_t));
+    }
+}
+
+uint16_t ani_builder_register_string(struct ani_builder *builder, const char *s)
+{
+    for (size_t offset = 1; offset < builder->strings_size; offset += strlen((const char*)builder->strings + offset) + 1) {
+        if (strcmp((const char*)builder->strings + offset, s) == 0) return (uint16_t)offset;
+    }
+    const size_t len = strlen(s) + 1;
+    const size_t offset = builder->strings_size;
+    builder->strings = realloc(builder->strings, builder->strings_size + len);
+    memcpy(builder->strings + offset, s, len);
+    builder->strings_size += len;
+    return (uint16_t)offset;
+}
+
+// sets the compressed flag and replaces everything after the directory with the LZ4 block (frees raw)
+static void* compress_image(uint8_t *raw, size_t prefix, size_t raw_size, size_t *outsize)
+{
+    uint8_t *out = calloc(1, prefix + 16 + ani_builder_lz_bound(raw_size));
+    memcpy(out, raw, prefix);
+    uint16_t flags;
+    memcpy(&flags, out + 12, 2);
+    flags |= 1; // PDANI_HEADER_FLAG_COMPRESSED
+    memcpy(out + 12, &flags, 2);
+    const uint32_t packed = (uint32_t)ani_builder_lz_compress(raw + prefix, raw_size, out + prefix + 16);
+    const uint32_t raw32 = (uint32_t)raw_size;
+    memcpy(out + prefix, &raw32, 4);
+    memcpy(out + prefix + 4, &packed, 4);
+    free(raw);
+    *outsize = prefix + 16 + packed;
+    return out;
+}
+
+void* ani_builder_build(struct ani_builder *builder, size_t *size)
+{
+    struct ani_builder_chunk *strg = ani_builder_make_chunk(builder, "STRG");
+    ani_builder_chunk_append(strg, builder->strings, builder->strings_size);
+
+    const size_t directory_size = (builder->version >= 2)? align_size(8 * CHUNK_ORDER_COUNT, 16) : 0;
+    size_t total = 16 + directory_size;
+    for (int i = 0; i < builder->chunk_count; ++i) {
+        total += 16 + align_size(builder->chunks[i].size, 16);
+    }
+
+    uint8_t *bin = calloc(1, total);
+    memcpy(bin, "PANI", 4);
+    memcpy(bin + 4, &builder->version, 4);
+
+    if (builder->version >= 2) {
+        const uint16_t count = CHUNK_ORDER_COUNT, alignment = 16;
+        memcpy(bin + 8, &count, 2);
+        memcpy(bin + 10, &alignment, 2);
+
+        size_t offset = 16 + directory_size;
+        for (int i = 0; i < builder->chunk_count; ++i) {
+            const struct ani_builder_chunk *chunk = &builder->chunks[i];
+            const uint32_t sz = (uint32_t)chunk->size;
+            memcpy(bin + offset, chunk->id, 4);
+            memcpy(bin + offset + 4, &sz, 4);
+            memcpy(bin + offset + 8, chunk->misc, 8);
+            if (chunk->size > 0) memcpy(bin + offset + 16, chunk->data, chunk->size);
+            for (int t = 0; t < CHUNK_ORDER_COUNT; ++t) {
+                if (memcmp(chunk_order[t], chunk->id, 4) != 0) continue;
+                const uint32_t o = (uint32_t)offset;
+                memcpy(bin + 16 + t * 8, chunk->id, 4);
+                memcpy(bin + 16 + t * 8 + 4, &o, 4);
+            }
+            offset += 16 + align_size(chunk->size, 16);
+        }
+        // absent chunks keep their id with offset 0, like Writer:toStringWithDirectory
+        for (int t = 0; t < CHUNK_ORDER_COUNT; ++t) {
+            memcpy(bin + 16 + t * 8, chunk_order[t], 4);
+        }
+        if (builder->compressed) {
+            return compress_image(bin, 16 + directory_size, total - 16 - directory_size, size);
+        }
+        *size = total;
+        return bin;
+    }
+
+    size_t offset = 16;
+    for (int i = 0; i < builder->chunk_count; ++i) {
+        const struct ani_builder_chunk *chunk = &builder->chunks[i];
+        const size_t next = offset + 16 + align_size(chunk->size, 16);
+        const uint16_t sz = (uint16_t)chunk->size;
+        const uint16_t nx = (i + 1 < builder->chunk_count)? (uint16_t)(next >> 4) : 0;
+        memcpy(bin + offset, chunk->id, 4);
+        memcpy(bin + offset + 4, &sz, 2);
+        memcpy(bin + offset + 6, &nx, 2);
+        memcpy(bin + offset + 8, chunk->misc, 8);
+        if (chunk->size > 0) memcpy(bin + offset + 16, chunk->data, chunk->size);
+        offset = next;
+    }
+    *size = total;
+    return bin;
+}
+
+#define SPAN_MIN_RUN 32
+#define SPAN_MAX_RUNS 32
+
+struct span_run {
+    int a, b;
+};
+
+static void append_span(struct ani_builder_chunk *chunk, char kind, int x, int y, int w, int h)
+{
+    const struct { char kind; char reserved; uint16_t x, y, w, h; } span = { kind, 0, (uint16_t)x, (uint16_t)y, (uint16_t)w, (uint16_t)h };
+    ani_builder_chunk_append(chunk, &span, sizeof(span));
+}
+
+static int close_span_group(struct ani_builder_chunk *chunk, int w, int ys, int ye, const struct span_run *runs, int count, ani_builder_pixel_func pixel, void *ctx)
+{
+    int emitted = 0;
+    for (int g = 0; g <= count; ++g) {
+        const int ga = (g == 0)? 0 : runs[g - 1].b;
+        const int gb = (g == count)? w : runs[g].a;
+        int minx = gb, maxx = ga - 1;
+        for (int y = ys; y < ye; ++y) {
+            for (int x = ga; x < gb; ++x) {
+                if (pixel(ctx, x, y) == 0) continue;
+                if (x < minx) minx = x;
+                if (x > maxx) maxx = x;
+            }
+        }
+        if (minx <= maxx) {
+            append_span(chunk, 'M', minx, ys, maxx - minx + 1, ye - ys);
+            ++emitted;
+        }
+        if (g < count) {
+            append_span(chunk, 'O', runs[g].a, ys, runs[g].b - runs[g].a, ye - ys);
+            ++emitted;
+        }
+    }
+    return emitted;
+}
+
+int ani_builder_append_spans(struct ani_builder_chunk *chunk, int w, int h, ani_builder_pixel_func pixel, void *ctx)
+{
+    struct span_run group[SPAN_MAX_RUNS];
+    int group_count = 0;
+    int ys = -1;
+    int emitted = 0;
+
+    for (int y = 0; y <= h; ++y) {
+        struct span_run row[SPAN_MAX_RUNS];
+        int row_count = 0;
+        bool content = false;
+        for (int x = 0; y < h && x < w;) {
+            const int p = pixel(ctx, x, y);
+            if (p != 0) content = true;
+            if (p != 2) {
+                ++x;
+                continue;
+            }
+            int e = x;
+            while (e < w && pixel(ctx, e, y) == 2) ++e;
+            if (e - x >= SPAN_MIN_RUN && row_count < SPAN_MAX_RUNS) {
+                row[row_count++] = (struct span_run){ x, e };
+            }
+            x = e;
+        }
+
+        if (ys >= 0) {
+            bool merge = content && row_count == group_count;
+            for (int i = 0; merge && i < row_count; ++i) {
+                const int a = (group[i].a > row[i].a)? group[i].a : row[i].a;
+                const int b = (group[i].b < row[i].b)? group[i].b : row[i].b;
+                merge = a + SPAN_MIN_RUN <= b;
+            }
+            if (merge) {
+                for (int i = 0; i < row_count; ++i) {
+                    if (row[i].a > group[i].a) group[i].a = row[i].a;
+                    if (row[i].b < group[i].b) group[i].b = row[i].b;
+                }
+                continue;
+            }
+            emitted += close_span_group(chunk, w, ys, y, group, group_count, pixel, ctx);
+            ys = -1;
+        }
+        if (content) {
+            ys = y;
+            group_count = row_count;
+            memcpy(group, row, sizeof(struct span_run) * row_count);
+        }
+    }
+    return emitted;
+}
+
+int ani_builder_append_opaque_spans(struct ani_builder_chunk *chunk, int w, int h, ani_builder_pixel_func pixel, void *ctx)
+{
+    struct ani_builder_chunk spans = { { 0 } };
+    const int count = ani_builder_append_spans(&spans, w, h, pixel, ctx);
+    long opaque = 0;
+    for (int i = 0; i < count; ++i) {
+        struct { char kind; char reserved; uint16_t x, y, w, h; } span;
+        memcpy(&span, spans.data + sizeof(span) * i, sizeof(span));
+        if (span.kind == 'O') opaque += (long)span.w * span.h;
+    }
+    const int qualified = (count > 0 && opaque * 256 >= (long)w * h * ANI_SPAN_MIN_OPAQUE)? count : 0;
+    if (qualified > 0) ani_builder_chunk_append(chunk, spans.data, spans.size);
+    free(spans.data);
+    return qualified;
+}
+
+size_t ani_builder_lz_bound(size_t size)
+{
+    return size + size / 255 + 16;
+}
+
+static void lz_put_length(uint8_t **op, size_t len)
+{
+    for (len -= 15; len >= 255; len -= 255) *(*op)++ = 255;
+    *(*op)++ = (uint8_t)len;
+}
+
+static uint8_t* lz_emit(uint8_t *op, const uint8_t *anchor, size_t literals, size_t match, size_t offset)
+{
+    uint8_t *token = op++;
+    *token = (uint8_t)(((literals < 15)? literals : 15) << 4);
+    if (literals >= 15) lz_put_length(&op, literals);
+    memcpy(op, anchor, literals);
+    op += literals;
+    if (match == 0) return op;
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)((match - 4 < 15)? match - 4 : 15);
+    if (match - 4 >= 15) lz_put_length(&op, match - 4);
+    return op;
+}
+
+// greedy LZ4 block compressor emitting the same bytes as Writer.compress: each position takes the most
+// recent earlier position with the same 4 bytes (hash chains make that exact); the last match starts
+// 12 bytes before the end and the last 5 bytes are literals
+size_t ani_builder_lz_compress(const uint8_t *src, size_t size, uint8_t *dst)
+{
+    enum { HASH_BITS = 16 };
+    uint32_t *head = calloc(1u << HASH_BITS, sizeof(uint32_t)); // position + 1
+    uint32_t *chain = calloc(size + 1, sizeof(uint32_t));
+    uint8_t *op = dst;
+    const uint8_t *anchor = src;
+    size_t i = 0;
+    while (i + 12 <= size) {
+        uint32_t seq;
+        memcpy(&seq, src + i, 4);
+        const uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        uint32_t ref = head[h];
+        while (ref != 0 && i - (ref - 1) <= 65535 && memcmp(src + ref - 1, src + i, 4) != 0) ref = chain[ref - 1];
+        chain[i] = head[h];
+        head[h] = (uint32_t)i + 1;
+        if (ref == 0 || i - (ref - 1) > 65535) {
+            ++i;
+            continue;
+        }
+        const size_t from = ref - 1;
+        size_t len = 4;
+        while (i + len < size - 5 && src[from + len] == src[i + len]) ++len;
+        op = lz_emit(op, anchor, (size_t)(src + i - anchor), len, i - from);
+        i += len;
+        anchor = src + i;
+    }
+    op = lz_emit(op, anchor, (size_t)(src + size - anchor), 0, 0);
+    free(chain);
+    free(head);
+    return (size_t)(op - dst);
+}
+
+void* ani_builder_repack(const void *ani, size_t size, const struct ani_builder_chunk *extra, int compress, size_t *outsize)
+{
+    const uint8_t *in = ani;
+    uint32_t version;
+    uint16_t count;
+    memcpy(&version, in + 4, 4);
+    memcpy(&count, in + 8, 2);
+    if (version < 2) return NULL;
+
+    // rebuild the uncompressed image with every chunk in directory order plus the extra chunk
+    const size_t directory_size = align_size(8 * CHUNK_ORDER_COUNT, 16);
+    size_t raw_size = 0;
+    for (int t = 0; t < count && t < CHUNK_ORDER_COUNT; ++t) {
+        uint32_t offset, sz;
+        memcpy(&offset, in + 16 + t * 8 + 4, 4);
+        if (offset == 0) continue;
+        memcpy(&sz, in + offset + 4, 4);
+        raw_size += 16 + align_size(sz, 16);
+    }
+    if (extra != NULL) raw_size += 16 + align_size(extra->size, 16);
+
+    const size_t prefix = 16 + directory_size;
+    uint8_t *raw = calloc(1, prefix + raw_size);
+    memcpy(raw, in, 16);
+    const uint16_t order_count = CHUNK_ORDER_COUNT;
+    memcpy(raw + 8, &order_count, 2);
+    size_t pos = prefix;
+    for (int t = 0; t < CHUNK_ORDER_COUNT; ++t) {
+        memcpy(raw + 16 + t * 8, chunk_order[t], 4);
+        uint32_t offset = 0, sz;
+        if (t < count) memcpy(&offset, in + 16 + t * 8 + 4, 4);
+        if (offset != 0) {
+            memcpy(&sz, in + offset + 4, 4);
+            memcpy(raw + pos, in + offset, 16 + sz);
+        } else if (extra != NULL && memcmp(extra->id, chunk_order[t], 4) == 0) {
+            sz = (uint32_t)extra->size;
+            memcpy(raw + pos, extra->id, 4);
+            memcpy(raw + pos + 4, &sz, 4);
+            memcpy(raw + pos + 8, extra->misc, 8);
+            memcpy(raw + pos + 16, extra->data, extra->size);
+        } else {
+            continue;
+        }
+        const uint32_t o = (uint32_t)pos;
+        memcpy(raw + 16 + t * 8 + 4, &o, 4);
+        pos += 16 + align_size(sz, 16);
+    }
+
+    if (!compress) {
+        *outsize = prefix + raw_size;
+        return raw;
+    }
+
+    return compress_image(raw, prefix, raw_size, outsize);
+}
@@ -0,0 +1,60 @@
+#ifndef __ANI_BUILDER_H__
+#define __ANI_BUILDER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// In-memory .ani writer for host benchmarks; mirrors Writer in aseprite_extension/src/lib/writer.lua.
+
+struct ani_builder_chunk {
+    char id[4];
+    uint8_t misc[8];
+    uint8_t *data;
+    size_t size;
+};
+
+struct ani_builder {
+    uint32_t version; //< 1: linked chunks, 2: chunk directory and 32bit tables
+    int compressed; //< v2: compress everything after the directory
+    struct ani_builder_chunk chunks[16];
+    int chunk_count;
+    uint8_t *strings;
+    size_t strings_size;
+};
+
+// spans only beat one masked blit when opaque spans cover nearly all of the image (PDANI_SPAN_MIN_OPAQUE in pdani.c)
+#define ANI_SPAN_MIN_OPAQUE 240
+
+// 0: transparent, 1: partially visible, 2: opaque
+typedef int (*ani_builder_pixel_func)(void *ctx, int x, int y);
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void ani_builder_initialize(struct ani_builder *builder, uint32_t version);
+void ani_builder_finalize(struct ani_builder *builder);
+struct ani_builder_chunk* ani_builder_make_chunk(struct ani_builder *builder, const char *id);
+void ani_builder_chunk_append(struct ani_builder_chunk *chunk, const void *data, size_t size);
+void ani_builder_chunk_set_misc_u16(struct ani_builder_chunk *chunk, int index, uint16_t value);
+/// @fn FRAM のジャンプテーブルや SPAN の開始位置表の要素を追加する（v1 は 16bit、v2 は 32bit）
+void ani_builder_chunk_append_offset(const struct ani_builder *builder, struct ani_builder_chunk *chunk, uint32_t value);
+uint16_t ani_builder_register_string(struct ani_builder *builder, const char *s);
+/// @fn 画像1枚分の SPAN 矩形を追加する（Exporter:makeSpans と同じ分割）
+int ani_builder_append_spans(struct ani_builder_chunk *chunk, int w, int h, ani_builder_pixel_func pixel, void *ctx);
+/// @fn 不透明スパンが画像の ANI_SPAN_MIN_OPAQUE/256 以上を覆うときだけ追加する（それ以外は何も足さずに 0）
+int ani_builder_append_opaque_spans(struct ani_builder_chunk *chunk, int w, int h, ani_builder_pixel_func pixel, void *ctx);
+/// @fn ファイルイメージを生成する（呼び出し側で free すること）
+void* ani_builder_build(struct ani_builder *builder, size_t *size);
+/// @fn LZ4 ブロック形式で圧縮する（dst は ani_builder_lz_bound(size) バイト必要）
+size_t ani_builder_lz_bound(size_t size);
+size_t ani_builder_lz_compress(const uint8_t *src, size_t size, uint8_t *dst);
+/// @fn v2 のファイルイメージをディレクトリ順に並べ直す（extra があればそのチャンクも加え、compress なら圧縮する。v1 なら NULL）
+void* ani_builder_repack(const void *ani, size_t size, const struct ani_builder_chunk *extra, int compress, size_t *outsize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ANI_BUILDER_H__
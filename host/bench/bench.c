@@ -0,0 +1,1455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pd_stub.h"
+#include "pdani.h"
+#include "ani_builder.h"
+
+// A synthetic 64x64 rig: a group, three cel layers, a collider and an empty layer, four frames.
+#define RIG_SIZE 64
+#define RIG_FRAMES 4
+
+static PlaydateAPI *api = NULL;
+static int iterations = 20000;
+// load cases charge file reads at roughly the Playdate SD card rate
+static uint32_t read_rate = 2 * 1024 * 1024;
+
+struct bench_rig {
+    void *data;
+    size_t size;
+    LCDBitmap *atlas;
+    struct pdani_file file;
+};
+
+static uint32_t random_state = 0x12345678;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// u, v, w, h (x aligned to 8 like the exporter's packer)
+static const int16_t rig_images[4][4] = { { 0, 0, 48, 40 }, { 48, 0, 47, 40 }, { 0, 40, 20, 30 }, { 24, 40, 24, 22 } };
+
+struct rig_pixel_context {
+    const uint8_t *mask;
+    int rowbytes;
+    int u, v;
+};
+
+static int rig_pixel(void *ctx, int x, int y)
+{
+    const struct rig_pixel_context *c = ctx;
+    const int px = c->u + x;
+    const int py = c->v + y;
+    return ((c->mask[c->rowbytes * py + (px >> 3)] >> (7 - (px & 7))) & 1)? 2 : 0;
+}
+
+// sprite-like images: an opaque ellipse with a transparent margin and random texels
+// (solid: fully opaque, like a tile or a block)
+static void rig_fill_atlas(LCDBitmap *atlas, bool solid)
+{
+    int rowbytes, height;
+    uint8_t *texel, *mask;
+    api->graphics->getBitmapData(atlas, NULL, &height, &rowbytes, &mask, &texel);
+    memset(mask, 0, rowbytes * height);
+    for (int i = 0; i < rowbytes * height; ++i) {
+        texel[i] = (uint8_t)random_next();
+    }
+    for (int i = 0; i < 4; ++i) {
+        const int u = rig_images[i][0], v = rig_images[i][1], w = rig_images[i][2], h = rig_images[i][3];
+        for (int y = 0; y < h; ++y) {
+            for (int x = 0; x < w; ++x) {
+                const float nx = (x + 0.5f) / w * 2.0f - 1.0f;
+                const float ny = (y + 0.5f) / h * 2.0f - 1.0f;
+                if (solid || nx * nx + ny * ny <= 0.8f) {
+                    mask[rowbytes * (v + y) + ((u + x) >> 3)] |= (uint8_t)(0x80 >> ((u + x) & 7));
+                }
+            }
+        }
+    }
+}
+
+// durations: RIG_FRAMES frame lengths in ms, or NULL for 100 each
+// tags: NULL-terminated tag names, tag i covering frames (i % RIG_FRAMES) + 1 to RIG_FRAMES, or NULL for "run" and "idle"
+// events: RIG_FRAMES event names on the head layer, or NULL for "step" on frame 3
+static void rig_initialize_shape(struct bench_rig *rig, bool with_spans, uint32_t version, bool solid, const uint16_t *durations, const char *const *tags, const char *const *events)
+{
+    rig->atlas = api->graphics->newBitmap(96, 72, kColorClear);
+    rig_fill_atlas(rig->atlas, solid);
+
+    struct ani_builder b;
+    ani_builder_initialize(&b, version);
+
+    struct ani_builder_chunk *info = ani_builder_make_chunk(&b, "INFO");
+    ani_builder_chunk_set_misc_u16(info, 0, RIG_SIZE);
+    ani_builder_chunk_set_misc_u16(info, 1, RIG_SIZE);
+    ani_builder_chunk_set_misc_u16(info, 2, RIG_FRAMES);
+
+    struct ani_builder_chunk *tag_chunk = ani_builder_make_chunk(&b, "TAGS");
+    if (tags == NULL) {
+        ani_builder_chunk_set_misc_u16(tag_chunk, 0, 2);
+        const uint16_t tag_data[2][3] = {
+            { 1, RIG_FRAMES, ani_builder_register_string(&b, "run") },
+            { 1, 1, ani_builder_register_string(&b, "idle") },
+        };
+        ani_builder_chunk_append(tag_chunk, tag_data, sizeof(tag_data));
+    } else {
+        uint16_t count = 0;
+        for (; tags[count] != NULL; ++count) {
+            const uint16_t tag_data[3] = { (uint16_t)(count % RIG_FRAMES + 1), RIG_FRAMES, ani_builder_register_string(&b, tags[count]) };
+            ani_builder_chunk_append(tag_chunk, tag_data, sizeof(tag_data));
+        }
+        ani_builder_chunk_set_misc_u16(tag_chunk, 0, count);
+    }
+
+    // type, parent, name, layerCount
+    struct ani_builder_chunk *lays = ani_builder_make_chunk(&b, "LAYS");
+    const struct { char type; int8_t parent; uint16_t name, count; } layers[] = {
+        { 'G', -1, ani_builder_register_string(&b, "body"), 3 },
+        { 'L', 0, ani_builder_register_string(&b, "torso"), 0 },
+        { 'L', 0, ani_builder_register_string(&b, "arm"), 0 },
+        { 'L', 0, ani_builder_register_string(&b, "head"), 0 },
+        { 'C', -1, ani_builder_register_string(&b, "@hit"), 0 },
+        { 'L', -1, ani_builder_register_string(&b, "effect"), 0 },
+    };
+    ani_builder_chunk_set_misc_u16(lays, 0, sizeof(layers) / sizeof(layers[0]));
+    ani_builder_chunk_append(lays, layers, sizeof(layers));
+
+    // five frame layers (torso, arm, head, @hit, effect) per frame
+    struct ani_builder_chunk *fram = ani_builder_make_chunk(&b, "FRAM");
+    ani_builder_chunk_set_misc_u16(fram, 0, RIG_FRAMES);
+    const int frame_size = 2 + 5 * 4;
+    const int table_size = RIG_FRAMES * ((version >= 2)? 4 : 2);
+    for (int i = 0; i < RIG_FRAMES; ++i) {
+        ani_builder_chunk_append_offset(&b, fram, (uint32_t)(table_size + frame_size * i));
+    }
+    const uint16_t step = ani_builder_register_string(&b, "step");
+    for (int i = 0; i < RIG_FRAMES; ++i) {
+        const uint16_t event = (events != NULL)? ani_builder_register_string(&b, events[i]) : (i == 2)? step : 0;
+        const uint16_t frame[11] = {
+            (durations != NULL)? durations[i] : 100,
+            0, (uint16_t)(i & 1),
+            0, 2,
+            event, 3,
+            0, 0,
+            0, (uint16_t)-1,
+        };
+        ani_builder_chunk_append(fram, frame, sizeof(frame));
+    }
+
+    // image, x, y
+    struct ani_builder_chunk *cels = ani_builder_make_chunk(&b, "CELS");
+    const int16_t cel_data[4][3] = { { 0, 8, 20 }, { 1, 9, 21 }, { 2, 40, 24 }, { 3, 20, 2 } };
+    ani_builder_chunk_set_misc_u16(cels, 0, 4);
+    ani_builder_chunk_append(cels, cel_data, sizeof(cel_data));
+
+    struct ani_builder_chunk *cols = ani_builder_make_chunk(&b, "COLS");
+    const int16_t col_data[1][4] = { { 8, 16, 48, 40 } };
+    ani_builder_chunk_set_misc_u16(cols, 0, 1);
+    ani_builder_chunk_append(cols, col_data, sizeof(col_data));
+
+    struct ani_builder_chunk *imag = ani_builder_make_chunk(&b, "IMAG");
+    ani_builder_chunk_set_misc_u16(imag, 0, 4);
+    ani_builder_chunk_append(imag, rig_images, sizeof(rig_images));
+
+    if (with_spans) {
+        struct ani_builder_chunk *span = ani_builder_make_chunk(&b, "SPAN");
+        ani_builder_chunk_set_misc_u16(span, 0, 4);
+        struct ani_builder_chunk spans = { { 0 } };
+        uint32_t table[5] = { 0 };
+        for (int i = 0; i < 4; ++i) {
+            struct rig_pixel_context ctx = { .u = rig_images[i][0], .v = rig_images[i][1] };
+            api->graphics->getBitmapData(rig->atlas, NULL, NULL, &ctx.rowbytes, (uint8_t**)&ctx.mask, NULL);
+            table[i + 1] = (uint32_t)(table[i] + ani_builder_append_spans(&spans, rig_images[i][2], rig_images[i][3], rig_pixel, &ctx));
+        }
+        for (int i = 0; i < 5; ++i) {
+            ani_builder_chunk_append_offset(&b, span, table[i]);
+        }
+        ani_builder_chunk_append(span, spans.data, spans.size);
+        free(spans.data);
+    }
+
+    rig->data = ani_builder_build(&b, &rig->size);
+    ani_builder_finalize(&b);
+
+    pdani_file_initialize(&rig->file, rig->data, rig->atlas);
+}
+
+static void rig_initialize_version(struct bench_rig *rig, bool with_spans, uint32_t version)
+{
+    rig_initialize_shape(rig, with_spans, version, false, NULL, NULL, NULL);
+}
+
+static void rig_initialize(struct bench_rig *rig, bool with_spans)
+{
+    rig_initialize_version(rig, with_spans, 2);
+}
+
+static void rig_finalize(struct bench_rig *rig)
+{
+    pdani_file_finalize(&rig->file);
+    api->graphics->freeBitmap(rig->atlas);
+    free(rig->data);
+}
+
+struct draw_case {
+    const char *name;
+    int x, y;
+    bool fliph, flipv;
+};
+
+static void bench_draw(const struct pdani_file *file, const struct draw_case *c)
+{
+    const uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_file_draw(file, NULL, c->x, c->y, (i & (RIG_FRAMES - 1)) + 1, c->fliph, c->flipv);
+    }
+    const uint64_t end = pd_stub_nanotime();
+    pdani_dirty_clear();
+    printf("%-32s %10.1f ns/op\n", c->name, (double)(end - start) / iterations);
+}
+
+static void bench_player_update(struct pdani_file *file, const char *name, int players, int ms)
+{
+    struct pdani_player *list = malloc(sizeof(struct pdani_player) * players);
+    for (int i = 0; i < players; ++i) {
+        pdani_player_initialize(&list[i], file);
+        pdani_player_play(&list[i], "run");
+    }
+    const int rounds = (iterations + players - 1) / players;
+    const uint64_t start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < players; ++i) {
+            pdani_player_update(&list[i], ms, NULL, NULL);
+        }
+    }
+    const uint64_t end = pd_stub_nanotime();
+    for (int i = 0; i < players; ++i) {
+        pdani_player_finalize(&list[i]);
+    }
+    free(list);
+    printf("%-32s %10.1f ns/op\n", name, (double)(end - start) / ((double)rounds * players));
+}
+
+static void on_frame_event(const struct pdani_file *file, int framenum, const char *name, void *ptr)
+{
+    if (strcmp(name, "step") == 0) {
+        *(int*)ptr += 1;
+    }
+}
+
+static void bench_player_events(struct pdani_file *file, int players)
+{
+    struct pdani_player *list = malloc(sizeof(struct pdani_player) * players);
+    for (int i = 0; i < players; ++i) {
+        pdani_player_initialize(&list[i], file);
+        pdani_player_play(&list[i], "run");
+    }
+    const int rounds = (iterations + players - 1) / players;
+
+    int steps = 0;
+    uint64_t start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < players; ++i) {
+            pdani_player_update(&list[i], 50, on_frame_event, &steps);
+        }
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player events (callback)", (double)(end - start) / ((double)rounds * players));
+
+    const int step_id = pdani_intern("step");
+    for (int i = 0; i < players; ++i) {
+        pdani_player_enable_event_queue(&list[i], true);
+        pdani_player_play(&list[i], "run");
+    }
+    start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < players; ++i) {
+            pdani_player_update(&list[i], 50, NULL, NULL);
+            struct pdani_event event;
+            while (pdani_player_poll_event(&list[i], &event)) {
+                if (event.id == step_id) steps += 1;
+            }
+        }
+    }
+    end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player events (queue)", (double)(end - start) / ((double)rounds * players));
+
+    for (int i = 0; i < players; ++i) {
+        pdani_player_finalize(&list[i]);
+    }
+    free(list);
+}
+
+// the rig with the arm layer hidden, and with the whole body group (and the step event on its head) hidden
+static void bench_layer_mask(struct pdani_file *file)
+{
+    struct pdani_player player;
+    pdani_player_initialize(&player, file);
+    pdani_player_play(&player, "run");
+    pdani_player_set_layer_enabled_by_name(&player, "arm", false);
+    const uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_player_seek_frame(&player, (i & (RIG_FRAMES - 1)) + 1);
+        pdani_player_draw(&player, NULL, 67, 64);
+    }
+    const uint64_t end = pd_stub_nanotime();
+    pdani_dirty_clear();
+    printf("%-32s %10.1f ns/op\n", "draw unaligned (layer hidden)", (double)(end - start) / iterations);
+
+    pdani_player_set_layer_enabled(&player, pdani_file_find_layer(file, "arm"), true);
+    pdani_player_set_layer_enabled_by_name(&player, "body", false);
+    pdani_player_play(&player, "run");
+    int steps = 0;
+    for (int i = 0; i < RIG_FRAMES * 2; ++i) {
+        pdani_player_update(&player, 100, on_frame_event, &steps);
+    }
+    if (steps != 0 || pdani_player_is_layer_visible(&player, pdani_file_find_layer(file, "head"))) {
+        printf("hidden group mismatch: %d step events\n", steps);
+        exit(1);
+    }
+    pdani_player_finalize(&player);
+}
+
+// the same flock advanced one player at a time and as one pdani_player_group
+static void bench_player_group(struct pdani_file *file, int players)
+{
+    struct pdani_player *list = malloc(sizeof(struct pdani_player) * players);
+    struct pdani_player_group group;
+    pdani_player_group_initialize(&group, file, players);
+    for (int i = 0; i < players; ++i) {
+        pdani_player_initialize(&list[i], file);
+        pdani_player_play(&list[i], "run");
+        pdani_player_seek_frame(&list[i], (i & (RIG_FRAMES - 1)) + 1);
+        pdani_player_enable_event_queue(&list[i], true);
+        const int member = pdani_player_group_add(&group);
+        pdani_player_group_play(&group, member, "run");
+        pdani_player_group_seek_frame(&group, member, (i & (RIG_FRAMES - 1)) + 1);
+    }
+    pdani_player_group_enable_events(&group, true);
+    const int rounds = (iterations + players - 1) / players;
+    const int step_id = pdani_intern("step");
+
+    int steps = 0;
+    uint64_t start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < players; ++i) {
+            pdani_player_update(&list[i], 50, NULL, NULL);
+            struct pdani_event event;
+            while (pdani_player_poll_event(&list[i], &event)) {
+                if (event.id == step_id) steps += 1;
+            }
+        }
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "flock update (players)", (double)(end - start) / ((double)rounds * players));
+
+    int group_steps = 0;
+    start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        pdani_player_group_update(&group, 50);
+        for (int i = 0; i < group.event_count; ++i) {
+            if (group.events[i].id == step_id) group_steps += 1;
+        }
+    }
+    end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "flock update (group)", (double)(end - start) / ((double)rounds * players));
+    if (steps != group_steps) {
+        printf("flock events differ: %d != %d\n", steps, group_steps);
+        exit(1);
+    }
+
+    for (int i = 0; i < players; ++i) {
+        pdani_player_finalize(&list[i]);
+    }
+    free(list);
+    pdani_player_group_finalize(&group);
+}
+
+#define CROWD_SIZE 32
+
+static void bench_crowd(const struct pdani_file *file)
+{
+    int xs[CROWD_SIZE], ys[CROWD_SIZE];
+    for (int i = 0; i < CROWD_SIZE; ++i) {
+        // a quarter of the crowd is off-screen
+        xs[i] = (int)(random_next() % 560) - 80;
+        ys[i] = (int)(random_next() % 300) - 30;
+    }
+    const int rounds = (iterations + CROWD_SIZE - 1) / CROWD_SIZE;
+
+    uint64_t start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < CROWD_SIZE; ++i) {
+            pdani_file_draw(file, NULL, xs[i], ys[i], (i & (RIG_FRAMES - 1)) + 1, i & 1, false);
+        }
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "crowd draw (per actor)", (double)(end - start) / ((double)rounds * CROWD_SIZE));
+}
+
+static void bench_player_play(struct pdani_file *file)
+{
+    struct pdani_player player;
+    pdani_player_initialize(&player, file);
+
+    uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_player_play(&player, (i & 1)? "run" : "idle");
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player play (tag name)", (double)(end - start) / iterations);
+
+    const int tags[2] = { pdani_file_find_tag(file, "idle"), pdani_file_find_tag(file, "run") };
+    start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_player_play_tag_index(&player, tags[i & 1]);
+    }
+    end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player play (tag index)", (double)(end - start) / iterations);
+
+    start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_player_seek_time(&player, (i * 37) & 1023);
+    }
+    end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player seek time", (double)(end - start) / iterations);
+
+    pdani_player_finalize(&player);
+}
+
+// a side-scrolling level four screens wide
+#define COMBAT_ACTORS 128
+#define COMBAT_LEVEL_WIDTH 1600
+
+struct combat_rects {
+    int count;
+    int x[COMBAT_ACTORS], y[COMBAT_ACTORS], w[COMBAT_ACTORS], h[COMBAT_ACTORS];
+};
+
+static void combat_collect(const struct pdani_file *file, const char *name, int x, int y, int w, int h, void *ptr)
+{
+    struct combat_rects *rects = ptr;
+    rects->x[rects->count] = x;
+    rects->y[rects->count] = y;
+    rects->w[rects->count] = w;
+    rects->h[rects->count] = h;
+    rects->count += 1;
+}
+
+static void combat_count(const struct pdani_collision_entry *a, const struct pdani_collision_entry *b, void *ptr)
+{
+    *(int*)ptr += 1;
+}
+
+static void combat_found(const struct pdani_collision_entry *entry, void *ptr)
+{
+    *(int*)ptr += 1;
+}
+
+static void bench_collision(struct pdani_file *file)
+{
+    struct pdani_player *players = malloc(sizeof(struct pdani_player) * COMBAT_ACTORS);
+    int xs[COMBAT_ACTORS], ys[COMBAT_ACTORS];
+    for (int i = 0; i < COMBAT_ACTORS; ++i) {
+        pdani_player_initialize(&players[i], file);
+        pdani_player_play(&players[i], "run");
+        xs[i] = (int)(random_next() % COMBAT_LEVEL_WIDTH) - 32;
+        ys[i] = (int)(random_next() % 200) - 20;
+    }
+    const int rounds = (iterations + COMBAT_ACTORS - 1) / COMBAT_ACTORS;
+
+    // every actor's colliders compared against every other's
+    int hits = 0;
+    uint64_t start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        struct combat_rects rects = { 0 };
+        for (int i = 0; i < COMBAT_ACTORS; ++i) {
+            pdani_file_check_collision(file, xs[i], ys[i], players[i].frame_number, false, false, combat_collect, &rects);
+        }
+        for (int i = 0; i < rects.count; ++i) {
+            for (int j = i + 1; j < rects.count; ++j) {
+                if (rects.x[i] < rects.x[j] + rects.w[j] && rects.x[j] < rects.x[i] + rects.w[i]
+                    && rects.y[i] < rects.y[j] + rects.h[j] && rects.y[j] < rects.y[i] + rects.h[i]) {
+                    hits += 1;
+                }
+            }
+        }
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "collision pairs (brute force)", (double)(end - start) / ((double)rounds * COMBAT_ACTORS));
+
+    struct pdani_collision_world world;
+    const LCDRect level = { .left = 0, .right = COMBAT_LEVEL_WIDTH, .top = 0, .bottom = LCD_ROWS };
+    pdani_collision_world_initialize(&world, &level, 64);
+    int world_hits = 0;
+    start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        pdani_collision_world_begin(&world);
+        for (int i = 0; i < COMBAT_ACTORS; ++i) {
+            pdani_collision_world_add_player(&world, &players[i], xs[i], ys[i], &players[i]);
+        }
+        pdani_collision_world_build(&world);
+        pdani_collision_world_query_pairs(&world, "@hit", "@hit", combat_count, &world_hits);
+    }
+    end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "collision pairs (world)", (double)(end - start) / ((double)rounds * COMBAT_ACTORS));
+    if (hits != world_hits) {
+        printf("collision pair count mismatch: %d != %d\n", hits, world_hits);
+        exit(1);
+    }
+    pdani_collision_world_finalize(&world);
+
+    // a rectangle spanning more cells than the uint16 cell table holds is refused, and the world stays usable
+    const LCDRect wide = { .left = 0, .right = 512, .top = 0, .bottom = 512 };
+    pdani_collision_world_initialize(&world, &wide, 1);
+    pdani_collision_world_begin(&world);
+    const bool added_small = pdani_collision_world_add_rect(&world, "@hit", 10, 10, 4, 4, NULL);
+    const bool added_huge = pdani_collision_world_add_rect(&world, "@hit", 0, 0, 512, 512, NULL);
+    pdani_collision_world_build(&world);
+    int found = 0;
+    pdani_collision_world_query_rect(&world, "@hit", 0, 0, 512, 512, combat_found, &found);
+    if (!added_small || added_huge || world.count != 1 || found != 1) {
+        printf("collision world overflow: small %d huge %d count %d found %d\n", added_small, added_huge, world.count, found);
+        exit(1);
+    }
+    pdani_collision_world_finalize(&world);
+    for (int i = 0; i < COMBAT_ACTORS; ++i) {
+        pdani_player_finalize(&players[i]);
+    }
+    free(players);
+}
+
+#define ARENA_LEVEL_FILES 64
+
+static void bench_arena(const struct bench_rig *rig)
+{
+    struct pdani_file *files = malloc(sizeof(struct pdani_file) * ARENA_LEVEL_FILES);
+    const int rounds = (iterations + ARENA_LEVEL_FILES - 1) / ARENA_LEVEL_FILES;
+
+    // load a level's worth of files, then tear it down file by file
+    uint64_t start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < ARENA_LEVEL_FILES; ++i) {
+            pdani_file_initialize(&files[i], rig->data, rig->atlas);
+            pdani_file_compile_draw_list(&files[i]);
+        }
+        for (int i = 0; i < ARENA_LEVEL_FILES; ++i) {
+            pdani_file_finalize(&files[i]);
+        }
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "level load/free (heap)", (double)(end - start) / ((double)rounds * ARENA_LEVEL_FILES));
+
+    // the same through an arena, torn down with one reset
+    const size_t capacity = 1024 * ARENA_LEVEL_FILES;
+    void *buffer = malloc(capacity);
+    struct pdani_arena arena;
+    pdani_arena_initialize(&arena, buffer, capacity);
+    pdani_global_set_allocator(&arena.allocator);
+    start = pd_stub_nanotime();
+    for (int r = 0; r < rounds; ++r) {
+        for (int i = 0; i < ARENA_LEVEL_FILES; ++i) {
+            pdani_file_initialize(&files[i], rig->data, rig->atlas);
+            pdani_file_compile_draw_list(&files[i]);
+        }
+        pdani_arena_reset(&arena);
+    }
+    end = pd_stub_nanotime();
+    pdani_global_set_allocator(NULL);
+    printf("%-32s %10.1f ns/op\n", "level load/free (arena)", (double)(end - start) / ((double)rounds * ARENA_LEVEL_FILES));
+
+    free(buffer);
+    free(files);
+}
+
+// an arena too small for one file must stop with an error instead of handing out NULL (the arena_overflow test checks the message)
+static int arena_overflow(void)
+{
+    pd_stub_set_error_exits(true);
+    struct bench_rig rig;
+    rig_initialize(&rig, false);
+    static uint8_t buffer[256];
+    struct pdani_arena arena;
+    pdani_arena_initialize(&arena, buffer, sizeof(buffer));
+    pdani_global_set_allocator(&arena.allocator);
+    struct pdani_file file;
+    pdani_file_initialize(&file, rig.data, rig.atlas);
+    pdani_file_compile_draw_list(&file);
+    pdani_file_enable_frame_cache(&file, 64 * 1024);
+    pdani_global_set_allocator(NULL);
+    printf("arena overflow: %zu of %zu bytes used without an error\n", arena.used, arena.capacity);
+    return 1;
+}
+
+static void bench_file_initialize(const struct bench_rig *rig, const char *name)
+{
+    struct pdani_file file;
+    const uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_file_initialize(&file, rig->data, rig->atlas);
+        pdani_file_finalize(&file);
+    }
+    const uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", name, (double)(end - start) / iterations);
+}
+
+// the same with the load-time validator in front (the rig must pass it)
+static void bench_file_initialize_validated(const struct bench_rig *rig, const char *name)
+{
+    struct pdani_file file;
+    const uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        const enum pdani_file_error error = pdani_file_initialize_validated(&file, rig->data, rig->size, rig->atlas);
+        if (error != PDANI_FILE_ERROR_NONE) {
+            printf("%-32s rejected (%s)\n", name, pdani_file_get_error_name(error));
+            exit(1);
+        }
+        pdani_file_finalize(&file);
+    }
+    const uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", name, (double)(end - start) / iterations);
+}
+
+static void bench_streaming(const struct bench_rig *rig)
+{
+    const char *path = "pdani_bench_stream.ani";
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) return;
+    fwrite(rig->data, 1, rig->size, fp);
+    fclose(fp);
+
+    // a missing file must be reported, not crash
+    struct pdani_file file;
+    const enum pdani_file_error missing = pdani_file_initialize_streaming(&file, "pdani_bench_missing.ani", rig->atlas, 64);
+    if (missing != PDANI_FILE_ERROR_IO) {
+        printf("streaming: missing file returned %s\n", pdani_file_get_error_name(missing));
+        exit(1);
+    }
+
+    // a cache budget smaller than the "run" tag
+    if (pdani_file_initialize_streaming(&file, path, rig->atlas, 64) != PDANI_FILE_ERROR_NONE) {
+        printf("streaming: %s rejected\n", path);
+        exit(1);
+    }
+    struct pdani_player player;
+    pdani_player_initialize(&player, &file);
+
+    uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_player_play(&player, (i & 1)? "run" : "idle");
+    }
+    uint64_t end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player play (streaming)", (double)(end - start) / iterations);
+
+    pdani_player_play(&player, "run");
+    start = pd_stub_nanotime();
+    for (int i = 0; i < iterations; ++i) {
+        pdani_player_update(&player, 20, NULL, NULL);
+    }
+    end = pd_stub_nanotime();
+    printf("%-32s %10.1f ns/op\n", "player update (streaming)", (double)(end - start) / iterations);
+
+    // building the frame time, event, bounds and draw tables or the frame cache must not evict the prefetched tag from the cache
+    struct pdani_file scan_file;
+    if (pdani_file_initialize_streaming(&scan_file, path, rig->atlas, 64) != PDANI_FILE_ERROR_NONE) {
+        printf("streaming: %s rejected\n", path);
+        exit(1);
+    }
+    struct pdani_player scan_player;
+    pdani_player_initialize(&scan_player, &scan_file);
+    pdani_player_play(&scan_player, "idle");
+    const struct pdani_stream before = *scan_file.stream;
+    LCDRect bounds;
+    pdani_file_get_frame_bounds(&scan_file, 1, false, false, &bounds);
+    int steps = 0;
+    pdani_player_update(&scan_player, 20, on_frame_event, &steps);
+    pdani_player_seek_time(&scan_player, 150);
+    pdani_file_compile_draw_list(&scan_file);
+    pdani_file_enable_frame_cache(&scan_file, 64 * 1024);
+    LCDBitmap *scan_target = api->graphics->newBitmap(90, 70, kColorClear);
+    pdani_file_draw(&scan_file, scan_target, 10, 10, RIG_FRAMES, false, false);
+    api->graphics->freeBitmap(scan_target);
+    for (int i = 0; i < PDANI_STREAM_CACHE_SLOTS; ++i) {
+        if (scan_file.stream->slots[i].data != before.slots[i].data) {
+            printf("streaming: building tables evicted cache slot %d\n", i);
+            exit(1);
+        }
+    }
+    pdani_player_finalize(&scan_player);
+    pdani_file_finalize(&scan_file);
+
+    pdani_player_finalize(&player);
+    pdani_file_finalize(&file);
+    remove(path);
+}
+
+static void write_file(const char *path, const void *data, size_t size)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) return;
+    fwrite(data, 1, size, fp);
+    fclose(fp);
+}
+
+static void* read_file(const char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    *size = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    void *data = malloc(*size);
+    *size = fread(data, 1, *size, fp);
+    fclose(fp);
+    return data;
+}
+
+// ATLS chunk from an atlas bitmap (texel rows, then mask rows)
+static void atlas_chunk(struct ani_builder_chunk *chunk, LCDBitmap *bitmap)
+{
+    int width, height, rowbytes;
+    uint8_t *mask, *texel;
+    api->graphics->getBitmapData(bitmap, &width, &height, &rowbytes, &mask, &texel);
+    memset(chunk, 0, sizeof(struct ani_builder_chunk));
+    memcpy(chunk->id, "ATLS", 4);
+    ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)width);
+    ani_builder_chunk_set_misc_u16(chunk, 1, (uint16_t)height);
+    ani_builder_chunk_set_misc_u16(chunk, 2, (uint16_t)rowbytes);
+    ani_builder_chunk_append(chunk, texel, (size_t)rowbytes * height);
+    ani_builder_chunk_append(chunk, mask, (size_t)rowbytes * height);
+}
+
+static void bench_load(const char *name, const char *anipath, const char *bmppath)
+{
+    const int count = iterations / 100 + 1;
+    struct pdani_file file;
+    pd_stub_set_read_rate(read_rate);
+    const uint64_t start = pd_stub_nanotime();
+    for (int i = 0; i < count; ++i) {
+        pdani_file_initialize_with_filename(&file, anipath, bmppath);
+        pdani_file_finalize(&file);
+    }
+    const uint64_t end = pd_stub_nanotime();
+    pd_stub_set_read_rate(0);
+    printf("%-32s %10.1f ns/op\n", name, (double)(end - start) / count);
+}
+
+// raw .ani + atlas against one compressed .ani with the atlas inside
+static void bench_load_pair(const char *label, const void *ani, size_t size, LCDBitmap *atlas, const char *anipath, const char *bmppath)
+{
+    const char *raw_path = "pdani_bench_raw.ani";
+    const char *packed_path = "pdani_bench_packed.ani";
+    struct ani_builder_chunk atlas_data;
+    atlas_chunk(&atlas_data, atlas);
+    size_t packed_size = 0, raw_size = size;
+    void *packed = ani_builder_repack(ani, size, &atlas_data, 1, &packed_size);
+    void *raw = (bmppath == NULL)? ani_builder_repack(ani, size, &atlas_data, 0, &raw_size) : NULL;
+    free(atlas_data.data);
+    if (packed == NULL) {
+        printf("%-32s skipped (not a v2 .ani)\n", label);
+        free(raw);
+        return;
+    }
+    if (raw != NULL) write_file(raw_path, raw, raw_size);
+    write_file(packed_path, packed, packed_size);
+
+    char name[64];
+    snprintf(name, sizeof(name), "load raw (%s)", label);
+    bench_load(name, (raw != NULL)? raw_path : anipath, bmppath);
+    snprintf(name, sizeof(name), "load compressed (%s)", label);
+    bench_load(name, packed_path, NULL);
+    if (bmppath != NULL) {
+        size_t png_size = 0;
+        free(read_file(bmppath, &png_size));
+        raw_size += png_size;
+    }
+    printf("  %s: %zu -> %zu bytes\n", label, raw_size, packed_size);
+
+    free(raw);
+    free(packed);
+    remove(raw_path);
+    remove(packed_path);
+}
+
+// every baked heading in turn (pdani_convert --rotations), each one a single cel
+static void bench_variants(const char *label, const char *anipath, const char *bmppath)
+{
+    struct pdani_file file;
+    pdani_file_initialize_with_filename(&file, anipath, bmppath);
+    const int rotations = pdani_file_get_rotation_count(&file);
+    if (rotations > 1) {
+        struct pdani_player player;
+        pdani_player_initialize(&player, &file);
+        pdani_player_play(&player, NULL);
+        const int frames = pdani_file_get_frame_count(&file);
+        const uint64_t start = pd_stub_nanotime();
+        for (int i = 0; i < iterations; ++i) {
+            pdani_player_set_rotation(&player, (float)(i % rotations) * 360.0f / rotations);
+            pdani_player_seek_frame(&player, i % frames + 1);
+            pdani_player_draw(&player, NULL, 67, 64);
+        }
+        const uint64_t end = pd_stub_nanotime();
+        pdani_dirty_clear();
+        pdani_player_finalize(&player);
+        char name[64];
+        snprintf(name, sizeof(name), "draw %d headings (%s)", rotations, label);
+        printf("%-32s %10.1f ns/op\n", name, (double)(end - start) / iterations);
+    }
+    pdani_file_finalize(&file);
+}
+
+// exported .ani with its .png next to it, e.g. the samples' miata.ani and test.ani
+static void bench_load_path(const char *path)
+{
+    char bmppath[1024];
+    snprintf(bmppath, sizeof(bmppath), "%s", path);
+    char *ext = strrchr(bmppath, '.');
+    if (ext == NULL || (size_t)(ext - bmppath) + 5 > sizeof(bmppath)) return;
+    strcpy(ext, ".png");
+
+    const char *err = NULL;
+    LCDBitmap *atlas = api->graphics->loadBitmap(bmppath, &err);
+    size_t size = 0;
+    void *ani = read_file(path, &size);
+    if (atlas == NULL || ani == NULL) {
+        printf("%-32s skipped (%s)\n", path, (err != NULL)? err : "cannot read");
+        free(ani);
+        return;
+    }
+    const char *label = strrchr(path, '/');
+    bench_load_pair((label != NULL)? label + 1 : path, ani, size, atlas, path, bmppath);
+    bench_variants((label != NULL)? label + 1 : path, path, bmppath);
+    api->graphics->freeBitmap(atlas);
+    free(ani);
+}
+
+#ifdef PDANI_ENABLE_STATS
+static void stats_collect(const struct pdani_file *file, const char *name, int x, int y, int w, int h, void *ptr)
+{
+    *(int*)ptr += 1;
+}
+
+// one instrumented frame of the rig: every draw case once, a culled draw, a few updates and a collision check
+static void bench_stats(struct pdani_file *file)
+{
+    const struct draw_case cases[] = {
+        { "aligned", 64, 64, false, false },
+        { "unaligned", 67, 64, false, false },
+        { "flipped", 67, 64, true, false },
+        { "clipped", -13, -9, false, false },
+        { "culled", -200, -200, false, false },
+    };
+    struct pdani_player player;
+    pdani_player_initialize(&player, file);
+    pdani_player_play(&player, "run");
+    pdani_file_reset_stats(file);
+    pdani_stats_reset();
+
+    pdani_stats_begin_frame();
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        pdani_file_draw(file, NULL, cases[i].x, cases[i].y, 1, cases[i].fliph, cases[i].flipv);
+    }
+    int steps = 0, colliders = 0;
+    for (int i = 0; i < RIG_FRAMES; ++i) {
+        pdani_player_update(&player, 100, on_frame_event, &steps);
+        pdani_player_check_collision(&player, 0, 0, stats_collect, &colliders);
+    }
+    pdani_stats_end_frame();
+    pdani_dirty_clear();
+    pdani_player_finalize(&player);
+
+    pdani_stats_log();
+    pdani_stats_log_file(file, "rig");
+    const struct pdani_stats *stats = pdani_stats_get();
+    const struct pdani_stats_counters *c = &stats->frame;
+    const struct pdani_stats_counters *f = pdani_file_get_stats(file);
+    if (c->draws != 5 || c->culled_draws != 1 || c->callbacks != (unsigned)steps || c->collider_checks != (unsigned)colliders
+        || c->blits != c->aligned_blits + c->unaligned_blits + c->flipped_blits + c->culled_blits
+        || f->blits != c->blits || f->bytes != c->bytes || f->frames_advanced != c->frames_advanced || stats->frame_count != 1) {
+        printf("stats mismatch\n");
+        exit(1);
+    }
+}
+#endif
+
+// pixel check: every frame of the rigs drawn through pdani and through a one-pixel-at-a-time reference,
+// compared bit for bit (screen and a masked bitmap, all flips, clipped at every edge)
+
+static inline int ref_get(const uint8_t *bits, int rowbytes, int x, int y)
+{
+    return (bits[rowbytes * y + (x >> 3)] >> (7 - (x & 7))) & 1;
+}
+
+static inline void ref_set(uint8_t *bits, int rowbytes, int x, int y, int v)
+{
+    const uint8_t bit = (uint8_t)(0x80 >> (x & 7));
+    if (v) bits[rowbytes * y + (x >> 3)] |= bit; else bits[rowbytes * y + (x >> 3)] &= (uint8_t)~bit;
+}
+
+static const void* ref_chunk(const struct pdani_file *file, enum pdani_chunk_type type)
+{
+    return file->chunks[type] + 1;
+}
+
+// cels bottom layer first, flipped around the canvas like fileDrawLayers, one masked pixel at a time
+static void reference_draw(const struct pdani_file *file, uint8_t *data, uint8_t *mask, int rowbytes, int width, int height, int x, int y, int frame, bool fliph, bool flipv)
+{
+    int atlas_rowbytes;
+    uint8_t *atlas_mask, *atlas_texel;
+    api->graphics->getBitmapData(file->bitmap, NULL, NULL, &atlas_rowbytes, &atlas_mask, &atlas_texel);
+    const int sw = pdani_file_get_width(file);
+    const int sh = pdani_file_get_height(file);
+
+    const uint8_t *frames = ref_chunk(file, PDANI_CHUNK_TYPE_FRAME);
+    uint32_t offset;
+    if (file->header->version >= 2) {
+        offset = ((const uint32_t*)frames)[frame - 1];
+    } else {
+        offset = ((const uint16_t*)frames)[frame - 1];
+    }
+    const struct pdani_frame_layer *frame_layer = ((const struct pdani_frame_data*)(frames + offset))->layers;
+    const struct pdani_layer_data *layers = ref_chunk(file, PDANI_CHUNK_TYPE_LAYER);
+    const struct pdani_cel_data *cels = ref_chunk(file, PDANI_CHUNK_TYPE_CEL);
+    const struct pdani_image_data *images = ref_chunk(file, PDANI_CHUNK_TYPE_IMAGE);
+
+    for (int l = 0; l < pdani_file_get_layer_count(file); ++l) {
+        if (layers[l].type == PDANI_LAYER_TYPE_GROUP) continue;
+        const struct pdani_frame_layer *fl = frame_layer++;
+        if (layers[l].type != PDANI_LAYER_TYPE_LAYER || fl->cel < 0) continue;
+        const struct pdani_cel_data *cel = &cels[fl->cel];
+        const struct pdani_image_data *image = &images[cel->image];
+        const int dx = (fliph)? x + sw - cel->x - image->w : x + cel->x;
+        const int dy = (flipv)? y + sh - cel->y - image->h : y + cel->y;
+        for (int j = 0; j < image->h; ++j) {
+            for (int i = 0; i < image->w; ++i) {
+                if (!ref_get(atlas_mask, atlas_rowbytes, image->u + i, image->v + j)) continue;
+                const int px = dx + ((fliph)? image->w - 1 - i : i);
+                const int py = dy + ((flipv)? image->h - 1 - j : j);
+                if (px < 0 || py < 0 || px >= width || py >= height) continue;
+                ref_set(data, rowbytes, px, py, ref_get(atlas_texel, atlas_rowbytes, image->u + i, image->v + j));
+                if (mask != NULL) ref_set(mask, rowbytes, px, py, 1);
+            }
+        }
+    }
+}
+
+static int verify_rig(const char *name, const struct pdani_file *file)
+{
+    // screen positions: aligned, unaligned, then past each edge and corner
+    static const int screen_positions[][2] = {
+        { 64, 64 }, { 67, 64 }, { 129, 101 }, { -13, 90 }, { -40, 20 }, { 380, 90 }, { 355, 150 },
+        { 170, -9 }, { 170, -50 }, { 170, 200 }, { 170, 230 }, { -21, -17 }, { 371, 211 },
+    };
+    static const int bitmap_positions[][2] = { { 0, 0 }, { 13, 5 }, { -11, 20 }, { 60, 20 }, { 20, -30 }, { 20, 50 }, { -30, -35 }, { 62, 44 } };
+    LCDBitmap *bitmap = api->graphics->newBitmap(90, 70, kColorClear);
+    int bitmap_rowbytes;
+    uint8_t *bitmap_data, *bitmap_mask;
+    api->graphics->getBitmapData(bitmap, NULL, NULL, &bitmap_rowbytes, &bitmap_mask, &bitmap_data);
+    const size_t screen_size = (size_t)LCD_ROWSIZE * LCD_ROWS;
+    const size_t bitmap_size = (size_t)bitmap_rowbytes * 70;
+    uint8_t *expected = malloc(screen_size);
+    uint8_t *expected_mask = malloc(bitmap_size);
+    int bad = 0;
+
+    for (int frame = 1; frame <= pdani_file_get_frame_count(file); ++frame) {
+        for (int flip = 0; flip < 4; ++flip) {
+            const bool fh = flip & 1, fv = (flip & 2) != 0;
+            for (size_t p = 0; p < sizeof(screen_positions) / sizeof(screen_positions[0]); ++p) {
+                const int x = screen_positions[p][0], y = screen_positions[p][1];
+                uint8_t *frame_buffer = api->graphics->getFrame();
+                for (size_t i = 0; i < screen_size; ++i) frame_buffer[i] = (uint8_t)random_next();
+                memcpy(expected, frame_buffer, screen_size);
+                reference_draw(file, expected, NULL, LCD_ROWSIZE, LCD_COLUMNS, LCD_ROWS, x, y, frame, fh, fv);
+                pdani_file_draw(file, NULL, x, y, frame, fh, fv);
+                if (memcmp(expected, frame_buffer, screen_size) != 0) {
+                    if (bad++ < 8) printf("verify %s: screen frame %d flip %d at %d,%d differs\n", name, frame, flip, x, y);
+                }
+            }
+            for (size_t p = 0; p < sizeof(bitmap_positions) / sizeof(bitmap_positions[0]); ++p) {
+                const int x = bitmap_positions[p][0], y = bitmap_positions[p][1];
+                for (size_t i = 0; i < bitmap_size; ++i) {
+                    bitmap_data[i] = (uint8_t)random_next();
+                    bitmap_mask[i] = (uint8_t)random_next();
+                }
+                memcpy(expected, bitmap_data, bitmap_size);
+                memcpy(expected_mask, bitmap_mask, bitmap_size);
+                reference_draw(file, expected, expected_mask, bitmap_rowbytes, 90, 70, x, y, frame, fh, fv);
+                pdani_file_draw(file, bitmap, x, y, frame, fh, fv);
+                if (memcmp(expected, bitmap_data, bitmap_size) != 0 || memcmp(expected_mask, bitmap_mask, bitmap_size) != 0) {
+                    if (bad++ < 8) printf("verify %s: bitmap frame %d flip %d at %d,%d differs\n", name, frame, flip, x, y);
+                }
+            }
+        }
+    }
+    pdani_dirty_clear();
+    free(expected);
+    free(expected_mask);
+    api->graphics->freeBitmap(bitmap);
+    printf("verify %-24s %s\n", name, (bad == 0)? "ok" : "FAILED");
+    return bad;
+}
+
+// every event seen by a frame callback since the last poll
+struct event_log {
+    struct pdani_event items[64];
+    int count;
+};
+
+static void on_logged_event(const struct pdani_file *file, int framenum, const char *name, void *ptr)
+{
+    struct event_log *log = ptr;
+    if (log->count < (int)(sizeof(log->items) / sizeof(log->items[0]))) {
+        log->items[log->count++] = (struct pdani_event){ .frame = (int16_t)framenum, .id = (uint16_t)pdani_intern(name) };
+    }
+}
+
+// the event queue against a frame callback: below capacity it keeps everything in order, past it it keeps the newest PDANI_EVENT_QUEUE_SIZE
+static int verify_event_queue(void)
+{
+    static const char *const events[RIG_FRAMES] = { "e1", "e2", "e3", "e4" };
+    struct bench_rig rig;
+    rig_initialize_shape(&rig, false, 2, false, NULL, NULL, events);
+    struct pdani_player queued, logged;
+    pdani_player_initialize(&queued, &rig.file);
+    pdani_player_initialize(&logged, &rig.file);
+    pdani_player_enable_event_queue(&queued, true);
+    pdani_player_play(&queued, "run");
+    pdani_player_play(&logged, "run");
+
+    int bad = 0, overflows = 0;
+    struct event_log log = { .count = 0 };
+    for (int i = 0; i < 500; ++i) {
+        const int ms = (int)(random_next() % 600);
+        pdani_player_update(&queued, ms, NULL, NULL);
+        pdani_player_update(&logged, ms, on_logged_event, &log);
+        // poll after a random run of at most 8 updates, which the log always holds
+        if (random_next() % 3 != 0 && (i & 7) != 7) continue;
+
+        const int kept = (log.count < PDANI_EVENT_QUEUE_SIZE)? log.count : PDANI_EVENT_QUEUE_SIZE;
+        if (log.count > PDANI_EVENT_QUEUE_SIZE) overflows += 1;
+        struct pdani_event event;
+        int polled = 0;
+        while (pdani_player_poll_event(&queued, &event)) {
+            const struct pdani_event *expected = (polled < kept)? &log.items[log.count - kept + polled] : NULL;
+            if (expected == NULL || expected->frame != event.frame || expected->id != event.id) {
+                if (bad++ < 8) printf("verify event queue: update %d event %d is frame %d %s\n", i, polled, event.frame, pdani_intern_get_name(event.id));
+            }
+            polled += 1;
+        }
+        if (polled != kept) {
+            if (bad++ < 8) printf("verify event queue: update %d polled %d of %d events\n", i, polled, kept);
+        }
+        log.count = 0;
+    }
+    if (overflows == 0) {
+        printf("verify event queue: the queue never overflowed\n");
+        bad += 1;
+    }
+
+    // turning the queue off drops what is left
+    pdani_player_update(&queued, 1000, NULL, NULL);
+    pdani_player_enable_event_queue(&queued, false);
+    struct pdani_event event;
+    if (pdani_player_poll_event(&queued, &event)) {
+        printf("verify event queue: events left after disabling the queue\n");
+        bad += 1;
+    }
+    pdani_player_finalize(&queued);
+    pdani_player_finalize(&logged);
+    rig_finalize(&rig);
+    printf("verify %-24s %s\n", "event queue", (bad == 0)? "ok" : "FAILED");
+    return bad;
+}
+
+// the tag hash index against a linear scan: duplicate names find the first tag, missing names find nothing
+static int verify_tags(void)
+{
+    static const char *const tags[] = {
+        "run", "idle", "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7", "t8", "t9", "t10", "t11",
+        "t3", "run", "t7", "t0", "t11", "idle", "t3", NULL,
+    };
+    static const char *const missing[] = { "", "t12", "t1 ", "T1", "ru", "runn", "idle2" };
+    struct bench_rig rig;
+    rig_initialize_shape(&rig, false, 2, false, NULL, tags, NULL);
+    int bad = 0;
+    const int count = pdani_file_get_tag_count(&rig.file);
+    for (int i = 0; tags[i] != NULL; ++i) {
+        int expected = -1;
+        for (int j = 0; j < count && expected < 0; ++j) {
+            if (strcmp(pdani_file_get_tag_name(&rig.file, j), tags[i]) == 0) expected = j;
+        }
+        const int found = pdani_file_find_tag(&rig.file, tags[i]);
+        if (found != expected) {
+            if (bad++ < 8) printf("verify tags: \"%s\" found %d, first is %d\n", tags[i], found, expected);
+        }
+    }
+    for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); ++i) {
+        const int found = pdani_file_find_tag(&rig.file, missing[i]);
+        if (found != -1) {
+            if (bad++ < 8) printf("verify tags: missing \"%s\" found %d\n", missing[i], found);
+        }
+    }
+    rig_finalize(&rig);
+    printf("verify %-24s %s\n", "find tag", (bad == 0)? "ok" : "FAILED");
+    return bad;
+}
+
+// rows marked by a clipped screen draw cover every changed row and stay on screen, and pdani_dirty_flush reports them this frame and the next
+static int verify_dirty(const struct pdani_file *file)
+{
+    static const int positions[][2] = { { 170, -9 }, { 170, 200 }, { -21, -17 }, { 371, 211 }, { 170, 300 } };
+    const size_t screen_size = (size_t)LCD_ROWSIZE * LCD_ROWS;
+    uint8_t *before = malloc(screen_size);
+    int bad = 0;
+    for (size_t p = 0; p < sizeof(positions) / sizeof(positions[0]); ++p) {
+        const int x = positions[p][0], y = positions[p][1];
+        pdani_dirty_clear();
+        pd_stub_clear_frame(kColorWhite);
+        const uint8_t *frame_buffer = api->graphics->getFrame();
+        memcpy(before, frame_buffer, screen_size);
+        pdani_file_draw(file, NULL, x, y, 1, false, false);
+
+        int changed_top = LCD_ROWS, changed_bottom = 0;
+        for (int row = 0; row < LCD_ROWS; ++row) {
+            if (memcmp(before + LCD_ROWSIZE * row, frame_buffer + LCD_ROWSIZE * row, LCD_ROWSIZE) == 0) continue;
+            if (row < changed_top) changed_top = row;
+            changed_bottom = row + 1;
+        }
+        LCDRect rc;
+        const bool marked = pdani_dirty_get_bounds(&rc);
+        const bool changed = changed_top < changed_bottom;
+        if (changed != marked || (marked && (rc.top < 0 || rc.bottom > LCD_ROWS || rc.top > changed_top || rc.bottom < changed_bottom))) {
+            if (bad++ < 8) printf("verify dirty at %d,%d: marked %d rows %d-%d, changed rows %d-%d\n", x, y, marked, rc.top, rc.bottom, changed_top, changed_bottom);
+            continue;
+        }
+
+        // this frame's rows, then the same rows again so the old image gets erased, then nothing
+        const int expected_start = marked? rc.top : -1, expected_end = marked? rc.bottom - 1 : -1;
+        for (int flush = 0; flush < 3; ++flush) {
+            pd_stub_reset_updated_rows();
+            pdani_dirty_flush();
+            int start, end;
+            pd_stub_get_updated_rows(&start, &end);
+            const bool expect_rows = flush < 2 && marked;
+            if (start != (expect_rows? expected_start : -1) || end != (expect_rows? expected_end : -1)) {
+                if (bad++ < 8) printf("verify dirty at %d,%d: flush %d updated rows %d-%d\n", x, y, flush, start, end);
+            }
+        }
+    }
+    pdani_dirty_clear();
+    pd_stub_reset_updated_rows();
+    free(before);
+    printf("verify %-24s %s\n", "dirty rows", (bad == 0)? "ok" : "FAILED");
+    return bad;
+}
+
+// the cumulative-time fast path (no callback) against stepping frame by frame (callback, event queue), and seek_time against stepping from the tag start
+static int verify_timing(struct pdani_file *file)
+{
+    static const char *tags[] = { "run", "idle" };
+    int bad = 0;
+    for (int t = 0; t < 2; ++t) {
+        for (int loop = 0; loop < 2; ++loop) {
+            const enum pdani_player_loop_type loop_type = (loop == 0)? PDANI_LOOP_TYPE_LOOP : PDANI_LOOP_TYPE_ONESHOT;
+            struct pdani_player fast, stepped, queued;
+            pdani_player_initialize(&fast, file);
+            pdani_player_initialize(&stepped, file);
+            pdani_player_initialize(&queued, file);
+            pdani_player_enable_event_queue(&queued, true);
+            struct pdani_player *players[3] = { &fast, &stepped, &queued };
+            for (int p = 0; p < 3; ++p) {
+                pdani_player_play(players[p], tags[t]);
+                players[p]->loop_type = loop_type;
+            }
+            int steps = 0;
+            for (int i = 0; i < 2000 && fast.is_playing; ++i) {
+                const int ms = (int)(random_next() % 400);
+                pdani_player_update(&fast, ms, NULL, NULL);
+                pdani_player_update(&stepped, ms, on_frame_event, &steps);
+                pdani_player_update(&queued, ms, NULL, NULL);
+                struct pdani_event event;
+                while (pdani_player_poll_event(&queued, &event)) {}
+                for (int p = 1; p < 3; ++p) {
+                    if (fast.frame_number != players[p]->frame_number || fast.frame_elapsed != players[p]->frame_elapsed || fast.is_playing != players[p]->is_playing) {
+                        if (bad++ < 8) {
+                            printf("verify timing: %s loop %d step %d: fast frame %d+%d, %s frame %d+%d\n", tags[t], loop, i,
+                                fast.frame_number, fast.frame_elapsed, (p == 1)? "callback" : "queue", players[p]->frame_number, players[p]->frame_elapsed);
+                        }
+                    }
+                }
+            }
+
+            for (int ms = 0; ms < 2000; ms += 7) {
+                pdani_player_play(&fast, tags[t]);
+                pdani_player_seek_time(&fast, ms);
+                pdani_player_play(&stepped, tags[t]);
+                pdani_player_update(&stepped, 0, on_frame_event, &steps);
+                pdani_player_update(&stepped, ms, on_frame_event, &steps);
+                if (fast.frame_number != stepped.frame_number || fast.frame_elapsed != stepped.frame_elapsed) {
+                    if (bad++ < 8) {
+                        printf("verify timing: %s loop %d seek %d ms: frame %d+%d, stepped frame %d+%d\n", tags[t], loop, ms,
+                            fast.frame_number, fast.frame_elapsed, stepped.frame_number, stepped.frame_elapsed);
+                    }
+                }
+            }
+            for (int p = 0; p < 3; ++p) {
+                pdani_player_finalize(players[p]);
+            }
+        }
+    }
+    printf("verify %-24s %s\n", "update and seek time", (bad == 0)? "ok" : "FAILED");
+    return bad;
+}
+
+// shared files: reference counting, LRU eviction over the budget, failed loads and arena independence
+static int verify_asset(const struct bench_rig *rig)
+{
+    const char *paths[2] = { "pdani_verify_asset_a.ani", "pdani_verify_asset_b.ani" };
+    struct ani_builder_chunk atlas_data;
+    atlas_chunk(&atlas_data, rig->atlas);
+    size_t size = 0;
+    void *ani = ani_builder_repack(rig->data, rig->size, &atlas_data, 0, &size);
+    free(atlas_data.data);
+    write_file(paths[0], ani, size);
+    write_file(paths[1], ani, size);
+    free(ani);
+    int height, rowbytes;
+    api->graphics->getBitmapData(rig->atlas, NULL, &height, &rowbytes, NULL, NULL);
+    const size_t asset_size = size + (size_t)rowbytes * height * 2;
+    int bad = 0;
+
+    if (pdani_asset_acquire("pdani_verify_missing.ani", NULL) != NULL) {
+        printf("verify asset: a missing file was acquired\n");
+        bad += 1;
+    }
+
+    // an arena allocator must not hold shared files, which outlive pdani_arena_reset
+    uint8_t *buffer = malloc(64 * 1024);
+    struct pdani_arena arena;
+    pdani_arena_initialize(&arena, buffer, 64 * 1024);
+    pdani_global_set_allocator(&arena.allocator);
+    pdani_asset_set_budget(asset_size * 4);
+    struct pdani_file *a = pdani_asset_acquire(paths[0], NULL);
+    struct pdani_file *b = pdani_asset_acquire(paths[1], NULL);
+    pdani_global_set_allocator(NULL);
+    if (a == NULL || b == NULL || arena.used != 0) {
+        printf("verify asset: acquire a %p b %p, arena used %zu\n", (void*)a, (void*)b, arena.used);
+        free(buffer);
+        remove(paths[0]);
+        remove(paths[1]);
+        return bad + 1;
+    }
+    if (pdani_asset_acquire(paths[0], NULL) != a) {
+        printf("verify asset: a second acquire loaded a new file\n");
+        bad += 1;
+    }
+
+    // a is still referenced once, so purging keeps it even after the file is gone from disk
+    pdani_asset_release(a);
+    pdani_asset_purge();
+    remove(paths[0]);
+    if (pdani_asset_acquire(paths[0], NULL) != a) {
+        printf("verify asset: a referenced file was purged\n");
+        bad += 1;
+    }
+    pdani_asset_release(a);
+    pdani_asset_release(a);
+
+    // a was acquired last, so shrinking the budget to one file drops b first
+    pdani_asset_release(b);
+    remove(paths[1]);
+    pdani_asset_set_budget(asset_size);
+    if (pdani_asset_acquire(paths[1], NULL) != NULL) {
+        printf("verify asset: the least recently used file was kept\n");
+        bad += 1;
+    }
+    struct pdani_file *kept = pdani_asset_acquire(paths[0], NULL);
+    if (kept != a) {
+        printf("verify asset: the most recently used file was dropped\n");
+        bad += 1;
+    }
+    if (kept != NULL) pdani_asset_release(kept);
+    pdani_asset_set_budget(0);
+    if (pdani_asset_acquire(paths[0], NULL) != NULL) {
+        printf("verify asset: an unreferenced file survived a zero budget\n");
+        bad += 1;
+    }
+    free(buffer);
+    printf("verify %-24s %s\n", "asset cache", (bad == 0)? "ok" : "FAILED");
+    return bad;
+}
+
+static int verify_draw(void)
+{
+    int bad = 0;
+    struct bench_rig rig;
+    rig_initialize_version(&rig, false, 1);
+    bad += verify_rig("v1", &rig.file);
+    rig_finalize(&rig);
+
+    rig_initialize(&rig, false);
+    bad += verify_rig("v2", &rig.file);
+    pdani_file_enable_flip_cache(&rig.file, false);
+    bad += verify_rig("flip cache", &rig.file);
+    pdani_file_compile_draw_list(&rig.file);
+    bad += verify_rig("draw list", &rig.file);
+    rig_finalize(&rig);
+
+    rig_initialize(&rig, true);
+    bad += verify_rig("spans", &rig.file);
+    rig_finalize(&rig);
+
+    rig_initialize_shape(&rig, true, 2, true, NULL, NULL, NULL);
+    bad += verify_rig("spans (solid)", &rig.file);
+    rig_finalize(&rig);
+
+    // the first pass fills the cache, the second draws from it
+    rig_initialize(&rig, false);
+    pdani_file_enable_frame_cache(&rig.file, 256 * 1024);
+    bad += verify_rig("frame cache (fill)", &rig.file);
+    bad += verify_rig("frame cache", &rig.file);
+    rig_finalize(&rig);
+
+    bad += verify_tags();
+    bad += verify_event_queue();
+
+    rig_initialize(&rig, false);
+    bad += verify_dirty(&rig.file);
+    bad += verify_asset(&rig);
+    rig_finalize(&rig);
+
+    const uint16_t durations[RIG_FRAMES] = { 40, 170, 60, 130 };
+    rig_initialize_shape(&rig, false, 2, false, durations, NULL, NULL);
+    bad += verify_timing(&rig.file);
+    rig_finalize(&rig);
+    return (bad == 0)? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    bool verify = false, overflow = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            iterations = 200;
+        } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--read-rate") == 0 && i + 1 < argc) {
+            read_rate = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else if (strcmp(argv[i], "--arena-overflow") == 0) {
+            overflow = true;
+        }
+    }
+
+    api = pd_stub_get_api();
+    pdani_global_initialize(api);
+    if (verify) return verify_draw();
+    if (overflow) return arena_overflow();
+
+    struct bench_rig rig;
+    rig_initialize(&rig, false);
+
+    const struct draw_case draw_cases[] = {
+        { "draw aligned", 64, 64, false, false },
+        { "draw unaligned", 67, 64, false, false },
+        { "draw flipped", 67, 64, true, false },
+        { "draw flipped vertically", 67, 64, false, true },
+        { "draw clipped", -13, -9, false, false },
+        { "draw clipped flipped", 380, 200, true, true },
+    };
+    for (size_t i = 0; i < sizeof(draw_cases) / sizeof(draw_cases[0]); ++i) {
+        bench_draw(&rig.file, &draw_cases[i]);
+    }
+
+    pdani_file_enable_flip_cache(&rig.file, false);
+    const struct draw_case cached = { "draw flipped (flip cache)", 67, 64, true, false };
+    bench_draw(&rig.file, &cached);
+
+    pdani_file_compile_draw_list(&rig.file);
+    const struct draw_case compiled[] = {
+        { "draw unaligned (draw list)", 67, 64, false, false },
+        { "draw clipped (draw list)", -13, -9, false, false },
+    };
+    for (size_t i = 0; i < sizeof(compiled) / sizeof(compiled[0]); ++i) {
+        bench_draw(&rig.file, &compiled[i]);
+    }
+
+    bench_crowd(&rig.file);
+
+    struct bench_rig span_rig;
+    rig_initialize(&span_rig, true);
+    const struct draw_case span_cases[] = {
+        { "draw unaligned (spans)", 67, 64, false, false },
+        { "draw flipped (spans)", 67, 64, true, false },
+        { "draw clipped (spans)", -13, -9, false, false },
+    };
+    for (size_t i = 0; i < sizeof(span_cases) / sizeof(span_cases[0]); ++i) {
+        bench_draw(&span_rig.file, &span_cases[i]);
+    }
+    rig_finalize(&span_rig);
+
+    // spans only pay off when opaque spans cover most of the image; the ellipses above fall back to one blit
+    const struct draw_case solid_cases[][2] = {
+        { { "draw unaligned (solid)", 67, 64, false, false }, { "draw unaligned (solid, spans)", 67, 64, false, false } },
+        { { "draw flipped (solid)", 67, 64, true, false }, { "draw flipped (solid, spans)", 67, 64, true, false } },
+    };
+    for (int with_spans = 0; with_spans < 2; ++with_spans) {
+        rig_initialize_shape(&span_rig, with_spans, 2, true, NULL, NULL, NULL);
+        for (size_t i = 0; i < sizeof(solid_cases) / sizeof(solid_cases[0]); ++i) {
+            bench_draw(&span_rig.file, &solid_cases[i][with_spans]);
+        }
+        rig_finalize(&span_rig);
+    }
+
+    // each frame composited once, then drawn as a single blit
+    struct bench_rig cached_rig;
+    rig_initialize(&cached_rig, false);
+    pdani_file_enable_frame_cache(&cached_rig.file, 64 * 1024);
+    const struct draw_case frame_cache_cases[] = {
+        { "draw unaligned (frame cache)", 67, 64, false, false },
+        { "draw flipped (frame cache)", 67, 64, true, false },
+        { "draw clipped (frame cache)", -13, -9, false, false },
+    };
+    for (size_t i = 0; i < sizeof(frame_cache_cases) / sizeof(frame_cache_cases[0]); ++i) {
+        bench_draw(&cached_rig.file, &frame_cache_cases[i]);
+    }
+    rig_finalize(&cached_rig);
+
+    bench_player_update(&rig.file, "player update", 64, 20);
+    bench_player_update(&rig.file, "player update catch-up", 64, 1000);
+    bench_player_update(&rig.file, "player update resume (60s)", 64, 60000);
+    bench_player_events(&rig.file, 64);
+    bench_layer_mask(&rig.file);
+#ifdef PDANI_ENABLE_STATS
+    bench_stats(&rig.file);
+#endif
+    bench_player_group(&rig.file, 256);
+    bench_player_play(&rig.file);
+    bench_collision(&rig.file);
+    bench_streaming(&rig);
+    bench_arena(&rig);
+
+    struct bench_rig v1_rig;
+    rig_initialize_version(&v1_rig, true, 1);
+    bench_file_initialize(&v1_rig, "file initialize (v1)");
+    bench_file_initialize_validated(&v1_rig, "file initialize validated (v1)");
+    rig_finalize(&v1_rig);
+    struct bench_rig v2_rig;
+    rig_initialize_version(&v2_rig, true, 2);
+    bench_file_initialize(&v2_rig, "file initialize (v2)");
+    bench_file_initialize_validated(&v2_rig, "file initialize validated (v2)");
+    bench_load_pair("rig", v2_rig.data, v2_rig.size, v2_rig.atlas, NULL, NULL);
+    rig_finalize(&v2_rig);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ani") == 0 && i + 1 < argc) bench_load_path(argv[++i]);
+    }
+
+    rig_finalize(&rig);
+    return 0;
+}
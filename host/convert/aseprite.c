@@ -0,0 +1,400 @@
+#include "aseprite.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <zlib.h>
+
+// https://github.com/aseprite/aseprite/blob/main/docs/ase-file-specs.md
+
+#define ASE_HEADER_MAGIC 0xA5E0
+#define ASE_FRAME_MAGIC 0xF1FA
+#define ASE_HEADER_FLAG_LAYER_UUID 4
+
+enum ase_chunk_type {
+    ASE_CHUNK_OLD_PALETTE = 0x0004,
+    ASE_CHUNK_OLD_PALETTE_6BIT = 0x0011,
+    ASE_CHUNK_LAYER = 0x2004,
+    ASE_CHUNK_CEL = 0x2005,
+    ASE_CHUNK_CEL_EXTRA = 0x2006,
+    ASE_CHUNK_TAGS = 0x2018,
+    ASE_CHUNK_PALETTE = 0x2019,
+    ASE_CHUNK_USER_DATA = 0x2020,
+};
+
+enum ase_cel_type {
+    ASE_CEL_RAW = 0,
+    ASE_CEL_LINKED = 1,
+    ASE_CEL_COMPRESSED = 2,
+};
+
+struct reader {
+    const uint8_t *p, *end;
+    bool error;
+};
+
+static const uint8_t* read_bytes(struct reader *r, size_t n)
+{
+    if (r->error || (size_t)(r->end - r->p) < n) {
+        r->error = true;
+        return NULL;
+    }
+    const uint8_t *p = r->p;
+    r->p += n;
+    return p;
+}
+
+static unsigned read_u8(struct reader *r)
+{
+    const uint8_t *p = read_bytes(r, 1);
+    return (p != NULL)? p[0] : 0;
+}
+
+static unsigned read_u16(struct reader *r)
+{
+    const uint8_t *p = read_bytes(r, 2);
+    return (p != NULL)? (unsigned)(p[0] | (p[1] << 8)) : 0;
+}
+
+static int read_s16(struct reader *r)
+{
+    return (int16_t)read_u16(r);
+}
+
+static uint32_t read_u32(struct reader *r)
+{
+    const uint8_t *p = read_bytes(r, 4);
+    return (p != NULL)? (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24) : 0;
+}
+
+static char* read_string(struct reader *r)
+{
+    const unsigned len = read_u16(r);
+    const uint8_t *p = read_bytes(r, len);
+    if (p == NULL) return NULL;
+    char *s = malloc(len + 1);
+    memcpy(s, p, len);
+    s[len] = '\0';
+    return s;
+}
+
+static void* grow(void *buf, int count, int *capacity, size_t elem)
+{
+    if (count < *capacity) return buf;
+    *capacity = (*capacity > 0)? *capacity * 2 : 16;
+    return realloc(buf, elem * (size_t)*capacity);
+}
+
+int ase_bytes_per_pixel(const struct ase_sprite *sprite)
+{
+    return sprite->color_mode / 8;
+}
+
+const struct ase_cel* ase_get_cel(const struct ase_sprite *sprite, int frame, int layer)
+{
+    int index = frame * sprite->layer_count + layer;
+    // 共有元をたどる（壊れたファイルで回り続けないよう回数を限る）
+    for (int i = 0; i < sprite->frame_count && sprite->cels[index].link != index; ++i) {
+        index = sprite->cels[index].link;
+    }
+    return &sprite->cels[index];
+}
+
+struct parse_state {
+    int layer_capacity, image_capacity, tag_capacity;
+    int level_parent[64]; //< 子レベルごとの直近のレイヤー
+    int last_cel; //< 直前の cel（user data の行き先、無ければ -1）
+    int pending_tag_user_data; //< tags チャンクの後に続く tag 用 user data の残り
+    bool has_new_palette;
+};
+
+static bool parse_layer(struct ase_sprite *sprite, struct parse_state *st, struct reader *r, uint32_t header_flags)
+{
+    read_u16(r); // flags
+    const int type = (int)read_u16(r);
+    const int level = (int)read_u16(r);
+    read_bytes(r, 2 + 2 + 2 + 1 + 3); // default size, blend mode, opacity, reserved
+    char *name = read_string(r);
+    if (type == ASE_LAYER_TILEMAP) read_u32(r);
+    if (header_flags & ASE_HEADER_FLAG_LAYER_UUID) read_bytes(r, 16);
+    if (r->error || level >= 64) {
+        free(name);
+        return false;
+    }
+
+    sprite->layers = grow(sprite->layers, sprite->layer_count, &st->layer_capacity, sizeof(struct ase_layer));
+    const int index = sprite->layer_count++;
+    struct ase_layer *layer = &sprite->layers[index];
+    layer->type = type;
+    layer->name = name;
+    layer->child_count = 0;
+    layer->parent = (level > 0)? st->level_parent[level - 1] : -1;
+    if (layer->parent >= 0) sprite->layers[layer->parent].child_count++;
+    st->level_parent[level] = index;
+    return true;
+}
+
+static int add_image(struct ase_sprite *sprite, struct parse_state *st, int width, int height)
+{
+    sprite->images = grow(sprite->images, sprite->image_count, &st->image_capacity, sizeof(struct ase_image));
+    struct ase_image *image = &sprite->images[sprite->image_count];
+    image->width = width;
+    image->height = height;
+    image->pixels = calloc((size_t)width * height, (size_t)ase_bytes_per_pixel(sprite));
+    return sprite->image_count++;
+}
+
+static bool parse_cel(struct ase_sprite *sprite, struct parse_state *st, struct reader *r, int frame)
+{
+    const int layer = (int)read_u16(r);
+    const int x = read_s16(r);
+    const int y = read_s16(r);
+    read_u8(r); // opacity
+    const int type = (int)read_u16(r);
+    read_bytes(r, 2 + 5); // z-index, reserved
+    if (r->error || layer >= sprite->layer_count) return false;
+
+    const int index = frame * sprite->layer_count + layer;
+    struct ase_cel *cel = &sprite->cels[index];
+    st->last_cel = index;
+    if (sprite->layers[layer].type != ASE_LAYER_IMAGE) {
+        // tilemap cels are not exported (their image is a tile index map)
+        return true;
+    }
+
+    cel->x = x;
+    cel->y = y;
+    if (type == ASE_CEL_LINKED) {
+        const int position = (int)read_u16(r);
+        if (r->error || position >= frame) return false;
+        cel->link = position * sprite->layer_count + layer;
+        st->last_cel = ase_get_cel(sprite, frame, layer) - sprite->cels;
+        return true;
+    }
+    if (type != ASE_CEL_RAW && type != ASE_CEL_COMPRESSED) return true;
+
+    const int width = (int)read_u16(r);
+    const int height = (int)read_u16(r);
+    if (r->error) return false;
+    const size_t size = (size_t)width * height * ase_bytes_per_pixel(sprite);
+    // deflate cannot expand more than ~1032:1, so larger sizes are broken files
+    const size_t available = (size_t)(r->end - r->p);
+    if (size > ((type == ASE_CEL_RAW)? available : available * 1032)) return false;
+    cel->image = add_image(sprite, st, width, height);
+    uint8_t *pixels = sprite->images[cel->image].pixels;
+    if (type == ASE_CEL_RAW) {
+        const uint8_t *p = read_bytes(r, size);
+        if (p == NULL) return false;
+        memcpy(pixels, p, size);
+        return true;
+    }
+    uLongf len = (uLongf)size;
+    const int result = uncompress(pixels, &len, r->p, (uLong)(r->end - r->p));
+    return (result == Z_OK || result == Z_BUF_ERROR) && len == size;
+}
+
+static bool parse_tags(struct ase_sprite *sprite, struct parse_state *st, struct reader *r)
+{
+    const int count = (int)read_u16(r);
+    read_bytes(r, 8);
+    for (int i = 0; i < count && !r->error; ++i) {
+        const int from = (int)read_u16(r);
+        const int to = (int)read_u16(r);
+        read_bytes(r, 1 + 2 + 6 + 3 + 1); // direction, repeat, reserved, color, extra
+        char *name = read_string(r);
+        if (name == NULL) return false;
+        sprite->tags = grow(sprite->tags, sprite->tag_count, &st->tag_capacity, sizeof(struct ase_tag));
+        sprite->tags[sprite->tag_count++] = (struct ase_tag){ from, to, name };
+    }
+    st->pending_tag_user_data = count;
+    return !r->error;
+}
+
+static void parse_palette(struct ase_sprite *sprite, struct parse_state *st, struct reader *r)
+{
+    read_u32(r); // size
+    const uint32_t first = read_u32(r);
+    const uint32_t last = read_u32(r);
+    read_bytes(r, 8);
+    for (uint32_t i = first; i <= last && !r->error; ++i) {
+        const unsigned flags = read_u16(r);
+        const uint8_t *rgba = read_bytes(r, 4);
+        if (rgba != NULL && i < 256) memcpy(sprite->palette[i], rgba, 4);
+        if (flags & 1) free(read_string(r));
+    }
+    st->has_new_palette = true;
+}
+
+static void parse_old_palette(struct ase_sprite *sprite, struct reader *r, int shift)
+{
+    const int packets = (int)read_u16(r);
+    int index = 0;
+    for (int i = 0; i < packets && !r->error; ++i) {
+        index += (int)read_u8(r);
+        int count = (int)read_u8(r);
+        if (count == 0) count = 256;
+        for (int c = 0; c < count && !r->error; ++c, ++index) {
+            const uint8_t *rgb = read_bytes(r, 3);
+            if (rgb == NULL || index >= 256) continue;
+            for (int k = 0; k < 3; ++k) sprite->palette[index][k] = (uint8_t)(rgb[k] << shift);
+            sprite->palette[index][3] = 255;
+        }
+    }
+}
+
+static void parse_user_data(struct ase_sprite *sprite, struct parse_state *st, struct reader *r)
+{
+    const uint32_t flags = read_u32(r);
+    char *text = (flags & 1)? read_string(r) : NULL;
+    if (st->pending_tag_user_data > 0) {
+        // tags チャンクの後は tag ごとの user data が続く
+        --st->pending_tag_user_data;
+        free(text);
+        return;
+    }
+    if (st->last_cel >= 0) {
+        struct ase_cel *cel = &sprite->cels[st->last_cel];
+        free(cel->user_data);
+        cel->user_data = text;
+        return;
+    }
+    free(text);
+}
+
+static bool parse_frame(struct ase_sprite *sprite, struct parse_state *st, struct reader *r, int frame, uint32_t header_flags)
+{
+    const uint32_t frame_size = read_u32(r);
+    const unsigned magic = read_u16(r);
+    const unsigned old_chunks = read_u16(r);
+    sprite->durations[frame] = (int)read_u16(r);
+    read_bytes(r, 2);
+    const uint32_t new_chunks = read_u32(r);
+    if (r->error || magic != ASE_FRAME_MAGIC || frame_size < 16) return false;
+    const uint32_t chunks = (new_chunks != 0)? new_chunks : old_chunks;
+
+    st->last_cel = -1;
+    for (uint32_t i = 0; i < chunks; ++i) {
+        const uint32_t size = read_u32(r);
+        const unsigned type = read_u16(r);
+        if (r->error || size < 6 || (size_t)(r->end - r->p) < size - 6) return false;
+        struct reader chunk = { r->p, r->p + size - 6, false };
+        r->p += size - 6;
+
+        if (type != ASE_CHUNK_USER_DATA && type != ASE_CHUNK_CEL_EXTRA) {
+            st->last_cel = -1;
+            if (type != ASE_CHUNK_TAGS) st->pending_tag_user_data = 0;
+        }
+        switch (type) {
+        case ASE_CHUNK_LAYER:
+            if (!parse_layer(sprite, st, &chunk, header_flags)) return false;
+            break;
+        case ASE_CHUNK_CEL:
+            if (sprite->cels == NULL) {
+                // レイヤーは最初のフレームの cel より前に全部並んでいる
+                const size_t count = (size_t)sprite->frame_count * sprite->layer_count;
+                sprite->cels = calloc(count, sizeof(struct ase_cel));
+                for (size_t c = 0; c < count; ++c) {
+                    sprite->cels[c].image = -1;
+                    sprite->cels[c].link = (int)c;
+                }
+            }
+            if (!parse_cel(sprite, st, &chunk, frame)) return false;
+            break;
+        case ASE_CHUNK_TAGS:
+            if (!parse_tags(sprite, st, &chunk)) return false;
+            break;
+        case ASE_CHUNK_PALETTE:
+            if (frame == 0) parse_palette(sprite, st, &chunk);
+            break;
+        case ASE_CHUNK_OLD_PALETTE:
+        case ASE_CHUNK_OLD_PALETTE_6BIT:
+            if (frame == 0 && !st->has_new_palette) parse_old_palette(sprite, &chunk, (type == ASE_CHUNK_OLD_PALETTE)? 0 : 2);
+            break;
+        case ASE_CHUNK_USER_DATA:
+            parse_user_data(sprite, st, &chunk);
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+int ase_load(struct ase_sprite *sprite, const char *path, char *err, size_t errlen)
+{
+    memset(sprite, 0, sizeof(struct ase_sprite));
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        snprintf(err, errlen, "cannot open");
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    const long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = malloc((size_t)len + 1);
+    const size_t read = fread(data, 1, (size_t)len, fp);
+    fclose(fp);
+
+    struct reader r = { data, data + read, false };
+    read_u32(&r); // file size
+    const unsigned magic = read_u16(&r);
+    sprite->frame_count = (int)read_u16(&r);
+    sprite->width = (int)read_u16(&r);
+    sprite->height = (int)read_u16(&r);
+    sprite->color_mode = (int)read_u16(&r);
+    const uint32_t header_flags = read_u32(&r);
+    read_bytes(&r, 2 + 4 + 4); // speed, reserved
+    sprite->transparent_index = (int)read_u8(&r);
+    read_bytes(&r, 128 - 29);
+    if (r.error || magic != ASE_HEADER_MAGIC) {
+        snprintf(err, errlen, "not an .aseprite file");
+        free(data);
+        return -1;
+    }
+    if (sprite->color_mode != ASE_COLOR_RGB && sprite->color_mode != ASE_COLOR_GRAY && sprite->color_mode != ASE_COLOR_INDEXED) {
+        snprintf(err, errlen, "unsupported color depth %d", sprite->color_mode);
+        free(data);
+        return -1;
+    }
+
+    sprite->durations = calloc((size_t)sprite->frame_count + 1, sizeof(int));
+    struct parse_state st = { 0 };
+    st.last_cel = -1;
+    for (int i = 0; i < 256; ++i) {
+        sprite->palette[i][0] = sprite->palette[i][1] = sprite->palette[i][2] = (uint8_t)i;
+        sprite->palette[i][3] = 255;
+    }
+    for (int frame = 0; frame < sprite->frame_count; ++frame) {
+        if (!parse_frame(sprite, &st, &r, frame, header_flags)) {
+            snprintf(err, errlen, "broken frame %d", frame + 1);
+            free(data);
+            ase_free(sprite);
+            return -1;
+        }
+    }
+    if (sprite->cels == NULL) {
+        sprite->cels = calloc((size_t)sprite->frame_count * sprite->layer_count + 1, sizeof(struct ase_cel));
+        for (int c = 0; c < sprite->frame_count * sprite->layer_count; ++c) {
+            sprite->cels[c].image = -1;
+            sprite->cels[c].link = c;
+        }
+    }
+    free(data);
+    return 0;
+}
+
+void ase_free(struct ase_sprite *sprite)
+{
+    for (int i = 0; i < sprite->layer_count; ++i) free(sprite->layers[i].name);
+    for (int i = 0; i < sprite->image_count; ++i) free(sprite->images[i].pixels);
+    for (int i = 0; i < sprite->tag_count; ++i) free(sprite->tags[i].name);
+    if (sprite->cels != NULL) {
+        for (int i = 0; i < sprite->frame_count * sprite->layer_count; ++i) free(sprite->cels[i].user_data);
+    }
+    free(sprite->layers);
+    free(sprite->images);
+    free(sprite->tags);
+    free(sprite->cels);
+    free(sprite->durations);
+    memset(sprite, 0, sizeof(struct ase_sprite));
+}
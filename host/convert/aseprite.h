@@ -0,0 +1,79 @@
+#ifndef __ASEPRITE_H__
+#define __ASEPRITE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// .aseprite reader for the converter: layers, cels, tags, cel user data and the first palette.
+// Reads only what Exporter in aseprite_extension/src/lib/exporter.lua looks at.
+
+enum ase_color_mode {
+    ASE_COLOR_RGB = 32,
+    ASE_COLOR_GRAY = 16,
+    ASE_COLOR_INDEXED = 8,
+};
+
+enum ase_layer_type {
+    ASE_LAYER_IMAGE = 0,
+    ASE_LAYER_GROUP = 1,
+    ASE_LAYER_TILEMAP = 2,
+};
+
+struct ase_image {
+    int width, height;
+    uint8_t *pixels; //< width * height 個（RGBA / 値とアルファ / インデックス）
+};
+
+struct ase_layer {
+    int type;
+    int parent; //< layers 内の親グループ（最上位なら -1）
+    int child_count; //< 直下のレイヤー数（# で始まるものも含む）
+    char *name;
+};
+
+// linked cel は元の cel と image、位置、user data を共有する（Aseprite の CelData と同じ）
+struct ase_cel {
+    int image; //< images 内の位置（cel が無ければ -1）
+    int x, y;
+    int link; //< 共有している cel（frame * layer_count + layer、自分なら自分）
+    char *user_data; //< 無ければ NULL
+};
+
+struct ase_tag {
+    int from, to; //< 0 始まり
+    char *name;
+};
+
+struct ase_sprite {
+    int width, height;
+    int color_mode; //< enum ase_color_mode（1ピクセルのバイト数 * 8）
+    int transparent_index;
+    int frame_count;
+    int *durations; //< ms
+    struct ase_layer *layers; //< ファイル順（親が先、下から上）
+    int layer_count;
+    struct ase_cel *cels; //< frame_count * layer_count
+    struct ase_image *images;
+    int image_count;
+    struct ase_tag *tags;
+    int tag_count;
+    uint8_t palette[256][4]; //< 最初のフレームのパレット（RGBA）
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @fn 読み込む（失敗したら err にメッセージを入れて -1）
+int ase_load(struct ase_sprite *sprite, const char *path, char *err, size_t errlen);
+void ase_free(struct ase_sprite *sprite);
+int ase_bytes_per_pixel(const struct ase_sprite *sprite);
+/// @fn frame, layer の cel（共有元をたどった後のもの）
+const struct ase_cel* ase_get_cel(const struct ase_sprite *sprite, int frame, int layer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __ASEPRITE_H__
@@ -0,0 +1,657 @@
+#include "exporter.h"
+#include "packer.h"
+#include "ani_builder.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the visible part of one of sprite->images or of the baked variants after them (Exporter.trimImage)
+struct registered_image {
+    int image;
+    int x, y, w, h;
+};
+
+struct registered_cel {
+    int image, x, y, w, h;
+};
+
+struct registered_collider {
+    int x, y, w, h;
+};
+
+// Exporter.images, Exporter.cels and Exporter.colliders with hashed lookups instead of linear scans.
+// Entries are only added when no equal one exists, so the first registration wins as in the Lua code.
+struct export_state {
+    const struct ase_sprite *sprite;
+    struct ani_builder builder;
+    struct registered_image *images; //< 登録順
+    int image_count;
+    struct registered_image *trims; //< sprite->images ごとの切り詰め結果（w < 0 なら未計算、0 なら全部透明）
+    struct registered_cel *cels;
+    int cel_count;
+    struct registered_collider *colliders;
+    int collider_count;
+    struct ase_image *baked; //< 焼き込んだ回転・拡大縮小（番号は sprite->image_count から続く）
+    int baked_count;
+    int *slots; //< 種類ごとに分けた番号 + 1 のオープンアドレス表
+    int mask;
+};
+
+enum { SLOT_IMAGE, SLOT_CEL, SLOT_COLLIDER };
+
+static uint32_t hash_bytes(uint32_t h, const void *data, size_t size)
+{
+    // FNV-1a
+    const uint8_t *p = data;
+    for (size_t i = 0; i < size; ++i) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static int* find_slot(struct export_state *st, int kind, uint32_t hash, int (*equal)(const struct export_state*, int, const void*), const void *key)
+{
+    int h = (int)((hash ^ (uint32_t)kind * 0x9e3779b9u) & (uint32_t)st->mask);
+    while (st->slots[h] != 0) {
+        const int v = st->slots[h] - 1;
+        if ((v & 3) == kind && equal(st, v >> 2, key)) break;
+        h = (h + 1) & st->mask;
+    }
+    return &st->slots[h];
+}
+
+static const uint8_t* image_pixel(const struct ase_sprite *sprite, const struct ase_image *image, int x, int y)
+{
+    return image->pixels + ((size_t)y * image->width + x) * ase_bytes_per_pixel(sprite);
+}
+
+static const struct ase_image* state_image(const struct export_state *st, int index)
+{
+    return (index < st->sprite->image_count)? &st->sprite->images[index] : &st->baked[index - st->sprite->image_count];
+}
+
+static const uint8_t* window_row(const struct export_state *st, const struct registered_image *window, int y)
+{
+    return image_pixel(st->sprite, state_image(st, window->image), window->x, window->y + y);
+}
+
+static uint32_t image_hash(const struct export_state *st, const struct registered_image *window)
+{
+    uint32_t h = hash_bytes(2166136261u, &window->w, sizeof(int));
+    h = hash_bytes(h, &window->h, sizeof(int));
+    for (int y = 0; y < window->h; ++y) {
+        h = hash_bytes(h, window_row(st, window, y), (size_t)window->w * ase_bytes_per_pixel(st->sprite));
+    }
+    return h;
+}
+
+// Image:isEqual
+static int image_equal(const struct export_state *st, int index, const void *key)
+{
+    const struct registered_image *a = &st->images[index];
+    const struct registered_image *b = key;
+    if (a->w != b->w || a->h != b->h) return 0;
+    for (int y = 0; y < a->h; ++y) {
+        if (memcmp(window_row(st, a, y), window_row(st, b, y), (size_t)a->w * ase_bytes_per_pixel(st->sprite)) != 0) return 0;
+    }
+    return 1;
+}
+
+static int cel_equal(const struct export_state *st, int index, const void *key)
+{
+    return memcmp(&st->cels[index], key, sizeof(struct registered_cel)) == 0;
+}
+
+static int collider_equal(const struct export_state *st, int index, const void *key)
+{
+    return memcmp(&st->colliders[index], key, sizeof(struct registered_collider)) == 0;
+}
+
+static int register_image(struct export_state *st, const struct registered_image *window)
+{
+    int *slot = find_slot(st, SLOT_IMAGE, image_hash(st, window), image_equal, window);
+    if (*slot != 0) return (*slot - 1) >> 2;
+    st->images[st->image_count] = *window;
+    *slot = ((st->image_count << 2) | SLOT_IMAGE) + 1;
+    return st->image_count++;
+}
+
+static int register_cel(struct export_state *st, const struct registered_cel *cel)
+{
+    int *slot = find_slot(st, SLOT_CEL, hash_bytes(2166136261u, cel, sizeof(*cel)), cel_equal, cel);
+    if (*slot != 0) return (*slot - 1) >> 2;
+    st->cels[st->cel_count] = *cel;
+    *slot = ((st->cel_count << 2) | SLOT_CEL) + 1;
+    return st->cel_count++;
+}
+
+static int register_collider(struct export_state *st, const struct registered_collider *col)
+{
+    int *slot = find_slot(st, SLOT_COLLIDER, hash_bytes(2166136261u, col, sizeof(*col)), collider_equal, col);
+    if (*slot != 0) return (*slot - 1) >> 2;
+    st->colliders[st->collider_count] = *col;
+    *slot = ((st->collider_count << 2) | SLOT_COLLIDER) + 1;
+    return st->collider_count++;
+}
+
+// Image:isEmpty (every pixel is 0, or the transparent index for indexed images)
+static int image_is_empty(const struct ase_sprite *sprite, const struct ase_image *image)
+{
+    const size_t count = (size_t)image->width * image->height;
+    if (sprite->color_mode == ASE_COLOR_INDEXED) {
+        for (size_t i = 0; i < count; ++i) {
+            if (image->pixels[i] != sprite->transparent_index) return 0;
+        }
+        return 1;
+    }
+    for (size_t i = 0; i < count * ase_bytes_per_pixel(sprite); ++i) {
+        if (image->pixels[i] != 0) return 0;
+    }
+    return 1;
+}
+
+static int pixel_alpha(const struct ase_sprite *sprite, const uint8_t *px)
+{
+    switch (sprite->color_mode) {
+    case ASE_COLOR_RGB: return px[3];
+    case ASE_COLOR_GRAY: return px[1];
+    default: return (px[0] == sprite->transparent_index)? 0 : 255;
+    }
+}
+
+struct opacity_context {
+    const struct export_state *st;
+    const struct registered_image *window;
+};
+
+// Exporter.pixelOpacity
+static int pixel_opacity(void *ctx, int x, int y)
+{
+    const struct opacity_context *c = ctx;
+    const int alpha = pixel_alpha(c->st->sprite, window_row(c->st, c->window, y) + (size_t)x * ase_bytes_per_pixel(c->st->sprite));
+    return (alpha == 0)? 0 : (alpha == 255)? 2 : 1;
+}
+
+// Exporter.trimImage (w is 0 if nothing is visible)
+static struct registered_image find_visible(const struct export_state *st, int index)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    const struct ase_image *image = state_image(st, index);
+    int x0 = image->width, y0 = image->height, x1 = -1, y1 = -1;
+    for (int y = 0; y < image->height; ++y) {
+        for (int x = 0; x < image->width; ++x) {
+            if (pixel_alpha(sprite, image_pixel(sprite, image, x, y)) == 0) continue;
+            if (x < x0) x0 = x;
+            if (x > x1) x1 = x;
+            if (y < y0) y0 = y;
+            if (y > y1) y1 = y;
+        }
+    }
+    return (x1 < 0)? (struct registered_image){ index, 0, 0, 0, 0 } : (struct registered_image){ index, x0, y0, x1 - x0 + 1, y1 - y0 + 1 };
+}
+
+// Exporter.trimImage, once per image
+static const struct registered_image* trim_image(struct export_state *st, int index)
+{
+    struct registered_image *trim = &st->trims[index];
+    if (trim->w < 0) *trim = find_visible(st, index);
+    return trim;
+}
+
+static int luminance(int r, int g, int b)
+{
+    return (r * 299 + g * 587 + b * 114) / 1000;
+}
+
+// Exporter.pixelBits
+static void pixel_bits(const struct ase_sprite *sprite, const uint8_t *px, int *white, int *opaque)
+{
+    int value = 0, alpha = 255;
+    if (sprite->color_mode == ASE_COLOR_RGB) {
+        value = luminance(px[0], px[1], px[2]);
+        alpha = px[3];
+    } else if (sprite->color_mode == ASE_COLOR_GRAY) {
+        value = px[0];
+        alpha = px[1];
+    } else {
+        const uint8_t *c = sprite->palette[px[0]];
+        value = luminance(c[0], c[1], c[2]);
+        alpha = (px[0] == sprite->transparent_index)? 0 : c[3];
+    }
+    *white = value >= 128;
+    *opaque = alpha >= 128;
+}
+
+static int is_group(const struct ase_layer *layer)
+{
+    return layer->type == ASE_LAYER_GROUP;
+}
+
+// Exporter:exportCels; returns the cel (or collider) index and the user data string
+static int export_cel(struct export_state *st, int frame, int layer, int collider, uint16_t *usercb)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    const struct ase_cel *cel = ase_get_cel(sprite, frame, layer);
+    *usercb = 0;
+    if (cel->image < 0) return -1;
+    const struct ase_image *image = &sprite->images[cel->image];
+    if (image->width <= 0 || image->height <= 0 || image_is_empty(sprite, image)) return -1;
+    const struct registered_image *trim = NULL;
+    if (!collider) {
+        trim = trim_image(st, cel->image);
+        if (trim->w == 0) return -1;
+    }
+
+    if (cel->user_data != NULL && cel->user_data[0] != '\0') {
+        *usercb = ani_builder_register_string(&st->builder, cel->user_data);
+    }
+    if (collider) {
+        const struct registered_collider col = { cel->x, cel->y, image->width, image->height };
+        return register_collider(st, &col);
+    }
+    // the trimmed margins move into the cel position, so the runtime draws the same pixels
+    const struct registered_cel c = { register_image(st, trim), cel->x + trim->x, cel->y + trim->y, trim->w, trim->h };
+    return register_cel(st, &c);
+}
+
+static void export_frames(struct export_state *st, const int *flat, int flat_count)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    struct ani_builder_chunk *chunk = ani_builder_make_chunk(&st->builder, "FRAM");
+    ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)sprite->frame_count);
+
+    struct ani_builder_chunk bodies = { { 0 } };
+    size_t *ends = malloc(sizeof(size_t) * ((size_t)sprite->frame_count + 1));
+    for (int frame = 0; frame < sprite->frame_count; ++frame) {
+        // math.tointeger(frame.duration * 1000.0) where frame.duration is ms / 1000, floored like Aseprite's Lua
+        const uint16_t duration = (uint16_t)floor((double)sprite->durations[frame] / 1000.0 * 1000.0);
+        ani_builder_chunk_append(&bodies, &duration, sizeof(duration));
+        for (int i = 0; i < flat_count; ++i) {
+            const struct ase_layer *layer = &sprite->layers[flat[i]];
+            if (is_group(layer)) continue;
+            uint16_t usercb;
+            const int16_t cel = (int16_t)export_cel(st, frame, flat[i], layer->name[0] == '@', &usercb);
+            ani_builder_chunk_append(&bodies, &usercb, sizeof(usercb));
+            ani_builder_chunk_append(&bodies, &cel, sizeof(cel));
+        }
+        ends[frame] = bodies.size;
+    }
+
+    const uint32_t table_size = (uint32_t)(4 * sprite->frame_count);
+    for (int frame = 0; frame < sprite->frame_count; ++frame) {
+        ani_builder_chunk_append_offset(&st->builder, chunk, table_size + (uint32_t)((frame > 0)? ends[frame - 1] : 0));
+    }
+    if (bodies.size > 0) ani_builder_chunk_append(chunk, bodies.data, bodies.size);
+    free(bodies.data);
+    free(ends);
+}
+
+enum { VARIANT_NOT_BAKED = -1, VARIANT_EMPTY = -2 };
+
+struct composite {
+    struct ase_image image; //< 描くセルがなければ pixels が NULL
+    int x, y; //< キャンバス上の位置
+};
+
+static int64_t floor_div(int64_t a, int64_t b)
+{
+    const int64_t q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0))? q - 1 : q;
+}
+
+// Exporter:compositeFrame
+static void composite_frame(const struct export_state *st, int frame, const int *flat, int flat_count, struct composite *out)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    const int bpp = ase_bytes_per_pixel(sprite);
+    memset(out, 0, sizeof(struct composite));
+    int x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < flat_count; ++i) {
+            const struct ase_layer *layer = &sprite->layers[flat[i]];
+            if (is_group(layer) || layer->name[0] == '@') continue;
+            const struct ase_cel *cel = ase_get_cel(sprite, frame, flat[i]);
+            if (cel->image < 0) continue;
+            const struct ase_image *src = &sprite->images[cel->image];
+            if (src->width <= 0 || src->height <= 0 || image_is_empty(sprite, src)) continue;
+            if (pass == 0) {
+                if (cel->x < x0) x0 = cel->x;
+                if (cel->y < y0) y0 = cel->y;
+                if (cel->x + src->width > x1) x1 = cel->x + src->width;
+                if (cel->y + src->height > y1) y1 = cel->y + src->height;
+                continue;
+            }
+            for (int y = 0; y < src->height; ++y) {
+                for (int x = 0; x < src->width; ++x) {
+                    const uint8_t *px = image_pixel(sprite, src, x, y);
+                    int white, opaque;
+                    pixel_bits(sprite, px, &white, &opaque);
+                    if (opaque) memcpy((uint8_t*)image_pixel(sprite, &out->image, cel->x - x0 + x, cel->y - y0 + y), px, (size_t)bpp);
+                }
+            }
+        }
+        if (pass == 0) {
+            if (x1 < x0) return;
+            out->x = x0;
+            out->y = y0;
+            out->image.width = x1 - x0;
+            out->image.height = y1 - y0;
+            const size_t size = (size_t)out->image.width * out->image.height * bpp;
+            out->image.pixels = malloc(size);
+            memset(out->image.pixels, (sprite->color_mode == ASE_COLOR_INDEXED)? sprite->transparent_index : 0, size);
+        }
+    }
+}
+
+// Exporter:bakeVariant
+static int bake_variant(struct export_state *st, const struct composite *composite, int angle, int angles, int scale)
+{
+    if (composite->image.pixels == NULL) return VARIANT_EMPTY;
+    const struct ase_sprite *sprite = st->sprite;
+    const int bpp = ase_bytes_per_pixel(sprite);
+    const int64_t W = sprite->width, H = sprite->height;
+    const double theta = 2.0 * M_PI * angle / angles;
+    const int64_t c = (int64_t)floor(cos(theta) * 65536 + 0.5);
+    const int64_t s = (int64_t)floor(sin(theta) * 65536 + 0.5);
+    const int64_t one = 65536 * 256;
+    const struct ase_image *src = &composite->image;
+
+    // destination box from the turned corners (positions are doubled and relative to the canvas center)
+    int64_t min_x = INT64_MAX, min_y = INT64_MAX, max_x = INT64_MIN, max_y = INT64_MIN;
+    for (int i = 0; i < 4; ++i) {
+        const int64_t ux = 2 * (composite->x + ((i & 1)? src->width : 0)) - W;
+        const int64_t uy = 2 * (composite->y + ((i & 2)? src->height : 0)) - H;
+        const int64_t fx = floor_div((c * ux - s * uy) * scale, one);
+        const int64_t fy = floor_div((s * ux + c * uy) * scale, one);
+        if (fx < min_x) min_x = fx;
+        if (fx > max_x) max_x = fx;
+        if (fy < min_y) min_y = fy;
+        if (fy > max_y) max_y = fy;
+    }
+    const int64_t bx = floor_div(min_x + W, 2) - 1, by = floor_div(min_y + H, 2) - 1;
+    const int bw = (int)(floor_div(max_x + W, 2) + 2 - bx), bh = (int)(floor_div(max_y + H, 2) + 2 - by);
+
+    struct ase_image *img = &st->baked[st->baked_count];
+    img->width = bw;
+    img->height = bh;
+    img->pixels = malloc((size_t)bw * bh * bpp);
+    memset(img->pixels, (sprite->color_mode == ASE_COLOR_INDEXED)? sprite->transparent_index : 0, (size_t)bw * bh * bpp);
+    const int64_t den = (int64_t)scale * 65536;
+    for (int y = 0; y < bh; ++y) {
+        const int64_t vy = 2 * (by + y) + 1 - H;
+        for (int x = 0; x < bw; ++x) {
+            const int64_t vx = 2 * (bx + x) + 1 - W;
+            const int64_t sx = floor_div((c * vx + s * vy) * 256 + W * den, 2 * den) - composite->x;
+            const int64_t sy = floor_div((c * vy - s * vx) * 256 + H * den, 2 * den) - composite->y;
+            if (sx >= 0 && sy >= 0 && sx < src->width && sy < src->height) {
+                memcpy((uint8_t*)image_pixel(sprite, img, x, y), image_pixel(sprite, src, (int)sx, (int)sy), (size_t)bpp);
+            }
+        }
+    }
+
+    const struct registered_image trim = find_visible(st, sprite->image_count + st->baked_count++);
+    if (trim.w == 0) return VARIANT_EMPTY;
+    const struct registered_cel cel = { register_image(st, &trim), (int)bx + trim.x, (int)by + trim.y, trim.w, trim.h };
+    return register_cel(st, &cel);
+}
+
+// Exporter:exportVariants (VARS: scale levels, then a cel per frame for each variant after the first)
+static void export_variants(struct export_state *st, const struct ani_export_options *options, const int *scales, int scale_count, const int *flat, int flat_count)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    const int angles = (options->rotations > 1)? options->rotations : 1;
+    if (angles * scale_count == 1) return;
+
+    uint8_t *baked = calloc((size_t)sprite->frame_count + 1, 1);
+    for (int frame = 0; frame < sprite->frame_count; ++frame) {
+        baked[frame] = options->bake_tag_count == 0;
+    }
+    for (int i = 0; i < sprite->tag_count; ++i) {
+        for (int j = 0; j < options->bake_tag_count; ++j) {
+            if (strcmp(sprite->tags[i].name, options->bake_tags[j]) != 0) continue;
+            for (int frame = sprite->tags[i].from; frame <= sprite->tags[i].to; ++frame) baked[frame] = 1;
+            break;
+        }
+    }
+
+    struct ani_builder_chunk *chunk = ani_builder_make_chunk(&st->builder, "VARS");
+    ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)angles);
+    ani_builder_chunk_set_misc_u16(chunk, 1, (uint16_t)scale_count);
+    for (int i = 0; i < scale_count; ++i) {
+        const uint16_t scale = (uint16_t)scales[i];
+        ani_builder_chunk_append(chunk, &scale, sizeof(scale));
+    }
+    struct composite *composites = calloc((size_t)sprite->frame_count + 1, sizeof(struct composite));
+    for (int frame = 0; frame < sprite->frame_count; ++frame) {
+        if (baked[frame]) composite_frame(st, frame, flat, flat_count, &composites[frame]);
+    }
+    for (int v = 1; v < angles * scale_count; ++v) {
+        for (int frame = 0; frame < sprite->frame_count; ++frame) {
+            const int16_t cel = (int16_t)((baked[frame])? bake_variant(st, &composites[frame], v % angles, angles, scales[v / angles]) : VARIANT_NOT_BAKED);
+            ani_builder_chunk_append(chunk, &cel, sizeof(cel));
+        }
+    }
+    for (int frame = 0; frame < sprite->frame_count; ++frame) {
+        free(composites[frame].image.pixels);
+    }
+    free(composites);
+    free(baked);
+}
+
+// Exporter:exportAtlas (1bit texel rows then mask rows, 32bit aligned)
+static void export_atlas(struct export_state *st, const uint8_t *pixels, int width, int height)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    const int bpp = ase_bytes_per_pixel(sprite);
+    const int rowbytes = ((width + 31) / 32) * 4;
+    uint8_t *bits = calloc((size_t)rowbytes * height * 2 + 1, 1);
+    uint8_t *mask = bits + (size_t)rowbytes * height;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int white, opaque;
+            pixel_bits(sprite, pixels + ((size_t)y * width + x) * bpp, &white, &opaque);
+            if (white) bits[rowbytes * y + (x >> 3)] |= (uint8_t)(0x80 >> (x & 7));
+            if (opaque) mask[rowbytes * y + (x >> 3)] |= (uint8_t)(0x80 >> (x & 7));
+        }
+    }
+    struct ani_builder_chunk *chunk = ani_builder_make_chunk(&st->builder, "ATLS");
+    ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)width);
+    ani_builder_chunk_set_misc_u16(chunk, 1, (uint16_t)height);
+    ani_builder_chunk_set_misc_u16(chunk, 2, (uint16_t)rowbytes);
+    if (height > 0) ani_builder_chunk_append(chunk, bits, (size_t)rowbytes * height * 2);
+    free(bits);
+}
+
+// the atlas as RGBA (or gray + alpha) rows for the .png
+static uint8_t* atlas_to_png_pixels(const struct ase_sprite *sprite, const uint8_t *pixels, int width, int height, int *channels)
+{
+    const size_t count = (size_t)width * height;
+    *channels = (sprite->color_mode == ASE_COLOR_GRAY)? 2 : 4;
+    uint8_t *out = malloc(count * *channels + 1);
+    for (size_t i = 0; i < count; ++i) {
+        if (sprite->color_mode == ASE_COLOR_INDEXED) {
+            memcpy(out + i * 4, sprite->palette[pixels[i]], 4);
+            if (pixels[i] == sprite->transparent_index) out[i * 4 + 3] = 0;
+        } else {
+            memcpy(out + i * *channels, pixels + i * *channels, (size_t)*channels);
+        }
+    }
+    return out;
+}
+
+static void export_images(struct export_state *st, const struct ani_export_options *options, struct ani_export_result *result)
+{
+    const struct ase_sprite *sprite = st->sprite;
+    const int bpp = ase_bytes_per_pixel(sprite);
+    struct packer_rect *rects = malloc(sizeof(struct packer_rect) * ((size_t)st->image_count + 1));
+    for (int i = 0; i < st->image_count; ++i) {
+        const struct registered_image *img = &st->images[i];
+        rects[i] = (struct packer_rect){ 0, 0, (img->w + 7) / 8 * 8, img->h, img->w, i };
+    }
+    int width = 0, height = 0;
+    packer_pack(rects, st->image_count, 0, options->atlas_width, &width, &height);
+
+    // Image(width, height, colorMode) cleared, then every image drawn at its place
+    uint8_t *pixels = malloc((size_t)width * height * bpp + 1);
+    memset(pixels, (sprite->color_mode == ASE_COLOR_INDEXED)? sprite->transparent_index : 0, (size_t)width * height * bpp);
+    int *placed = malloc(sizeof(int) * ((size_t)st->image_count + 1));
+    for (int i = 0; i < st->image_count; ++i) {
+        const struct packer_rect *rc = &rects[i];
+        const struct registered_image *img = &st->images[rc->object];
+        placed[rc->object] = i;
+        for (int y = 0; y < img->h; ++y) {
+            memcpy(pixels + ((size_t)(rc->y + y) * width + rc->x) * bpp, window_row(st, img, y), (size_t)img->w * bpp);
+        }
+    }
+    if (options->compress) {
+        export_atlas(st, pixels, width, height);
+    } else {
+        result->atlas = atlas_to_png_pixels(sprite, pixels, width, height, &result->atlas_channels);
+    }
+    result->atlas_width = width;
+    result->atlas_height = height;
+    free(pixels);
+
+    struct ani_builder_chunk *chunk = ani_builder_make_chunk(&st->builder, "IMAG");
+    ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)st->image_count);
+    for (int i = 0; i < st->image_count; ++i) {
+        const struct packer_rect *rc = &rects[placed[i]];
+        const int16_t data[4] = { (int16_t)rc->x, (int16_t)rc->y, (int16_t)rc->original_width, (int16_t)rc->h };
+        ani_builder_chunk_append(chunk, data, sizeof(data));
+    }
+    free(placed);
+    free(rects);
+}
+
+// only images whose opaque spans cover nearly all of them get spans; without any, no SPAN chunk is written
+static void export_spans(struct export_state *st)
+{
+    struct ani_builder_chunk spans = { { 0 } };
+    uint32_t *starts = calloc((size_t)st->image_count + 1, sizeof(uint32_t));
+    for (int i = 0; i < st->image_count; ++i) {
+        struct opacity_context ctx = { st, &st->images[i] };
+        starts[i + 1] = starts[i] + (uint32_t)ani_builder_append_opaque_spans(&spans, ctx.window->w, ctx.window->h, pixel_opacity, &ctx);
+    }
+    if (starts[st->image_count] > 0) {
+        struct ani_builder_chunk *chunk = ani_builder_make_chunk(&st->builder, "SPAN");
+        ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)st->image_count);
+        for (int i = 0; i <= st->image_count; ++i) {
+            ani_builder_chunk_append_offset(&st->builder, chunk, starts[i]);
+        }
+        ani_builder_chunk_append(chunk, spans.data, spans.size);
+    }
+    free(starts);
+    free(spans.data);
+}
+
+int ani_export(const struct ase_sprite *sprite, const struct ani_export_options *options, struct ani_export_result *result)
+{
+    memset(result, 0, sizeof(struct ani_export_result));
+    struct export_state st = { 0 };
+    st.sprite = sprite;
+    ani_builder_initialize(&st.builder, 2);
+    st.builder.compressed = options->compress;
+
+    // scale levels x256; 1.0 comes first
+    int *scales = malloc(sizeof(int) * ((size_t)options->scale_count + 1));
+    int scale_count = 0;
+    scales[scale_count++] = 256;
+    for (int i = 0; i < options->scale_count; ++i) {
+        const int scale = (int)floor(options->scales[i] * 256 + 0.5);
+        if (scale > 0 && scale != 256) scales[scale_count++] = scale;
+    }
+    const int variants = ((options->rotations > 1)? options->rotations : 1) * scale_count;
+    const int max_baked = sprite->frame_count * (variants - 1);
+
+    const int max_entries = sprite->frame_count * sprite->layer_count + max_baked + 1;
+    st.images = malloc(sizeof(struct registered_image) * max_entries);
+    st.trims = malloc(sizeof(struct registered_image) * ((size_t)sprite->image_count + 1));
+    for (int i = 0; i < sprite->image_count; ++i) st.trims[i].w = -1;
+    st.cels = malloc(sizeof(struct registered_cel) * max_entries);
+    st.colliders = malloc(sizeof(struct registered_collider) * max_entries);
+    st.baked = malloc(sizeof(struct ase_image) * ((size_t)max_baked + 1));
+    int capacity = 64;
+    while (capacity < max_entries * 3 * 2) capacity *= 2;
+    st.slots = calloc((size_t)capacity, sizeof(int));
+    st.mask = capacity - 1;
+
+    // Exporter.flattenLayers: file order is already parent first, bottom to top; '#' hides a subtree
+    int *flat = malloc(sizeof(int) * ((size_t)sprite->layer_count + 1));
+    int *flat_index = malloc(sizeof(int) * ((size_t)sprite->layer_count + 1));
+    int flat_count = 0;
+    for (int i = 0; i < sprite->layer_count; ++i) {
+        const struct ase_layer *layer = &sprite->layers[i];
+        const int hidden = layer->name[0] == '#' || (layer->parent >= 0 && flat_index[layer->parent] < 0);
+        flat_index[i] = (hidden)? -1 : flat_count;
+        if (!hidden) flat[flat_count++] = i;
+    }
+
+    struct ani_builder_chunk *info = ani_builder_make_chunk(&st.builder, "INFO");
+    ani_builder_chunk_set_misc_u16(info, 0, (uint16_t)sprite->width);
+    ani_builder_chunk_set_misc_u16(info, 1, (uint16_t)sprite->height);
+    ani_builder_chunk_set_misc_u16(info, 2, (uint16_t)sprite->frame_count);
+
+    struct ani_builder_chunk *tags = ani_builder_make_chunk(&st.builder, "TAGS");
+    ani_builder_chunk_set_misc_u16(tags, 0, (uint16_t)sprite->tag_count);
+    for (int i = 0; i < sprite->tag_count; ++i) {
+        const uint16_t tag[3] = {
+            (uint16_t)(sprite->tags[i].from + 1),
+            (uint16_t)(sprite->tags[i].to + 1),
+            ani_builder_register_string(&st.builder, sprite->tags[i].name),
+        };
+        ani_builder_chunk_append(tags, tag, sizeof(tag));
+    }
+
+    struct ani_builder_chunk *lays = ani_builder_make_chunk(&st.builder, "LAYS");
+    ani_builder_chunk_set_misc_u16(lays, 0, (uint16_t)flat_count);
+    for (int i = 0; i < flat_count; ++i) {
+        const struct ase_layer *layer = &sprite->layers[flat[i]];
+        const char type = is_group(layer)? 'G' : (layer->name[0] == '@')? 'C' : 'L';
+        const int8_t parent = (int8_t)((layer->parent >= 0)? flat_index[layer->parent] : -1);
+        const uint16_t name = ani_builder_register_string(&st.builder, layer->name);
+        const uint16_t count = (uint16_t)(is_group(layer)? layer->child_count : 0);
+        ani_builder_chunk_append(lays, &type, 1);
+        ani_builder_chunk_append(lays, &parent, 1);
+        ani_builder_chunk_append(lays, &name, 2);
+        ani_builder_chunk_append(lays, &count, 2);
+    }
+
+    export_frames(&st, flat, flat_count);
+    export_variants(&st, options, scales, scale_count, flat, flat_count);
+
+    struct ani_builder_chunk *cels = ani_builder_make_chunk(&st.builder, "CELS");
+    for (int i = 0; i < st.cel_count; ++i) {
+        const int16_t cel[3] = { (int16_t)st.cels[i].image, (int16_t)st.cels[i].x, (int16_t)st.cels[i].y };
+        ani_builder_chunk_append(cels, cel, sizeof(cel));
+    }
+    ani_builder_chunk_set_misc_u16(cels, 0, (uint16_t)st.cel_count);
+
+    struct ani_builder_chunk *cols = ani_builder_make_chunk(&st.builder, "COLS");
+    for (int i = 0; i < st.collider_count; ++i) {
+        const int16_t col[4] = { (int16_t)st.colliders[i].x, (int16_t)st.colliders[i].y, (int16_t)st.colliders[i].w, (int16_t)st.colliders[i].h };
+        ani_builder_chunk_append(cols, col, sizeof(col));
+    }
+    ani_builder_chunk_set_misc_u16(cols, 0, (uint16_t)st.collider_count);
+
+    export_images(&st, options, result);
+    if (options->spans) export_spans(&st);
+
+    result->ani = ani_builder_build(&st.builder, &result->ani_size);
+    ani_builder_finalize(&st.builder);
+    free(flat);
+    free(flat_index);
+    free(st.images);
+    free(st.trims);
+    free(st.cels);
+    free(st.colliders);
+    for (int i = 0; i < st.baked_count; ++i) free(st.baked[i].pixels);
+    free(st.baked);
+    free(scales);
+    free(st.slots);
+    return 0;
+}
+
+void ani_export_free(struct ani_export_result *result)
+{
+    free(result->ani);
+    free(result->atlas);
+    memset(result, 0, sizeof(struct ani_export_result));
+}
@@ -0,0 +1,43 @@
+#ifndef __EXPORTER_H__
+#define __EXPORTER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "aseprite.h"
+
+// .ani writer for the converter; produces the same bytes as Exporter:export in
+// aseprite_extension/src/lib/exporter.lua.
+
+struct ani_export_options {
+    bool spans; //< ほぼ不透明な画像に SPAN を書く（Exporter の options.spans、既定はオフ）
+    bool compress; //< 圧縮してアトラスを ATLS チャンクに入れる（options.compress）
+    int atlas_width; //< PACKER_WIDTH_AUTO、PACKER_WIDTH_POT か幅（options.atlasWidth）
+    int rotations; //< 焼き込む向きの数（1 以下なら回さない。options.rotations）
+    const double *scales; //< 焼き込む拡大率（options.scales）
+    int scale_count;
+    const char *const *bake_tags; //< 焼き込むタグ（0 個なら全フレーム。options.bakeTags）
+    int bake_tag_count;
+};
+
+struct ani_export_result {
+    void *ani;
+    size_t ani_size;
+    int atlas_width, atlas_height;
+    int atlas_channels; //< 4: RGBA, 2: グレー + アルファ
+    uint8_t *atlas; //< .png に書くアトラス（compress なら NULL）
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int ani_export(const struct ase_sprite *sprite, const struct ani_export_options *options, struct ani_export_result *result);
+void ani_export_free(struct ani_export_result *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __EXPORTER_H__
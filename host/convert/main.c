@@ -0,0 +1,243 @@
+#include "aseprite.h"
+#include "exporter.h"
+#include "packer.h"
+#include <ctype.h>
+#include <png.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// pdani_convert: .aseprite -> .ani (+ .png atlas) without Aseprite.
+// Writes the same files as "Export .ani File" in the extension; files are converted in parallel.
+
+struct convert_job {
+    const char *input;
+    char error[256];
+    int result;
+};
+
+struct convert_queue {
+    struct convert_job *jobs;
+    int count;
+    int next;
+    pthread_mutex_t lock;
+    const char *output_dir; //< NULL なら入力と同じ場所
+    const char *output_file; //< 入力が1つのときだけ
+    struct ani_export_options options;
+};
+
+static const char* base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return (slash != NULL)? slash + 1 : path;
+}
+
+// dir/name where name keeps up to the last '.' (app.fs.fileTitle) or the first '.' (the png prefix of Exporter:export)
+static void make_path(char *out, size_t size, const char *dir, const char *name, int first_dot, const char *ext)
+{
+    const char *dot = first_dot? strchr(name, '.') : strrchr(name, '.');
+    const int len = (dot != NULL && dot != name)? (int)(dot - name) : (int)strlen(name);
+    if (dir != NULL && dir[0] != '\0') {
+        snprintf(out, size, "%s/%.*s%s", dir, len, name, ext);
+    } else {
+        snprintf(out, size, "%.*s%s", len, name, ext);
+    }
+}
+
+static void dir_name(char *out, size_t size, const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        snprintf(out, size, ".");
+    } else {
+        snprintf(out, size, "%.*s", (int)(slash - path), path);
+    }
+}
+
+static int write_file(const char *path, const void *data, size_t size)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL) return -1;
+    const size_t written = fwrite(data, 1, size, fp);
+    return (fclose(fp) == 0 && written == size)? 0 : -1;
+}
+
+static int write_png(const char *path, const struct ani_export_result *result)
+{
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    image.width = (png_uint_32)result->atlas_width;
+    image.height = (png_uint_32)result->atlas_height;
+    image.format = (result->atlas_channels == 2)? PNG_FORMAT_GA : PNG_FORMAT_RGBA;
+    const uint8_t transparent[4] = { 0 };
+    const void *pixels = result->atlas;
+    if (image.width == 0 || image.height == 0) {
+        // no visible cels: PNG has no empty images, so the runtime gets a 1x1 transparent atlas
+        image.width = image.height = 1;
+        pixels = transparent;
+    }
+    if (!png_image_write_to_file(&image, path, 0, pixels, 0, NULL)) return -1;
+    return 0;
+}
+
+static void convert(struct convert_queue *queue, struct convert_job *job)
+{
+    struct ase_sprite sprite;
+    if (ase_load(&sprite, job->input, job->error, sizeof(job->error)) != 0) {
+        job->result = -1;
+        return;
+    }
+
+    char dir[1024];
+    char ani_path[1200], png_path[1200];
+    if (queue->output_file != NULL) {
+        snprintf(ani_path, sizeof(ani_path), "%s", queue->output_file);
+    } else {
+        if (queue->output_dir != NULL) snprintf(dir, sizeof(dir), "%s", queue->output_dir);
+        else dir_name(dir, sizeof(dir), job->input);
+        make_path(ani_path, sizeof(ani_path), dir, base_name(job->input), 0, ".ani");
+    }
+    dir_name(dir, sizeof(dir), ani_path);
+    make_path(png_path, sizeof(png_path), dir, base_name(ani_path), 1, ".png");
+
+    struct ani_export_result result;
+    job->result = ani_export(&sprite, &queue->options, &result);
+    ase_free(&sprite);
+    if (job->result != 0) {
+        snprintf(job->error, sizeof(job->error), "export failed");
+        return;
+    }
+    if (write_file(ani_path, result.ani, result.ani_size) != 0) {
+        snprintf(job->error, sizeof(job->error), "cannot write %.200s", ani_path);
+        job->result = -1;
+    } else if (result.atlas != NULL && write_png(png_path, &result) != 0) {
+        snprintf(job->error, sizeof(job->error), "cannot write %.200s", png_path);
+        job->result = -1;
+    }
+    ani_export_free(&result);
+}
+
+// "a, b" -> "a", "b" in place (SplitList in main.lua); returns the count
+static int split_list(char *text, char **items, int capacity)
+{
+    int count = 0;
+    for (char *item = strtok(text, ","); item != NULL && count < capacity; item = strtok(NULL, ",")) {
+        while (isspace((unsigned char)*item)) ++item;
+        char *end = item + strlen(item);
+        while (end > item && isspace((unsigned char)end[-1])) *--end = '\0';
+        if (*item != '\0') items[count++] = item;
+    }
+    return count;
+}
+
+static void* worker(void *arg)
+{
+    struct convert_queue *queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        const int index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->count) break;
+        convert(queue, &queue->jobs[index]);
+    }
+    return NULL;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: pdani_convert [options] file.aseprite...\n"
+        "  -j N             worker threads (default: number of CPUs)\n"
+        "  -o DIR           output directory (default: next to each input)\n"
+        "  --output FILE    output .ani path (single input only)\n"
+        "  --spans          write the SPAN chunk for images that are nearly all opaque\n"
+        "  --compress       compress the .ani and embed the atlas (no .png)\n"
+        "  --atlas-width W  auto (default), pot (power of two sizes) or a width in pixels\n"
+        "  --rotations N    bake N evenly spaced headings into the atlas\n"
+        "  --scales S,...   bake these scale levels into the atlas (e.g. 0.5,0.75)\n"
+        "  --bake-tags T,.. bake only the frames of these tags (default: all frames)\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct convert_queue queue = { 0 };
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    queue.jobs = calloc((size_t)argc, sizeof(struct convert_job));
+    char *scale_items[64];
+    double scales[64];
+    char *bake_tags[64];
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            queue.output_dir = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            queue.output_file = argv[++i];
+        } else if (strcmp(argv[i], "--spans") == 0) {
+            queue.options.spans = true;
+        } else if (strcmp(argv[i], "--no-spans") == 0) {
+            queue.options.spans = false;
+        } else if (strcmp(argv[i], "--compress") == 0) {
+            queue.options.compress = true;
+        } else if (strcmp(argv[i], "--atlas-width") == 0 && i + 1 < argc) {
+            const char *policy = argv[++i];
+            queue.options.atlas_width = (strcmp(policy, "pot") == 0)? PACKER_WIDTH_POT
+                : (strcmp(policy, "auto") == 0)? PACKER_WIDTH_AUTO : atoi(policy);
+            if (queue.options.atlas_width < PACKER_WIDTH_POT) {
+                usage();
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--rotations") == 0 && i + 1 < argc) {
+            queue.options.rotations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scales") == 0 && i + 1 < argc) {
+            // entries that are not numbers are dropped, like tonumber in main.lua
+            const int count = split_list(argv[++i], scale_items, 64);
+            queue.options.scale_count = 0;
+            for (int j = 0; j < count; ++j) {
+                char *end;
+                const double scale = strtod(scale_items[j], &end);
+                if (*end == '\0') scales[queue.options.scale_count++] = scale;
+            }
+            queue.options.scales = scales;
+        } else if (strcmp(argv[i], "--bake-tags") == 0 && i + 1 < argc) {
+            queue.options.bake_tag_count = split_list(argv[++i], bake_tags, 64);
+            queue.options.bake_tags = (const char *const *)bake_tags;
+        } else if (argv[i][0] == '-') {
+            usage();
+            return 2;
+        } else {
+            queue.jobs[queue.count++].input = argv[i];
+        }
+    }
+    if (queue.count == 0 || (queue.output_file != NULL && queue.count != 1)) {
+        usage();
+        return 2;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > queue.count) threads = queue.count;
+
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_t *workers = calloc((size_t)threads, sizeof(pthread_t));
+    for (long i = 0; i < threads; ++i) {
+        pthread_create(&workers[i], NULL, worker, &queue);
+    }
+    for (long i = 0; i < threads; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    free(workers);
+
+    int failed = 0;
+    for (int i = 0; i < queue.count; ++i) {
+        if (queue.jobs[i].result != 0) {
+            fprintf(stderr, "%s: %s\n", queue.jobs[i].input, queue.jobs[i].error);
+            ++failed;
+        }
+    }
+    free(queue.jobs);
+    return (failed > 0)? 1 : 0;
+}
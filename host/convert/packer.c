@@ -0,0 +1,195 @@
+#include "packer.h"
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Packer.MaxRects: free rectangles of one bin, kept in the same order as the Lua table so ties
+// between equally good free rects resolve the same way.
+struct packer_free {
+    int x, y, w, h;
+};
+
+struct packer_bin {
+    struct packer_free *free;
+    int count;
+    struct packer_free *scratch;
+    int capacity;
+};
+
+static int max_int(int a, int b)
+{
+    return (a > b)? a : b;
+}
+
+static int min_int(int a, int b)
+{
+    return (a < b)? a : b;
+}
+
+static int free_contains(const struct packer_free *a, const struct packer_free *b)
+{
+    return b->x >= a->x && b->y >= a->y && b->x + b->w <= a->x + a->w && b->y + b->h <= a->y + a->h;
+}
+
+static void bin_reserve(struct packer_bin *bin, int count)
+{
+    if (count <= bin->capacity) return;
+    while (bin->capacity < count) bin->capacity = (bin->capacity > 0)? bin->capacity * 2 : 64;
+    bin->free = realloc(bin->free, sizeof(struct packer_free) * bin->capacity);
+    bin->scratch = realloc(bin->scratch, sizeof(struct packer_free) * bin->capacity);
+}
+
+static const struct packer_free* bin_find(const struct packer_bin *bin, int w, int h)
+{
+    const struct packer_free *best = NULL;
+    int best_short = INT_MAX, best_long = INT_MAX;
+    for (int i = 0; i < bin->count; ++i) {
+        const struct packer_free *fr = &bin->free[i];
+        if (w > fr->w || h > fr->h) continue;
+        const int dw = fr->w - w, dh = fr->h - h;
+        const int s = min_int(dw, dh), l = max_int(dw, dh);
+        if (s < best_short || (s == best_short && l < best_long)) {
+            best = fr;
+            best_short = s;
+            best_long = l;
+        }
+    }
+    return best;
+}
+
+static void bin_place(struct packer_bin *bin, int x, int y, int w, int h)
+{
+    // each split free rect becomes at most 4
+    bin_reserve(bin, bin->count * 4 + 1);
+    struct packer_free *out = bin->scratch;
+    int n = 0;
+    for (int i = 0; i < bin->count; ++i) {
+        const struct packer_free fr = bin->free[i];
+        if (!(x < fr.x + fr.w && x + w > fr.x && y < fr.y + fr.h && y + h > fr.y)) {
+            out[n++] = fr;
+            continue;
+        }
+        if (y > fr.y) out[n++] = (struct packer_free){ fr.x, fr.y, fr.w, y - fr.y };
+        if (y + h < fr.y + fr.h) out[n++] = (struct packer_free){ fr.x, y + h, fr.w, fr.y + fr.h - (y + h) };
+        if (x > fr.x) out[n++] = (struct packer_free){ fr.x, fr.y, x - fr.x, fr.h };
+        if (x + w < fr.x + fr.w) out[n++] = (struct packer_free){ x + w, fr.y, fr.x + fr.w - (x + w), fr.h };
+    }
+
+    bin->count = 0;
+    for (int i = 0; i < n; ++i) {
+        int redundant = 0;
+        for (int j = 0; j < n && !redundant; ++j) {
+            // of two equal rects the first one stays
+            redundant = i != j && free_contains(&out[j], &out[i]) && (j < i || !free_contains(&out[i], &out[j]));
+        }
+        if (!redundant) bin->free[bin->count++] = out[i];
+    }
+}
+
+// Packer:insertImagesToBin; returns the used height or -1
+static int insert_rects(struct packer_bin *bin, struct packer_rect *rects, int count, int margin, int width, int height)
+{
+    bin->count = 0;
+    bin_reserve(bin, 1);
+    bin->free[bin->count++] = (struct packer_free){ 0, 0, width, height };
+    int used = 0;
+    for (int i = 0; i < count; ++i) {
+        struct packer_rect *rc = &rects[i];
+        const struct packer_free *fr = bin_find(bin, rc->w + margin, rc->h + margin);
+        if (fr == NULL) return -1;
+        rc->x = fr->x;
+        rc->y = fr->y;
+        bin_place(bin, rc->x, rc->y, rc->w + margin, rc->h + margin);
+        used = max_int(used, rc->y + rc->h);
+    }
+    return used;
+}
+
+// Packer:packWidth
+static int pack_width(struct packer_bin *bin, struct packer_rect *rects, int count, int margin, int width, long long total)
+{
+    int height = (int)((total + width - 1) / width);
+    for (int i = 0; i < count; ++i) height = max_int(height, rects[i].h + margin);
+    for (;;) {
+        const int used = insert_rects(bin, rects, count, margin, width, height);
+        if (used >= 0) return used;
+        height += max_int(8, height / 8);
+    }
+}
+
+// Packer.larger
+static int larger_first(const void *pa, const void *pb)
+{
+    const struct packer_rect *a = pa, *b = pb;
+    const int am = max_int(a->w, a->h), bm = max_int(b->w, b->h);
+    if (am != bm) return (am > bm)? -1 : 1;
+    if (a->h != b->h) return (a->h > b->h)? -1 : 1;
+    if (a->w != b->w) return (a->w > b->w)? -1 : 1;
+    return (a->object < b->object)? -1 : (a->object > b->object);
+}
+
+static int align8(int x)
+{
+    return (x + 7) / 8 * 8;
+}
+
+static int next_power_of_two(int x)
+{
+    int n = 8;
+    while (n < x) n *= 2;
+    return n;
+}
+
+void packer_pack(struct packer_rect *rects, int count, int margin, int width_policy, int *width, int *height)
+{
+    *width = *height = 0;
+    if (count == 0) return;
+    qsort(rects, (size_t)count, sizeof(struct packer_rect), larger_first);
+
+    long long total = 0;
+    int max_width = 0;
+    for (int i = 0; i < count; ++i) {
+        total += (long long)(rects[i].w + margin) * (rects[i].h + margin);
+        max_width = max_int(max_width, rects[i].w + margin);
+    }
+
+    int candidates[4];
+    int candidate_count = 0;
+    if (width_policy > 0) {
+        candidates[candidate_count++] = width_policy;
+    } else {
+        const int side = (int)floor(sqrt((double)total));
+        candidates[candidate_count++] = side;
+        candidates[candidate_count++] = side * 5 / 4;
+        candidates[candidate_count++] = side * 3 / 2;
+        candidates[candidate_count++] = side * 2;
+    }
+
+    struct packer_bin bin = { 0 };
+    int best_width = 0, best_height = 0;
+    for (int i = 0; i < candidate_count; ++i) {
+        int w = align8(max_int(candidates[i], max_width));
+        if (width_policy == PACKER_WIDTH_POT) w = next_power_of_two(w);
+        int tried = 0;
+        for (int j = 0; j < i; ++j) {
+            int prev = align8(max_int(candidates[j], max_width));
+            if (width_policy == PACKER_WIDTH_POT) prev = next_power_of_two(prev);
+            tried |= prev == w;
+        }
+        if (tried) continue;
+        int h = pack_width(&bin, rects, count, margin, w, total);
+        if (width_policy == PACKER_WIDTH_POT) h = next_power_of_two(h);
+        if (best_width == 0 || (long long)w * h < (long long)best_width * best_height) {
+            best_width = w;
+            best_height = h;
+        }
+    }
+
+    // place the rects again at the chosen width
+    pack_width(&bin, rects, count, margin, best_width, total);
+    free(bin.free);
+    free(bin.scratch);
+    *width = best_width;
+    *height = best_height;
+}
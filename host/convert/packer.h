@@ -0,0 +1,32 @@
+#ifndef __PACKER_H__
+#define __PACKER_H__
+
+// Atlas packer; mirrors Packer in aseprite_extension/src/lib/packer.lua.
+
+// atlas width policy (Packer options.width)
+enum {
+    PACKER_WIDTH_AUTO = 0, //< 正方形付近のいくつかの幅で詰めて一番小さいもの
+    PACKER_WIDTH_POT = -1, //< 2 の累乗の幅と高さ
+    // 正の値はその幅（8 に揃える）
+};
+
+struct packer_rect {
+    int x, y;
+    int w, h; //< 配置する大きさ（幅は 8 に揃えたもの）
+    int original_width;
+    int object; //< 呼び出し側の番号（同じ大きさのものはこの順に並ぶ）
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// @fn Packer:pack と同じ順に並べ替えて MaxRects（best short side fit）で配置し、アトラスの大きさを返す
+void packer_pack(struct packer_rect *rects, int count, int margin, int width_policy, int *width, int *height);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PACKER_H__
@@ -0,0 +1,493 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pd_stub.h"
+#include "pdani.h"
+#include "ani_builder.h"
+
+// Fuzz harness for the .ani parser. Every input goes through pdani_file_validate; whatever it accepts is loaded
+// with pdani_file_initialize_validated and driven through the draw, update and collision paths, which then run
+// without data checks. Built with ASan/UBSan, a gap in the validator shows up as a sanitizer report.
+//
+// Standalone it mutates built-in v1/v2 seeds (plus any --ani files, with the .png next to them embedded as ATLS).
+// With -DPDANI_FUZZ_LIBFUZZER and -fsanitize=fuzzer the same target runs under libFuzzer
+// (pdani_fuzz --write-seeds <dir> gives it a starting corpus).
+
+static PlaydateAPI *api = NULL;
+static uint32_t random_state = 0x2545f491;
+
+static uint32_t random_next(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static void on_frame_event(const struct pdani_file *file, int framenum, const char *name, void *ptr)
+{
+    *(size_t*)ptr += strlen(name);
+}
+
+static void on_collider(const struct pdani_file *file, const char *name, int x, int y, int w, int h, void *ptr)
+{
+    *(size_t*)ptr += strlen(name) + (size_t)(w + h);
+}
+
+// every path that reads a validated file without checks
+static size_t exercise(struct pdani_file *file)
+{
+    size_t sum = 0;
+    const int frames = pdani_file_get_frame_count(file);
+    const int frame_limit = (frames < 32)? frames : 32;
+    const int variants = pdani_file_get_rotation_count(file) * pdani_file_get_scale_count(file);
+    LCDBitmap *target = api->graphics->newBitmap(72, 40, kColorClear);
+
+    for (int i = 0; i < pdani_file_get_tag_count(file); ++i) {
+        sum += strlen(pdani_file_get_tag_name(file, i));
+    }
+    for (int i = 0; i < pdani_file_get_layer_count(file); ++i) {
+        sum += (size_t)pdani_file_get_layer_name_id(file, i);
+    }
+    for (int f = 1; f <= frame_limit; ++f) {
+        for (int flip = 0; flip < 4; ++flip) {
+            LCDRect rect;
+            pdani_file_get_frame_bounds(file, f, flip & 1, flip & 2, &rect);
+            pdani_file_draw(file, NULL, 100 - f * 7, 60, f, flip & 1, flip & 2);
+            pdani_file_draw(file, target, -5, 3, f, flip & 1, flip & 2);
+            pdani_file_check_collision(file, 10, -10, f, flip & 1, flip & 2, on_collider, &sum);
+        }
+        for (int v = 1; v < variants && v < 8; ++v) {
+            pdani_file_draw_variant(file, NULL, 30, 30, f, v, v & 1, false);
+        }
+    }
+
+    pdani_file_compile_draw_list(file);
+    pdani_file_enable_flip_cache(file, true);
+    pdani_file_enable_frame_cache(file, 16 * 1024);
+    for (int f = 1; f <= frame_limit; ++f) {
+        pdani_file_draw(file, NULL, 200, 100, f, f & 1, false);
+        pdani_file_draw(file, NULL, 201, 100, f, f & 1, false);
+    }
+
+    struct pdani_player player;
+    pdani_player_initialize(&player, file);
+    pdani_player_enable_event_queue(&player, true);
+    for (int t = -1; t < pdani_file_get_tag_count(file) && t < 8; ++t) {
+        pdani_player_play_tag_index(&player, t);
+        pdani_player_set_flip(&player, t & 1, false);
+        for (int i = 0; i < 10; ++i) {
+            pdani_player_update(&player, 1 + (int)(random_next() % 200), on_frame_event, &sum);
+            pdani_player_draw(&player, NULL, 40, 40);
+            pdani_player_check_collision(&player, 0, 0, on_collider, &sum);
+            struct pdani_event event;
+            while (pdani_player_poll_event(&player, &event)) ++sum;
+        }
+    }
+    for (int i = 0; i < pdani_file_get_layer_count(file) && i < 8; ++i) {
+        pdani_player_set_layer_enabled(&player, i, false);
+        pdani_player_draw(&player, target, 0, 0);
+        pdani_player_update(&player, 100, on_frame_event, &sum);
+        pdani_player_set_layer_enabled(&player, i, true);
+    }
+    pdani_player_set_rotation(&player, 135.0f);
+    pdani_player_set_scale(&player, 0.5f);
+    pdani_player_draw(&player, NULL, 20, 20);
+    pdani_player_finalize(&player);
+
+    struct pdani_player_group group;
+    pdani_player_group_initialize(&group, file, 4);
+    pdani_player_group_enable_events(&group, true);
+    for (int i = 0; i < 4; ++i) {
+        const int member = pdani_player_group_add(&group);
+        pdani_player_group_play_tag_index(&group, member, (i < pdani_file_get_tag_count(file))? i : -1);
+    }
+    for (int i = 0; i < 6; ++i) {
+        pdani_player_group_update(&group, 60);
+        for (int member = 0; member < 4; ++member) {
+            pdani_player_group_draw(&group, member, NULL, member * 50, 120);
+        }
+    }
+    pdani_player_group_finalize(&group);
+
+    api->graphics->freeBitmap(target);
+    return sum;
+}
+
+static enum pdani_file_error fuzz_one(const uint8_t *data, size_t size)
+{
+    // a loaded file is at least 4-byte aligned
+    uint8_t *buf = malloc((size > 0)? size : 1);
+    memcpy(buf, data, size);
+    const enum pdani_file_error error = pdani_file_validate(buf, size, 0, 0);
+    if (error == PDANI_FILE_ERROR_NONE) {
+        struct pdani_file file;
+        const enum pdani_file_error again = pdani_file_initialize_validated(&file, buf, size, NULL);
+        if (again != error) {
+            fprintf(stderr, "pdani_file_initialize_validated disagrees with pdani_file_validate (%s)\n", pdani_file_get_error_name(again));
+            abort();
+        }
+        exercise(&file);
+        pdani_file_finalize(&file);
+    }
+    free(buf);
+    return error;
+}
+
+#ifdef PDANI_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (api == NULL) {
+        api = pd_stub_get_api();
+        pdani_global_initialize(api);
+    }
+    fuzz_one(data, size);
+    return 0;
+}
+
+#else
+
+#define SEED_MAX 16
+#define SEED_FRAMES 4
+// bytes past the end of a seed a mutation may grow into
+#define SEED_SLACK 64
+// 3 mutations in 4 land in the first bytes (header, directory, tables); the atlas is mostly texels
+#define HEAD_BYTES 1024
+
+struct seed {
+    uint8_t *data;
+    size_t size;
+    const char *name;
+};
+
+static struct seed seeds[SEED_MAX];
+static int seed_count = 0;
+
+static void add_seed(const char *name, uint8_t *data, size_t size)
+{
+    if (seed_count == SEED_MAX) {
+        free(data);
+        return;
+    }
+    seeds[seed_count++] = (struct seed){ .data = data, .size = size, .name = name };
+}
+
+// 1bit atlas as an ATLS chunk (texel rows, then mask rows)
+static void append_atlas(struct ani_builder *b, LCDBitmap *atlas)
+{
+    int width, height, rowbytes;
+    uint8_t *mask, *texel;
+    api->graphics->getBitmapData(atlas, &width, &height, &rowbytes, &mask, &texel);
+    struct ani_builder_chunk *chunk = ani_builder_make_chunk(b, "ATLS");
+    ani_builder_chunk_set_misc_u16(chunk, 0, (uint16_t)width);
+    ani_builder_chunk_set_misc_u16(chunk, 1, (uint16_t)height);
+    ani_builder_chunk_set_misc_u16(chunk, 2, (uint16_t)rowbytes);
+    ani_builder_chunk_append(chunk, texel, (size_t)rowbytes * height);
+    ani_builder_chunk_append(chunk, mask, (size_t)rowbytes * height);
+}
+
+struct seed_pixel_context {
+    const uint8_t *mask;
+    int rowbytes;
+    int u, v;
+};
+
+static int seed_pixel(void *ctx, int x, int y)
+{
+    const struct seed_pixel_context *c = ctx;
+    const int px = c->u + x;
+    const int py = c->v + y;
+    return ((c->mask[c->rowbytes * py + (px >> 3)] >> (7 - (px & 7))) & 1)? 2 : 0;
+}
+
+// a small rig touching every chunk: tags, a group, cel and collider layers, events, spans, an atlas and baked variants
+static void add_builtin_seed(const char *name, uint32_t version)
+{
+    static const int16_t images[3][4] = { { 0, 0, 16, 12 }, { 16, 0, 9, 16 }, { 0, 16, 30, 8 } };
+    LCDBitmap *atlas = api->graphics->newBitmap(32, 24, kColorClear);
+    int rowbytes;
+    uint8_t *mask, *texel;
+    api->graphics->getBitmapData(atlas, NULL, NULL, &rowbytes, &mask, &texel);
+    for (int i = 0; i < rowbytes * 24; ++i) {
+        texel[i] = (uint8_t)random_next();
+        mask[i] = (uint8_t)(random_next() | random_next());
+    }
+
+    struct ani_builder b;
+    ani_builder_initialize(&b, version);
+
+    struct ani_builder_chunk *info = ani_builder_make_chunk(&b, "INFO");
+    ani_builder_chunk_set_misc_u16(info, 0, 40);
+    ani_builder_chunk_set_misc_u16(info, 1, 32);
+    ani_builder_chunk_set_misc_u16(info, 2, SEED_FRAMES);
+
+    struct ani_builder_chunk *tags = ani_builder_make_chunk(&b, "TAGS");
+    const uint16_t tag_data[2][3] = {
+        { 1, SEED_FRAMES, ani_builder_register_string(&b, "walk") },
+        { 2, 3, ani_builder_register_string(&b, "hit") },
+    };
+    ani_builder_chunk_set_misc_u16(tags, 0, 2);
+    ani_builder_chunk_append(tags, tag_data, sizeof(tag_data));
+
+    struct ani_builder_chunk *lays = ani_builder_make_chunk(&b, "LAYS");
+    const struct { char type; int8_t parent; uint16_t name, count; } layers[] = {
+        { 'G', -1, ani_builder_register_string(&b, "body"), 2 },
+        { 'L', 0, ani_builder_register_string(&b, "torso"), 0 },
+        { 'C', 0, ani_builder_register_string(&b, "@hurt"), 0 },
+        { 'L', -1, ani_builder_register_string(&b, "fx"), 0 },
+    };
+    ani_builder_chunk_set_misc_u16(lays, 0, sizeof(layers) / sizeof(layers[0]));
+    ani_builder_chunk_append(lays, layers, sizeof(layers));
+
+    // three frame layers (torso, @hurt, fx) per frame
+    struct ani_builder_chunk *fram = ani_builder_make_chunk(&b, "FRAM");
+    ani_builder_chunk_set_misc_u16(fram, 0, SEED_FRAMES);
+    const int frame_size = 2 + 3 * 4;
+    const int table_size = SEED_FRAMES * ((version >= 2)? 4 : 2);
+    for (int i = 0; i < SEED_FRAMES; ++i) {
+        ani_builder_chunk_append_offset(&b, fram, (uint32_t)(table_size + frame_size * i));
+    }
+    const uint16_t step = ani_builder_register_string(&b, "step");
+    for (int i = 0; i < SEED_FRAMES; ++i) {
+        const uint16_t frame[7] = {
+            (uint16_t)(50 + i * 30),
+            (i == 1)? step : 0, (uint16_t)(i % 3),
+            0, (uint16_t)((i & 1)? 0 : -1),
+            (i == 3)? step : 0, (uint16_t)((i < 2)? -1 : 3),
+        };
+        ani_builder_chunk_append(fram, frame, sizeof(frame));
+    }
+
+    struct ani_builder_chunk *cels = ani_builder_make_chunk(&b, "CELS");
+    const int16_t cel_data[4][3] = { { 0, 4, 10 }, { 1, 20, 8 }, { 2, -6, 28 }, { 1, 30, 0 } };
+    ani_builder_chunk_set_misc_u16(cels, 0, 4);
+    ani_builder_chunk_append(cels, cel_data, sizeof(cel_data));
+
+    struct ani_builder_chunk *cols = ani_builder_make_chunk(&b, "COLS");
+    const int16_t col_data[1][4] = { { 6, 8, 20, 20 } };
+    ani_builder_chunk_set_misc_u16(cols, 0, 1);
+    ani_builder_chunk_append(cols, col_data, sizeof(col_data));
+
+    struct ani_builder_chunk *imag = ani_builder_make_chunk(&b, "IMAG");
+    ani_builder_chunk_set_misc_u16(imag, 0, 3);
+    ani_builder_chunk_append(imag, images, sizeof(images));
+
+    struct ani_builder_chunk *span = ani_builder_make_chunk(&b, "SPAN");
+    ani_builder_chunk_set_misc_u16(span, 0, 3);
+    struct ani_builder_chunk spans = { { 0 } };
+    uint32_t table[4] = { 0 };
+    for (int i = 0; i < 3; ++i) {
+        struct seed_pixel_context ctx = { .mask = mask, .rowbytes = rowbytes, .u = images[i][0], .v = images[i][1] };
+        table[i + 1] = (uint32_t)(table[i] + ani_builder_append_spans(&spans, images[i][2], images[i][3], seed_pixel, &ctx));
+    }
+    for (int i = 0; i < 4; ++i) {
+        ani_builder_chunk_append_offset(&b, span, table[i]);
+    }
+    ani_builder_chunk_append(span, spans.data, spans.size);
+    free(spans.data);
+
+    append_atlas(&b, atlas);
+
+    // two headings at one scale: the second heading reuses cels, skips one frame and leaves one unbaked
+    struct ani_builder_chunk *vars = ani_builder_make_chunk(&b, "VARS");
+    ani_builder_chunk_set_misc_u16(vars, 0, 2);
+    ani_builder_chunk_set_misc_u16(vars, 1, 1);
+    const int16_t variant_data[1 + SEED_FRAMES] = { 256, 3, PDANI_VARIANT_CEL_EMPTY, PDANI_VARIANT_CEL_NOT_BAKED, 0 };
+    ani_builder_chunk_append(vars, variant_data, sizeof(variant_data));
+
+    size_t size = 0;
+    uint8_t *data = ani_builder_build(&b, &size);
+    ani_builder_finalize(&b);
+    api->graphics->freeBitmap(atlas);
+    add_seed(name, data, size);
+}
+
+static uint8_t* read_file(const char *path, size_t *size)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return NULL;
+    fseek(fp, 0, SEEK_END);
+    *size = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    *size = fread(data, 1, *size, fp);
+    fclose(fp);
+    return data;
+}
+
+// a converted .ani with the .png next to it packed in as ATLS, so the seed stands alone
+static void add_file_seed(const char *path)
+{
+    char bmppath[1024];
+    snprintf(bmppath, sizeof(bmppath), "%s", path);
+    char *ext = strrchr(bmppath, '.');
+    if (ext == NULL || (size_t)(ext - bmppath) + 5 > sizeof(bmppath)) return;
+    strcpy(ext, ".png");
+
+    size_t size = 0;
+    uint8_t *ani = read_file(path, &size);
+    if (ani == NULL) {
+        printf("%s: cannot read\n", path);
+        return;
+    }
+    const char *err = NULL;
+    LCDBitmap *atlas = api->graphics->loadBitmap(bmppath, &err);
+    if (atlas == NULL) {
+        add_seed(path, ani, size);
+        return;
+    }
+    int width, height, rowbytes;
+    uint8_t *mask, *texel;
+    api->graphics->getBitmapData(atlas, &width, &height, &rowbytes, &mask, &texel);
+    struct ani_builder_chunk chunk = { .id = { 'A', 'T', 'L', 'S' } };
+    ani_builder_chunk_set_misc_u16(&chunk, 0, (uint16_t)width);
+    ani_builder_chunk_set_misc_u16(&chunk, 1, (uint16_t)height);
+    ani_builder_chunk_set_misc_u16(&chunk, 2, (uint16_t)rowbytes);
+    ani_builder_chunk_append(&chunk, texel, (size_t)rowbytes * height);
+    ani_builder_chunk_append(&chunk, mask, (size_t)rowbytes * height);
+    size_t packed_size = 0;
+    uint8_t *packed = ani_builder_repack(ani, size, &chunk, 0, &packed_size);
+    free(chunk.data);
+    api->graphics->freeBitmap(atlas);
+    if (packed != NULL) {
+        free(ani);
+        add_seed(path, packed, packed_size);
+    } else {
+        // v1 has no directory to add a chunk to; validate against nothing and let it fail on the atlas
+        add_seed(path, ani, size);
+    }
+}
+
+static void write_u16(uint8_t *data, size_t size, uint32_t value)
+{
+    if (size < 2) return;
+    const size_t offset = (random_next() % (size - 1)) & ~(size_t)1;
+    const uint16_t v = (uint16_t)value;
+    memcpy(data + offset, &v, 2);
+}
+
+static size_t pick_offset(size_t size)
+{
+    const size_t range = ((random_next() & 3) != 0 && size > HEAD_BYTES)? HEAD_BYTES : size;
+    return random_next() % range;
+}
+
+// a few byte-level edits biased towards counts, offsets and indices
+static size_t mutate(uint8_t *data, size_t size, size_t capacity)
+{
+    static const uint32_t interesting[] = { 0, 1, 2, 3, 4, 15, 16, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xfffe, 0xffff, 0x10000, 0x7fffffff, 0xffffffff };
+    const int edits = 1 + (int)(random_next() % 4);
+    for (int i = 0; i < edits && size > 0; ++i) {
+        const uint32_t value = interesting[random_next() % (sizeof(interesting) / sizeof(interesting[0]))];
+        switch (random_next() % 8) {
+        case 0:
+            data[pick_offset(size)] ^= (uint8_t)(1 << (random_next() & 7));
+            break;
+        case 1:
+            data[pick_offset(size)] = (uint8_t)random_next();
+            break;
+        case 2:
+        case 3:
+            // the value or one off from it
+            write_u16(data, (size < HEAD_BYTES || (random_next() & 1))? size : HEAD_BYTES, value + random_next() % 3 - 1);
+            break;
+        case 4: {
+            if (size < 4) break;
+            const size_t offset = (pick_offset(size - 3)) & ~(size_t)3;
+            memcpy(data + offset, &value, 4);
+            break;
+        }
+        case 5:
+            size = random_next() % size;
+            break;
+        case 6:
+            // grow into the slack with garbage
+            while (size < capacity && (random_next() & 7) != 0) data[size++] = (uint8_t)random_next();
+            break;
+        default: {
+            const size_t length = 1 + random_next() % 16;
+            if (size <= length) break;
+            const size_t from = pick_offset(size - length);
+            const size_t to = pick_offset(size - length);
+            memmove(data + to, data + from, length);
+            break;
+        }
+        }
+    }
+    return size;
+}
+
+static void write_seeds(const char *dir)
+{
+    for (int i = 0; i < seed_count; ++i) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/seed_%02d.ani", dir, i);
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL) continue;
+        fwrite(seeds[i].data, 1, seeds[i].size, fp);
+        fclose(fp);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = 20000;
+    const char *seed_dir = NULL;
+    api = pd_stub_get_api();
+    pdani_global_initialize(api);
+
+    add_builtin_seed("builtin v1", 1);
+    add_builtin_seed("builtin v2", 2);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            random_state = (uint32_t)strtoul(argv[++i], NULL, 0);
+            if (random_state == 0) random_state = 1;
+        } else if (strcmp(argv[i], "--ani") == 0 && i + 1 < argc) {
+            add_file_seed(argv[++i]);
+        } else if (strcmp(argv[i], "--write-seeds") == 0 && i + 1 < argc) {
+            seed_dir = argv[++i];
+        }
+    }
+
+    // unmodified seeds must pass, or the fuzzer would only ever test the rejection paths
+    for (int i = 0; i < seed_count; ++i) {
+        const enum pdani_file_error error = fuzz_one(seeds[i].data, seeds[i].size);
+        if (error != PDANI_FILE_ERROR_NONE) {
+            printf("seed %s rejected (%s)\n", seeds[i].name, pdani_file_get_error_name(error));
+            return 1;
+        }
+    }
+    if (seed_dir != NULL) {
+        write_seeds(seed_dir);
+    }
+
+    int results[PDANI_FILE_ERROR_ATLAS + 1] = { 0 };
+    size_t capacity = 0;
+    for (int i = 0; i < seed_count; ++i) {
+        if (seeds[i].size + SEED_SLACK > capacity) capacity = seeds[i].size + SEED_SLACK;
+    }
+    uint8_t *buf = malloc(capacity);
+    for (int i = 0; i < iterations; ++i) {
+        const struct seed *seed = &seeds[random_next() % seed_count];
+        memcpy(buf, seed->data, seed->size);
+        const size_t size = mutate(buf, seed->size, seed->size + SEED_SLACK);
+        results[fuzz_one(buf, size)] += 1;
+    }
+    free(buf);
+
+    printf("%d inputs from %d seeds:", iterations, seed_count);
+    for (int i = 0; i <= PDANI_FILE_ERROR_ATLAS; ++i) {
+        if (results[i] > 0) printf(" %s %d", pdani_file_get_error_name((enum pdani_file_error)i), results[i]);
+    }
+    printf("\n");
+
+    for (int i = 0; i < seed_count; ++i) {
+        free(seeds[i].data);
+    }
+    return 0;
+}
+
+#endif // PDANI_FUZZ_LIBFUZZER
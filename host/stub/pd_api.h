@@ -0,0 +1,81 @@
+#ifndef __PD_API_H__
+#define __PD_API_H__
+
+// Minimal host-side stand-in for the Playdate SDK's pd_api.h.
+// Only the parts used by pdani.c, the samples' common code and the host tools are declared.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "pd_api/pd_api_gfx.h"
+
+typedef struct SDFile SDFile;
+typedef enum {
+    kFileRead = (1<<0),
+    kFileReadData = (1<<1),
+    kFileWrite = (1<<2),
+    kFileAppend = (2<<2),
+} FileOptions;
+
+typedef struct playdate_file {
+    SDFile* (*open)(const char *name, FileOptions mode);
+    int (*close)(SDFile *file);
+    int (*read)(SDFile *file, void *buf, unsigned int len);
+    int (*write)(SDFile *file, const void *buf, unsigned int len);
+    int (*seek)(SDFile *file, int pos, int whence);
+    int (*tell)(SDFile *file);
+} playdate_file;
+
+typedef enum {
+    kButtonLeft = (1<<0),
+    kButtonRight = (1<<1),
+    kButtonUp = (1<<2),
+    kButtonDown = (1<<3),
+    kButtonB = (1<<4),
+    kButtonA = (1<<5),
+} PDButtons;
+
+typedef enum {
+    kEventInit,
+    kEventInitLua,
+    kEventLock,
+    kEventUnlock,
+    kEventPause,
+    kEventResume,
+    kEventTerminate,
+    kEventKeyPressed,
+    kEventKeyReleased,
+    kEventLowPower,
+} PDSystemEvent;
+
+typedef int PDCallbackFunction(void *userdata);
+
+typedef struct playdate_sys {
+    void* (*realloc)(void *ptr, size_t size);
+    void (*logToConsole)(const char *fmt, ...);
+    void (*error)(const char *fmt, ...);
+    int (*formatString)(char **ret, const char *fmt, ...);
+    unsigned int (*getCurrentTimeMilliseconds)(void);
+    void (*resetElapsedTime)(void);
+    float (*getElapsedTime)(void);
+    void (*setUpdateCallback)(PDCallbackFunction *update, void *userdata);
+    void (*getButtonState)(PDButtons *current, PDButtons *pushed, PDButtons *released);
+} playdate_sys;
+
+typedef struct playdate_display {
+    void (*setRefreshRate)(float rate);
+} playdate_display;
+
+typedef struct PlaydateAPI {
+    const struct playdate_sys *system;
+    const struct playdate_file *file;
+    const struct playdate_graphics *graphics;
+    const struct playdate_sprite *sprite;
+    const struct playdate_display *display;
+} PlaydateAPI;
+
+#endif // __PD_API_H__
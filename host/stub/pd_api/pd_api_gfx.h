@@ -0,0 +1,98 @@
+#ifndef __PD_API_GFX_H__
+#define __PD_API_GFX_H__
+
+#include <stdint.h>
+
+#define LCD_COLUMNS 400
+#define LCD_ROWS 240
+#define LCD_ROWSIZE 52
+
+typedef struct {
+    int left;
+    int right; // not inclusive
+    int top;
+    int bottom; // not inclusive
+} LCDRect;
+
+static inline LCDRect LCDMakeRect(int x, int y, int width, int height)
+{
+    LCDRect r = { .left = x, .right = x + width, .top = y, .bottom = y + height };
+    return r;
+}
+
+static inline LCDRect LCDRect_translate(LCDRect r, int dx, int dy)
+{
+    return (LCDRect){ .left = r.left + dx, .right = r.right + dx, .top = r.top + dy, .bottom = r.bottom + dy };
+}
+
+typedef struct {
+    float x;
+    float y;
+    float width;
+    float height;
+} PDRect;
+
+static inline PDRect PDRectMake(float x, float y, float width, float height)
+{
+    return (PDRect){ .x = x, .y = y, .width = width, .height = height };
+}
+
+typedef enum {
+    kColorBlack,
+    kColorWhite,
+    kColorClear,
+    kColorXOR,
+} LCDSolidColor;
+
+typedef uintptr_t LCDColor;
+
+typedef enum {
+    kBitmapUnflipped,
+    kBitmapFlippedX,
+    kBitmapFlippedY,
+    kBitmapFlippedXY,
+} LCDBitmapFlip;
+
+typedef enum {
+    kASCIIEncoding,
+    kUTF8Encoding,
+    k16BitLEEncoding,
+} PDStringEncoding;
+
+typedef struct LCDBitmap LCDBitmap;
+typedef struct LCDFont LCDFont;
+typedef struct LCDSprite LCDSprite;
+
+typedef struct playdate_graphics {
+    void (*clear)(LCDColor color);
+    LCDBitmap* (*newBitmap)(int width, int height, LCDColor bgcolor);
+    void (*freeBitmap)(LCDBitmap *bitmap);
+    LCDBitmap* (*loadBitmap)(const char *path, const char **outerr);
+    void (*getBitmapData)(LCDBitmap *bitmap, int *width, int *height, int *rowbytes, uint8_t **mask, uint8_t **data);
+    uint8_t* (*getFrame)(void);
+    void (*markUpdatedRows)(int start, int end);
+    LCDFont* (*loadFont)(const char *path, const char **outErr);
+    int (*drawText)(const void *text, size_t len, PDStringEncoding encoding, int x, int y);
+} playdate_graphics;
+
+typedef void LCDSpriteDrawFunction(LCDSprite *sprite, PDRect bounds, PDRect drawrect);
+typedef void LCDSpriteUpdateFunction(LCDSprite *sprite);
+
+typedef struct playdate_sprite {
+    LCDSprite* (*newSprite)(void);
+    void (*freeSprite)(LCDSprite *sprite);
+    void (*addSprite)(LCDSprite *sprite);
+    void (*moveTo)(LCDSprite *sprite, float x, float y);
+    void (*getPosition)(LCDSprite *sprite, float *x, float *y);
+    void (*setBounds)(LCDSprite *sprite, PDRect bounds);
+    PDRect (*getBounds)(LCDSprite *sprite);
+    void (*setImage)(LCDSprite *sprite, LCDBitmap *image, LCDBitmapFlip flip);
+    void (*markDirty)(LCDSprite *sprite);
+    void (*setUpdateFunction)(LCDSprite *sprite, LCDSpriteUpdateFunction *func);
+    void (*setDrawFunction)(LCDSprite *sprite, LCDSpriteDrawFunction *func);
+    void (*setUserdata)(LCDSprite *sprite, void *userdata);
+    void* (*getUserdata)(LCDSprite *sprite);
+    void (*updateAndDrawSprites)(void);
+} playdate_sprite;
+
+#endif // __PD_API_GFX_H__
@@ -0,0 +1,412 @@
+#define _POSIX_C_SOURCE 199309L
+#include "pd_stub.h"
+#include <stdarg.h>
+#include <time.h>
+#ifdef PDSTUB_HAVE_PNG
+#include <png.h>
+#endif
+
+struct LCDBitmap {
+    int width, height;
+    int rowbytes;
+    uint8_t *data;
+    uint8_t *mask;
+};
+
+struct LCDSprite {
+    float x, y;
+    PDRect bounds;
+    void *userdata;
+    LCDSpriteUpdateFunction *update;
+    LCDSpriteDrawFunction *draw;
+    bool dirty;
+};
+
+static uint8_t s_frame[LCD_ROWSIZE * LCD_ROWS] __attribute__((aligned(4)));
+static int s_updated_start = -1;
+static int s_updated_end = -1;
+static struct timespec s_elapsed_base;
+static uint64_t s_read_rate = 0; // bytes per second, 0 = free
+static uint64_t s_io_ns = 0; // simulated time spent reading files
+static bool s_error_exits = false; // system->error ends the process normally instead of aborting
+
+static void stub_charge_read(uint64_t bytes)
+{
+    if (s_read_rate > 0) s_io_ns += bytes * 1000000000ull / s_read_rate;
+}
+
+// system
+static void* stub_realloc(void *ptr, size_t size)
+{
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+static void stub_logToConsole(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stdout, fmt, args);
+    va_end(args);
+    fputc('\n', stdout);
+}
+
+static void stub_error(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    if (s_error_exits) exit(0);
+    abort();
+}
+
+uint64_t pd_stub_nanotime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec + s_io_ns;
+}
+
+void pd_stub_set_read_rate(uint32_t bytes_per_second)
+{
+    s_read_rate = bytes_per_second;
+}
+
+void pd_stub_set_error_exits(bool enabled)
+{
+    s_error_exits = enabled;
+}
+
+// *ret is freed with realloc(*ret, 0)
+static int stub_formatString(char **ret, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    const int len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    *ret = malloc((size_t)len + 1);
+    va_start(args, fmt);
+    vsnprintf(*ret, (size_t)len + 1, fmt, args);
+    va_end(args);
+    return len;
+}
+
+static unsigned int stub_getCurrentTimeMilliseconds(void)
+{
+    return (unsigned int)(pd_stub_nanotime() / 1000000ull);
+}
+
+static void stub_resetElapsedTime(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &s_elapsed_base);
+}
+
+static float stub_getElapsedTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (float)(ts.tv_sec - s_elapsed_base.tv_sec) + (float)(ts.tv_nsec - s_elapsed_base.tv_nsec) * 1e-9f;
+}
+
+static void stub_setUpdateCallback(PDCallbackFunction *update, void *userdata)
+{
+}
+
+static void stub_getButtonState(PDButtons *current, PDButtons *pushed, PDButtons *released)
+{
+    if (current != NULL) *current = 0;
+    if (pushed != NULL) *pushed = 0;
+    if (released != NULL) *released = 0;
+}
+
+// file
+static SDFile* stub_open(const char *name, FileOptions mode)
+{
+    const char *m = (mode & kFileWrite)? "wb" : (mode & kFileAppend)? "ab" : "rb";
+    return (SDFile*)fopen(name, m);
+}
+
+static int stub_close(SDFile *file)
+{
+    return fclose((FILE*)file);
+}
+
+static int stub_read(SDFile *file, void *buf, unsigned int len)
+{
+    const size_t n = fread(buf, 1, len, (FILE*)file);
+    stub_charge_read(n);
+    return (int)n;
+}
+
+static int stub_write(SDFile *file, const void *buf, unsigned int len)
+{
+    return (int)fwrite(buf, 1, len, (FILE*)file);
+}
+
+static int stub_seek(SDFile *file, int pos, int whence)
+{
+    return fseek((FILE*)file, pos, whence);
+}
+
+static int stub_tell(SDFile *file)
+{
+    return (int)ftell((FILE*)file);
+}
+
+// graphics
+void pd_stub_clear_frame(LCDColor color)
+{
+    memset(s_frame, (color == kColorBlack)? 0x00 : 0xff, sizeof(s_frame));
+}
+
+static LCDBitmap* stub_newBitmap(int width, int height, LCDColor bgcolor)
+{
+    LCDBitmap *bmp = calloc(1, sizeof(LCDBitmap));
+    bmp->width = width;
+    bmp->height = height;
+    bmp->rowbytes = ((width + 31) >> 5) << 2;
+    // data and mask share one block like on device, rows are 32-bit aligned
+    bmp->data = aligned_alloc(4, (size_t)bmp->rowbytes * height * 2 + 4);
+    bmp->mask = bmp->data + bmp->rowbytes * height;
+    memset(bmp->data, (bgcolor == kColorBlack)? 0x00 : 0xff, (size_t)bmp->rowbytes * height);
+    memset(bmp->mask, (bgcolor == kColorClear)? 0x00 : 0xff, (size_t)bmp->rowbytes * height);
+    return bmp;
+}
+
+static void stub_freeBitmap(LCDBitmap *bitmap)
+{
+    if (bitmap == NULL) return;
+    free(bitmap->data);
+    free(bitmap);
+}
+
+static LCDBitmap* stub_loadBitmap(const char *path, const char **outerr)
+{
+#ifdef PDSTUB_HAVE_PNG
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_file(&image, path)) {
+        if (outerr != NULL) *outerr = "cannot open bitmap";
+        return NULL;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (fp != NULL) {
+        fseek(fp, 0, SEEK_END);
+        stub_charge_read((uint64_t)ftell(fp));
+        fclose(fp);
+    }
+    image.format = PNG_FORMAT_GA;
+    uint8_t *pixels = malloc(PNG_IMAGE_SIZE(image));
+    if (!png_image_finish_read(&image, NULL, pixels, 0, NULL)) {
+        free(pixels);
+        if (outerr != NULL) *outerr = "cannot decode bitmap";
+        return NULL;
+    }
+    LCDBitmap *bmp = stub_newBitmap((int)image.width, (int)image.height, kColorClear);
+    memset(bmp->data, 0, (size_t)bmp->rowbytes * bmp->height);
+    for (int y = 0; y < bmp->height; ++y) {
+        for (int x = 0; x < bmp->width; ++x) {
+            const uint8_t *p = &pixels[(y * bmp->width + x) * 2];
+            const uint8_t bit = (uint8_t)(0x80 >> (x & 7));
+            if (p[0] >= 0x80) bmp->data[y * bmp->rowbytes + (x >> 3)] |= bit;
+            if (p[1] >= 0x80) bmp->mask[y * bmp->rowbytes + (x >> 3)] |= bit;
+        }
+    }
+    free(pixels);
+    return bmp;
+#else
+    if (outerr != NULL) *outerr = "bitmap loading is not supported in this build";
+    return NULL;
+#endif
+}
+
+static void stub_getBitmapData(LCDBitmap *bitmap, int *width, int *height, int *rowbytes, uint8_t **mask, uint8_t **data)
+{
+    if (width != NULL) *width = bitmap->width;
+    if (height != NULL) *height = bitmap->height;
+    if (rowbytes != NULL) *rowbytes = bitmap->rowbytes;
+    if (mask != NULL) *mask = bitmap->mask;
+    if (data != NULL) *data = bitmap->data;
+}
+
+static uint8_t* stub_getFrame(void)
+{
+    return s_frame;
+}
+
+static void stub_markUpdatedRows(int start, int end)
+{
+    if (s_updated_start < 0 || start < s_updated_start) s_updated_start = start;
+    if (end > s_updated_end) s_updated_end = end;
+}
+
+void pd_stub_get_updated_rows(int *start, int *end)
+{
+    *start = s_updated_start;
+    *end = s_updated_end;
+}
+
+void pd_stub_reset_updated_rows(void)
+{
+    s_updated_start = -1;
+    s_updated_end = -1;
+}
+
+static LCDFont* stub_loadFont(const char *path, const char **outErr)
+{
+    return NULL;
+}
+
+static int stub_drawText(const void *text, size_t len, PDStringEncoding encoding, int x, int y)
+{
+    return 0;
+}
+
+// sprite
+static LCDSprite* stub_newSprite(void)
+{
+    return calloc(1, sizeof(LCDSprite));
+}
+
+static void stub_freeSprite(LCDSprite *sprite)
+{
+    free(sprite);
+}
+
+static void stub_addSprite(LCDSprite *sprite)
+{
+}
+
+static void stub_moveTo(LCDSprite *sprite, float x, float y)
+{
+    sprite->x = x;
+    sprite->y = y;
+    sprite->dirty = true;
+}
+
+static void stub_getPosition(LCDSprite *sprite, float *x, float *y)
+{
+    *x = sprite->x;
+    *y = sprite->y;
+}
+
+static void stub_setBounds(LCDSprite *sprite, PDRect bounds)
+{
+    sprite->bounds = bounds;
+}
+
+static PDRect stub_getBounds(LCDSprite *sprite)
+{
+    return sprite->bounds;
+}
+
+static void stub_setImage(LCDSprite *sprite, LCDBitmap *image, LCDBitmapFlip flip)
+{
+}
+
+static void stub_markDirty(LCDSprite *sprite)
+{
+    sprite->dirty = true;
+}
+
+static void stub_setUpdateFunction(LCDSprite *sprite, LCDSpriteUpdateFunction *func)
+{
+    sprite->update = func;
+}
+
+static void stub_setDrawFunction(LCDSprite *sprite, LCDSpriteDrawFunction *func)
+{
+    sprite->draw = func;
+}
+
+static void stub_setUserdata(LCDSprite *sprite, void *userdata)
+{
+    sprite->userdata = userdata;
+}
+
+static void* stub_getUserdata(LCDSprite *sprite)
+{
+    return sprite->userdata;
+}
+
+static void stub_updateAndDrawSprites(void)
+{
+}
+
+// display
+static void stub_setRefreshRate(float rate)
+{
+}
+
+static const struct playdate_sys s_sys = {
+    .realloc = stub_realloc,
+    .logToConsole = stub_logToConsole,
+    .error = stub_error,
+    .formatString = stub_formatString,
+    .getCurrentTimeMilliseconds = stub_getCurrentTimeMilliseconds,
+    .resetElapsedTime = stub_resetElapsedTime,
+    .getElapsedTime = stub_getElapsedTime,
+    .setUpdateCallback = stub_setUpdateCallback,
+    .getButtonState = stub_getButtonState,
+};
+
+static const struct playdate_file s_file = {
+    .open = stub_open,
+    .close = stub_close,
+    .read = stub_read,
+    .write = stub_write,
+    .seek = stub_seek,
+    .tell = stub_tell,
+};
+
+static const struct playdate_graphics s_graphics = {
+    .clear = pd_stub_clear_frame,
+    .newBitmap = stub_newBitmap,
+    .freeBitmap = stub_freeBitmap,
+    .loadBitmap = stub_loadBitmap,
+    .getBitmapData = stub_getBitmapData,
+    .getFrame = stub_getFrame,
+    .markUpdatedRows = stub_markUpdatedRows,
+    .loadFont = stub_loadFont,
+    .drawText = stub_drawText,
+};
+
+static const struct playdate_sprite s_sprite = {
+    .newSprite = stub_newSprite,
+    .freeSprite = stub_freeSprite,
+    .addSprite = stub_addSprite,
+    .moveTo = stub_moveTo,
+    .getPosition = stub_getPosition,
+    .setBounds = stub_setBounds,
+    .getBounds = stub_getBounds,
+    .setImage = stub_setImage,
+    .markDirty = stub_markDirty,
+    .setUpdateFunction = stub_setUpdateFunction,
+    .setDrawFunction = stub_setDrawFunction,
+    .setUserdata = stub_setUserdata,
+    .getUserdata = stub_getUserdata,
+    .updateAndDrawSprites = stub_updateAndDrawSprites,
+};
+
+static const struct playdate_display s_display = {
+    .setRefreshRate = stub_setRefreshRate,
+};
+
+static PlaydateAPI s_api = {
+    .system = &s_sys,
+    .file = &s_file,
+    .graphics = &s_graphics,
+    .sprite = &s_sprite,
+    .display = &s_display,
+};
+
+PlaydateAPI* pd_stub_get_api(void)
+{
+    return &s_api;
+}
@@ -0,0 +1,30 @@
+#ifndef __PD_STUB_H__
+#define __PD_STUB_H__
+
+#include "pd_api.h"
+
+// host-only helpers around the stub PlaydateAPI
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+PlaydateAPI* pd_stub_get_api(void);
+/// @fn 400x240 の 1bit フレームバッファを指定色で埋める
+void pd_stub_clear_frame(LCDColor color);
+/// @fn 直近の markUpdatedRows で通知された行範囲（未通知なら -1）
+void pd_stub_get_updated_rows(int *start, int *end);
+void pd_stub_reset_updated_rows(void);
+/// @fn 単調増加のナノ秒タイマ（pd_stub_set_read_rate で見積もった読み込み時間を含む）
+uint64_t pd_stub_nanotime(void);
+/// @fn ファイル読み込みの速度（バイト/秒）を設定し、読んだ分だけ pd_stub_nanotime を進める。0 で無効
+void pd_stub_set_read_rate(uint32_t bytes_per_second);
+/// @fn system->error で abort せず exit(0) する（エラーで止まることを確かめるテスト用）
+void pd_stub_set_error_exits(bool enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __PD_STUB_H__
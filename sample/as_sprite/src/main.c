@@ -51,7 +51,7 @@ int UpdateCallback(void *ptr)
 
     //api->sprite->drawSprites();
     api->sprite->updateAndDrawSprites();
-    api->graphics->markUpdatedRows(0, 240-1);
+    pdani_dirty_flush();
 
     return 1;
 }
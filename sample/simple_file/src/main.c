@@ -46,7 +46,7 @@ int UpdateCallback(void *ptr)
     sprintf(text, "Move: D-pad\nA: Flip-H\nB: Flip-V\n%d,%d", (int)ax, (int)ay);
     api->graphics->drawText(text, strlen(text), kASCIIEncoding, 0, 0);
 
-    api->graphics->markUpdatedRows(0, 240-1);
+    pdani_dirty_flush();
 
     return 1;
 }
@@ -62,6 +62,7 @@ int eventHandler(PlaydateAPI *playdate, PDSystemEvent event, __attribute__ ((unu
 
         pdani_global_initialize(api);
         pdani_file_initialize_with_filename(&anifile, "ani/test.ani", "ani/test.png");
+        pdani_file_enable_flip_cache(&anifile, true);
         pdani_file_dump(&anifile);
         ax = 128;
         ay = 128;
@@ -54,7 +54,7 @@ int UpdateCallback(void *ptr)
     sprintf(text, "Move: D-pad\nA: Flip-H\nB: Flip-V\n%d,%d", (int)ax, (int)ay);
     api->graphics->drawText(text, strlen(text), kASCIIEncoding, 0, 0);
 
-    api->graphics->markUpdatedRows(0, 240-1);
+    pdani_dirty_flush();
 
     return 1;
 }
@@ -13,8 +13,70 @@
 #define BIT_CHECK(v, f) ((v) & (f))
 #define BIT_CLEAR(v, f) (v) &= ~(f)
 
+// ファイルの中身から引いた番号や位置の確認。読み込み時に検証したファイルでは省く
+// （PDANI_ENABLE_DATA_CHECKS ならリリースビルドでも未検証のファイルは調べる）
+#if !defined(NDEBUG) || defined(PDANI_ENABLE_DATA_CHECKS)
+#   define DATA_CHECK(file, v) { if (!BIT_CHECK((file)->flags, PDANI_FILE_FLAG_VALIDATED) && !(v)) { s_api->system->error("%s:%d broken data in %s\n%s", __FILE__, __LINE__, __func__, #v); } }
+#else
+#   define DATA_CHECK(file, v)
+#endif
+
 static PlaydateAPI *s_api = NULL;
+static const struct pdani_allocator *s_allocator = NULL;
+
+#ifdef PDANI_ENABLE_STATS
+static struct {
+    struct pdani_stats result;
+    struct pdani_stats_counters frame; //< 数えている途中のフレーム
+    const struct pdani_file *drawing; //< 描いているファイル（転送の数をこのファイルにも付ける）
+} s_stats;
+
+/// @internal 計測値は const なファイルでも数える
+static inline struct pdani_stats_counters* statsOf(const struct pdani_file *file)
+{
+    return (struct pdani_stats_counters*)&file->stats;
+}
+
+#   define STATS_COUNT(file, field, n) { s_stats.frame.field += (n); if ((file) != NULL) statsOf(file)->field += (n); }
+#   define STATS_TIMER_START(t) const float t = s_api->system->getElapsedTime()
+#   define STATS_TIMER_STOP(file, field, t) STATS_COUNT(file, field, (s_api->system->getElapsedTime() - (t)) * 1000.0f)
+#   define STATS_DRAW_BEGIN(file) const struct pdani_file *stats_drawing = s_stats.drawing; s_stats.drawing = (file); STATS_TIMER_START(stats_start)
+#   define STATS_DRAW_END(file) STATS_TIMER_STOP(file, draw_ms, stats_start); s_stats.drawing = stats_drawing
+#else
+#   define STATS_COUNT(file, field, n)
+#   define STATS_TIMER_START(t)
+#   define STATS_TIMER_STOP(file, field, t)
+#   define STATS_DRAW_BEGIN(file)
+#   define STATS_DRAW_END(file)
+#endif
 static int s_frame_ms = 1000 / 20;
+static struct {
+    char **names; //< ID-1 の文字列
+    int count, capacity;
+    uint16_t *slots; //< ID のオープンアドレス表（0は空き）
+    int mask;
+} s_intern;
+/// ファイル名で共有するファイル（file を先頭に置き、pdani_file* から戻す）
+struct pdani_asset {
+    struct pdani_file file;
+    struct pdani_asset *next;
+    uint32_t hash;
+    int refcount;
+    uint32_t last_used;
+    size_t size; //< .ani とアトラスのおおよそのバイト数
+    char key[]; //< "ani\0bmp\0"
+};
+static struct {
+    struct pdani_asset *head;
+    size_t budget;
+    size_t unused_size; //< 参照されていないものの合計
+    uint32_t tick;
+} s_assets;
+static struct {
+    uint32_t rows[(LCD_ROWS + 31) >> 5]; //< このフレームで書き込んだ行
+    uint32_t previous_rows[(LCD_ROWS + 31) >> 5]; //< 前フレームで書き込んだ行（消去が必要）
+    LCDRect bounds;
+} s_dirty;
 static const char *s_chunk_names[(int)PDANI_CHUNK_TYPE_MAX] = {
     "INFO",
     "TAGS",
@@ -24,6 +86,9 @@ static const char *s_chunk_names[(int)PDANI_CHUNK_TYPE_MAX] = {
     "COLS",
     "IMAG",
     "STRG",
+    "SPAN",
+    "ATLS",
+    "VARS",
 };
 static const LCDRect screen_rect = { .left = 0, .right = LCD_COLUMNS, .top = 0, .bottom = LCD_ROWS };
 
@@ -37,6 +102,25 @@ static inline const void* chunkGetData(const struct pdani_chunk *chunk)
     return chunk + 1;
 }
 
+// v2 は size が 32bit
+static inline uint32_t chunkGetSize(const struct pdani_file *file, const struct pdani_chunk *chunk)
+{
+    if (BIT_CHECK(file->flags, PDANI_FILE_FLAG_WIDE_OFFSETS)) return ((const struct pdani_chunk_v2*)chunk)->size;
+    return chunk->size;
+}
+
+// FRAM のジャンプテーブルと SPAN の開始位置表の要素（v1 は 16bit、v2 は 32bit）
+static inline int tableGetEntrySize(const struct pdani_file *file)
+{
+    return BIT_CHECK(file->flags, PDANI_FILE_FLAG_WIDE_OFFSETS)? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+static inline uint32_t tableGet(const struct pdani_file *file, const void *table, int index)
+{
+    if (BIT_CHECK(file->flags, PDANI_FILE_FLAG_WIDE_OFFSETS)) return ((const uint32_t*)table)[index];
+    return ((const uint16_t*)table)[index];
+}
+
 static inline const void* seek(const struct pdani_file *file, int offset)
 {
     return ((const char*)file->header + offset);
@@ -49,10 +133,21 @@ static inline const void* seekChunkData(const struct pdani_chunk *chunk, int off
 
 static inline const char* getString(const struct pdani_file *file, int index)
 {
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_STRING] != NULL && (uint32_t)index < chunkGetSize(file, file->chunks[PDANI_CHUNK_TYPE_STRING]));
     const char *stream = (const char*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_STRING]);
     return &stream[index];
 }
 
+static inline uint32_t hashString(const char *s)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*s != '\0') {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
 static enum pdani_chunk_type detectChunkType(const struct pdani_chunk *chunk)
 {
     for (int i = 0; i < (int)PDANI_CHUNK_TYPE_MAX; ++i) {
@@ -90,21 +185,48 @@ static bool clip_rect(LCDRect* rc, const LCDRect* cliprc)
     return rc->right - rc->left > 0 && rc->bottom - rc->top > 0;
 }
 
+static inline void unionRect(LCDRect *rc, const LCDRect *add)
+{
+    if (rc->right <= rc->left || rc->bottom <= rc->top) {
+        *rc = *add;
+        return;
+    }
+    if (add->left < rc->left) rc->left = add->left;
+    if (add->right > rc->right) rc->right = add->right;
+    if (add->top < rc->top) rc->top = add->top;
+    if (add->bottom > rc->bottom) rc->bottom = add->bottom;
+}
+
+static inline void* mem_realloc(const struct pdani_allocator *allocator, void *buf, const size_t sz)
+{
+    if (allocator != NULL) return allocator->realloc(allocator->context, buf, sz);
+    return s_api->system->realloc(buf, sz);
+}
+
 static void* mem_alloc(const size_t sz)
 {
-    return s_api->system->realloc(NULL, sz);
+    return mem_realloc(s_allocator, NULL, sz);
+}
+
+/// @internal ファイルが持つメモリは初期化時のアロケータで確保・解放する
+static void* fileAlloc(const struct pdani_file *file, const size_t sz)
+{
+    return mem_realloc(file->allocator, NULL, sz);
 }
 
-static void mem_free(void *buf)
+static void fileFree(const struct pdani_file *file, void *buf)
 {
-    s_api->system->realloc(buf, 0);
+    if (buf != NULL) mem_realloc(file->allocator, buf, 0);
 }
 
-static void* loadfile(const char *path)
+/// @internal 開けなければ NULL
+static void* loadfile(const char *path, int *outlen)
 {
     SDFile *file = s_api->file->open(path, kFileRead);
+    if (file == NULL) return NULL;
     s_api->file->seek(file, 0, SEEK_END);
     int len = s_api->file->tell(file);
+    if (outlen != NULL) *outlen = len;
     s_api->file->seek(file, 0, SEEK_SET);
     void *buf = mem_alloc(len);
     s_api->file->read(file, buf, len);
@@ -112,13 +234,116 @@ static void* loadfile(const char *path)
     return buf;
 }
 
-static LCDBitmap* loadbitmap(const char *path)
+static bool streamRead(SDFile *fp, uint32_t offset, void *buf, uint32_t len)
+{
+    if (s_api->file->seek(fp, (int)offset, SEEK_SET) != 0) return false;
+    return s_api->file->read(fp, buf, len) == (int)len;
+}
+
+static inline uint32_t lzReadLength(const uint8_t **ip, const uint8_t *iend, uint32_t len)
+{
+    if (len != 15) return len;
+    uint8_t b;
+    do {
+        if (*ip >= iend) return UINT32_MAX;
+        b = *(*ip)++;
+        len += b;
+    } while (b == 255);
+    return len;
+}
+
+/// @internal LZ4 ブロック形式の展開。src を dst と同じバッファの後ろ寄りに置けばその場で展開できる
+/// （書き込みが未読の入力に追いつかないよう、dst の末尾から (srclen >> 8) + 32 バイト以上の余白を空けること）
+static bool lzDecompress(const uint8_t *src, uint32_t srclen, uint8_t *dst, uint32_t dstlen)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + srclen;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dstlen;
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+        uint32_t len = lzReadLength(&ip, iend, token >> 4);
+        if (len > (uint32_t)(iend - ip) || len > (uint32_t)(oend - op)) return false;
+        memmove(op, ip, len);
+        op += len;
+        ip += len;
+        // 最後のシーケンスはリテラルだけ
+        if (ip >= iend) break;
+
+        if (iend - ip < 2) return false;
+        const uint32_t offset = (uint32_t)ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) return false;
+        len = lzReadLength(&ip, iend, token & 15);
+        if (len == UINT32_MAX || len + 4 > (uint32_t)(oend - op)) return false;
+        len += 4;
+        const uint8_t *match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+        } else {
+            // 重なるコピーは前から1バイトずつ（繰り返しになる）
+            for (uint32_t i = 0; i < len; ++i) op[i] = match[i];
+        }
+        op += len;
+    }
+    return op == oend;
+}
+
+/// @internal .ani を読み込む。圧縮されていれば最終バッファの後ろに圧縮データを読み、その場で展開する
+/// （読めなければ NULL を返し、error に理由を入れる）
+static void* loadani(const char *path, int *outlen, enum pdani_file_error *error)
+{
+    *error = PDANI_FILE_ERROR_NONE;
+    SDFile *fp = s_api->file->open(path, kFileRead);
+    if (fp == NULL) {
+        *error = PDANI_FILE_ERROR_IO;
+        return NULL;
+    }
+    struct pdani_header header;
+    if (!streamRead(fp, 0, &header, sizeof(header)) || header.version < 2 || !BIT_CHECK(header.flags, PDANI_HEADER_FLAG_COMPRESSED)) {
+        s_api->file->close(fp);
+        void *buf = loadfile(path, outlen);
+        if (buf == NULL) *error = PDANI_FILE_ERROR_IO;
+        return buf;
+    }
+
+    const uint32_t prefix = sizeof(header) + ((sizeof(struct pdani_directory_entry) * header.chunk_count + 15) & ~15);
+    struct pdani_compressed_block block;
+    s_api->file->seek(fp, 0, SEEK_END);
+    const uint32_t length = (uint32_t)s_api->file->tell(fp);
+    // 確保する前に大きさを確かめる（LZ4 は入力1バイトから高々255バイトしか出さない）
+    if (!streamRead(fp, prefix, &block, sizeof(block)) || block.packed_size > length || block.raw_size / 255 > block.packed_size) {
+        s_api->file->close(fp);
+        *error = PDANI_FILE_ERROR_COMPRESSED;
+        return NULL;
+    }
+    const uint32_t margin = (block.packed_size >> 8) + 32;
+    const uint32_t capacity = (block.raw_size + margin > block.packed_size)? block.raw_size + margin : block.packed_size;
+    uint8_t *buf = mem_alloc(prefix + capacity);
+    uint8_t *packed = buf + prefix + capacity - block.packed_size;
+    const bool ok = streamRead(fp, 0, buf, prefix)
+        && streamRead(fp, prefix + sizeof(block), packed, block.packed_size)
+        && lzDecompress(packed, block.packed_size, buf + prefix, block.raw_size);
+    s_api->file->close(fp);
+    if (!ok) {
+        mem_realloc(s_allocator, buf, 0);
+        *error = PDANI_FILE_ERROR_COMPRESSED;
+        return NULL;
+    }
+    BIT_CLEAR(((struct pdani_header*)buf)->flags, PDANI_HEADER_FLAG_COMPRESSED);
+    if (outlen != NULL) *outlen = (int)(prefix + block.raw_size);
+    return buf;
+}
+
+/// @internal 読めなければ NULL（report なら system->error も呼ぶ）
+static LCDBitmap* loadbitmap(const char *path, bool report)
 {
     const char *err = NULL;
     LCDBitmap *bmp = s_api->graphics->loadBitmap(path, &err);
     if (err != NULL)
     {
-        s_api->system->error(err);
+        if (report) s_api->system->error(err);
+        return NULL;
     }
     return bmp;
 }
@@ -129,18 +354,87 @@ void pdani_global_initialize(PlaydateAPI *api)
     s_api = api;
 }
 
+void pdani_global_set_allocator(const struct pdani_allocator *allocator)
+{
+    s_allocator = allocator;
+}
+
+const struct pdani_allocator* pdani_global_get_allocator(void)
+{
+    return s_allocator;
+}
+
 void pdani_set_fps(int fps)
 {
     ASSERT(s_api != NULL);
     s_frame_ms = 1000 / fps;
 }
 
+static void fileBuildTagIndex(struct pdani_file *file);
+static void fileBuildSpanImages(struct pdani_file *file);
+
+/// @internal ATLS チャンクのテクセルとマスクからアトラスを作る
+static LCDBitmap* fileCreateAtlas(const struct pdani_file *file)
+{
+    const struct pdani_chunk *chunk = file->chunks[PDANI_CHUNK_TYPE_ATLAS];
+    if (chunk == NULL) return NULL;
+    const struct pdani_atlas_misc *misc = (const struct pdani_atlas_misc*)chunkGetMisc(chunk);
+    LCDBitmap *bitmap = s_api->graphics->newBitmap(misc->width, misc->height, kColorClear);
+    int rowbytes = 0;
+    uint8_t *mask = NULL, *texel = NULL;
+    s_api->graphics->getBitmapData(bitmap, NULL, NULL, &rowbytes, &mask, &texel);
+    ASSERT(mask != NULL && "atlas needs a mask");
+
+    const uint8_t *src = (const uint8_t*)chunkGetData(chunk);
+    const int bytes = (rowbytes < misc->rowbytes)? rowbytes : misc->rowbytes;
+    for (int y = 0; y < misc->height; ++y) {
+        memcpy(texel + rowbytes * y, src + misc->rowbytes * y, bytes);
+        memcpy(mask + rowbytes * y, src + misc->rowbytes * (misc->height + y), bytes);
+    }
+    return bitmap;
+}
+
 static void file_initialize(struct pdani_file *file, void *data, LCDBitmap *bitmap)
 {
     ASSERT(s_api != NULL && "need to call pdani_global_initialize)");
 
     memset(file, 0, sizeof(struct pdani_file));
+    file->allocator = s_allocator;
     file->header = data;
+
+    ASSERT(*(uint32_t*)&file->header->id[0] == *(uint32_t*)"PANI" && "not a .ani file");
+    ASSERT(!BIT_CHECK(file->header->flags, PDANI_HEADER_FLAG_COMPRESSED) && "compressed .ani must be loaded by filename");
+    if (file->header->version == 2) {
+        // v2: 固定のディレクトリを引くだけ
+        ASSERT(file->header->alignment >= 4 && "invalid alignment");
+        BIT_SET(file->flags, PDANI_FILE_FLAG_WIDE_OFFSETS);
+        const struct pdani_directory_entry *directory = (const struct pdani_directory_entry*)(file->header + 1);
+        const int count = (file->header->chunk_count < PDANI_CHUNK_TYPE_MAX)? file->header->chunk_count : PDANI_CHUNK_TYPE_MAX;
+        for (int i = 0; i < count; ++i) {
+            if (directory[i].offset == 0) continue;
+            const struct pdani_chunk *chunk = (const struct pdani_chunk*)seek(file, directory[i].offset);
+            ASSERT(*(uint32_t*)&chunk->id[0] == *(uint32_t*)s_chunk_names[i] && "chunk does not match directory");
+            file->chunks[i] = chunk;
+        }
+    } else if (file->header->version == 1) {
+        const struct pdani_chunk *chunk = (const struct pdani_chunk*)(file->header + 1);
+        do {
+            enum pdani_chunk_type type = detectChunkType(chunk);
+            ASSERT(0 <= type && type < PDANI_CHUNK_TYPE_MAX && "invalid chunk type");
+            file->chunks[(int)type] = chunk;
+            if (chunk->next == 0) break;
+            chunk = (const struct pdani_chunk*)seek(file, chunk->next << 4);
+        } while (1);
+    } else {
+        s_api->system->error("unsupported .ani version %d", (int)file->header->version);
+        return;
+    }
+
+    if (bitmap == NULL) {
+        bitmap = fileCreateAtlas(file);
+        ASSERT(bitmap != NULL && "no bitmap and no ATLS chunk");
+        BIT_SET(file->flags, PDANI_FILE_FLAG_OWN_BITMAP);
+    }
     file->bitmap = bitmap;
     s_api->graphics->getBitmapData(
         bitmap,
@@ -150,15 +444,10 @@ static void file_initialize(struct pdani_file *file, void *data, LCDBitmap *bitm
         &file->bitmap_info.mask,
         &file->bitmap_info.texel
     );
+    ASSERT((file->bitmap_info.rowbytes & 3) == 0 && "bitmap rows must be 32bit aligned");
 
-    const struct pdani_chunk *chunk = (const struct pdani_chunk*)(file->header + 1);
-    do {
-        enum pdani_chunk_type type = detectChunkType(chunk);
-        ASSERT(0 <= type && type < PDANI_CHUNK_TYPE_MAX && "invalid chunk type");
-        file->chunks[(int)type] = chunk;
-        if (chunk->next == 0) break;
-        chunk = (const struct pdani_chunk*)seek(file, chunk->next << 4);
-    } while (1);
+    fileBuildTagIndex(file);
+    fileBuildSpanImages(file);
 }
 
 void pdani_file_initialize(struct pdani_file *file, void *data, LCDBitmap *bitmap)
@@ -168,20 +457,601 @@ void pdani_file_initialize(struct pdani_file *file, void *data, LCDBitmap *bitma
 
 void pdani_file_initialize_with_filename(struct pdani_file *file, const char *anifilename, const char *bitmapfilename)
 {
-    void *ani = loadfile(anifilename);
-    LCDBitmap *bmp = loadbitmap(bitmapfilename);
+    enum pdani_file_error error;
+    void *ani = loadani(anifilename, NULL, &error);
+    ASSERT(ani != NULL && "cannot load .ani");
+    LCDBitmap *bmp = (bitmapfilename != NULL)? loadbitmap(bitmapfilename, true) : NULL;
     file_initialize(file, ani, bmp);
     BIT_SET(file->flags, PDANI_FILE_FLAG_SELF_ALLOCATE);
 }
 
+// validate
+// 検証したファイルは描画・更新で範囲を調べないので、そこで引く番号と位置をここですべて確かめる
+
+static const char *s_file_error_names[] = {
+    "none",
+    "io",
+    "header",
+    "compressed",
+    "chunk",
+    "table",
+    "frame",
+    "index",
+    "string",
+    "layer",
+    "atlas",
+};
+
+/// @internal [offset, offset + length) が size に収まるか
+static inline bool validateRange(size_t size, size_t offset, size_t length)
+{
+    return offset <= size && length <= size - offset;
+}
+
+/// @internal ヘッダとチャンクの位置を調べ、probe->chunks に並べる
+static enum pdani_file_error validateChunks(struct pdani_file *probe, const uint8_t *data, size_t size)
+{
+    const struct pdani_header *header = (const struct pdani_header*)data;
+    if (size < sizeof(struct pdani_header) || ((uintptr_t)data & 3) != 0) return PDANI_FILE_ERROR_HEADER;
+    if (memcmp(header->id, "PANI", 4) != 0) return PDANI_FILE_ERROR_HEADER;
+    if (BIT_CHECK(header->flags, PDANI_HEADER_FLAG_COMPRESSED)) return PDANI_FILE_ERROR_COMPRESSED;
+    probe->header = (struct pdani_header*)header;
+
+    if (header->version == 2) {
+        if (header->alignment < 4) return PDANI_FILE_ERROR_HEADER;
+        BIT_SET(probe->flags, PDANI_FILE_FLAG_WIDE_OFFSETS);
+        if (!validateRange(size, sizeof(struct pdani_header), sizeof(struct pdani_directory_entry) * header->chunk_count)) return PDANI_FILE_ERROR_CHUNK;
+        const struct pdani_directory_entry *directory = (const struct pdani_directory_entry*)(header + 1);
+        const int count = (header->chunk_count < PDANI_CHUNK_TYPE_MAX)? header->chunk_count : PDANI_CHUNK_TYPE_MAX;
+        for (int i = 0; i < count; ++i) {
+            const uint32_t offset = directory[i].offset;
+            if (offset == 0) continue;
+            if ((offset & 3) != 0 || !validateRange(size, offset, sizeof(struct pdani_chunk_v2))) return PDANI_FILE_ERROR_CHUNK;
+            const struct pdani_chunk_v2 *chunk = (const struct pdani_chunk_v2*)(data + offset);
+            if (memcmp(chunk->id, s_chunk_names[i], 4) != 0) return PDANI_FILE_ERROR_CHUNK;
+            if (!validateRange(size, (size_t)offset + sizeof(struct pdani_chunk_v2), chunk->size)) return PDANI_FILE_ERROR_CHUNK;
+            probe->chunks[i] = (const struct pdani_chunk*)chunk;
+        }
+    } else if (header->version == 1) {
+        size_t offset = sizeof(struct pdani_header);
+        do {
+            if (!validateRange(size, offset, sizeof(struct pdani_chunk))) return PDANI_FILE_ERROR_CHUNK;
+            const struct pdani_chunk *chunk = (const struct pdani_chunk*)(data + offset);
+            int type = 0;
+            while (type < PDANI_CHUNK_TYPE_MAX && memcmp(chunk->id, s_chunk_names[type], 4) != 0) ++type;
+            if (type == PDANI_CHUNK_TYPE_MAX) return PDANI_FILE_ERROR_CHUNK;
+            if (!validateRange(size, offset + sizeof(struct pdani_chunk), chunk->size)) return PDANI_FILE_ERROR_CHUNK;
+            probe->chunks[type] = chunk;
+            if (chunk->next == 0) break;
+            // 後ろにしか進めないので循環しない
+            if (((size_t)chunk->next << 4) <= offset) return PDANI_FILE_ERROR_CHUNK;
+            offset = (size_t)chunk->next << 4;
+        } while (1);
+    } else {
+        return PDANI_FILE_ERROR_HEADER;
+    }
+
+    if (probe->chunks[PDANI_CHUNK_TYPE_INFO] == NULL || probe->chunks[PDANI_CHUNK_TYPE_LAYER] == NULL || probe->chunks[PDANI_CHUNK_TYPE_FRAME] == NULL) {
+        return PDANI_FILE_ERROR_CHUNK;
+    }
+    return PDANI_FILE_ERROR_NONE;
+}
+
+/// @internal misc の先頭の要素数（entry_size バイトずつ並べてチャンクに収まらなければ -1。チャンクが無ければ 0）
+static int validateGetCount(const struct pdani_file *probe, enum pdani_chunk_type type, size_t entry_size)
+{
+    const struct pdani_chunk *chunk = probe->chunks[type];
+    if (chunk == NULL) return 0;
+    const int count = *(const uint16_t*)chunkGetMisc(chunk);
+    return ((size_t)count * entry_size <= chunkGetSize(probe, chunk))? count : -1;
+}
+
+/// @internal STRG の終端は検証済みなので、位置が中にあれば文字列として読める
+static inline bool validateString(const struct pdani_file *probe, uint32_t offset)
+{
+    const struct pdani_chunk *chunk = probe->chunks[PDANI_CHUNK_TYPE_STRING];
+    return chunk != NULL && offset < chunkGetSize(probe, chunk);
+}
+
+static enum pdani_file_error fileValidate(struct pdani_file *probe, const void *data, size_t size, int atlas_width, int atlas_height)
+{
+    memset(probe, 0, sizeof(struct pdani_file));
+    const enum pdani_file_error error = validateChunks(probe, (const uint8_t*)data, size);
+    if (error != PDANI_FILE_ERROR_NONE) return error;
+
+    const int tag_count = validateGetCount(probe, PDANI_CHUNK_TYPE_TAG, sizeof(struct pdani_tag_data));
+    const int layer_count = validateGetCount(probe, PDANI_CHUNK_TYPE_LAYER, sizeof(struct pdani_layer_data));
+    const int frame_count = validateGetCount(probe, PDANI_CHUNK_TYPE_FRAME, tableGetEntrySize(probe));
+    const int cel_count = validateGetCount(probe, PDANI_CHUNK_TYPE_CEL, sizeof(struct pdani_cel_data));
+    const int collider_count = validateGetCount(probe, PDANI_CHUNK_TYPE_COLLIDER, sizeof(struct pdani_collider_data));
+    const int image_count = validateGetCount(probe, PDANI_CHUNK_TYPE_IMAGE, sizeof(struct pdani_image_data));
+    if (tag_count < 0 || layer_count < 0 || frame_count <= 0 || cel_count < 0 || collider_count < 0 || image_count < 0) {
+        return PDANI_FILE_ERROR_CHUNK;
+    }
+
+    const struct pdani_chunk *strings = probe->chunks[PDANI_CHUNK_TYPE_STRING];
+    if (strings != NULL) {
+        const uint32_t strings_size = chunkGetSize(probe, strings);
+        if (strings_size == 0 || ((const char*)chunkGetData(strings))[strings_size - 1] != '\0') return PDANI_FILE_ERROR_STRING;
+    }
+
+    // アトラスが渡されなければ ATLS から作る
+    if (atlas_width == 0 && atlas_height == 0) {
+        const struct pdani_chunk *atlas = probe->chunks[PDANI_CHUNK_TYPE_ATLAS];
+        if (atlas == NULL) return PDANI_FILE_ERROR_ATLAS;
+        const struct pdani_atlas_misc *misc = (const struct pdani_atlas_misc*)chunkGetMisc(atlas);
+        if (misc->rowbytes * 8 < misc->width || (size_t)misc->rowbytes * misc->height * 2 > chunkGetSize(probe, atlas)) return PDANI_FILE_ERROR_ATLAS;
+        atlas_width = misc->width;
+        atlas_height = misc->height;
+    }
+
+    for (int i = 0; i < tag_count; ++i) {
+        const struct pdani_tag_data *tag = (const struct pdani_tag_data*)chunkGetData(probe->chunks[PDANI_CHUNK_TYPE_TAG]) + i;
+        if (tag->from < 1 || tag->from > tag->to || tag->to > frame_count) return PDANI_FILE_ERROR_INDEX;
+        if (!validateString(probe, tag->name)) return PDANI_FILE_ERROR_STRING;
+    }
+
+    // 親は自分より前のグループ（レイヤーマスクは先頭から1回なめて子孫に伝える）
+    const struct pdani_layer_data *layers = (const struct pdani_layer_data*)chunkGetData(probe->chunks[PDANI_CHUNK_TYPE_LAYER]);
+    int frame_layer_count = 0;
+    for (int i = 0; i < layer_count; ++i) {
+        const struct pdani_layer_data *layer = &layers[i];
+        if (layer->type != PDANI_LAYER_TYPE_LAYER && layer->type != PDANI_LAYER_TYPE_GROUP && layer->type != PDANI_LAYER_TYPE_COLLIDER) return PDANI_FILE_ERROR_LAYER;
+        if (layer->parent != -1 && (layer->parent < 0 || layer->parent >= i || layers[layer->parent].type != PDANI_LAYER_TYPE_GROUP)) return PDANI_FILE_ERROR_LAYER;
+        if (!validateString(probe, layer->name)) return PDANI_FILE_ERROR_STRING;
+        if (layer->type != PDANI_LAYER_TYPE_GROUP) ++frame_layer_count;
+    }
+
+    // フレームはジャンプテーブルの先に、グループ以外のレイヤーの数だけ並ぶ
+    const struct pdani_chunk *frames = probe->chunks[PDANI_CHUNK_TYPE_FRAME];
+    const uint32_t frames_size = chunkGetSize(probe, frames);
+    const size_t frame_size = sizeof(struct pdani_frame_data) + sizeof(struct pdani_frame_layer) * frame_layer_count;
+    uint32_t draw_total = 0, event_total = 0;
+    for (int f = 0; f < frame_count; ++f) {
+        const uint32_t offset = tableGet(probe, chunkGetData(frames), f);
+        if ((offset & 1) != 0 || !validateRange(frames_size, offset, frame_size)) return PDANI_FILE_ERROR_TABLE;
+        const struct pdani_frame_data *frame = (const struct pdani_frame_data*)seekChunkData(frames, (int)offset);
+        // 長さ 0 のフレームばかりだと更新が進まない
+        if (frame->duration == 0) return PDANI_FILE_ERROR_FRAME;
+        const struct pdani_frame_layer *frame_layer = &frame->layers[0];
+        for (int i = 0; i < layer_count; ++i) {
+            if (layers[i].type == PDANI_LAYER_TYPE_GROUP) continue;
+            if (layers[i].type == PDANI_LAYER_TYPE_LAYER && frame_layer->cel >= 0) {
+                if (frame_layer->cel >= cel_count) return PDANI_FILE_ERROR_INDEX;
+                ++draw_total;
+            }
+            if (layers[i].type == PDANI_LAYER_TYPE_COLLIDER && frame_layer->collider >= collider_count) return PDANI_FILE_ERROR_INDEX;
+            if (frame_layer->userCallback != 0) {
+                if (!validateString(probe, frame_layer->userCallback)) return PDANI_FILE_ERROR_STRING;
+                ++event_total;
+            }
+            ++frame_layer;
+        }
+    }
+    // 描画命令とイベントの表は 16bit の位置で引く
+    if (draw_total > 0xffff || event_total > 0xffff) return PDANI_FILE_ERROR_INDEX;
+
+    for (int i = 0; i < cel_count; ++i) {
+        const struct pdani_cel_data *cel = (const struct pdani_cel_data*)chunkGetData(probe->chunks[PDANI_CHUNK_TYPE_CEL]) + i;
+        if (cel->image >= image_count) return PDANI_FILE_ERROR_INDEX;
+    }
+    const struct pdani_image_data *images = (image_count > 0)? (const struct pdani_image_data*)chunkGetData(probe->chunks[PDANI_CHUNK_TYPE_IMAGE]) : NULL;
+    for (int i = 0; i < image_count; ++i) {
+        const struct pdani_image_data *image = &images[i];
+        if (image->u < 0 || image->v < 0 || image->u + image->w > atlas_width || image->v + image->h > atlas_height) return PDANI_FILE_ERROR_ATLAS;
+    }
+
+    const struct pdani_chunk *spans = probe->chunks[PDANI_CHUNK_TYPE_SPAN];
+    if (spans != NULL) {
+        const uint32_t spans_size = chunkGetSize(probe, spans);
+        const int count = ((const struct pdani_span_misc*)chunkGetMisc(spans))->count;
+        const size_t table_size = (size_t)tableGetEntrySize(probe) * (count + 1);
+        if (count < image_count || table_size > spans_size) return PDANI_FILE_ERROR_TABLE;
+        const void *table = chunkGetData(spans);
+        const struct pdani_span_data *span_data = (const struct pdani_span_data*)((const uint8_t*)table + table_size);
+        const uint32_t total = tableGet(probe, table, count);
+        if (total > (spans_size - table_size) / sizeof(struct pdani_span_data)) return PDANI_FILE_ERROR_TABLE;
+        for (int i = 0; i < count; ++i) {
+            const uint32_t begin = tableGet(probe, table, i);
+            const uint32_t end = tableGet(probe, table, i + 1);
+            if (begin > end || end > total) return PDANI_FILE_ERROR_TABLE;
+            if (i >= image_count) continue;
+            for (uint32_t j = begin; j < end; ++j) {
+                const struct pdani_span_data *span = &span_data[j];
+                if (span->x + span->w > images[i].w || span->y + span->h > images[i].h) return PDANI_FILE_ERROR_ATLAS;
+            }
+        }
+    }
+
+    const struct pdani_chunk *variants = probe->chunks[PDANI_CHUNK_TYPE_VARIANT];
+    if (variants != NULL) {
+        const struct pdani_variant_misc *misc = (const struct pdani_variant_misc*)chunkGetMisc(variants);
+        const uint32_t variant_count = (uint32_t)misc->angle_count * misc->scale_count;
+        if (misc->angle_count == 0 || misc->scale_count == 0 || variant_count > 0xffff) return PDANI_FILE_ERROR_CHUNK;
+        const size_t cel_total = (size_t)(variant_count - 1) * frame_count;
+        if (sizeof(uint16_t) * misc->scale_count + sizeof(int16_t) * cel_total > chunkGetSize(probe, variants)) return PDANI_FILE_ERROR_CHUNK;
+        const int16_t *cels = (const int16_t*)((const uint16_t*)chunkGetData(variants) + misc->scale_count);
+        for (size_t i = 0; i < cel_total; ++i) {
+            if (cels[i] == PDANI_VARIANT_CEL_NOT_BAKED || cels[i] == PDANI_VARIANT_CEL_EMPTY) continue;
+            if (cels[i] < 0 || cels[i] >= cel_count) return PDANI_FILE_ERROR_INDEX;
+        }
+    }
+    return PDANI_FILE_ERROR_NONE;
+}
+
+enum pdani_file_error pdani_file_validate(const void *data, size_t size, int atlas_width, int atlas_height)
+{
+    struct pdani_file probe;
+    return fileValidate(&probe, data, size, atlas_width, atlas_height);
+}
+
+const char* pdani_file_get_error_name(enum pdani_file_error error)
+{
+    if ((unsigned)error >= sizeof(s_file_error_names) / sizeof(s_file_error_names[0])) return "unknown";
+    return s_file_error_names[error];
+}
+
+enum pdani_file_error pdani_file_initialize_validated(struct pdani_file *file, void *data, size_t size, LCDBitmap *bitmap)
+{
+    ASSERT(s_api != NULL && "need to call pdani_global_initialize)");
+    int width = 0, height = 0;
+    if (bitmap != NULL) s_api->graphics->getBitmapData(bitmap, &width, &height, NULL, NULL, NULL);
+    const enum pdani_file_error error = fileValidate(file, data, size, width, height);
+    if (error != PDANI_FILE_ERROR_NONE) {
+        memset(file, 0, sizeof(struct pdani_file));
+        return error;
+    }
+    file_initialize(file, data, bitmap);
+    BIT_SET(file->flags, PDANI_FILE_FLAG_VALIDATED);
+    return PDANI_FILE_ERROR_NONE;
+}
+
+// @internal size に読み込んだ .ani のバイト数を返す
+static enum pdani_file_error fileInitializeWithFilename(struct pdani_file *file, const char *anifilename, const char *bitmapfilename, int *size)
+{
+    memset(file, 0, sizeof(struct pdani_file));
+    enum pdani_file_error error;
+    void *ani = loadani(anifilename, size, &error);
+    if (ani == NULL) return error;
+    LCDBitmap *bmp = NULL;
+    if (bitmapfilename != NULL) {
+        bmp = loadbitmap(bitmapfilename, false);
+        if (bmp == NULL) {
+            mem_realloc(s_allocator, ani, 0);
+            return PDANI_FILE_ERROR_IO;
+        }
+    }
+    error = pdani_file_initialize_validated(file, ani, (size_t)*size, bmp);
+    if (error != PDANI_FILE_ERROR_NONE) {
+        mem_realloc(s_allocator, ani, 0);
+        if (bmp != NULL) s_api->graphics->freeBitmap(bmp);
+        return error;
+    }
+    BIT_SET(file->flags, PDANI_FILE_FLAG_SELF_ALLOCATE);
+    return PDANI_FILE_ERROR_NONE;
+}
+
+enum pdani_file_error pdani_file_initialize_with_filename_validated(struct pdani_file *file, const char *anifilename, const char *bitmapfilename)
+{
+    int size = 0;
+    return fileInitializeWithFilename(file, anifilename, bitmapfilename, &size);
+}
+
+// intern
+// ID はファイルより長生きするので、pdani_global_set_allocator のアロケータではなく system->realloc で持つ
+
+static int internFindSlot(const char *name, uint32_t hash)
+{
+    int h = (int)(hash & (uint32_t)s_intern.mask);
+    while (s_intern.slots[h] != 0) {
+        if (strcmp(s_intern.names[s_intern.slots[h] - 1], name) == 0) break;
+        h = (h + 1) & s_intern.mask;
+    }
+    return h;
+}
+
+static void internGrowSlots(void)
+{
+    const int size = (s_intern.slots != NULL)? (s_intern.mask + 1) * 2 : 64;
+    uint16_t *old = s_intern.slots;
+    s_intern.slots = s_api->system->realloc(NULL, sizeof(uint16_t) * size);
+    memset(s_intern.slots, 0, sizeof(uint16_t) * size);
+    s_intern.mask = size - 1;
+    for (int id = 1; id <= s_intern.count; ++id) {
+        const int h = internFindSlot(s_intern.names[id - 1], hashString(s_intern.names[id - 1]));
+        s_intern.slots[h] = (uint16_t)id;
+    }
+    if (old != NULL) s_api->system->realloc(old, 0);
+}
+
+int pdani_intern(const char *name)
+{
+    ASSERT(s_api != NULL);
+    ASSERT(name != NULL);
+    if (s_intern.slots == NULL) internGrowSlots();
+
+    const uint32_t hash = hashString(name);
+    int h = internFindSlot(name, hash);
+    if (s_intern.slots[h] != 0) return s_intern.slots[h];
+
+    ASSERT(s_intern.count < 0xffff && "too many interned strings");
+    if ((s_intern.count + 1) * 2 > s_intern.mask + 1) {
+        internGrowSlots();
+        h = internFindSlot(name, hash);
+    }
+    if (s_intern.count >= s_intern.capacity) {
+        s_intern.capacity = (s_intern.capacity > 0)? s_intern.capacity * 2 : 32;
+        s_intern.names = s_api->system->realloc(s_intern.names, sizeof(char*) * s_intern.capacity);
+    }
+    const size_t len = strlen(name) + 1;
+    char *copy = s_api->system->realloc(NULL, len);
+    memcpy(copy, name, len);
+    s_intern.names[s_intern.count++] = copy;
+    s_intern.slots[h] = (uint16_t)s_intern.count;
+    return s_intern.count;
+}
+
+const char* pdani_intern_get_name(int id)
+{
+    if (id < 1 || id > s_intern.count) return NULL;
+    return s_intern.names[id - 1];
+}
+
+// asset
+// 共有ファイルはアリーナのリセットより長生きするので、pdani_global_set_allocator のアロケータではなく system->realloc で持つ
+
+static void assetFree(struct pdani_asset *asset)
+{
+    struct pdani_asset **link = &s_assets.head;
+    while (*link != asset) link = &(*link)->next;
+    *link = asset->next;
+    s_assets.unused_size -= asset->size;
+    pdani_file_finalize(&asset->file);
+    s_api->system->realloc(asset, 0);
+}
+
+/// @internal 予算を超えた分を参照されていない古いものから捨てる
+static void assetTrim(size_t budget)
+{
+    while (s_assets.unused_size > budget) {
+        struct pdani_asset *oldest = NULL;
+        for (struct pdani_asset *asset = s_assets.head; asset != NULL; asset = asset->next) {
+            if (asset->refcount == 0 && (oldest == NULL || asset->last_used < oldest->last_used)) {
+                oldest = asset;
+            }
+        }
+        if (oldest == NULL) break;
+        assetFree(oldest);
+    }
+}
+
+struct pdani_file* pdani_asset_acquire(const char *anifilename, const char *bmpfilename)
+{
+    ASSERT(s_api != NULL);
+    if (bmpfilename == NULL) bmpfilename = "";
+    const size_t anilen = strlen(anifilename) + 1;
+    const size_t bmplen = strlen(bmpfilename) + 1;
+    const uint32_t hash = hashString(anifilename) ^ (hashString(bmpfilename) * 16777619u);
+
+    ++s_assets.tick;
+    for (struct pdani_asset *asset = s_assets.head; asset != NULL; asset = asset->next) {
+        if (asset->hash == hash && strcmp(asset->key, anifilename) == 0 && strcmp(asset->key + anilen, bmpfilename) == 0) {
+            if (asset->refcount++ == 0) s_assets.unused_size -= asset->size;
+            asset->last_used = s_assets.tick;
+            return &asset->file;
+        }
+    }
+
+    struct pdani_asset *asset = s_api->system->realloc(NULL, sizeof(struct pdani_asset) + anilen + bmplen);
+    const struct pdani_allocator *allocator = s_allocator;
+    s_allocator = NULL;
+    int size = 0;
+    const enum pdani_file_error error = fileInitializeWithFilename(&asset->file, anifilename, (*bmpfilename != '\0')? bmpfilename : NULL, &size);
+    s_allocator = allocator;
+    if (error != PDANI_FILE_ERROR_NONE) {
+        s_api->system->realloc(asset, 0);
+        return NULL;
+    }
+    BIT_SET(asset->file.flags, PDANI_FILE_FLAG_SHARED);
+    asset->hash = hash;
+    asset->refcount = 1;
+    asset->last_used = s_assets.tick;
+    asset->size = (size_t)size + (size_t)asset->file.bitmap_info.rowbytes * asset->file.bitmap_info.height * 2;
+    memcpy(asset->key, anifilename, anilen);
+    memcpy(asset->key + anilen, bmpfilename, bmplen);
+    asset->next = s_assets.head;
+    s_assets.head = asset;
+    return &asset->file;
+}
+
+void pdani_asset_release(struct pdani_file *file)
+{
+    ASSERT(BIT_CHECK(file->flags, PDANI_FILE_FLAG_SHARED) && "not acquired by pdani_asset_acquire");
+    struct pdani_asset *asset = (struct pdani_asset*)file;
+    ASSERT(asset->refcount > 0);
+    if (--asset->refcount > 0) return;
+    s_assets.unused_size += asset->size;
+    assetTrim(s_assets.budget);
+}
+
+void pdani_asset_set_budget(size_t bytes)
+{
+    s_assets.budget = bytes;
+    assetTrim(s_assets.budget);
+}
+
+void pdani_asset_purge(void)
+{
+    assetTrim(0);
+}
+
+// @internal チャンクの見出しを読んで常駐部分を組み立てる（fp は呼び出し側で閉じる）
+static enum pdani_file_error streamInitialize(struct pdani_file *file, SDFile *fp, LCDBitmap *bitmap, int cache_bytes)
+{
+    if (s_api->file->seek(fp, 0, SEEK_END) != 0) return PDANI_FILE_ERROR_IO;
+    const int length = s_api->file->tell(fp);
+    if (length < (int)sizeof(struct pdani_header)) return PDANI_FILE_ERROR_HEADER;
+    const uint32_t file_size = (uint32_t)length;
+
+    struct pdani_file probe = { 0 };
+    struct pdani_header header;
+    if (!streamRead(fp, 0, &header, sizeof(header))) return PDANI_FILE_ERROR_IO;
+    if (*(uint32_t*)&header.id[0] != *(uint32_t*)"PANI" || (header.version != 1 && header.version != 2)) return PDANI_FILE_ERROR_HEADER;
+    if (BIT_CHECK(header.flags, PDANI_HEADER_FLAG_COMPRESSED)) return PDANI_FILE_ERROR_COMPRESSED;
+    const bool v2 = header.version == 2;
+    if (v2) BIT_SET(probe.flags, PDANI_FILE_FLAG_WIDE_OFFSETS);
+
+    // チャンクヘッダだけを読み、常駐させる部分の大きさを数える
+    struct {
+        struct pdani_chunk chunk;
+        int type;
+        uint32_t offset; //< ファイル内でのデータ位置
+        uint32_t size; //< 常駐させるバイト数
+    } entries[PDANI_CHUNK_TYPE_MAX];
+    int count = 0;
+    uint32_t frame_data_offset = 0, frame_data_size = 0;
+    struct pdani_directory_entry directory[PDANI_CHUNK_TYPE_MAX];
+    const int directory_count = (header.chunk_count < PDANI_CHUNK_TYPE_MAX)? header.chunk_count : PDANI_CHUNK_TYPE_MAX;
+    if (v2 && !streamRead(fp, sizeof(header), directory, sizeof(struct pdani_directory_entry) * directory_count)) {
+        return PDANI_FILE_ERROR_IO;
+    }
+    uint32_t pos = (v2)? 0 : sizeof(header);
+    for (int i = 0; (v2)? i < directory_count : pos != 0; ++i) {
+        if (v2) {
+            pos = directory[i].offset;
+            if (pos == 0) continue;
+        }
+        if (count >= (int)PDANI_CHUNK_TYPE_MAX || pos > file_size - sizeof(struct pdani_chunk)) return PDANI_FILE_ERROR_CHUNK;
+        struct pdani_chunk *chunk = &entries[count].chunk;
+        if (!streamRead(fp, pos, chunk, sizeof(struct pdani_chunk))) return PDANI_FILE_ERROR_IO;
+        int type = i;
+        if (!v2) {
+            for (type = 0; type < (int)PDANI_CHUNK_TYPE_MAX; ++type) {
+                if (*(uint32_t*)&chunk->id[0] == *(uint32_t*)s_chunk_names[type]) break;
+            }
+            if (type == (int)PDANI_CHUNK_TYPE_MAX) return PDANI_FILE_ERROR_CHUNK;
+        }
+        entries[count].type = type;
+        entries[count].offset = pos + sizeof(struct pdani_chunk);
+        entries[count].size = chunkGetSize(&probe, chunk);
+        if (entries[count].size > file_size - entries[count].offset) return PDANI_FILE_ERROR_CHUNK;
+        if (entries[count].type == PDANI_CHUNK_TYPE_FRAME) {
+            // FRAM はジャンプテーブルだけ常駐させる
+            frame_data_offset = entries[count].offset;
+            frame_data_size = entries[count].size;
+            entries[count].size = ((const struct pdani_frame_misc*)chunkGetMisc(chunk))->count * tableGetEntrySize(&probe);
+            if (entries[count].size > frame_data_size) return PDANI_FILE_ERROR_TABLE;
+        }
+        if (!v2) pos = chunk->next << 4;
+        ++count;
+    }
+
+    if (bitmap == NULL) {
+        bool atlas = false;
+        for (int i = 0; i < count; ++i) {
+            if (entries[i].type == PDANI_CHUNK_TYPE_ATLAS) atlas = true;
+        }
+        if (!atlas) return PDANI_FILE_ERROR_ATLAS;
+    }
+
+    // 常駐部分を詰めて並べ直す（next やディレクトリも詰めた位置に書き換える）
+    const uint32_t directory_size = (v2)? ((sizeof(struct pdani_directory_entry) * header.chunk_count + 15) & ~15) : 0;
+    uint32_t total = sizeof(header) + directory_size;
+    for (int i = 0; i < count; ++i) {
+        total += sizeof(struct pdani_chunk) + ((entries[i].size + 15) & ~15);
+    }
+    uint8_t *data = mem_alloc(total);
+    memset(data, 0, total);
+    header.alignment = 16;
+    memcpy(data, &header, sizeof(header));
+    struct pdani_directory_entry *packed_directory = (struct pdani_directory_entry*)(data + sizeof(header));
+    if (v2) {
+        memcpy(packed_directory, directory, sizeof(struct pdani_directory_entry) * directory_count);
+        for (int i = 0; i < directory_count; ++i) {
+            packed_directory[i].offset = 0;
+        }
+    }
+    uint32_t offset = sizeof(header) + directory_size;
+    for (int i = 0; i < count; ++i) {
+        struct pdani_chunk *chunk = (struct pdani_chunk*)(data + offset);
+        *chunk = entries[i].chunk;
+        if (!streamRead(fp, entries[i].offset, chunk + 1, entries[i].size)) {
+            mem_realloc(s_allocator, data, 0);
+            return PDANI_FILE_ERROR_IO;
+        }
+        if (v2) {
+            ((struct pdani_chunk_v2*)chunk)->size = entries[i].size;
+            packed_directory[entries[i].type].offset = offset;
+        } else {
+            chunk->size = (uint16_t)entries[i].size;
+        }
+        offset += sizeof(struct pdani_chunk) + ((entries[i].size + 15) & ~15);
+        if (!v2) chunk->next = (i + 1 < count)? (uint16_t)(offset >> 4) : 0;
+    }
+
+    file_initialize(file, data, bitmap);
+
+    struct pdani_stream *stream = fileAlloc(file, sizeof(struct pdani_stream));
+    memset(stream, 0, sizeof(struct pdani_stream));
+    stream->fp = fp;
+    stream->frame_data_offset = frame_data_offset;
+    stream->frame_data_size = frame_data_size;
+    stream->budget = (cache_bytes > 0)? (uint32_t)cache_bytes : 0;
+    file->stream = stream;
+    return PDANI_FILE_ERROR_NONE;
+}
+
+enum pdani_file_error pdani_file_initialize_streaming(struct pdani_file *file, const char *anifilename, LCDBitmap *bitmap, int cache_bytes)
+{
+    memset(file, 0, sizeof(struct pdani_file));
+    SDFile *fp = s_api->file->open(anifilename, kFileRead);
+    if (fp == NULL) return PDANI_FILE_ERROR_IO;
+    const enum pdani_file_error error = streamInitialize(file, fp, bitmap, cache_bytes);
+    if (error != PDANI_FILE_ERROR_NONE) {
+        s_api->file->close(fp);
+        memset(file, 0, sizeof(struct pdani_file));
+    }
+    return error;
+}
+
 void pdani_file_finalize(struct pdani_file *file)
 {
-    if (BIT_CHECK(file->flags, PDANI_FILE_FLAG_SELF_ALLOCATE))
+    // 項目数をヘッダーから引くので先に捨てる
+    pdani_file_enable_frame_cache(file, 0);
+    if (BIT_CHECK(file->flags, PDANI_FILE_FLAG_SELF_ALLOCATE | PDANI_FILE_FLAG_OWN_BITMAP))
     {
         s_api->graphics->freeBitmap(file->bitmap);
-        mem_free(file->bitmap);
-        mem_free(file->header);
     }
+    if (BIT_CHECK(file->flags, PDANI_FILE_FLAG_SELF_ALLOCATE))
+    {
+        fileFree(file, file->header);
+    }
+    if (file->stream != NULL)
+    {
+        for (int i = 0; i < PDANI_STREAM_CACHE_SLOTS; ++i) {
+            fileFree(file, file->stream->slots[i].data);
+        }
+        s_api->file->close(file->stream->fp);
+        fileFree(file, file->stream);
+        file->stream = NULL;
+        fileFree(file, file->header);
+    }
+    fileFree(file, file->bitmap_info.flipped_texel);
+    file->bitmap_info.flipped_texel = NULL;
+    file->bitmap_info.flipped_mask = NULL;
+    fileFree(file, file->tag_index.slots);
+    file->tag_index.slots = NULL;
+    fileFree(file, file->span_images);
+    file->span_images = NULL;
+    fileFree(file, file->draw_list.commands);
+    file->draw_list.commands = NULL;
+    file->draw_list.frame_start = NULL;
+    fileFree(file, file->frame_time);
+    file->frame_time = NULL;
+    fileFree(file, file->frame_bounds);
+    file->frame_bounds = NULL;
+    fileFree(file, file->symbols.layer_ids);
+    memset(&file->symbols, 0, sizeof(file->symbols));
 }
 
 int pdani_file_get_width(const struct pdani_file *file)
@@ -199,7 +1069,8 @@ int pdani_file_get_height(const struct pdani_file *file)
 // tag
 int pdani_file_get_tag_count(const struct pdani_file *file)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_TAG] != NULL);
+    // TAGS は無くてもよい
+    if (file->chunks[PDANI_CHUNK_TYPE_TAG] == NULL) return 0;
     return ((const struct pdani_tag_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_TAG]))->count;
 }
 
@@ -209,17 +1080,45 @@ static inline const struct pdani_tag_data* spriteGetTagData(const struct pdani_f
     return ((const struct pdani_tag_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_TAG]) + index);
 }
 
-static const struct pdani_tag_data* spriteFindTagData(const struct pdani_file *file, const char *name)
+static void fileBuildTagIndex(struct pdani_file *file)
 {
-    // @todo improvement
-    for (int i = 0; i < pdani_file_get_tag_count(file); ++i) {
+    if (file->chunks[PDANI_CHUNK_TYPE_TAG] == NULL) return;
+    const int count = pdani_file_get_tag_count(file);
+    if (count == 0) return;
+
+    int size = 4;
+    while (size < count * 2) size <<= 1;
+    uint16_t *slots = fileAlloc(file, sizeof(uint16_t) * size);
+    memset(slots, 0, sizeof(uint16_t) * size);
+    const uint32_t mask = (uint32_t)(size - 1);
+
+    for (int i = 0; i < count; ++i) {
         const struct pdani_tag_data *tag = spriteGetTagData(file, i);
-        const char *tagname = getString(file, tag->name);
-        if (strcmp(tagname, name) == 0) {
-            return tag;
+        uint32_t h = hashString(getString(file, tag->name)) & mask;
+        // 同名のタグは先に出てきたものを優先する（線形探索と同じ結果）
+        while (slots[h] != 0) {
+            h = (h + 1) & mask;
         }
+        slots[h] = (uint16_t)(i + 1);
     }
-    return NULL;
+    file->tag_index.slots = slots;
+    file->tag_index.mask = mask;
+}
+
+int pdani_file_find_tag(const struct pdani_file *file, const char *tagname)
+{
+    ASSERT(file != NULL && tagname != NULL);
+    if (file->tag_index.slots == NULL) return -1;
+
+    uint32_t h = hashString(tagname) & file->tag_index.mask;
+    while (file->tag_index.slots[h] != 0) {
+        const int index = file->tag_index.slots[h] - 1;
+        if (strcmp(getString(file, spriteGetTagData(file, index)->name), tagname) == 0) {
+            return index;
+        }
+        h = (h + 1) & file->tag_index.mask;
+    }
+    return -1;
 }
 
 const char* pdani_file_get_tag_name(const struct pdani_file *file, int index)
@@ -247,211 +1146,585 @@ const char* pdani_file_get_layer_name(const struct pdani_file *file, int index)
     return getString(file, layer->name);
 }
 
-// frame
-int pdani_file_get_frame_count(const struct pdani_file *file)
+int pdani_file_find_layer(const struct pdani_file *file, const char *layername)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_FRAME] != NULL);
-    return ((const struct pdani_frame_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_FRAME]))->count;
+    ASSERT(file != NULL && layername != NULL);
+    const int count = pdani_file_get_layer_count(file);
+    for (int i = 0; i < count; ++i) {
+        if (strcmp(pdani_file_get_layer_name(file, i), layername) == 0) return i;
+    }
+    return -1;
 }
 
-static inline const struct pdani_frame_data* spriteGetFrameData(const struct pdani_file *file, int frameNumber)
+/// @internal hidden は pdani_player.hidden_layers（マスクの外のレイヤーは常に描く）
+static inline bool layerIsHidden(uint64_t hidden, int index)
 {
-    const struct pdani_chunk *chunk = file->chunks[PDANI_CHUNK_TYPE_FRAME];
-    ASSERT(chunk != NULL);
-    uint16_t *table = (uint16_t*)chunkGetData(chunk);
-    ASSERT(1 <= frameNumber && frameNumber <= pdani_file_get_frame_count(file));
-    return (const struct pdani_frame_data*)seekChunkData(chunk, table[frameNumber - 1]);
+    return index < PDANI_LAYER_MASK_BITS && ((hidden >> index) & 1) != 0;
 }
 
-static inline const struct pdani_frame_layer* spriteGetFrameLayer(const struct pdani_file *file, int frameNumber)
+// frame
+int pdani_file_get_frame_count(const struct pdani_file *file)
 {
-    const struct pdani_chunk *chunk = file->chunks[PDANI_CHUNK_TYPE_FRAME];
-    ASSERT(chunk != NULL);
-    uint16_t *table = (uint16_t*)chunkGetData(chunk);
-    ASSERT(1 <= frameNumber && frameNumber <= pdani_file_get_frame_count(file));
-    return &((const struct pdani_frame_data*)seekChunkData(chunk, table[frameNumber - 1]))->layers[0];
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_FRAME] != NULL);
+    return ((const struct pdani_frame_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_FRAME]))->count;
 }
 
-// image
-static inline int spriteGetImageCount(const struct pdani_file *file)
+// stream
+static void streamEvict(const struct pdani_file *file, int slot)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_IMAGE] != NULL);
-    return ((const struct pdani_frame_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_IMAGE]))->count;
+    struct pdani_stream *stream = file->stream;
+    stream->used -= stream->slots[slot].end - stream->slots[slot].begin;
+    fileFree(file, stream->slots[slot].data);
+    stream->slots[slot].data = NULL;
 }
 
-static inline const struct pdani_image_data* spriteGetImageData(const struct pdani_file *file, int index)
+/// @internal FRAM データの [begin, end) を読み込み、使ったスロット番号を返す
+static int streamLoad(const struct pdani_file *file, uint32_t begin, uint32_t end)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_IMAGE] != NULL);
-    ASSERT(0 <= index && index < spriteGetImageCount(file));
-    return ((const struct pdani_image_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_IMAGE])) + index;
+    struct pdani_stream *stream = file->stream;
+    const uint32_t size = end - begin;
+    int slot;
+    for (;;) {
+        int empty = -1, oldest = -1;
+        for (int i = 0; i < PDANI_STREAM_CACHE_SLOTS; ++i) {
+            if (stream->slots[i].data == NULL) {
+                if (empty < 0) empty = i;
+            } else if (oldest < 0 || stream->slots[i].last_used < stream->slots[oldest].last_used) {
+                oldest = i;
+            }
+        }
+        // 予算を超えていても空のキャッシュには必ず読む
+        if (empty >= 0 && (stream->used + size <= stream->budget || oldest < 0)) {
+            slot = empty;
+            break;
+        }
+        streamEvict(file, oldest);
+    }
+
+    uint8_t *data = fileAlloc(file, size);
+    const bool ok = streamRead(stream->fp, stream->frame_data_offset + begin, data, size);
+    ASSERT(ok && "cannot read frame data");
+    (void)ok;
+    stream->slots[slot].data = data;
+    stream->slots[slot].begin = begin;
+    stream->slots[slot].end = end;
+    stream->slots[slot].last_used = stream->tick;
+    stream->used += size;
+    return slot;
+}
+
+/// @internal キャッシュから [begin, end) を含むスロットを探す（なければ読み込む）
+static const uint8_t* streamFetch(const struct pdani_file *file, uint32_t begin, uint32_t end)
+{
+    struct pdani_stream *stream = file->stream;
+    ++stream->tick;
+    int slot = -1;
+    for (int i = 0; i < PDANI_STREAM_CACHE_SLOTS; ++i) {
+        if (stream->slots[i].data != NULL && stream->slots[i].begin <= begin && end <= stream->slots[i].end) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        slot = streamLoad(file, begin, end);
+    }
+    stream->slots[slot].last_used = stream->tick;
+    return stream->slots[slot].data + (begin - stream->slots[slot].begin);
 }
 
-// cel
-static inline int spriteGetCelCount(const struct pdani_file *file)
+static inline uint32_t streamGetFrameBegin(const struct pdani_file *file, int frameNumber)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_CEL] != NULL);
-    return ((const struct pdani_cel_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_CEL]))->count;
+    return tableGet(file, chunkGetData(file->chunks[PDANI_CHUNK_TYPE_FRAME]), frameNumber - 1);
 }
 
-static inline const struct pdani_cel_data* spriteGetCelData(const struct pdani_file *file, int index)
+static inline uint32_t streamGetFrameEnd(const struct pdani_file *file, int frameNumber)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_CEL] != NULL);
-    ASSERT(index < spriteGetCelCount(file));
-    return ((const struct pdani_cel_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_CEL])) + index;
+    if (frameNumber >= pdani_file_get_frame_count(file)) return file->stream->frame_data_size;
+    return streamGetFrameBegin(file, frameNumber + 1);
 }
 
-// collider
-static inline int spriteGetColliderCount(const struct pdani_file *file)
+/// @internal タグのフレーム範囲をまとめて読み込んでおく
+static void streamPrefetch(const struct pdani_file *file, int from, int to)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_COLLIDER] != NULL);
-    return ((const struct pdani_collider_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_COLLIDER]))->count;
+    streamFetch(file, streamGetFrameBegin(file, from), streamGetFrameEnd(file, to));
 }
 
-static inline const struct pdani_collider_data* spriteGetColliderData(const struct pdani_file *file, int index)
+/// @internal 全フレームを順に見て表を作るときの読み出し。ストリーミング時は LRU キャッシュを通さず、まとめて直接読む
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t begin, end; //< buf に読んだ FRAM データ内のバイト範囲
+    uint32_t capacity;
+} FrameScan;
+
+#define PDANI_FRAME_SCAN_BYTES 1024
+
+static const struct pdani_frame_data* spriteGetFrameData(const struct pdani_file *file, int frameNumber);
+
+static const struct pdani_frame_data* frameScanGet(const struct pdani_file *file, FrameScan *scan, int frameNumber)
+{
+    if (file->stream == NULL) return spriteGetFrameData(file, frameNumber);
+
+    const uint32_t begin = streamGetFrameBegin(file, frameNumber);
+    const uint32_t end = streamGetFrameEnd(file, frameNumber);
+    if (begin < scan->begin || end > scan->end) {
+        uint32_t load_end = begin + PDANI_FRAME_SCAN_BYTES;
+        if (load_end < end) load_end = end;
+        if (load_end > file->stream->frame_data_size) load_end = file->stream->frame_data_size;
+        if (load_end - begin > scan->capacity) {
+            fileFree(file, scan->buf);
+            scan->capacity = load_end - begin;
+            scan->buf = fileAlloc(file, scan->capacity);
+        }
+        const bool ok = streamRead(file->stream->fp, file->stream->frame_data_offset + begin, scan->buf, load_end - begin);
+        ASSERT(ok && "cannot read frame data");
+        (void)ok;
+        scan->begin = begin;
+        scan->end = load_end;
+    }
+    return (const struct pdani_frame_data*)(scan->buf + (begin - scan->begin));
+}
+
+static void frameScanFinalize(const struct pdani_file *file, FrameScan *scan)
+{
+    fileFree(file, scan->buf);
+    scan->buf = NULL;
+}
+
+static inline const struct pdani_frame_data* spriteGetFrameData(const struct pdani_file *file, int frameNumber)
+{
+    const struct pdani_chunk *chunk = file->chunks[PDANI_CHUNK_TYPE_FRAME];
+    DATA_CHECK(file, chunk != NULL);
+    ASSERT(1 <= frameNumber && frameNumber <= pdani_file_get_frame_count(file));
+    if (file->stream != NULL) {
+        return (const struct pdani_frame_data*)streamFetch(
+            file, streamGetFrameBegin(file, frameNumber), streamGetFrameEnd(file, frameNumber));
+    }
+    return (const struct pdani_frame_data*)seekChunkData(chunk, tableGet(file, chunkGetData(chunk), frameNumber - 1));
+}
+
+static inline const struct pdani_frame_layer* spriteGetFrameLayer(const struct pdani_file *file, int frameNumber)
+{
+    return &spriteGetFrameData(file, frameNumber)->layers[0];
+}
+
+// image
+static inline int spriteGetImageCount(const struct pdani_file *file)
+{
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_IMAGE] != NULL);
+    return ((const struct pdani_frame_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_IMAGE]))->count;
+}
+
+static inline const struct pdani_image_data* spriteGetImageData(const struct pdani_file *file, int index)
 {
-    ASSERT(file->chunks[PDANI_CHUNK_TYPE_COLLIDER] != NULL);
-    ASSERT(index < spriteGetColliderCount(file));
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_IMAGE] != NULL && 0 <= index && index < spriteGetImageCount(file));
+    return ((const struct pdani_image_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_IMAGE])) + index;
+}
+
+// cel
+static inline int spriteGetCelCount(const struct pdani_file *file)
+{
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_CEL] != NULL);
+    return ((const struct pdani_cel_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_CEL]))->count;
+}
+
+static inline const struct pdani_cel_data* spriteGetCelData(const struct pdani_file *file, int index)
+{
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_CEL] != NULL && 0 <= index && index < spriteGetCelCount(file));
+    return ((const struct pdani_cel_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_CEL])) + index;
+}
+
+// collider
+static inline int spriteGetColliderCount(const struct pdani_file *file)
+{
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_COLLIDER] != NULL);
+    return ((const struct pdani_collider_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_COLLIDER]))->count;
+}
+
+static inline const struct pdani_collider_data* spriteGetColliderData(const struct pdani_file *file, int index)
+{
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_COLLIDER] != NULL && 0 <= index && index < spriteGetColliderCount(file));
     return ((const struct pdani_collider_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_COLLIDER])) + index;
 }
 
-static inline uint32_t bitFlip8(uint32_t a)
+// 1bit bitmaps are stored MSB-first, so a row is read as big-endian 32-bit words
+static inline uint32_t loadWord(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline void storeWord(uint8_t *p, uint32_t v)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint32_t bitReverse32(uint32_t a)
+{
+#if defined(__arm__) && defined(__ARM_ARCH) && (__ARM_ARCH >= 7)
+    uint32_t r;
+    __asm__ ("rbit %0, %1" : "=r"(r) : "r"(a));
+    return r;
+#else
+    a = ((a >> 1) & 0x55555555) | ((a & 0x55555555) << 1);
+    a = ((a >> 2) & 0x33333333) | ((a & 0x33333333) << 2);
+    a = ((a >> 4) & 0x0f0f0f0f) | ((a & 0x0f0f0f0f) << 4);
+    return __builtin_bswap32(a);
+#endif
+}
+
+/// @internal 連続する2ワード hi:lo のうち off ビット目から32ビットを取り出す（off == 0 も可）
+static inline uint32_t funnelShift(uint32_t hi, uint32_t lo, int off)
+{
+    return (hi << off) | ((lo >> 1) >> (31 - off));
+}
+
+/// @internal 1行あたりの書き込みパラメータ
+typedef struct
+{
+    int words; //< 書き込むワード数
+    uint32_t lmask, rmask; //< 両端のワードの書き込みマスク
+    int first, last; //< 読み込んでよいソースのワード範囲
+    int index; //< 先頭ワードに対応するソースのワード位置
+    int off; //< ソースのビットオフセット
+} BlitSpan;
+
+/// @internal 読み込み元（アトラスや合成済みフレーム）。行は32bit境界に揃っていること
+typedef struct
+{
+    const uint8_t *texel;
+    const uint8_t *mask;
+    const uint8_t *flipped_texel; //< 水平反転済みのテクセル（NULL ならワードごとに反転しながら読む）
+    const uint8_t *flipped_mask;
+    int rowbytes;
+} DrawSource;
+
+/// @internal 描画先（画面・ビットマップ・合成済みフレーム）。行は32bit境界に揃っていること
+typedef struct
+{
+    uint8_t *data;
+    uint8_t *mask; //< 描いた画素のマスクを立てる（NULL ならマスクなし）
+    int rowbytes;
+    LCDRect clip;
+} DrawTarget;
+
+static inline void blitWord(uint8_t *dst, uint32_t t, uint32_t m)
+{
+    const uint32_t d = loadWord(dst);
+    storeWord(dst, (d & ~m) | (t & m));
+}
+
+// opaque なら不透明スパンとしてマスクを読まずに上書きする
+static inline uint32_t loadMask(const uint8_t *p, bool valid, bool opaque)
+{
+    return (opaque)? 0xffffffffu : (valid)? loadWord(p) : 0;
+}
+
+static inline void blitForward(const BlitSpan *span, uint8_t *dst, int dststep, const uint8_t *texel, const uint8_t *mask, int h, int bufstep, const bool opaque)
 {
-    uint32_t b = a;
-    a = a & 0x55555555;
-    b = b ^ a;
-    a = a << 2;
-    a = a | b;
+    const int words = span->words;
+    const int off = span->off;
+    const int i0 = span->index;
+    const uint8_t *t0 = texel + i0 * 4;
+    const uint8_t *m0 = mask + i0 * 4;
+    const bool head = i0 >= span->first;
+    const bool tail = i0 + words <= span->last;
+
+    if (words == 1) {
+        const uint32_t em = span->lmask & span->rmask;
+        for (int sy = 0; sy < h; ++sy) {
+            const uint32_t th = (head)? loadWord(t0) : 0, mh = loadMask(m0, head, opaque);
+            const uint32_t tl = (tail)? loadWord(t0 + 4) : 0, ml = loadMask(m0 + 4, tail, opaque);
+            blitWord(dst, funnelShift(th, tl, off), funnelShift(mh, ml, off) & em);
+            t0 += bufstep;
+            m0 += bufstep;
+            dst += dststep;
+        }
+        return;
+    }
 
-    b = a;
-    a = a & (0x33333333<<1);
-    b = b ^ a;
-    a = a << 4;
-    a = a | b;
+    for (int sy = 0; sy < h; ++sy) {
+        const uint8_t *ts = t0;
+        const uint8_t *ms = m0;
+        uint8_t *d = dst;
+        uint32_t th = (head)? loadWord(ts) : 0, mh = loadMask(ms, head, opaque);
+        uint32_t tl = loadWord(ts += 4), ml = loadMask(ms += 4, true, opaque);
+        blitWord(d, funnelShift(th, tl, off), funnelShift(mh, ml, off) & span->lmask);
+        d += 4;
+        for (int k = words - 2; k > 0; --k) {
+            th = tl;
+            mh = ml;
+            tl = loadWord(ts += 4);
+            ml = loadMask(ms += 4, true, opaque);
+            blitWord(d, funnelShift(th, tl, off), funnelShift(mh, ml, off));
+            d += 4;
+        }
+        th = tl;
+        mh = ml;
+        tl = (tail)? loadWord(ts + 4) : 0;
+        ml = loadMask(ms + 4, tail, opaque);
+        blitWord(d, funnelShift(th, tl, off), funnelShift(mh, ml, off) & span->rmask);
+        t0 += bufstep;
+        m0 += bufstep;
+        dst += dststep;
+    }
+}
+
+// 水平反転: ソースを右から左へ読み、ワード単位でビットを反転して書き込む
+static inline void blitReverse(const BlitSpan *span, uint8_t *dst, int dststep, const uint8_t *texel, const uint8_t *mask, int h, int bufstep, const bool opaque)
+{
+    const int words = span->words;
+    const int off = span->off;
+    const int i0 = span->index;
+    const uint8_t *t0 = texel + i0 * 4;
+    const uint8_t *m0 = mask + i0 * 4;
+    const bool head = i0 + 1 <= span->last;
+    const bool tail = i0 - (words - 1) >= span->first;
+
+    if (words == 1) {
+        const uint32_t em = span->lmask & span->rmask;
+        const bool valid = i0 >= span->first;
+        for (int sy = 0; sy < h; ++sy) {
+            const uint32_t th = (valid)? loadWord(t0) : 0, mh = loadMask(m0, valid, opaque);
+            const uint32_t tl = (head)? loadWord(t0 + 4) : 0, ml = loadMask(m0 + 4, head, opaque);
+            blitWord(dst, bitReverse32(funnelShift(th, tl, off)), bitReverse32(funnelShift(mh, ml, off)) & em);
+            t0 += bufstep;
+            m0 += bufstep;
+            dst += dststep;
+        }
+        return;
+    }
 
-    b = a;
-    a = a & (0x0f0f0f0f<<3);
-    b = b ^ a;
-    a = a << 8;
-    a = a | b;
+    for (int sy = 0; sy < h; ++sy) {
+        const uint8_t *ts = t0;
+        const uint8_t *ms = m0;
+        uint8_t *d = dst;
+        uint32_t tl = (head)? loadWord(ts + 4) : 0, ml = loadMask(ms + 4, head, opaque);
+        uint32_t th = loadWord(ts), mh = loadMask(ms, true, opaque);
+        blitWord(d, bitReverse32(funnelShift(th, tl, off)), bitReverse32(funnelShift(mh, ml, off)) & span->lmask);
+        d += 4;
+        for (int k = words - 2; k > 0; --k) {
+            tl = th;
+            ml = mh;
+            th = loadWord(ts -= 4);
+            mh = loadMask(ms -= 4, true, opaque);
+            blitWord(d, bitReverse32(funnelShift(th, tl, off)), bitReverse32(funnelShift(mh, ml, off)));
+            d += 4;
+        }
+        tl = th;
+        ml = mh;
+        th = (tail)? loadWord(ts - 4) : 0;
+        mh = loadMask(ms - 4, tail, opaque);
+        blitWord(d, bitReverse32(funnelShift(th, tl, off)), bitReverse32(funnelShift(mh, ml, off)) & span->rmask);
+        t0 += bufstep;
+        m0 += bufstep;
+        dst += dststep;
+    }
+}
 
-    a = a >> 7;
-    return a;
+// 反転と不透明の有無ごとに展開した blitForward / blitReverse を選ぶ
+static inline void blitRect(const BlitSpan *span, uint8_t *dst, int dststep, const uint8_t *texel, const uint8_t *mask, int h, int bufstep, bool fh, bool opaque)
+{
+    if (fh) {
+        if (opaque) {
+            blitReverse(span, dst, dststep, texel, mask, h, bufstep, true);
+        } else {
+            blitReverse(span, dst, dststep, texel, mask, h, bufstep, false);
+        }
+    } else {
+        if (opaque) {
+            blitForward(span, dst, dststep, texel, mask, h, bufstep, true);
+        } else {
+            blitForward(span, dst, dststep, texel, mask, h, bufstep, false);
+        }
+    }
 }
 
-static void drawBitmapWithRect(const struct pdani_file *file, uint8_t *framebuf, int x, int y, int u, int v, int w, int h, _Bool fh, _Bool fv)
+// テクセル/マスクは32bit境界に揃った行を前提に、ワード単位で読み書きする
+// @param opaque 矩形内のマスクがすべて1であることが分かっている
+// @param written 実際に書き込んだ矩形を合成する
+static void drawBitmapWithRect(const DrawSource *src, const DrawTarget *target, int x, int y, int u, int v, int w, int h, _Bool fh, _Bool fv, _Bool opaque, LCDRect *written)
 {
-    uint8_t *dst = framebuf;
-    uint8_t *texel = file->bitmap_info.texel;
-    uint8_t *mask = file->bitmap_info.mask;
+    // 反転済みアトラスがあれば、その上の同じ矩形を通常方向で描く
+    const bool fh_cached = fh && src->flipped_texel != NULL;
+    if (fh_cached) {
+        u = (src->rowbytes << 3) - u - w;
+        fh = false;
+    }
 
     // clip
-    if (y < 0) {
-        v += -y;
-        h -= -y;
-        y = 0;
+#ifdef PDANI_ENABLE_STATS
+    const int unclipped_w = w, unclipped_h = h;
+#endif
+    const LCDRect *clip = &target->clip;
+    if (x < clip->left) {
+        const int m = clip->left - x;
+        if (!fh) u += m;
+        w -= m;
+        x = clip->left;
     }
-    if (y + h > LCD_ROWS) {
-        int m = ((y + h) - LCD_ROWS);
+    if (x + w > clip->right) {
+        const int m = (x + w) - clip->right;
+        if (fh) u += m;
+        w -= m;
+    }
+    if (y < clip->top) {
+        const int m = clip->top - y;
+        if (!fv) v += m;
         h -= m;
+        y = clip->top;
+    }
+    if (y + h > clip->bottom) {
+        const int m = (y + h) - clip->bottom;
         if (fv) v += m;
+        h -= m;
+    }
+    STATS_COUNT(s_stats.drawing, blits, 1);
+    if (w <= 0 || h <= 0) {
+        STATS_COUNT(s_stats.drawing, culled_blits, 1);
+        return;
     }
-    if (h <= 0) return;
+#ifdef PDANI_ENABLE_STATS
+    if (w != unclipped_w || h != unclipped_h) STATS_COUNT(s_stats.drawing, clipped_blits, 1);
+#endif
 
-    const int bw = (w + (8-1)) >> 3;
-    const int vdir = (fv)? -1 : +1;
-    const int bufstep = file->bitmap_info.rowbytes * vdir;
+    unionRect(written, &(LCDRect){ .left = x, .right = x + w, .top = y, .bottom = y + h });
+
+    const int rowbytes = src->rowbytes;
+    const int bufstep = (fv)? -rowbytes : rowbytes;
+    const int sy = (fv)? v + (h - 1) : v;
+    const uint8_t *texel = ((fh_cached)? src->flipped_texel : src->texel) + rowbytes * sy;
+    const uint8_t *mask = ((fh_cached)? src->flipped_mask : src->mask) + rowbytes * sy;
+    const int offset = target->rowbytes * y + ((x >> 5) << 2);
+    uint8_t *dst = target->data + offset;
+
+    // 先頭ワードの先頭ピクセルに対応するソースのビット位置（-31 以上）
+    const int sbit = ((fh)? u + w - 32 + (x & 31) : u - (x & 31)) + 32;
+    const BlitSpan span = {
+        .words = ((x + w - 1) >> 5) - (x >> 5) + 1,
+        .lmask = 0xffffffffu >> (x & 31),
+        .rmask = 0xffffffffu << (31 - ((x + w - 1) & 31)),
+        .first = u >> 5,
+        .last = (u + w - 1) >> 5,
+        .index = (sbit >> 5) - 1,
+        .off = sbit & 31,
+    };
+
+#ifdef PDANI_ENABLE_STATS
+    if (fh) {
+        STATS_COUNT(s_stats.drawing, flipped_blits, 1);
+    } else if (span.off == 0) {
+        STATS_COUNT(s_stats.drawing, aligned_blits, 1);
+    } else {
+        STATS_COUNT(s_stats.drawing, unaligned_blits, 1);
+    }
+    STATS_COUNT(s_stats.drawing, bytes, span.words * 4 * h * ((target->mask != NULL)? 2 : 1));
+#endif
 
-    x = (fh)? x - ((bw << 3) - w) : x;
-    v = (fv)? v + (h - 1) : v;
+    blitRect(&span, dst, target->rowbytes, texel, mask, h, bufstep, fh, opaque);
+    if (target->mask != NULL) {
+        // マスクをテクセルとして重ねると描いた画素のマスクが立つ（d | m）
+        blitRect(&span, target->mask + offset, target->rowbytes, mask, mask, h, bufstep, fh, opaque);
+    }
+}
 
-    texel += file->bitmap_info.rowbytes * v + (u >> 3);
-    mask += file->bitmap_info.rowbytes * v + (u >> 3);
-    dst += LCD_ROWSIZE * y;
+// span
+static inline int spriteGetSpanImageCount(const struct pdani_file *file)
+{
+    DATA_CHECK(file, file->chunks[PDANI_CHUNK_TYPE_SPAN] != NULL);
+    return ((const struct pdani_span_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_SPAN]))->count;
+}
 
-    int dst_startbyte = x >> 3;
-    int dst_endbyte = dst_startbyte + bw;
+// @return image のスパン列（[*begin, *end)）
+static inline const struct pdani_span_data* spriteGetSpanData(const struct pdani_file *file, int image, const struct pdani_span_data **end)
+{
+    const struct pdani_chunk *chunk = file->chunks[PDANI_CHUNK_TYPE_SPAN];
+    const int count = spriteGetSpanImageCount(file);
+    DATA_CHECK(file, 0 <= image && image < count);
+    const void *table = chunkGetData(chunk);
+    const struct pdani_span_data *spans = (const struct pdani_span_data*)((const uint8_t*)table + tableGetEntrySize(file) * (count + 1));
+    *end = spans + tableGet(file, table, image + 1);
+    return spans + tableGet(file, table, image);
+}
 
-    const int write1size = 8 - (x - dst_startbyte * 8);
-    const int write2size = 8 - write1size;
-    const uint8_t write1mask = (uint8_t)(((uint16_t)1 << write1size) - 1);
-    const uint8_t write2mask = (uint8_t)(((uint16_t)1 << write2size) - 1) << write1size;
+// スパンごとの転送は1回ごとの準備が重いので、不透明スパンが画像の大部分を覆うときだけ使う（PDANI_SPAN_MIN_OPAQUE/256 以上）
+#define PDANI_SPAN_MIN_OPAQUE 240
 
-    int startx = (fh)? bw - 1 : 0;
-    const int sinc = (fh)? -1 : 1;
+static void fileBuildSpanImages(struct pdani_file *file)
+{
+    if (file->chunks[PDANI_CHUNK_TYPE_SPAN] == NULL || file->chunks[PDANI_CHUNK_TYPE_IMAGE] == NULL) return;
+    const int image_count = spriteGetImageCount(file);
+    const int count = (spriteGetSpanImageCount(file) < image_count)? spriteGetSpanImageCount(file) : image_count;
+    if (count == 0) return;
 
-    if (dst_startbyte < 0) {
-        startx += -dst_startbyte;
-        dst_startbyte = 0;
-    }
-    if (dst_endbyte > LCD_COLUMNS >> 3)
-    {
-        dst_endbyte = LCD_COLUMNS >> 3;
-    }
-    if (write2size == 0) {
-        if (fh) {
-            for (int sy = 0; sy < h; ++sy) {
-                for (int sx = startx, dx = dst_startbyte; dx < dst_endbyte; sx += sinc, ++dx) {
-                    const uint8_t t = bitFlip8(*(texel + sx));
-                    const uint8_t m = bitFlip8(*(mask + sx));
-                    const uint8_t d = *(dst + dx);
-                    *(dst + dx) = (d & ~m) | (t & m);
-                }
-                texel += bufstep;
-                mask += bufstep;
-                dst += LCD_ROWSIZE;
-            }
-        } else {
-            for (int sy = 0; sy < h; ++sy) {
-                for (int sx = startx, dx = dst_startbyte; dx < dst_endbyte; sx += sinc, ++dx) {
-                    const uint8_t t = *(texel + sx);
-                    const uint8_t m = *(mask + sx);
-                    const uint8_t d = *(dst + dx);
-                    *(dst + dx) = (d & ~m) | (t & m);
-                }
-                texel += bufstep;
-                mask += bufstep;
-                dst += LCD_ROWSIZE;
-            }
+    uint8_t *bits = fileAlloc(file, (image_count + 7) >> 3);
+    memset(bits, 0, (image_count + 7) >> 3);
+    for (int i = 0; i < count; ++i) {
+        const struct pdani_image_data *image = spriteGetImageData(file, i);
+        uint32_t opaque = 0;
+        const struct pdani_span_data *end;
+        for (const struct pdani_span_data *span = spriteGetSpanData(file, i, &end); span != end; ++span) {
+            if (span->kind == PDANI_SPAN_KIND_OPAQUE) opaque += (uint32_t)span->w * span->h;
         }
-    } else {
-        if (fh) {
-            for (int sy = 0; sy < h; ++sy) {
-                for (int sx = startx, dx = dst_startbyte; dx < dst_endbyte; sx += sinc, ++dx) {
-                    const uint8_t t = bitFlip8(*(texel + sx));
-                    const uint8_t m = bitFlip8(*(mask + sx));
-                    const uint8_t t1 = (t >> write2size) & write1mask;
-                    const uint8_t t2 = (t << write1size) & write2mask;
-                    const uint8_t m1 = (m >> write2size) & write1mask;
-                    const uint8_t m2 = (m << write1size) & write2mask;
-                    const uint8_t d1 = *(dst + dx + 0);
-                    const uint8_t d2 = *(dst + dx + 1);
-                    *(dst + dx + 0) = (d1 & ~m1) | (t1 & m1);
-                    *(dst + dx + 1) = (d2 & ~m2) | (t2 & m2);
-                }
-                texel += bufstep;
-                mask += bufstep;
-                dst += LCD_ROWSIZE;
-            }
-        } else {
-            for (int sy = 0; sy < h; ++sy) {
-                for (int sx = startx, dx = dst_startbyte; dx < dst_endbyte; sx += sinc, ++dx) {
-                    const uint8_t t = *(texel + sx);
-                    const uint8_t m = *(mask + sx);
-                    const uint8_t t1 = (t >> write2size) & write1mask;
-                    const uint8_t t2 = (t << write1size) & write2mask;
-                    const uint8_t m1 = (m >> write2size) & write1mask;
-                    const uint8_t m2 = (m << write1size) & write2mask;
-                    const uint8_t d1 = *(dst + dx + 0);
-                    const uint8_t d2 = *(dst + dx + 1);
-                    *(dst + dx + 0) = (d1 & ~m1) | (t1 & m1);
-                    *(dst + dx + 1) = (d2 & ~m2) | (t2 & m2);
-                }
-                texel += bufstep;
-                mask += bufstep;
-                dst += LCD_ROWSIZE;
-            }
+        if (opaque * 256 >= (uint32_t)image->w * image->h * PDANI_SPAN_MIN_OPAQUE) {
+            bits[i >> 3] |= (uint8_t)(1 << (i & 7));
+        }
+    }
+    file->span_images = bits;
+}
+
+// スパンで描く画像なら、透明部分を飛ばし、不透明部分はマスクなしで描く
+static void drawImage(const struct pdani_file *file, const DrawSource *src, const DrawTarget *target, int x, int y, int imageIndex, int u, int v, int w, int h, bool fh, bool fv, LCDRect *written)
+{
+    if (file->span_images == NULL || !BIT_CHECK(file->span_images[imageIndex >> 3], 1 << (imageIndex & 7))) {
+        drawBitmapWithRect(src, target, x, y, u, v, w, h, fh, fv, false, written);
+        return;
+    }
+
+    const struct pdani_span_data *end;
+    for (const struct pdani_span_data *span = spriteGetSpanData(file, imageIndex, &end); span != end; ++span) {
+        const int dx = (fh)? x + w - span->x - span->w : x + span->x;
+        const int dy = (fv)? y + h - span->y - span->h : y + span->y;
+        drawBitmapWithRect(src, target, dx, dy, u + span->x, v + span->y, span->w, span->h, fh, fv, span->kind == PDANI_SPAN_KIND_OPAQUE, written);
+    }
+}
+
+static void fileBuildFlipCache(struct pdani_file *file)
+{
+    const int rowbytes = file->bitmap_info.rowbytes;
+    const int height = file->bitmap_info.height;
+    const int words = rowbytes >> 2;
+    uint8_t *texel = fileAlloc(file, rowbytes * height * 2);
+    uint8_t *mask = texel + rowbytes * height;
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t *st = file->bitmap_info.texel + rowbytes * y;
+        const uint8_t *sm = file->bitmap_info.mask + rowbytes * y;
+        uint8_t *dt = texel + rowbytes * y;
+        uint8_t *dm = mask + rowbytes * y;
+        for (int k = 0; k < words; ++k) {
+            storeWord(dt + k * 4, bitReverse32(loadWord(st + (words - 1 - k) * 4)));
+            storeWord(dm + k * 4, bitReverse32(loadWord(sm + (words - 1 - k) * 4)));
         }
     }
+    file->bitmap_info.flipped_texel = texel;
+    file->bitmap_info.flipped_mask = mask;
+}
+
+void pdani_file_enable_flip_cache(struct pdani_file *file, bool lazy)
+{
+    ASSERT(file != NULL);
+    BIT_SET(file->flags, PDANI_FILE_FLAG_FLIP_CACHE);
+    if (!lazy && file->bitmap_info.flipped_texel == NULL) {
+        fileBuildFlipCache(file);
+    }
 }
 
 //! @internal
@@ -462,11 +1735,17 @@ typedef struct
     const struct pdani_frame_layer *frame_layer;
 } SpriteFrameLayerIterator;
 
-static inline void spriteFrameLayerBegin(SpriteFrameLayerIterator *it, const struct pdani_file *file, int frame_number)
+static inline void spriteFrameLayerBeginWithData(SpriteFrameLayerIterator *it, const struct pdani_file *file, const struct pdani_frame_data *frame)
 {
     it->layer_index = 0;
-    it->layer_data = spriteGetLayerData(file, 0);
-    it->frame_layer = spriteGetFrameLayer(file, frame_number);
+    // レイヤーが 0 個（全部 # で隠した）のファイルもあるので spriteGetLayerData は使わない
+    it->layer_data = (const struct pdani_layer_data*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_LAYER]);
+    it->frame_layer = &frame->layers[0];
+}
+
+static inline void spriteFrameLayerBegin(SpriteFrameLayerIterator *it, const struct pdani_file *file, int frame_number)
+{
+    spriteFrameLayerBeginWithData(it, file, spriteGetFrameData(file, frame_number));
 }
 
 static inline void spriteFrameLayerEnd(SpriteFrameLayerIterator *it, const struct pdani_file *file, int frame_number)
@@ -491,121 +1770,606 @@ static inline bool spriteFrameLayerCompare(SpriteFrameLayerIterator *it0, Sprite
     return it0->layer_index == it1->layer_index;
 }
 
-void pdani_file_draw(const struct pdani_file *file, LCDBitmap *target, int x, int y, int framenumber, bool fliph, bool flipv)
+void pdani_file_get_frame_bounds(struct pdani_file *file, int frame, bool fliph, bool flipv, LCDRect *rect)
 {
-    ASSERT(s_api != NULL);
     ASSERT(file != NULL);
-    ASSERT(1 <= framenumber && framenumber <= pdani_file_get_frame_count(file));
+    ASSERT(1 <= frame && frame <= pdani_file_get_frame_count(file));
+    const int sw = pdani_file_get_width(file);
+    const int sh = pdani_file_get_height(file);
 
-    uint8_t *framebuf = NULL;
-    if (target != NULL) {
-        s_api->graphics->getBitmapData(target, NULL, NULL, NULL, NULL, &framebuf);
-    } else {
-        framebuf = s_api->graphics->getFrame();
+    if (file->frame_bounds == NULL) {
+        const int frame_count = pdani_file_get_frame_count(file);
+        LCDRect *bounds = fileAlloc(file, sizeof(LCDRect) * frame_count);
+        FrameScan scan = { 0 };
+        for (int f = 1; f <= frame_count; ++f) {
+            LCDRect rc = { 0 };
+            SpriteFrameLayerIterator it, end;
+            spriteFrameLayerEnd(&end, file, f);
+            for (spriteFrameLayerBeginWithData(&it, file, frameScanGet(file, &scan, f)); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+                if (it.layer_data->type != PDANI_LAYER_TYPE_LAYER || it.frame_layer->cel < 0) continue;
+                const struct pdani_cel_data *cel = spriteGetCelData(file, it.frame_layer->cel);
+                const struct pdani_image_data *image = spriteGetImageData(file, cel->image);
+                LCDRect cel_rect = LCDMakeRect(cel->x, cel->y, image->w, image->h);
+                if (!clip_rect(&cel_rect, &(LCDRect){ .left = 0, .right = sw, .top = 0, .bottom = sh })) continue;
+                unionRect(&rc, &cel_rect);
+            }
+            bounds[f - 1] = rc;
+        }
+        frameScanFinalize(file, &scan);
+        file->frame_bounds = bounds;
     }
 
-    SpriteFrameLayerIterator it, end;
+    *rect = file->frame_bounds[frame - 1];
+    if (rect->right <= rect->left || rect->bottom <= rect->top) return;
+    if (fliph) {
+        const int left = sw - rect->right;
+        rect->right = sw - rect->left;
+        rect->left = left;
+    }
+    if (flipv) {
+        const int top = sh - rect->bottom;
+        rect->bottom = sh - rect->top;
+        rect->top = top;
+    }
+}
+
+void pdani_file_compile_draw_list(struct pdani_file *file)
+{
+    ASSERT(file != NULL);
+    if (file->draw_list.commands != NULL) return;
+
+    const int frame_count = pdani_file_get_frame_count(file);
     const int sw = pdani_file_get_width(file);
     const int sh = pdani_file_get_height(file);
 
-    LCDRect rc = LCDMakeRect(x, y, sw, sh);
-    if (!clip_rect(&rc, &screen_rect)) return;
+    FrameScan scan = { 0 };
+    int total = 0;
+    for (int f = 1; f <= frame_count; ++f) {
+        SpriteFrameLayerIterator it, end;
+        spriteFrameLayerEnd(&end, file, f);
+        for (spriteFrameLayerBeginWithData(&it, file, frameScanGet(file, &scan, f)); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+            if (it.layer_data->type == PDANI_LAYER_TYPE_LAYER && it.frame_layer->cel >= 0) ++total;
+        }
+    }
+    ASSERT(total <= 0xffff);
+
+    // 命令列と開始位置表をひとつのブロックに置く
+    const size_t commands_size = sizeof(struct pdani_draw_command) * total;
+    uint8_t *buf = fileAlloc(file, commands_size + sizeof(uint16_t) * (frame_count + 1));
+    struct pdani_draw_command *commands = (struct pdani_draw_command*)buf;
+    uint16_t *frame_start = (uint16_t*)(buf + commands_size);
+
+    int n = 0;
+    for (int f = 1; f <= frame_count; ++f) {
+        frame_start[f - 1] = (uint16_t)n;
+        SpriteFrameLayerIterator it, end;
+        spriteFrameLayerEnd(&end, file, f);
+        for (spriteFrameLayerBeginWithData(&it, file, frameScanGet(file, &scan, f)); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+            if (it.layer_data->type != PDANI_LAYER_TYPE_LAYER || it.frame_layer->cel < 0) continue;
+
+            const struct pdani_cel_data *cel = spriteGetCelData(file, it.frame_layer->cel);
+            const struct pdani_image_data *image = spriteGetImageData(file, cel->image);
+            commands[n++] = (struct pdani_draw_command){
+                .x = cel->x,
+                .y = cel->y,
+                .flipped_x = (int16_t)(sw - cel->x - image->w),
+                .flipped_y = (int16_t)(sh - cel->y - image->h),
+                .u = image->u,
+                .v = image->v,
+                .w = image->w,
+                .h = image->h,
+                .image = cel->image,
+                .layer = (uint16_t)it.layer_index,
+            };
+        }
+    }
+    frame_start[frame_count] = (uint16_t)n;
+    frameScanFinalize(file, &scan);
 
-    spriteFrameLayerEnd(&end, file, framenumber);
-    for (spriteFrameLayerBegin(&it, file, framenumber); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+    file->draw_list.commands = commands;
+    file->draw_list.frame_start = frame_start;
+}
+
+// @internal アトラスを描画元にする
+static void fileGetDrawSource(const struct pdani_file *file, bool fliph, DrawSource *src)
+{
+    if (fliph && BIT_CHECK(file->flags, PDANI_FILE_FLAG_FLIP_CACHE) && file->bitmap_info.flipped_texel == NULL) {
+        // 反転キャッシュはファイルが持つ描画用の内部状態なので、ここでだけ const を外す
+        fileBuildFlipCache((struct pdani_file*)file);
+    }
+    *src = (DrawSource){
+        .texel = file->bitmap_info.texel,
+        .mask = file->bitmap_info.mask,
+        .flipped_texel = file->bitmap_info.flipped_texel,
+        .flipped_mask = file->bitmap_info.flipped_mask,
+        .rowbytes = file->bitmap_info.rowbytes,
+    };
+}
+
+// @internal 読み出し済みのフレームのセルを1枚ずつ描く（hidden のレイヤーは飛ばす）
+static void fileDrawFrameData(const struct pdani_file *file, const DrawSource *src, const DrawTarget *target, int x, int y, const struct pdani_frame_data *frame, uint64_t hidden, bool fliph, bool flipv, LCDRect *written)
+{
+    const int sw = pdani_file_get_width(file);
+    const int sh = pdani_file_get_height(file);
+    SpriteFrameLayerIterator it, end;
+    spriteFrameLayerEnd(&end, file, 0);
+    for (spriteFrameLayerBeginWithData(&it, file, frame); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
         const struct pdani_layer_data *layer = it.layer_data;
         const struct pdani_frame_layer *framelayer = it.frame_layer;
 
         if (layer->type != PDANI_LAYER_TYPE_LAYER || framelayer->cel < 0) continue;
+        if (hidden != 0 && layerIsHidden(hidden, it.layer_index)) continue;
 
         const struct pdani_cel_data *cel = spriteGetCelData(file, framelayer->cel);
         const struct pdani_image_data *image = spriteGetImageData(file, cel->image);
         const int dx = (fliph)? x + sw - cel->x - image->w : x + cel->x;
         const int dy = (flipv)? y + sh - cel->y - image->h : y + cel->y;
-        drawBitmapWithRect(file, framebuf, dx, dy, image->u, image->v, image->w, image->h, fliph, flipv);
+        drawImage(file, src, target, dx, dy, cel->image, image->u, image->v, image->w, image->h, fliph, flipv, written);
     }
 }
 
-static void spriteCheckFrameTrigger(const struct pdani_file *file, int framenumber, pdani_frame_layer_callback callback, void *ptr)
+// @internal セルを1枚ずつ描く（hidden のレイヤーは飛ばす）
+static void fileDrawLayers(const struct pdani_file *file, const DrawTarget *target, int x, int y, int framenumber, uint64_t hidden, bool fliph, bool flipv, LCDRect *written)
 {
-    ASSERT(s_api != NULL);
-    ASSERT(file != NULL);
-    ASSERT(1 <= framenumber && framenumber <= pdani_file_get_frame_count(file));
-
-    if (callback == NULL) return;
-
-    SpriteFrameLayerIterator it, end;
+    DrawSource src;
+    fileGetDrawSource(file, fliph, &src);
 
-    spriteFrameLayerEnd(&end, file, framenumber);
-    for (spriteFrameLayerBegin(&it, file, framenumber); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
-        const struct pdani_layer_data *layer = it.layer_data;
-        const struct pdani_frame_layer *framelayer = it.frame_layer;
-        if (layer->type != PDANI_LAYER_TYPE_GROUP && framelayer->userCallback > 0) {
-            (*callback)(file, framenumber, getString(file, framelayer->userCallback), ptr);
+    if (file->draw_list.commands != NULL) {
+        const struct pdani_draw_command *cmd = &file->draw_list.commands[file->draw_list.frame_start[framenumber - 1]];
+        const struct pdani_draw_command *cmdend = &file->draw_list.commands[file->draw_list.frame_start[framenumber]];
+        for (; cmd != cmdend; ++cmd) {
+            if (hidden != 0 && layerIsHidden(hidden, cmd->layer)) continue;
+            const int dx = x + ((fliph)? cmd->flipped_x : cmd->x);
+            const int dy = y + ((flipv)? cmd->flipped_y : cmd->y);
+            drawImage(file, &src, target, dx, dy, cmd->image, cmd->u, cmd->v, cmd->w, cmd->h, fliph, flipv, written);
         }
+    } else {
+        fileDrawFrameData(file, &src, target, x, y, spriteGetFrameData(file, framenumber), hidden, fliph, flipv, written);
     }
 }
 
-void pdani_file_check_collision(const struct pdani_file *file, int x, int y, int framenumber, bool fliph, bool flipv, pdani_collider_callback callback, void *ptr)
+// frame cache
+
+enum {
+    FRAME_CACHE_EMPTY, //< 未作成（追い出し後も）
+    FRAME_CACHE_READY,
+    FRAME_CACHE_SKIP, //< セルが1枚以下か、予算に入らないので直接描く
+};
+
+static inline uint32_t frameCacheEntrySize(const struct pdani_frame_cache_entry *entry)
 {
-    ASSERT(s_api != NULL);
-    ASSERT(file != NULL);
-    ASSERT(1 <= framenumber && framenumber <= pdani_file_get_frame_count(file));
+    return (uint32_t)entry->rowbytes * entry->h * 2;
+}
 
-    if (callback == NULL) return;
+static void frameCacheEvict(const struct pdani_file *file, struct pdani_frame_cache_entry *entry)
+{
+    file->frame_cache->used -= frameCacheEntrySize(entry);
+    fileFree(file, entry->data);
+    entry->data = NULL;
+    entry->state = FRAME_CACHE_EMPTY;
+}
 
-    SpriteFrameLayerIterator it, end;
+/// @internal フレームのセルを反転込みで1枚に合成する
+static void frameCacheBuild(const struct pdani_file *file, struct pdani_frame_cache_entry *entry, int framenumber, bool fliph, bool flipv)
+{
+    struct pdani_frame_cache *cache = file->frame_cache;
     const int sw = pdani_file_get_width(file);
     const int sh = pdani_file_get_height(file);
 
+    // 描くセルの外接矩形（キャンバスからはみ出したセルも直接描くときと同じく含める）
+    // ストリーミング時もキャッシュを通さずに読む（再生中のタグを追い出さない）
+    FrameScan scan = { 0 };
+    const struct pdani_frame_data *frame = frameScanGet(file, &scan, framenumber);
+    LCDRect rc = { 0 };
+    int cels = 0;
+    SpriteFrameLayerIterator it, end;
     spriteFrameLayerEnd(&end, file, framenumber);
-    for (spriteFrameLayerBegin(&it, file, framenumber); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
-        const struct pdani_layer_data *layer = it.layer_data;
-        const struct pdani_frame_layer *framelayer = it.frame_layer;
-        if (layer->type == PDANI_LAYER_TYPE_COLLIDER && framelayer->collider >= 0) {
-            const struct pdani_collider_data *col = spriteGetColliderData(file, framelayer->collider);
-            const int dx = (fliph)? x + sw - col->x - col->w : x + col->x;
-            const int dy = (flipv)? y + sh - col->y - col->h : y + col->y;
-            (*callback)(file, getString(file, layer->name), dx, dy, col->w, col->h, ptr);
-        }
+    for (spriteFrameLayerBeginWithData(&it, file, frame); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+        if (it.layer_data->type != PDANI_LAYER_TYPE_LAYER || it.frame_layer->cel < 0) continue;
+        const struct pdani_cel_data *cel = spriteGetCelData(file, it.frame_layer->cel);
+        const struct pdani_image_data *image = spriteGetImageData(file, cel->image);
+        if (image->w == 0 || image->h == 0) continue;
+        const int dx = (fliph)? sw - cel->x - image->w : cel->x;
+        const int dy = (flipv)? sh - cel->y - image->h : cel->y;
+        const LCDRect cel_rect = LCDMakeRect(dx, dy, image->w, image->h);
+        unionRect(&rc, &cel_rect);
+        ++cels;
     }
-}
-
-void pdani_file_dump(const struct pdani_file *file)
-{
-    PRINT("top: %p", file->header);
-    PRINT("id: %c%c%c%c version: %d", file->header->id[0], file->header->id[1], file->header->id[2], file->header->id[3], file->header->version);
-
-    for (int i = 0; i < PDANI_CHUNK_TYPE_MAX; ++i) {
-        const struct pdani_chunk *chunk = file->chunks[i];
 
-        PRINT("chunk: %p %s", chunk, s_chunk_names[detectChunkType(chunk)]);
-        PRINT("id: %c%c%c%c size: %d next: %d", chunk->id[0], chunk->id[1], chunk->id[2], chunk->id[3], chunk->size, chunk->next);
+    const int w = rc.right - rc.left;
+    const int h = rc.bottom - rc.top;
+    entry->x = (int16_t)rc.left;
+    entry->y = (int16_t)rc.top;
+    entry->w = (uint16_t)w;
+    entry->h = (uint16_t)h;
+    entry->rowbytes = (uint16_t)(((w + 31) >> 5) << 2);
+    const uint32_t size = frameCacheEntrySize(entry);
+    if (cels <= 1 || size > cache->budget) {
+        entry->state = FRAME_CACHE_SKIP;
+        frameScanFinalize(file, &scan);
+        return;
     }
 
-    if (file->chunks[PDANI_CHUNK_TYPE_TAG] != NULL) {
-        PRINT("tagCount: %d", pdani_file_get_tag_count(file));
-        for (int i = 0; i < pdani_file_get_tag_count(file); ++i) {
-            const struct pdani_tag_data *tag = spriteGetTagData(file, i);
-            PRINT("  from:%d to:%d name:%s", tag->from, tag->to, getString(file, tag->name));
+    // 予算に入るまで最も長く使っていないものから捨てる
+    const int count = pdani_file_get_frame_count(file) * 4;
+    while (cache->used + size > cache->budget) {
+        struct pdani_frame_cache_entry *oldest = NULL;
+        for (int i = 0; i < count; ++i) {
+            struct pdani_frame_cache_entry *e = &cache->entries[i];
+            if (e->state == FRAME_CACHE_READY && (oldest == NULL || e->last_used < oldest->last_used)) oldest = e;
         }
+        frameCacheEvict(file, oldest);
     }
 
-    if (file->chunks[PDANI_CHUNK_TYPE_LAYER] != NULL) {
-        PRINT("layerCount: %d", pdani_file_get_layer_count(file));
-        for (int i = 0; i < pdani_file_get_layer_count(file); ++i) {
-            const struct pdani_layer_data *layer = spriteGetLayerData(file, i);
-            PRINT("  [%2d] type:%c parent:%d name:%s sub:%d", i, layer->type, layer->parent, getString(file, layer->name), layer->layerCount);
-        }
-        //aniSpriteTraverseLayer(file, LayerCallback, NULL);
+    entry->data = fileAlloc(file, size);
+    memset(entry->data, 0, size);
+    cache->used += size;
+    entry->state = FRAME_CACHE_READY;
+
+    const DrawTarget target = {
+        .data = entry->data,
+        .mask = entry->data + entry->rowbytes * h,
+        .rowbytes = entry->rowbytes,
+        .clip = { .left = 0, .right = w, .top = 0, .bottom = h },
+    };
+    DrawSource src;
+    fileGetDrawSource(file, fliph, &src);
+    LCDRect written = { 0 };
+    fileDrawFrameData(file, &src, &target, -rc.left, -rc.top, frame, 0, fliph, flipv, &written);
+    frameScanFinalize(file, &scan);
+}
+
+// @internal 合成済みのフレームがあれば1回の転送で描く（なければ false）
+static bool fileDrawCachedFrame(const struct pdani_file *file, const DrawTarget *target, int x, int y, int framenumber, bool fliph, bool flipv, LCDRect *written)
+{
+    struct pdani_frame_cache *cache = file->frame_cache;
+    struct pdani_frame_cache_entry *entry = &cache->entries[((framenumber - 1) << 2) | (fliph? 1 : 0) | (flipv? 2 : 0)];
+    if (entry->state == FRAME_CACHE_EMPTY) {
+        frameCacheBuild(file, entry, framenumber, fliph, flipv);
     }
+    if (entry->state != FRAME_CACHE_READY) return false;
 
-    if (file->chunks[PDANI_CHUNK_TYPE_FRAME] != NULL) {
-        PRINT("frameCount: %d", pdani_file_get_frame_count(file));
-        for (int i = 1; i <= pdani_file_get_frame_count(file); ++i) {
-            const struct pdani_frame_data *frame = spriteGetFrameData(file, i);
-            PRINT("  frame:%d duration:%dms", i, frame->duration);//, frame->layerCount);
-            int celidx = 0;
+    entry->last_used = ++cache->tick;
+    const DrawSource src = {
+        .texel = entry->data,
+        .mask = entry->data + entry->rowbytes * entry->h,
+        .rowbytes = entry->rowbytes,
+    };
+    drawBitmapWithRect(&src, target, x + entry->x, y + entry->y, 0, 0, entry->w, entry->h, false, false, false, written);
+    return true;
+}
+
+void pdani_file_enable_frame_cache(struct pdani_file *file, int budget_bytes)
+{
+    ASSERT(file != NULL);
+    struct pdani_frame_cache *cache = file->frame_cache;
+    if (cache != NULL) {
+        const int count = pdani_file_get_frame_count(file) * 4;
+        for (int i = 0; i < count; ++i) {
+            if (cache->entries[i].state == FRAME_CACHE_READY) frameCacheEvict(file, &cache->entries[i]);
+        }
+        if (budget_bytes <= 0) {
+            fileFree(file, cache);
+            file->frame_cache = NULL;
+            return;
+        }
+    } else {
+        if (budget_bytes <= 0) return;
+        // 項目表を後ろに続けてひとつのブロックに置く
+        const size_t entries_size = sizeof(struct pdani_frame_cache_entry) * pdani_file_get_frame_count(file) * 4;
+        cache = fileAlloc(file, sizeof(struct pdani_frame_cache) + entries_size);
+        memset(cache, 0, sizeof(struct pdani_frame_cache) + entries_size);
+        cache->entries = (struct pdani_frame_cache_entry*)(cache + 1);
+        file->frame_cache = cache;
+    }
+    // 予算が変わると入らなくなるものや入るようになるものがあるので作り直す
+    const int count = pdani_file_get_frame_count(file) * 4;
+    for (int i = 0; i < count; ++i) {
+        cache->entries[i].state = FRAME_CACHE_EMPTY;
+    }
+    cache->budget = (uint32_t)budget_bytes;
+}
+
+// variant
+
+static inline const struct pdani_variant_misc* fileGetVariantMisc(const struct pdani_file *file)
+{
+    const struct pdani_chunk *chunk = file->chunks[PDANI_CHUNK_TYPE_VARIANT];
+    return (chunk != NULL)? (const struct pdani_variant_misc*)chunkGetMisc(chunk) : NULL;
+}
+
+int pdani_file_get_rotation_count(const struct pdani_file *file)
+{
+    const struct pdani_variant_misc *misc = fileGetVariantMisc(file);
+    return (misc != NULL)? misc->angle_count : 1;
+}
+
+int pdani_file_get_scale_count(const struct pdani_file *file)
+{
+    const struct pdani_variant_misc *misc = fileGetVariantMisc(file);
+    return (misc != NULL)? misc->scale_count : 1;
+}
+
+/// @internal 最も近い向きの番号
+static int fileFindRotation(const struct pdani_file *file, float degrees)
+{
+    const int count = pdani_file_get_rotation_count(file);
+    const float position = degrees * count / 360.0f;
+    const int index = (int)(position + ((position < 0.0f)? -0.5f : 0.5f)) % count;
+    return (index < 0)? index + count : index;
+}
+
+/// @internal 最も近い拡大率の番号
+static int fileFindScale(const struct pdani_file *file, float scale)
+{
+    const struct pdani_variant_misc *misc = fileGetVariantMisc(file);
+    if (misc == NULL) return 0;
+    const uint16_t *scales = (const uint16_t*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_VARIANT]);
+    int best = 0;
+    float best_distance = 0.0f;
+    for (int i = 0; i < misc->scale_count; ++i) {
+        const float distance = (scales[i] / 256.0f > scale)? scales[i] / 256.0f - scale : scale - scales[i] / 256.0f;
+        if (i == 0 || distance < best_distance) {
+            best = i;
+            best_distance = distance;
+        }
+    }
+    return best;
+}
+
+int pdani_file_find_variant(const struct pdani_file *file, float degrees, float scale)
+{
+    ASSERT(file != NULL);
+    return fileFindScale(file, scale) * pdani_file_get_rotation_count(file) + fileFindRotation(file, degrees);
+}
+
+/// @internal 焼き込み済みのセル番号（enum pdani_variant_cel も返す）
+static inline int fileGetVariantCel(const struct pdani_file *file, int framenumber, int variant)
+{
+    if (variant == 0) return PDANI_VARIANT_CEL_NOT_BAKED;
+    const struct pdani_variant_misc *misc = fileGetVariantMisc(file);
+    DATA_CHECK(file, misc != NULL && variant < misc->angle_count * misc->scale_count);
+    const int16_t *cels = (const int16_t*)((const uint16_t*)chunkGetData(file->chunks[PDANI_CHUNK_TYPE_VARIANT]) + misc->scale_count);
+    return cels[(variant - 1) * pdani_file_get_frame_count(file) + framenumber - 1];
+}
+
+/// @internal 描く範囲（キャンバス座標、反転込み）。焼き込み済みのセルはその矩形、それ以外はキャンバス。何も描かなければ false
+static bool fileGetDrawRect(const struct pdani_file *file, int framenumber, int variant, bool fliph, bool flipv, LCDRect *rect)
+{
+    const int sw = pdani_file_get_width(file);
+    const int sh = pdani_file_get_height(file);
+    const int celindex = fileGetVariantCel(file, framenumber, variant);
+    if (celindex == PDANI_VARIANT_CEL_EMPTY) return false;
+    if (celindex == PDANI_VARIANT_CEL_NOT_BAKED) {
+        *rect = LCDMakeRect(0, 0, sw, sh);
+        return true;
+    }
+    const struct pdani_cel_data *cel = spriteGetCelData(file, celindex);
+    const struct pdani_image_data *image = spriteGetImageData(file, cel->image);
+    *rect = LCDMakeRect((fliph)? sw - cel->x - image->w : cel->x, (flipv)? sh - cel->y - image->h : cel->y, image->w, image->h);
+    return true;
+}
+
+// @internal 描画先の範囲内に入ることは呼び出し側で確認済み。隠すレイヤーがあれば合成済みの絵は使えない
+static void fileDrawFrame(const struct pdani_file *file, const DrawTarget *target, int x, int y, int framenumber, int variant, uint64_t hidden, bool fliph, bool flipv, LCDRect *written)
+{
+    if (hidden != 0) {
+        fileDrawLayers(file, target, x, y, framenumber, hidden, fliph, flipv, written);
+        return;
+    }
+    const int celindex = fileGetVariantCel(file, framenumber, variant);
+    if (celindex >= 0) {
+        // 焼き込み済みのバリエーションは1枚のセル
+        DrawSource src;
+        fileGetDrawSource(file, fliph, &src);
+        const struct pdani_cel_data *cel = spriteGetCelData(file, celindex);
+        const struct pdani_image_data *image = spriteGetImageData(file, cel->image);
+        const int dx = (fliph)? x + pdani_file_get_width(file) - cel->x - image->w : x + cel->x;
+        const int dy = (flipv)? y + pdani_file_get_height(file) - cel->y - image->h : y + cel->y;
+        drawImage(file, &src, target, dx, dy, cel->image, image->u, image->v, image->w, image->h, fliph, flipv, written);
+        return;
+    }
+    if (celindex == PDANI_VARIANT_CEL_EMPTY) return;
+    if (file->frame_cache != NULL && fileDrawCachedFrame(file, target, x, y, framenumber, fliph, flipv, written)) return;
+    fileDrawLayers(file, target, x, y, framenumber, 0, fliph, flipv, written);
+}
+
+// @internal target が NULL なら画面
+static void getDrawTarget(LCDBitmap *target, DrawTarget *out)
+{
+    if (target != NULL) {
+        int width = 0, height = 0;
+        s_api->graphics->getBitmapData(target, &width, &height, &out->rowbytes, &out->mask, &out->data);
+        ASSERT((out->rowbytes & 3) == 0 && "bitmap rows must be 32bit aligned");
+        out->clip = (LCDRect){ .left = 0, .right = width, .top = 0, .bottom = height };
+    } else {
+        out->data = s_api->graphics->getFrame();
+        out->mask = NULL;
+        out->rowbytes = LCD_ROWSIZE;
+        out->clip = screen_rect;
+    }
+}
+
+static void fileDraw(const struct pdani_file *file, LCDBitmap *target, int x, int y, int framenumber, int variant, uint64_t hidden, bool fliph, bool flipv)
+{
+    ASSERT(s_api != NULL);
+    ASSERT(file != NULL);
+    ASSERT(1 <= framenumber && framenumber <= pdani_file_get_frame_count(file));
+
+    STATS_COUNT(file, draws, 1);
+    LCDRect rc;
+    if (!fileGetDrawRect(file, framenumber, variant, fliph, flipv, &rc)) {
+        STATS_COUNT(file, culled_draws, 1);
+        return;
+    }
+    DrawTarget dst;
+    getDrawTarget(target, &dst);
+    rc = LCDMakeRect(x + rc.left, y + rc.top, rc.right - rc.left, rc.bottom - rc.top);
+    if (!clip_rect(&rc, &dst.clip)) {
+        STATS_COUNT(file, culled_draws, 1);
+        return;
+    }
+
+    LCDRect written = { 0 };
+    STATS_DRAW_BEGIN(file);
+    fileDrawFrame(file, &dst, x, y, framenumber, variant, hidden, fliph, flipv, &written);
+    STATS_DRAW_END(file);
+
+    if (target == NULL && written.bottom > written.top) {
+        pdani_dirty_mark(&written);
+    }
+}
+
+void pdani_file_draw_variant(const struct pdani_file *file, LCDBitmap *target, int x, int y, int framenumber, int variant, bool fliph, bool flipv)
+{
+    fileDraw(file, target, x, y, framenumber, variant, 0, fliph, flipv);
+}
+
+void pdani_file_draw(const struct pdani_file *file, LCDBitmap *target, int x, int y, int framenumber, bool fliph, bool flipv)
+{
+    pdani_file_draw_variant(file, target, x, y, framenumber, 0, fliph, flipv);
+}
+
+/// @internal レイヤー名の ID と、フレームごとのイベント表を作る
+static void fileBuildSymbols(struct pdani_file *file)
+{
+    if (file->symbols.layer_ids != NULL) return;
+
+    const int layer_count = pdani_file_get_layer_count(file);
+    const int frame_count = pdani_file_get_frame_count(file);
+    FrameScan scan = { 0 };
+    int total = 0;
+    for (int f = 1; f <= frame_count; ++f) {
+        SpriteFrameLayerIterator it, end;
+        spriteFrameLayerEnd(&end, file, f);
+        for (spriteFrameLayerBeginWithData(&it, file, frameScanGet(file, &scan, f)); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+            if (it.layer_data->type != PDANI_LAYER_TYPE_GROUP && it.frame_layer->userCallback > 0) ++total;
+        }
+    }
+    ASSERT(total <= 0xffff);
+
+    // layer_ids を先頭にひとつのブロックに置く
+    uint16_t *buf = fileAlloc(file, sizeof(uint16_t) * (layer_count + frame_count + 1) + sizeof(struct pdani_event_data) * total);
+    uint16_t *layer_ids = buf;
+    uint16_t *frame_start = buf + layer_count;
+    struct pdani_event_data *events = (struct pdani_event_data*)(frame_start + frame_count + 1);
+
+    for (int i = 0; i < layer_count; ++i) {
+        layer_ids[i] = (uint16_t)pdani_intern(getString(file, spriteGetLayerData(file, i)->name));
+    }
+    int n = 0;
+    for (int f = 1; f <= frame_count; ++f) {
+        frame_start[f - 1] = (uint16_t)n;
+        SpriteFrameLayerIterator it, end;
+        spriteFrameLayerEnd(&end, file, f);
+        for (spriteFrameLayerBeginWithData(&it, file, frameScanGet(file, &scan, f)); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+            if (it.layer_data->type == PDANI_LAYER_TYPE_GROUP || it.frame_layer->userCallback == 0) continue;
+            const uint16_t name = it.frame_layer->userCallback;
+            events[n++] = (struct pdani_event_data){ .id = (uint16_t)pdani_intern(getString(file, name)), .name = name, .layer = (uint16_t)it.layer_index };
+        }
+    }
+    frame_start[frame_count] = (uint16_t)n;
+    frameScanFinalize(file, &scan);
+
+    file->symbols.layer_ids = layer_ids;
+    file->symbols.frame_start = frame_start;
+    file->symbols.events = events;
+}
+
+static void spriteCheckFrameTrigger(struct pdani_file *file, int framenumber, uint64_t hidden, pdani_frame_layer_callback callback, void *ptr)
+{
+    ASSERT(s_api != NULL);
+    ASSERT(file != NULL);
+    ASSERT(1 <= framenumber && framenumber <= pdani_file_get_frame_count(file));
+
+    if (callback == NULL) return;
+
+    fileBuildSymbols(file);
+    const int end = file->symbols.frame_start[framenumber];
+    for (int i = file->symbols.frame_start[framenumber - 1]; i < end; ++i) {
+        if (hidden != 0 && layerIsHidden(hidden, file->symbols.events[i].layer)) continue;
+        STATS_COUNT(file, callbacks, 1);
+        (*callback)(file, framenumber, getString(file, file->symbols.events[i].name), ptr);
+    }
+}
+
+int pdani_file_get_layer_name_id(struct pdani_file *file, int index)
+{
+    ASSERT(0 <= index && index < pdani_file_get_layer_count(file));
+    fileBuildSymbols(file);
+    return file->symbols.layer_ids[index];
+}
+
+static void fileCheckCollision(const struct pdani_file *file, int x, int y, int framenumber, uint64_t hidden, bool fliph, bool flipv, pdani_collider_callback callback, void *ptr)
+{
+    ASSERT(s_api != NULL);
+    ASSERT(file != NULL);
+    ASSERT(1 <= framenumber && framenumber <= pdani_file_get_frame_count(file));
+
+    if (callback == NULL) return;
+
+    SpriteFrameLayerIterator it, end;
+    const int sw = pdani_file_get_width(file);
+    const int sh = pdani_file_get_height(file);
+
+    spriteFrameLayerEnd(&end, file, framenumber);
+    for (spriteFrameLayerBegin(&it, file, framenumber); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+        const struct pdani_layer_data *layer = it.layer_data;
+        const struct pdani_frame_layer *framelayer = it.frame_layer;
+        if (layer->type == PDANI_LAYER_TYPE_COLLIDER && framelayer->collider >= 0) {
+            if (hidden != 0 && layerIsHidden(hidden, it.layer_index)) continue;
+            const struct pdani_collider_data *col = spriteGetColliderData(file, framelayer->collider);
+            const int dx = (fliph)? x + sw - col->x - col->w : x + col->x;
+            const int dy = (flipv)? y + sh - col->y - col->h : y + col->y;
+            STATS_COUNT(file, collider_checks, 1);
+            (*callback)(file, getString(file, layer->name), dx, dy, col->w, col->h, ptr);
+        }
+    }
+}
+
+void pdani_file_check_collision(const struct pdani_file *file, int x, int y, int framenumber, bool fliph, bool flipv, pdani_collider_callback callback, void *ptr)
+{
+    fileCheckCollision(file, x, y, framenumber, 0, fliph, flipv, callback, ptr);
+}
+
+void pdani_file_dump(const struct pdani_file *file)
+{
+    // PRINT はリリースビルドで消えるので、読み出しごと消す
+#ifndef NDEBUG
+    PRINT("top: %p", file->header);
+    PRINT("id: %c%c%c%c version: %d", file->header->id[0], file->header->id[1], file->header->id[2], file->header->id[3], file->header->version);
+
+    for (int i = 0; i < PDANI_CHUNK_TYPE_MAX; ++i) {
+        const struct pdani_chunk *chunk = file->chunks[i];
+        if (chunk == NULL) continue;
+
+        PRINT("chunk: %p %s", chunk, s_chunk_names[detectChunkType(chunk)]);
+        PRINT("id: %c%c%c%c size: %d", chunk->id[0], chunk->id[1], chunk->id[2], chunk->id[3], (int)chunkGetSize(file, chunk));
+    }
+
+    if (file->chunks[PDANI_CHUNK_TYPE_TAG] != NULL) {
+        PRINT("tagCount: %d", pdani_file_get_tag_count(file));
+        for (int i = 0; i < pdani_file_get_tag_count(file); ++i) {
+            const struct pdani_tag_data *tag = spriteGetTagData(file, i);
+            PRINT("  from:%d to:%d name:%s", tag->from, tag->to, getString(file, tag->name));
+        }
+    }
+
+    if (file->chunks[PDANI_CHUNK_TYPE_LAYER] != NULL) {
+        PRINT("layerCount: %d", pdani_file_get_layer_count(file));
+        for (int i = 0; i < pdani_file_get_layer_count(file); ++i) {
+            const struct pdani_layer_data *layer = spriteGetLayerData(file, i);
+            PRINT("  [%2d] type:%c parent:%d name:%s sub:%d", i, layer->type, layer->parent, getString(file, layer->name), layer->layerCount);
+        }
+        //aniSpriteTraverseLayer(file, LayerCallback, NULL);
+    }
+
+    if (file->chunks[PDANI_CHUNK_TYPE_FRAME] != NULL) {
+        PRINT("frameCount: %d", pdani_file_get_frame_count(file));
+        for (int i = 1; i <= pdani_file_get_frame_count(file); ++i) {
+            const struct pdani_frame_data *frame = spriteGetFrameData(file, i);
+            PRINT("  frame:%d duration:%dms", i, frame->duration);//, frame->layerCount);
+            int celidx = 0;
             for (int j = 0; j < pdani_file_get_layer_count(file); ++j) {
                 const struct pdani_layer_data *layer = spriteGetLayerData(file, j);
                 switch (layer->type) {
@@ -649,6 +2413,34 @@ void pdani_file_dump(const struct pdani_file *file)
             PRINT(" col:%d %d %d %d", col->x, col->y, col->w, col->h);
         }
     }
+
+    if (file->chunks[PDANI_CHUNK_TYPE_SPAN] != NULL) {
+        PRINT("spanImageCount: %d", spriteGetSpanImageCount(file));
+        for (int i = 0; i < spriteGetSpanImageCount(file); ++i) {
+            const struct pdani_span_data *end;
+            for (const struct pdani_span_data *span = spriteGetSpanData(file, i, &end); span != end; ++span) {
+                PRINT(" span:%d %c %d %d %d %d", i, span->kind, span->x, span->y, span->w, span->h);
+            }
+        }
+    }
+
+    if (file->chunks[PDANI_CHUNK_TYPE_ATLAS] != NULL) {
+        const struct pdani_atlas_misc *atlas = (const struct pdani_atlas_misc*)chunkGetMisc(file->chunks[PDANI_CHUNK_TYPE_ATLAS]);
+        PRINT("atlas: %d x %d rowbytes:%d", atlas->width, atlas->height, atlas->rowbytes);
+    }
+
+    if (file->chunks[PDANI_CHUNK_TYPE_VARIANT] != NULL) {
+        const int variants = pdani_file_get_rotation_count(file) * pdani_file_get_scale_count(file);
+        PRINT("variants: %d angles x %d scales", pdani_file_get_rotation_count(file), pdani_file_get_scale_count(file));
+        for (int v = 1; v < variants; ++v) {
+            for (int i = 1; i <= pdani_file_get_frame_count(file); ++i) {
+                PRINT(" variant:%d frame:%d cel:%d", v, i, fileGetVariantCel(file, i, v));
+            }
+        }
+    }
+#else
+    (void)file;
+#endif
 }
 
 
@@ -673,8 +2465,7 @@ void pdani_player_initialize(struct pdani_player *player, struct pdani_file *fil
 
 void pdani_player_initialize_with_filename(struct pdani_player *player, const char *anifilename, const char *bmpfilename)
 {
-    struct pdani_file *file = mem_alloc(sizeof(struct pdani_file));
-    pdani_file_initialize_with_filename(file, anifilename, bmpfilename);
+    struct pdani_file *file = pdani_asset_acquire(anifilename, bmpfilename);
     player_initialize(player, file);
     BIT_SET(player->flags, PDANI_PLAYER_FLAG_SELF_ALLOCATE);
 }
@@ -682,7 +2473,8 @@ void pdani_player_initialize_with_filename(struct pdani_player *player, const ch
 void pdani_player_finalize(struct pdani_player *player)
 {
     if (BIT_CHECK(player->flags, PDANI_PLAYER_FLAG_SELF_ALLOCATE)) {
-        pdani_file_finalize(player->file);
+        pdani_asset_release(player->file);
+        player->file = NULL;
     }
 }
 
@@ -691,14 +2483,29 @@ void pdani_player_play(struct pdani_player *player, const char *tagname)
     ASSERT(player != NULL);
 
     if (tagname != NULL) {
-        const struct pdani_tag_data *tag = spriteFindTagData(player->file, tagname);
-        ASSERT(tag != NULL && "not found");
+        const int index = pdani_file_find_tag(player->file, tagname);
+        ASSERT(index >= 0 && "not found");
+        pdani_player_play_tag_index(player, index);
+    } else {
+        pdani_player_play_tag_index(player, -1);
+    }
+}
+
+void pdani_player_play_tag_index(struct pdani_player *player, int tag_index)
+{
+    ASSERT(player != NULL);
+
+    if (tag_index >= 0) {
+        const struct pdani_tag_data *tag = spriteGetTagData(player->file, tag_index);
         player->start_frame = tag->from;
         player->end_frame = tag->to;
     } else {
         player->start_frame = 1;
         player->end_frame = pdani_file_get_frame_count(player->file);
     }
+    if (player->file->stream != NULL) {
+        streamPrefetch(player->file, player->start_frame, player->end_frame);
+    }
 
     pdani_player_seek_frame(player, player->start_frame);
     player->is_playing = true;
@@ -716,6 +2523,62 @@ void pdani_player_resume(struct pdani_player *player)
     player->is_playing = true;
 }
 
+/// @internal frame_time[n] はフレーム 1..n の長さの合計
+static const uint32_t* fileGetFrameTime(struct pdani_file *file)
+{
+    if (file->frame_time != NULL) return file->frame_time;
+
+    const int frame_count = pdani_file_get_frame_count(file);
+    uint32_t *times = fileAlloc(file, sizeof(uint32_t) * (frame_count + 1));
+    times[0] = 0;
+    FrameScan scan = { 0 };
+    for (int i = 1; i <= frame_count; ++i) {
+        times[i] = times[i - 1] + frameScanGet(file, &scan, i)->duration;
+    }
+    frameScanFinalize(file, &scan);
+    file->frame_time = times;
+    return times;
+}
+
+/// @internal start..end の先頭から rel ミリ秒の位置のフレームを二分探索で求める（elapsed にフレーム内の経過時間）
+static int locateFrameTime(const uint32_t *times, int start, int end, bool loop, uint32_t rel, int16_t *elapsed)
+{
+    const uint32_t length = times[end] - times[start - 1];
+    if (loop && length > 0) {
+        rel %= length;
+    }
+    const uint32_t t = times[start - 1] + rel;
+
+    // t < times[f] となる最小の f（長さ0のフレームは飛ばされる）
+    int lo = start, hi = end;
+    while (lo < hi) {
+        const int mid = (lo + hi) >> 1;
+        if (times[mid] > t) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    uint32_t e = t - times[lo - 1];
+    if (lo == end) {
+        // 最後のフレームに留まる場合、1フレームずつ進めたときと同じ余りにする
+        const uint32_t duration = times[end] - times[end - 1];
+        e = (duration > 0)? e % duration : 0;
+    }
+    *elapsed = (int16_t)e;
+    return lo;
+}
+
+/// @internal タグ先頭から rel ミリ秒の位置へ移動する
+static void playerLocateTime(struct pdani_player *player, uint32_t rel)
+{
+    const uint32_t *times = fileGetFrameTime(player->file);
+    player->frame_number = (int16_t)locateFrameTime(times, player->start_frame, player->end_frame,
+        player->loop_type == PDANI_LOOP_TYPE_LOOP, rel, &player->frame_elapsed);
+    player->current_frame = spriteGetFrameData(player->file, player->frame_number);
+}
+
 void pdani_player_seek_frame(struct pdani_player *player, int frame_number)
 {
     ASSERT(player != NULL);
@@ -726,6 +2589,15 @@ void pdani_player_seek_frame(struct pdani_player *player, int frame_number)
     player->previous_frame_number = -1;
 }
 
+void pdani_player_seek_time(struct pdani_player *player, int ms)
+{
+    ASSERT(player != NULL);
+    pdani_player_seek_frame(player, player->start_frame);
+    if (ms <= 0) return;
+    playerLocateTime(player, (uint32_t)ms);
+    player->total_elapsed = ms;
+}
+
 inline bool pdani_player_get_flip_horizontally(const struct pdani_player *player)
 {
     return BIT_CHECK(player->flags, PDANI_PLAYER_FLAG_FLIP_HORIZONTALLY);
@@ -751,18 +2623,122 @@ void pdani_player_set_flip(struct pdani_player *player, bool fliph, bool flipv)
     }
 }
 
+void pdani_player_set_rotation(struct pdani_player *player, float degrees)
+{
+    ASSERT(player != NULL);
+    const int count = pdani_file_get_rotation_count(player->file);
+    player->variant = (uint16_t)(player->variant / count * count + fileFindRotation(player->file, degrees));
+}
+
+void pdani_player_set_scale(struct pdani_player *player, float scale)
+{
+    ASSERT(player != NULL);
+    const int count = pdani_file_get_rotation_count(player->file);
+    player->variant = (uint16_t)(fileFindScale(player->file, scale) * count + player->variant % count);
+}
+
+void pdani_player_set_layer_enabled(struct pdani_player *player, int index, bool enabled)
+{
+    ASSERT(player != NULL);
+    const int count = pdani_file_get_layer_count(player->file);
+    ASSERT(0 <= index && index < count);
+    ASSERT(index < PDANI_LAYER_MASK_BITS && "only the first PDANI_LAYER_MASK_BITS layers can be disabled");
+    if (index >= PDANI_LAYER_MASK_BITS) return;
+
+    if (enabled) {
+        player->disabled_layers &= ~((uint64_t)1 << index);
+    } else {
+        player->disabled_layers |= (uint64_t)1 << index;
+    }
+
+    // 親は子より前に並んでいるので、先頭から1回なめれば子孫まで伝わる
+    uint64_t hidden = 0;
+    const int n = (count < PDANI_LAYER_MASK_BITS)? count : PDANI_LAYER_MASK_BITS;
+    for (int i = 0; i < n; ++i) {
+        const int parent = spriteGetLayerData(player->file, i)->parent;
+        if (((player->disabled_layers >> i) & 1) != 0 || (parent >= 0 && ((hidden >> parent) & 1) != 0)) {
+            hidden |= (uint64_t)1 << i;
+        }
+    }
+    player->hidden_layers = hidden;
+}
+
+bool pdani_player_set_layer_enabled_by_name(struct pdani_player *player, const char *layername, bool enabled)
+{
+    ASSERT(player != NULL);
+    const int index = pdani_file_find_layer(player->file, layername);
+    if (index < 0 || index >= PDANI_LAYER_MASK_BITS) return false;
+    pdani_player_set_layer_enabled(player, index, enabled);
+    return true;
+}
+
+bool pdani_player_is_layer_visible(const struct pdani_player *player, int index)
+{
+    ASSERT(player != NULL);
+    ASSERT(0 <= index && index < pdani_file_get_layer_count(player->file));
+    return !layerIsHidden(player->hidden_layers, index);
+}
+
+/// @internal 隠すレイヤーがあれば焼き込み済みの絵は使わず元の絵を描く
+static inline int playerGetDrawVariant(const struct pdani_player *player)
+{
+    return (player->hidden_layers != 0)? 0 : player->variant;
+}
+
+/// @internal
+static inline int calculateNextFrame(int start_frame, int end_frame, bool loop, int current_frame_number)
+{
+    if (current_frame_number >= end_frame) {
+        return loop? start_frame : current_frame_number;
+    }
+    return current_frame_number + 1;
+}
+
 /// @internal
 static inline int playerCalculateNextFrame(const struct pdani_player *player, int current_frame_number)
 {
-    if (current_frame_number >= player->end_frame) {
-        switch (player->loop_type) {
-        case PDANI_LOOP_TYPE_ONESHOT:
-            return current_frame_number;
-        case PDANI_LOOP_TYPE_LOOP:
-            return player->start_frame;
+    return calculateNextFrame(player->start_frame, player->end_frame, player->loop_type == PDANI_LOOP_TYPE_LOOP, current_frame_number);
+}
+
+void pdani_player_enable_event_queue(struct pdani_player *player, bool enable)
+{
+    ASSERT(player != NULL);
+    if (enable) {
+        BIT_SET(player->flags, PDANI_PLAYER_FLAG_EVENT_QUEUE);
+    } else {
+        BIT_CLEAR(player->flags, PDANI_PLAYER_FLAG_EVENT_QUEUE);
+        player->events.head = 0;
+        player->events.count = 0;
+    }
+}
+
+bool pdani_player_poll_event(struct pdani_player *player, struct pdani_event *event)
+{
+    ASSERT(player != NULL);
+    if (player->events.count == 0) return false;
+    *event = player->events.items[player->events.head];
+    player->events.head = (uint8_t)((player->events.head + 1) % PDANI_EVENT_QUEUE_SIZE);
+    player->events.count -= 1;
+    return true;
+}
+
+/// @internal フレームのイベントをキューに積む（あふれたら古いものを捨てる）
+static void playerQueueFrameEvents(struct pdani_player *player, int framenumber)
+{
+    struct pdani_file *file = player->file;
+    fileBuildSymbols(file);
+    const int end = file->symbols.frame_start[framenumber];
+    for (int i = file->symbols.frame_start[framenumber - 1]; i < end; ++i) {
+        if (player->hidden_layers != 0 && layerIsHidden(player->hidden_layers, file->symbols.events[i].layer)) continue;
+        if (player->events.count == PDANI_EVENT_QUEUE_SIZE) {
+            player->events.head = (uint8_t)((player->events.head + 1) % PDANI_EVENT_QUEUE_SIZE);
+            player->events.count -= 1;
         }
+        const int tail = (player->events.head + player->events.count) % PDANI_EVENT_QUEUE_SIZE;
+        player->events.items[tail] = (struct pdani_event){ .frame = (int16_t)framenumber, .id = file->symbols.events[i].id };
+        player->events.count += 1;
+        STATS_COUNT(file, callbacks, 1);
     }
-    return current_frame_number + 1;
 }
 
 void pdani_player_check_collision(const struct pdani_player *player, int x, int y, pdani_collider_callback callback, void *ptr)
@@ -775,33 +2751,36 @@ void pdani_player_check_collision(const struct pdani_player *player, int x, int
     const bool flipv = pdani_player_get_flip_vertically(player);
 
     if (player->previous_frame_number < 0) {
-        pdani_file_check_collision(player->file, x, y, player->frame_number, fliph, flipv, callback, ptr);
+        fileCheckCollision(player->file, x, y, player->frame_number, player->hidden_layers, fliph, flipv, callback, ptr);
     } else if (player->previous_frame_number != player->frame_number) {
         int f = player->previous_frame_number;
         do {
             f = playerCalculateNextFrame(player, f);
-            pdani_file_check_collision(player->file, x, y, f, fliph, flipv, callback, ptr);
+            fileCheckCollision(player->file, x, y, f, player->hidden_layers, fliph, flipv, callback, ptr);
         } while (f != player->frame_number);
     } else {
-        pdani_file_check_collision(player->file, x, y, player->frame_number, fliph, flipv, callback, ptr);
+        fileCheckCollision(player->file, x, y, player->frame_number, player->hidden_layers, fliph, flipv, callback, ptr);
     }
 }
 
 // postupdate
-void pdani_player_update(struct pdani_player *player, int ms, pdani_frame_layer_callback callback, void *ptr)
+static void playerUpdate(struct pdani_player *player, int ms, pdani_frame_layer_callback callback, void *ptr)
 {
     ASSERT(player != NULL);
     if (!player->is_playing) return;
-    if (callback != NULL)
+    const bool use_queue = BIT_CHECK(player->flags, PDANI_PLAYER_FLAG_EVENT_QUEUE);
+    if (callback != NULL || use_queue)
     {
         //PRINT("%d - %d", player->previous_frame_number, player->frame_number);
         if (player->previous_frame_number < 0) {
-            spriteCheckFrameTrigger(player->file, player->frame_number, callback, ptr);
+            spriteCheckFrameTrigger(player->file, player->frame_number, player->hidden_layers, callback, ptr);
+            if (use_queue) playerQueueFrameEvents(player, player->frame_number);
         } else if (player->previous_frame_number != player->frame_number) {
             int f = player->previous_frame_number;
             do {
                 f = playerCalculateNextFrame(player, f);
-                spriteCheckFrameTrigger(player->file, f, callback, ptr);
+                spriteCheckFrameTrigger(player->file, f, player->hidden_layers, callback, ptr);
+                if (use_queue) playerQueueFrameEvents(player, f);
             } while (f != player->frame_number);
         }
     }
@@ -810,18 +2789,41 @@ void pdani_player_update(struct pdani_player *player, int ms, pdani_frame_layer_
     player->previous_frame_number = player->frame_number;
     if (is_first) return;
 
-    player->frame_elapsed += ms;
+    const int32_t elapsed = player->frame_elapsed + ms;
     player->total_elapsed += ms;
 
     bool is_frame_skippable = BIT_CHECK(player->flags, PDANI_PLAYER_FLAG_FRAME_SKIPPABLE);
 
-    while (player->current_frame->duration <= player->frame_elapsed) {
-        player->frame_elapsed -= player->current_frame->duration;
-        player->frame_number = playerCalculateNextFrame(player, player->frame_number);
+    // ストリーミング読み込みでは他のプレイヤーがキャッシュを追い出しているかもしれないので引き直す
+    const struct pdani_frame_data *frame = (player->file->stream != NULL)?
+        spriteGetFrameData(player->file, player->frame_number) : player->current_frame;
+    if (frame->duration > elapsed) {
+        player->frame_elapsed = (int16_t)elapsed;
+        return;
+    }
+
+    // コールバックがなければ累積時間から移動先のフレームを直接求める
+    if (callback == NULL && !use_queue && is_frame_skippable
+        && player->start_frame <= player->frame_number && player->frame_number <= player->end_frame) {
+        const uint32_t *times = fileGetFrameTime(player->file);
+        playerLocateTime(player, times[player->frame_number - 1] - times[player->start_frame - 1] + (uint32_t)elapsed);
+        STATS_COUNT(player->file, frames_advanced, 1);
         if (player->frame_number >= player->end_frame && player->loop_type == PDANI_LOOP_TYPE_ONESHOT) {
             player->is_playing = false;
         }
-        player->current_frame = spriteGetFrameData(player->file, player->frame_number);
+        return;
+    }
+
+    player->frame_elapsed = (int16_t)elapsed;
+    while (frame->duration <= player->frame_elapsed) {
+        player->frame_elapsed -= frame->duration;
+        player->frame_number = playerCalculateNextFrame(player, player->frame_number);
+        STATS_COUNT(player->file, frames_advanced, 1);
+        if (player->frame_number >= player->end_frame && player->loop_type == PDANI_LOOP_TYPE_ONESHOT) {
+            player->is_playing = false;
+        }
+        frame = spriteGetFrameData(player->file, player->frame_number);
+        player->current_frame = frame;
 
         if (!is_frame_skippable) {
             player->frame_elapsed = 0;
@@ -830,16 +2832,785 @@ void pdani_player_update(struct pdani_player *player, int ms, pdani_frame_layer_
     }
 }
 
+void pdani_player_update(struct pdani_player *player, int ms, pdani_frame_layer_callback callback, void *ptr)
+{
+    STATS_TIMER_START(start);
+    playerUpdate(player, ms, callback, ptr);
+    STATS_TIMER_STOP(player->file, update_ms, start);
+}
+
 void pdani_player_draw(const struct pdani_player *player, LCDBitmap *target, int x, int y)
 {
     ASSERT(player != NULL);
     const int frame =  (player->is_playing)? player->frame_number : 1;
     const bool fliph = pdani_player_get_flip_horizontally(player);
     const bool flipv = pdani_player_get_flip_vertically(player);
-    pdani_file_draw(player->file, target, x, y, frame, fliph, flipv);
+    fileDraw(player->file, target, x, y, frame, playerGetDrawVariant(player), player->hidden_layers, fliph, flipv);
 }
 
 
+// player group
+
+/// @internal メンバーごとの配列をまとめて capacity 個に伸ばす
+static void groupReserve(struct pdani_player_group *group, int capacity)
+{
+    ASSERT(capacity <= 0x10000);
+    const struct pdani_allocator *allocator = group->allocator;
+    group->frame_number = mem_realloc(allocator, group->frame_number, sizeof(int16_t) * capacity);
+    group->previous_frame_number = mem_realloc(allocator, group->previous_frame_number, sizeof(int16_t) * capacity);
+    group->frame_elapsed = mem_realloc(allocator, group->frame_elapsed, sizeof(int16_t) * capacity);
+    group->total_elapsed = mem_realloc(allocator, group->total_elapsed, sizeof(int32_t) * capacity);
+    group->start_frame = mem_realloc(allocator, group->start_frame, sizeof(uint16_t) * capacity);
+    group->end_frame = mem_realloc(allocator, group->end_frame, sizeof(uint16_t) * capacity);
+    group->flags = mem_realloc(allocator, group->flags, sizeof(uint8_t) * capacity);
+    group->changed = mem_realloc(allocator, group->changed, sizeof(uint16_t) * capacity);
+    group->capacity = capacity;
+}
+
+void pdani_player_group_initialize(struct pdani_player_group *group, struct pdani_file *file, int capacity)
+{
+    ASSERT(s_api != NULL);
+    ASSERT(file != NULL);
+    memset(group, 0, sizeof(struct pdani_player_group));
+    group->allocator = s_allocator;
+    group->file = file;
+    if (capacity > 0) {
+        groupReserve(group, capacity);
+    }
+}
+
+void pdani_player_group_finalize(struct pdani_player_group *group)
+{
+    void *arrays[] = {
+        group->frame_number, group->previous_frame_number, group->frame_elapsed, group->total_elapsed,
+        group->start_frame, group->end_frame, group->flags, group->changed, group->events,
+    };
+    for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); ++i) {
+        if (arrays[i] != NULL) mem_realloc(group->allocator, arrays[i], 0);
+    }
+    memset(group, 0, sizeof(struct pdani_player_group));
+}
+
+int pdani_player_group_add(struct pdani_player_group *group)
+{
+    ASSERT(group != NULL);
+    if (group->count >= group->capacity) {
+        groupReserve(group, (group->capacity > 0)? group->capacity * 2 : 16);
+    }
+    const int member = group->count;
+    group->frame_number[member] = 1;
+    group->previous_frame_number[member] = -1;
+    group->frame_elapsed[member] = 0;
+    group->total_elapsed[member] = 0;
+    group->start_frame[member] = 1;
+    group->end_frame[member] = (uint16_t)pdani_file_get_frame_count(group->file);
+    group->flags[member] = PDANI_PLAYER_GROUP_FLAG_FRAME_SKIPPABLE;
+    group->count += 1;
+    return member;
+}
+
+void pdani_player_group_remove(struct pdani_player_group *group, int member)
+{
+    ASSERT(0 <= member && member < group->count);
+    const int last = group->count - 1;
+    group->frame_number[member] = group->frame_number[last];
+    group->previous_frame_number[member] = group->previous_frame_number[last];
+    group->frame_elapsed[member] = group->frame_elapsed[last];
+    group->total_elapsed[member] = group->total_elapsed[last];
+    group->start_frame[member] = group->start_frame[last];
+    group->end_frame[member] = group->end_frame[last];
+    group->flags[member] = group->flags[last];
+    group->count = last;
+}
+
+void pdani_player_group_play(struct pdani_player_group *group, int member, const char *tagname)
+{
+    if (tagname != NULL) {
+        const int index = pdani_file_find_tag(group->file, tagname);
+        ASSERT(index >= 0 && "not found");
+        pdani_player_group_play_tag_index(group, member, index);
+    } else {
+        pdani_player_group_play_tag_index(group, member, -1);
+    }
+}
+
+void pdani_player_group_play_tag_index(struct pdani_player_group *group, int member, int tag_index)
+{
+    ASSERT(0 <= member && member < group->count);
+    if (tag_index >= 0) {
+        const struct pdani_tag_data *tag = spriteGetTagData(group->file, tag_index);
+        group->start_frame[member] = tag->from;
+        group->end_frame[member] = tag->to;
+    } else {
+        group->start_frame[member] = 1;
+        group->end_frame[member] = (uint16_t)pdani_file_get_frame_count(group->file);
+    }
+    if (group->file->stream != NULL) {
+        streamPrefetch(group->file, group->start_frame[member], group->end_frame[member]);
+    }
+
+    pdani_player_group_seek_frame(group, member, group->start_frame[member]);
+    BIT_SET(group->flags[member], PDANI_PLAYER_GROUP_FLAG_PLAYING);
+}
+
+void pdani_player_group_stop(struct pdani_player_group *group, int member)
+{
+    ASSERT(0 <= member && member < group->count);
+    BIT_CLEAR(group->flags[member], PDANI_PLAYER_GROUP_FLAG_PLAYING);
+}
+
+void pdani_player_group_resume(struct pdani_player_group *group, int member)
+{
+    ASSERT(0 <= member && member < group->count);
+    BIT_SET(group->flags[member], PDANI_PLAYER_GROUP_FLAG_PLAYING);
+}
+
+void pdani_player_group_seek_frame(struct pdani_player_group *group, int member, int frame_number)
+{
+    ASSERT(0 <= member && member < group->count);
+    ASSERT(1 <= frame_number && frame_number <= pdani_file_get_frame_count(group->file));
+    group->frame_number[member] = (int16_t)frame_number;
+    group->frame_elapsed[member] = 0;
+    group->total_elapsed[member] = 0;
+    group->previous_frame_number[member] = -1;
+}
+
+void pdani_player_group_set_loop_type(struct pdani_player_group *group, int member, enum pdani_player_loop_type loop_type)
+{
+    ASSERT(0 <= member && member < group->count);
+    if (loop_type == PDANI_LOOP_TYPE_ONESHOT) {
+        BIT_SET(group->flags[member], PDANI_PLAYER_GROUP_FLAG_ONESHOT);
+    } else {
+        BIT_CLEAR(group->flags[member], PDANI_PLAYER_GROUP_FLAG_ONESHOT);
+    }
+}
+
+void pdani_player_group_set_frame_skippable(struct pdani_player_group *group, int member, bool skippable)
+{
+    ASSERT(0 <= member && member < group->count);
+    if (skippable) {
+        BIT_SET(group->flags[member], PDANI_PLAYER_GROUP_FLAG_FRAME_SKIPPABLE);
+    } else {
+        BIT_CLEAR(group->flags[member], PDANI_PLAYER_GROUP_FLAG_FRAME_SKIPPABLE);
+    }
+}
+
+void pdani_player_group_set_flip(struct pdani_player_group *group, int member, bool fliph, bool flipv)
+{
+    ASSERT(0 <= member && member < group->count);
+    if (fliph) {
+        BIT_SET(group->flags[member], PDANI_PLAYER_GROUP_FLAG_FLIP_HORIZONTALLY);
+    } else {
+        BIT_CLEAR(group->flags[member], PDANI_PLAYER_GROUP_FLAG_FLIP_HORIZONTALLY);
+    }
+
+    if (flipv) {
+        BIT_SET(group->flags[member], PDANI_PLAYER_GROUP_FLAG_FLIP_VERTICALLY);
+    } else {
+        BIT_CLEAR(group->flags[member], PDANI_PLAYER_GROUP_FLAG_FLIP_VERTICALLY);
+    }
+}
+
+void pdani_player_group_enable_events(struct pdani_player_group *group, bool enable)
+{
+    ASSERT(group != NULL);
+    group->events_enabled = enable;
+    group->event_count = 0;
+}
+
+/// @internal フレームのイベントを events に追加する
+static void groupPushFrameEvents(struct pdani_player_group *group, int member, int framenumber)
+{
+    const struct pdani_file *file = group->file;
+    const int end = file->symbols.frame_start[framenumber];
+    for (int i = file->symbols.frame_start[framenumber - 1]; i < end; ++i) {
+        if (group->event_count >= group->event_capacity) {
+            const int capacity = (group->event_capacity > 0)? group->event_capacity * 2 : 16;
+            group->events = mem_realloc(group->allocator, group->events, sizeof(struct pdani_group_event) * capacity);
+            group->event_capacity = capacity;
+        }
+        group->events[group->event_count++] = (struct pdani_group_event){
+            .member = (uint16_t)member,
+            .frame = (int16_t)framenumber,
+            .id = file->symbols.events[i].id,
+        };
+        STATS_COUNT(file, callbacks, 1);
+    }
+}
+
+// pdani_player_update と同じ進め方を、フレームデータを引かずに累積時間の表だけで行う
+void pdani_player_group_update(struct pdani_player_group *group, int ms)
+{
+    ASSERT(group != NULL);
+    group->changed_count = 0;
+    group->event_count = 0;
+    if (group->count == 0) return;
+    STATS_TIMER_START(stats_start);
+
+    const uint32_t *times = fileGetFrameTime(group->file);
+    const int frame_count = pdani_file_get_frame_count(group->file);
+    const bool use_events = group->events_enabled;
+    if (use_events) fileBuildSymbols(group->file);
+
+    int16_t *frame_number = group->frame_number;
+    int16_t *previous_frame_number = group->previous_frame_number;
+    int16_t *frame_elapsed = group->frame_elapsed;
+    int32_t *total_elapsed = group->total_elapsed;
+    const uint16_t *start_frame = group->start_frame;
+    const uint16_t *end_frame = group->end_frame;
+    uint8_t *flags = group->flags;
+
+    for (int i = 0; i < group->count; ++i) {
+        uint8_t state = flags[i];
+        if (!BIT_CHECK(state, PDANI_PLAYER_GROUP_FLAG_PLAYING)) continue;
+
+        const int start = start_frame[i];
+        const int end = end_frame[i];
+        const bool loop = !BIT_CHECK(state, PDANI_PLAYER_GROUP_FLAG_ONESHOT);
+        const int previous = previous_frame_number[i];
+        const int current = frame_number[i];
+        if (use_events) {
+            if (previous < 0) {
+                groupPushFrameEvents(group, i, current);
+            } else if (previous != current) {
+                // 途中でループの種類を変えると current に届かないことがあるので、全フレーム分で打ち切る
+                int f = previous;
+                for (int n = 0; n < frame_count && f != current; ++n) {
+                    f = calculateNextFrame(start, end, loop, f);
+                    groupPushFrameEvents(group, i, f);
+                }
+            }
+        }
+
+        previous_frame_number[i] = (int16_t)current;
+        if (previous < 0) continue;
+
+        const int32_t elapsed = frame_elapsed[i] + ms;
+        total_elapsed[i] += ms;
+
+        int32_t duration = (int32_t)(times[current] - times[current - 1]);
+        if (duration > elapsed) {
+            frame_elapsed[i] = (int16_t)elapsed;
+            continue;
+        }
+
+        const bool is_frame_skippable = BIT_CHECK(state, PDANI_PLAYER_GROUP_FLAG_FRAME_SKIPPABLE);
+        int frame = current;
+        int16_t remaining = (int16_t)elapsed;
+        if (is_frame_skippable && start <= frame && frame <= end) {
+            frame = locateFrameTime(times, start, end, loop, times[frame - 1] - times[start - 1] + (uint32_t)elapsed, &remaining);
+        } else {
+            // 1フレームずつ進める（範囲に入ったら残りは累積時間から直接求める）
+            while (duration <= remaining) {
+                remaining -= (int16_t)duration;
+                const int next = calculateNextFrame(start, end, loop, frame);
+                if (next >= end && !loop) {
+                    BIT_CLEAR(state, PDANI_PLAYER_GROUP_FLAG_PLAYING);
+                }
+                if (!is_frame_skippable) {
+                    frame = next;
+                    remaining = 0;
+                    break;
+                }
+                if (start <= next && next <= end) {
+                    frame = locateFrameTime(times, start, end, loop, times[next - 1] - times[start - 1] + (uint32_t)remaining, &remaining);
+                    break;
+                }
+                if (next == frame) {
+                    // 範囲の外で止まったフレームに留まる
+                    remaining = (duration > 0)? (int16_t)(remaining % duration) : 0;
+                    break;
+                }
+                frame = next;
+                duration = (int32_t)(times[frame] - times[frame - 1]);
+            }
+        }
+        if (frame >= end && !loop) {
+            BIT_CLEAR(state, PDANI_PLAYER_GROUP_FLAG_PLAYING);
+        }
+
+        frame_number[i] = (int16_t)frame;
+        frame_elapsed[i] = remaining;
+        flags[i] = state;
+        if (frame != current) {
+            STATS_COUNT(group->file, frames_advanced, 1);
+        }
+        // 停止すると描画するフレームは 1 になる
+        const int drawn = BIT_CHECK(state, PDANI_PLAYER_GROUP_FLAG_PLAYING)? frame : 1;
+        if (drawn != current) {
+            group->changed[group->changed_count++] = (uint16_t)i;
+        }
+    }
+    STATS_TIMER_STOP(group->file, update_ms, stats_start);
+}
+
+int pdani_player_group_get_frame(const struct pdani_player_group *group, int member)
+{
+    ASSERT(0 <= member && member < group->count);
+    return BIT_CHECK(group->flags[member], PDANI_PLAYER_GROUP_FLAG_PLAYING)? group->frame_number[member] : 1;
+}
+
+void pdani_player_group_draw(const struct pdani_player_group *group, int member, LCDBitmap *target, int x, int y)
+{
+    const int frame = pdani_player_group_get_frame(group, member);
+    const uint8_t state = group->flags[member];
+    pdani_file_draw(group->file, target, x, y, frame,
+        BIT_CHECK(state, PDANI_PLAYER_GROUP_FLAG_FLIP_HORIZONTALLY), BIT_CHECK(state, PDANI_PLAYER_GROUP_FLAG_FLIP_VERTICALLY));
+}
+
+// arena
+
+#define PDANI_ARENA_ALIGN 8
+
+/// @internal 確保した側は NULL を確かめないので、足りなければリリースビルドでもここで止める
+static void* arenaFull(const struct pdani_arena *arena, size_t size)
+{
+    s_api->system->error("pdani: arena is full (%d of %d bytes used, %d requested)", (int)arena->used, (int)arena->capacity, (int)size);
+    return NULL;
+}
+
+/// @internal 各ブロックの先頭に大きさを置き、直前のブロックだけはその場で伸縮・解放できる
+static void* arenaRealloc(void *context, void *ptr, size_t size)
+{
+    struct pdani_arena *arena = context;
+    const size_t header = PDANI_ARENA_ALIGN;
+    size_t old_size = 0;
+    bool is_last = false;
+    if (ptr != NULL) {
+        old_size = *(size_t*)((uint8_t*)ptr - header);
+        is_last = (uint8_t*)ptr - header == arena->buffer + arena->last;
+    }
+
+    if (size == 0) {
+        if (is_last) arena->used = arena->last;
+        return NULL;
+    }
+
+    const size_t aligned = (size + PDANI_ARENA_ALIGN - 1) & ~(size_t)(PDANI_ARENA_ALIGN - 1);
+    if (is_last) {
+        if (arena->last + header + aligned > arena->capacity) return arenaFull(arena, size);
+        *(size_t*)(arena->buffer + arena->last) = size;
+        arena->used = arena->last + header + aligned;
+        return ptr;
+    }
+
+    if (arena->used + header + aligned > arena->capacity) return arenaFull(arena, size);
+    uint8_t *block = arena->buffer + arena->used;
+    *(size_t*)block = size;
+    arena->last = arena->used;
+    arena->used += header + aligned;
+    if (ptr != NULL) {
+        memcpy(block + header, ptr, (old_size < size)? old_size : size);
+    }
+    return block + header;
+}
+
+void pdani_arena_initialize(struct pdani_arena *arena, void *buffer, size_t capacity)
+{
+    // 先頭を揃える
+    const size_t skip = (size_t)(-(uintptr_t)buffer) & (PDANI_ARENA_ALIGN - 1);
+    ASSERT(capacity >= skip);
+    arena->allocator.realloc = arenaRealloc;
+    arena->allocator.context = arena;
+    arena->buffer = (uint8_t*)buffer + skip;
+    arena->capacity = capacity - skip;
+    arena->used = 0;
+    arena->last = 0;
+}
+
+void pdani_arena_reset(struct pdani_arena *arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+}
+
+// collision world
+
+static inline int collisionCellX(const struct pdani_collision_world *world, int x)
+{
+    const int v = x - world->bounds.left;
+    if (v < 0) return 0;
+    return ((v >> world->cell_shift) < world->columns)? (v >> world->cell_shift) : world->columns - 1;
+}
+
+static inline int collisionCellY(const struct pdani_collision_world *world, int y)
+{
+    const int v = y - world->bounds.top;
+    if (v < 0) return 0;
+    return ((v >> world->cell_shift) < world->rows)? (v >> world->cell_shift) : world->rows - 1;
+}
+
+static inline bool collisionOverlap(const struct pdani_collision_entry *e, int x, int y, int w, int h)
+{
+    // ワールドはファイルを持たないので全体の値だけに数える
+    STATS_COUNT(NULL, collider_checks, 1);
+    return e->x < x + w && x < e->x + e->w && e->y < y + h && y < e->y + e->h;
+}
+
+static inline bool collisionMatch(const struct pdani_collision_entry *e, int id)
+{
+    return id == 0 || e->name_id == id;
+}
+
+void pdani_collision_world_initialize(struct pdani_collision_world *world, const LCDRect *bounds, int cell_size)
+{
+    ASSERT(s_api != NULL);
+    memset(world, 0, sizeof(struct pdani_collision_world));
+    world->allocator = s_allocator;
+    world->bounds = (bounds != NULL)? *bounds : screen_rect;
+    while ((1 << world->cell_shift) < cell_size) {
+        world->cell_shift += 1;
+    }
+    const int size = 1 << world->cell_shift;
+    const int w = world->bounds.right - world->bounds.left;
+    const int h = world->bounds.bottom - world->bounds.top;
+    world->columns = (w > 0)? (w + size - 1) >> world->cell_shift : 1;
+    world->rows = (h > 0)? (h + size - 1) >> world->cell_shift : 1;
+    world->cell_start = mem_realloc(world->allocator, NULL, sizeof(uint16_t) * (world->columns * world->rows + 2));
+}
+
+void pdani_collision_world_finalize(struct pdani_collision_world *world)
+{
+    if (world->entries != NULL) mem_realloc(world->allocator, world->entries, 0);
+    if (world->cell_items != NULL) mem_realloc(world->allocator, world->cell_items, 0);
+    if (world->cell_start != NULL) mem_realloc(world->allocator, world->cell_start, 0);
+    memset(world, 0, sizeof(struct pdani_collision_world));
+}
+
+void pdani_collision_world_begin(struct pdani_collision_world *world)
+{
+    world->count = 0;
+    world->cell_item_count = 0;
+}
+
+// @internal 番号とセルごとの登録は uint16 で持つので、収まらない矩形は登録しない
+static bool collisionAddEntry(struct pdani_collision_world *world, const char *name, int name_id, int x, int y, int w, int h, void *owner)
+{
+    if (w <= 0 || h <= 0) return true;
+    const int cells = (collisionCellX(world, x + w - 1) - collisionCellX(world, x) + 1) * (collisionCellY(world, y + h - 1) - collisionCellY(world, y) + 1);
+    if (world->count >= 0xffff || world->cell_item_count + cells > 0xffff) return false;
+    if (world->count >= world->capacity) {
+        const int capacity = (world->capacity > 0)? world->capacity * 2 : 64;
+        world->entries = mem_realloc(world->allocator, world->entries, sizeof(struct pdani_collision_entry) * capacity);
+        world->capacity = capacity;
+    }
+    world->entries[world->count] = (struct pdani_collision_entry){
+        .x = (int16_t)x,
+        .y = (int16_t)y,
+        .w = (uint16_t)w,
+        .h = (uint16_t)h,
+        .name = name,
+        .name_id = (uint16_t)name_id,
+        .owner = owner,
+    };
+    world->count += 1;
+    world->cell_item_count += cells;
+    return true;
+}
+
+bool pdani_collision_world_add_rect(struct pdani_collision_world *world, const char *name, int x, int y, int w, int h, void *owner)
+{
+    return collisionAddEntry(world, name, pdani_intern(name), x, y, w, h, owner);
+}
+
+bool pdani_collision_world_add_player(struct pdani_collision_world *world, const struct pdani_player *player, int x, int y, void *owner)
+{
+    ASSERT(player != NULL);
+    struct pdani_file *file = player->file;
+    fileBuildSymbols(file);
+
+    // pdani_player_draw と同じフレームを使う
+    const int frame = (player->is_playing)? player->frame_number : 1;
+    const bool fliph = pdani_player_get_flip_horizontally(player);
+    const bool flipv = pdani_player_get_flip_vertically(player);
+    const int sw = pdani_file_get_width(file);
+    const int sh = pdani_file_get_height(file);
+
+    bool added = true;
+    SpriteFrameLayerIterator it, end;
+    spriteFrameLayerEnd(&end, file, frame);
+    for (spriteFrameLayerBegin(&it, file, frame); !spriteFrameLayerCompare(&it, &end); spriteFrameLayerNext(&it)) {
+        if (it.layer_data->type != PDANI_LAYER_TYPE_COLLIDER || it.frame_layer->collider < 0) continue;
+        if (player->hidden_layers != 0 && layerIsHidden(player->hidden_layers, it.layer_index)) continue;
+        const struct pdani_collider_data *col = spriteGetColliderData(file, it.frame_layer->collider);
+        const int dx = (fliph)? x + sw - col->x - col->w : x + col->x;
+        const int dy = (flipv)? y + sh - col->y - col->h : y + col->y;
+        STATS_COUNT(file, collider_checks, 1);
+        added &= collisionAddEntry(world, getString(file, it.layer_data->name), file->symbols.layer_ids[it.layer_index], dx, dy, col->w, col->h, owner);
+    }
+    return added;
+}
+
+void pdani_collision_world_build(struct pdani_collision_world *world)
+{
+    const int cells = world->columns * world->rows;
+    uint16_t *start = world->cell_start;
+    memset(start, 0, sizeof(uint16_t) * (cells + 2));
+
+    // start[c + 2] に数えて累積すると、詰めながら start[c + 1] がセル c の終わりになる
+    int total = 0;
+    for (int i = 0; i < world->count; ++i) {
+        const struct pdani_collision_entry *e = &world->entries[i];
+        const int cx0 = collisionCellX(world, e->x), cx1 = collisionCellX(world, e->x + e->w - 1);
+        const int cy0 = collisionCellY(world, e->y), cy1 = collisionCellY(world, e->y + e->h - 1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx) {
+                start[cy * world->columns + cx + 2] += 1;
+            }
+        }
+        total += (cx1 - cx0 + 1) * (cy1 - cy0 + 1);
+    }
+    ASSERT(total == world->cell_item_count);
+    for (int c = 2; c < cells + 2; ++c) {
+        start[c] += start[c - 1];
+    }
+
+    if (total > world->cell_item_capacity) {
+        world->cell_items = mem_realloc(world->allocator, world->cell_items, sizeof(uint16_t) * total);
+        world->cell_item_capacity = total;
+    }
+    for (int i = 0; i < world->count; ++i) {
+        const struct pdani_collision_entry *e = &world->entries[i];
+        const int cx0 = collisionCellX(world, e->x), cx1 = collisionCellX(world, e->x + e->w - 1);
+        const int cy0 = collisionCellY(world, e->y), cy1 = collisionCellY(world, e->y + e->h - 1);
+        for (int cy = cy0; cy <= cy1; ++cy) {
+            for (int cx = cx0; cx <= cx1; ++cx) {
+                world->cell_items[start[cy * world->columns + cx + 1]++] = (uint16_t)i;
+            }
+        }
+    }
+}
+
+void pdani_collision_world_query_pairs(const struct pdani_collision_world *world, const char *name_a, const char *name_b, pdani_collision_pair_callback callback, void *ptr)
+{
+    ASSERT(callback != NULL);
+    const int id_a = (name_a != NULL)? pdani_intern(name_a) : 0;
+    const int id_b = (name_b != NULL)? pdani_intern(name_b) : 0;
+
+    for (int cy = 0; cy < world->rows; ++cy) {
+        for (int cx = 0; cx < world->columns; ++cx) {
+            const int c = cy * world->columns + cx;
+            const int begin = world->cell_start[c], end = world->cell_start[c + 1];
+            for (int i = begin; i < end; ++i) {
+                const struct pdani_collision_entry *a = &world->entries[world->cell_items[i]];
+                for (int j = i + 1; j < end; ++j) {
+                    const struct pdani_collision_entry *b = &world->entries[world->cell_items[j]];
+                    if (a->owner != NULL && a->owner == b->owner) continue;
+                    if (!collisionOverlap(a, b->x, b->y, b->w, b->h)) continue;
+                    // 複数のセルにまたがる組は、重なりの左上があるセルでだけ数える
+                    const int ix = (a->x > b->x)? a->x : b->x;
+                    const int iy = (a->y > b->y)? a->y : b->y;
+                    if (collisionCellX(world, ix) != cx || collisionCellY(world, iy) != cy) continue;
+
+                    if (collisionMatch(a, id_a) && collisionMatch(b, id_b)) {
+                        (*callback)(a, b, ptr);
+                    } else if (collisionMatch(b, id_a) && collisionMatch(a, id_b)) {
+                        (*callback)(b, a, ptr);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void pdani_collision_world_query_rect(const struct pdani_collision_world *world, const char *name, int x, int y, int w, int h, pdani_collision_query_callback callback, void *ptr)
+{
+    ASSERT(callback != NULL);
+    if (w <= 0 || h <= 0) return;
+    const int id = (name != NULL)? pdani_intern(name) : 0;
+
+    const int cx0 = collisionCellX(world, x), cx1 = collisionCellX(world, x + w - 1);
+    const int cy0 = collisionCellY(world, y), cy1 = collisionCellY(world, y + h - 1);
+    for (int cy = cy0; cy <= cy1; ++cy) {
+        for (int cx = cx0; cx <= cx1; ++cx) {
+            const int c = cy * world->columns + cx;
+            for (int i = world->cell_start[c]; i < world->cell_start[c + 1]; ++i) {
+                const struct pdani_collision_entry *e = &world->entries[world->cell_items[i]];
+                if (!collisionOverlap(e, x, y, w, h)) continue;
+                const int ix = (e->x > x)? e->x : x;
+                const int iy = (e->y > y)? e->y : y;
+                if (collisionCellX(world, ix) != cx || collisionCellY(world, iy) != cy) continue;
+                if (collisionMatch(e, id)) {
+                    (*callback)(e, ptr);
+                }
+            }
+        }
+    }
+}
+
+void pdani_collision_world_query_point(const struct pdani_collision_world *world, const char *name, int x, int y, pdani_collision_query_callback callback, void *ptr)
+{
+    pdani_collision_world_query_rect(world, name, x, y, 1, 1, callback, ptr);
+}
+
+// dirty
+
+static void dirtySetRows(uint32_t *rows, int top, int bottom)
+{
+    while (top < bottom) {
+        const int b = top & 31;
+        const int n = (32 - b < bottom - top)? 32 - b : bottom - top;
+        rows[top >> 5] |= ((n == 32)? 0xffffffffu : ((1u << n) - 1)) << b;
+        top += n;
+    }
+}
+
+void pdani_dirty_mark(const LCDRect *rect)
+{
+    LCDRect rc = *rect;
+    if (!clip_rect(&rc, &screen_rect)) return;
+    dirtySetRows(s_dirty.rows, rc.top, rc.bottom);
+    unionRect(&s_dirty.bounds, &rc);
+}
+
+bool pdani_dirty_get_bounds(LCDRect *rect)
+{
+    *rect = s_dirty.bounds;
+    return s_dirty.bounds.bottom > s_dirty.bounds.top;
+}
+
+void pdani_dirty_flush(void)
+{
+    ASSERT(s_api != NULL);
+    int start = -1;
+    for (int row = 0; row <= LCD_ROWS; ++row) {
+        const bool dirty = row < LCD_ROWS && BIT_CHECK(s_dirty.rows[row >> 5] | s_dirty.previous_rows[row >> 5], 1u << (row & 31));
+        if (dirty && start < 0) {
+            start = row;
+        } else if (!dirty && start >= 0) {
+            s_api->graphics->markUpdatedRows(start, row - 1);
+            start = -1;
+        }
+    }
+    memcpy(s_dirty.previous_rows, s_dirty.rows, sizeof(s_dirty.rows));
+    memset(s_dirty.rows, 0, sizeof(s_dirty.rows));
+    s_dirty.bounds = (LCDRect){ 0 };
+}
+
+void pdani_dirty_clear(void)
+{
+    memset(&s_dirty, 0, sizeof(s_dirty));
+}
+
+#ifdef PDANI_ENABLE_STATS
+// stats
+
+void pdani_stats_begin_frame(void)
+{
+    ASSERT(s_api != NULL);
+    memset(&s_stats.frame, 0, sizeof(s_stats.frame));
+    s_api->system->resetElapsedTime();
+}
+
+void pdani_stats_end_frame(void)
+{
+    ASSERT(s_api != NULL);
+    struct pdani_stats *result = &s_stats.result;
+    result->frame = s_stats.frame;
+    result->frame_ms = s_api->system->getElapsedTime() * 1000.0f;
+    const int bucket = (int)result->frame_ms;
+    result->histogram[(bucket < PDANI_STATS_HISTOGRAM_BUCKETS)? bucket : PDANI_STATS_HISTOGRAM_BUCKETS - 1] += 1;
+    result->frame_count += 1;
+}
+
+const struct pdani_stats* pdani_stats_get(void)
+{
+    return &s_stats.result;
+}
+
+void pdani_stats_reset(void)
+{
+    memset(&s_stats.result, 0, sizeof(s_stats.result));
+}
+
+const struct pdani_stats_counters* pdani_file_get_stats(const struct pdani_file *file)
+{
+    ASSERT(file != NULL);
+    return &file->stats;
+}
+
+void pdani_file_reset_stats(struct pdani_file *file)
+{
+    ASSERT(file != NULL);
+    memset(&file->stats, 0, sizeof(file->stats));
+}
+
+/// @internal 計測値を数行の文字列にして1行ずつ渡す
+static void statsFormat(const struct pdani_stats_counters *c, void (*line)(const char *text, void *ctx), void *ctx)
+{
+    char *text = NULL;
+    s_api->system->formatString(&text, "draw %u (culled %u) %.2fms",
+        (unsigned)c->draws, (unsigned)c->culled_draws, (double)c->draw_ms);
+    (*line)(text, ctx);
+    s_api->system->realloc(text, 0);
+    s_api->system->formatString(&text, "blit %u (clipped %u culled %u) %uKB",
+        (unsigned)c->blits, (unsigned)c->clipped_blits, (unsigned)c->culled_blits, (unsigned)(c->bytes >> 10));
+    (*line)(text, ctx);
+    s_api->system->realloc(text, 0);
+    s_api->system->formatString(&text, "aligned %u unaligned %u flipped %u",
+        (unsigned)c->aligned_blits, (unsigned)c->unaligned_blits, (unsigned)c->flipped_blits);
+    (*line)(text, ctx);
+    s_api->system->realloc(text, 0);
+    s_api->system->formatString(&text, "frames %u callbacks %u colliders %u update %.2fms",
+        (unsigned)c->frames_advanced, (unsigned)c->callbacks, (unsigned)c->collider_checks, (double)c->update_ms);
+    (*line)(text, ctx);
+    s_api->system->realloc(text, 0);
+}
+
+static void statsLogLine(const char *text, void *ctx)
+{
+    s_api->system->logToConsole("  %s", text);
+}
+
+void pdani_stats_log(void)
+{
+    ASSERT(s_api != NULL);
+    const struct pdani_stats *result = &s_stats.result;
+    s_api->system->logToConsole("pdani frame %u: %.2fms", (unsigned)result->frame_count, (double)result->frame_ms);
+    statsFormat(&result->frame, statsLogLine, NULL);
+    for (int i = 0; i < PDANI_STATS_HISTOGRAM_BUCKETS; ++i) {
+        if (result->histogram[i] == 0) continue;
+        s_api->system->logToConsole("  %2d%s ms: %u", i, (i == PDANI_STATS_HISTOGRAM_BUCKETS - 1)? "+" : " ", (unsigned)result->histogram[i]);
+    }
+}
+
+void pdani_stats_log_file(const struct pdani_file *file, const char *name)
+{
+    ASSERT(s_api != NULL);
+    ASSERT(file != NULL);
+    s_api->system->logToConsole("pdani %s:", (name != NULL)? name : "");
+    statsFormat(&file->stats, statsLogLine, NULL);
+}
+
+struct stats_overlay {
+    int x, y;
+    int line_height;
+};
+
+static void statsOverlayLine(const char *text, void *ctx)
+{
+    struct stats_overlay *overlay = ctx;
+    const int width = s_api->graphics->drawText(text, strlen(text), kASCIIEncoding, overlay->x, overlay->y);
+    if (width > 0) {
+        const LCDRect rc = LCDMakeRect(overlay->x, overlay->y, width, overlay->line_height);
+        pdani_dirty_mark(&rc);
+    }
+    overlay->y += overlay->line_height;
+}
+
+void pdani_stats_draw_overlay(int x, int y, int line_height)
+{
+    ASSERT(s_api != NULL);
+    struct stats_overlay overlay = { .x = x, .y = y, .line_height = line_height };
+    char *text = NULL;
+    s_api->system->formatString(&text, "pdani %.2fms / frame %.2fms",
+        (double)(s_stats.result.frame.draw_ms + s_stats.result.frame.update_ms), (double)s_stats.result.frame_ms);
+    statsOverlayLine(text, &overlay);
+    s_api->system->realloc(text, 0);
+    statsFormat(&s_stats.result.frame, statsOverlayLine, &overlay);
+}
+#endif
+
 // sprite
 
 static void sprite_update_function(LCDSprite *sprite)
@@ -851,11 +3622,39 @@ static void sprite_update_function(LCDSprite *sprite)
     //s_api->system->logToConsole("%d", anisprite->player.frame_number);
     float px, py;
     s_api->sprite->getPosition(s, &px, &py);
-    float x = px - anisprite->origin_x;
-    float y = py - anisprite->origin_y;
-    float w = pdani_file_get_width(&anisprite->file);
-    float h = pdani_file_get_height(&anisprite->file);
+    const int frame = (anisprite->player.is_playing)? anisprite->player.frame_number : 1;
+    const bool fliph = pdani_player_get_flip_horizontally(&anisprite->player);
+    const bool flipv = pdani_player_get_flip_vertically(&anisprite->player);
+    const int variant = playerGetDrawVariant(&anisprite->player);
+    const uint64_t hidden = anisprite->player.hidden_layers;
+
+    // 見た目が変わらないフレームでは再描画させない
+    if (anisprite->bounds_state.frame == frame && anisprite->bounds_state.variant == variant
+        && anisprite->bounds_state.hidden_layers == hidden
+        && anisprite->bounds_state.x == px && anisprite->bounds_state.y == py
+        && anisprite->bounds_state.fliph == fliph && anisprite->bounds_state.flipv == flipv) {
+        return;
+    }
+    anisprite->bounds_state.frame = frame;
+    anisprite->bounds_state.variant = variant;
+    anisprite->bounds_state.hidden_layers = hidden;
+    anisprite->bounds_state.x = px;
+    anisprite->bounds_state.y = py;
+    anisprite->bounds_state.fliph = fliph;
+    anisprite->bounds_state.flipv = flipv;
+
+    LCDRect rc;
+    if (fileGetVariantCel(&anisprite->file, frame, variant) == PDANI_VARIANT_CEL_NOT_BAKED) {
+        pdani_file_get_frame_bounds(&anisprite->file, frame, fliph, flipv, &rc);
+    } else if (!fileGetDrawRect(&anisprite->file, frame, variant, fliph, flipv, &rc)) {
+        rc = (LCDRect){ 0 };
+    }
+    float x = px - anisprite->origin_x + rc.left;
+    float y = py - anisprite->origin_y + rc.top;
+    float w = (rc.right > rc.left)? rc.right - rc.left : 0;
+    float h = (rc.bottom > rc.top)? rc.bottom - rc.top : 0;
     s_api->sprite->setBounds(s, PDRectMake(x, y, w, h));
+    s_api->sprite->markDirty(s);
 }
 
 static void sprite_draw_function(LCDSprite *sprite, PDRect bounds, PDRect drawrect)
@@ -887,6 +3686,7 @@ void pdani_sprite_initialize(struct pdani_sprite *anisprite, void *data, LCDBitm
     int h = pdani_file_get_height(&anisprite->file);
     anisprite->origin_x = w >> 1;
     anisprite->origin_y = h >> 1;
+    anisprite->bounds_state.frame = -1;
 
     s_api->sprite->setUserdata(anisprite->sprite, anisprite);
     s_api->sprite->setUpdateFunction(anisprite->sprite, sprite_update_function);
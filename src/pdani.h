@@ -3,6 +3,7 @@
 
 #include "pd_api.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 enum pdani_chunk_type {
     PDANI_CHUNK_TYPE_INFO,
@@ -13,6 +14,9 @@ enum pdani_chunk_type {
     PDANI_CHUNK_TYPE_COLLIDER,
     PDANI_CHUNK_TYPE_IMAGE,
     PDANI_CHUNK_TYPE_STRING,
+    PDANI_CHUNK_TYPE_SPAN,
+    PDANI_CHUNK_TYPE_ATLAS,
+    PDANI_CHUNK_TYPE_VARIANT,
     PDANI_CHUNK_TYPE_MAX,
 };
 
@@ -27,21 +31,76 @@ enum pdani_layer_type {
     PDANI_LAYER_TYPE_COLLIDER = 'C',
 };
 
+enum pdani_span_kind {
+    PDANI_SPAN_KIND_MASKED = 'M', //< マスクを使って描く
+    PDANI_SPAN_KIND_OPAQUE = 'O', //< すべて不透明なのでそのまま書き込む
+};
+
 enum pdani_file_flags {
     PDANI_FILE_FLAG_SELF_ALLOCATE = (1<<0),
+    PDANI_FILE_FLAG_FLIP_CACHE = (1<<1), //< 水平反転済みのアトラスを使う
+    PDANI_FILE_FLAG_SHARED = (1<<2), //< pdani_asset_acquire で得た共有ファイル
+    PDANI_FILE_FLAG_WIDE_OFFSETS = (1<<3), //< @internal v2: FRAM と SPAN の表が 32bit
+    PDANI_FILE_FLAG_OWN_BITMAP = (1<<4), //< @internal ATLS チャンクから作ったアトラスを持つ
+    PDANI_FILE_FLAG_VALIDATED = (1<<5), //< @internal 読み込み時に検証済み（描画・更新でデータの範囲を調べない）
     PDANI_FILE_FLAG_FORCE_U32 = 0xffffffff, //< @internal
 };
 
+/// pdani_file_validate の結果
+enum pdani_file_error {
+    PDANI_FILE_ERROR_NONE,
+    PDANI_FILE_ERROR_IO, //< ファイルやビットマップが読めない
+    PDANI_FILE_ERROR_HEADER, //< .ani ではない・未対応の版・揃えが足りない
+    PDANI_FILE_ERROR_COMPRESSED, //< 圧縮されたまま（ファイル名版で読む）か、展開できない
+    PDANI_FILE_ERROR_CHUNK, //< チャンクがファイルからはみ出す・必須チャンクが無い・要素数がチャンクに収まらない
+    PDANI_FILE_ERROR_TABLE, //< FRAM のジャンプテーブルや SPAN の開始位置表がチャンクからはみ出す
+    PDANI_FILE_ERROR_FRAME, //< 長さが 0 のフレームがある（再生が進まない）
+    PDANI_FILE_ERROR_INDEX, //< タグ・セル・画像・コライダーの番号が範囲外
+    PDANI_FILE_ERROR_STRING, //< 文字列の位置が STRG の外か、終端が無い
+    PDANI_FILE_ERROR_LAYER, //< レイヤーの種類が不明か、親が自分より前のグループではない
+    PDANI_FILE_ERROR_ATLAS, //< 画像やスパンの矩形がアトラスからはみ出す・アトラスが無い
+};
+
 enum pdani_player_flags {
     PDANI_PLAYER_FLAG_SELF_ALLOCATE = (1<<0),
     PDANI_PLAYER_FLAG_FRAME_SKIPPABLE = (1<<1), //< フレームをスキップできるかどうか
     PDANI_PLAYER_FLAG_FLIP_HORIZONTALLY = (1<<2), //< 水平方向の反転
     PDANI_PLAYER_FLAG_FLIP_VERTICALLY = (1<<3), //< 垂直方向の反転
+    PDANI_PLAYER_FLAG_EVENT_QUEUE = (1<<4), //< 通過したフレームのイベントをキューに積む
     PDANI_PLAYER_FLAG_FORCE_U32 = 0xffffffff, //< @internal
 };
 
+enum pdani_player_group_flags {
+    PDANI_PLAYER_GROUP_FLAG_PLAYING = (1<<0),
+    PDANI_PLAYER_GROUP_FLAG_ONESHOT = (1<<1), //< PDANI_LOOP_TYPE_ONESHOT
+    PDANI_PLAYER_GROUP_FLAG_FRAME_SKIPPABLE = (1<<2), //< フレームをスキップできるかどうか
+    PDANI_PLAYER_GROUP_FLAG_FLIP_HORIZONTALLY = (1<<3), //< 水平方向の反転
+    PDANI_PLAYER_GROUP_FLAG_FLIP_VERTICALLY = (1<<4), //< 垂直方向の反転
+};
+
 
 
+struct pdani_header {
+    int8_t id[4];
+    uint32_t version;
+    uint16_t chunk_count; //< v2: ディレクトリの項目数
+    uint16_t alignment; //< v2: チャンクの揃え
+    uint16_t flags; //< v2: enum pdani_header_flags
+    uint16_t padding;
+};
+
+enum pdani_header_flags {
+    PDANI_HEADER_FLAG_COMPRESSED = (1<<0), //< ディレクトリより後ろが struct pdani_compressed_block で圧縮されている
+};
+
+// v2 の圧縮ブロック。ディレクトリの直後に置き、その後ろに LZ4 ブロック形式のデータが packed_size バイト続く。
+// 展開したものはディレクトリの直後から raw_size バイトで、ディレクトリの offset は展開後の位置を指す
+struct pdani_compressed_block {
+    uint32_t raw_size;
+    uint32_t packed_size;
+    int32_t padding[2];
+};
+
 struct pdani_chunk {
     int8_t id[4];
     uint16_t size;
@@ -49,6 +108,39 @@ struct pdani_chunk {
     int misc[2];
 };
 
+// v2 のチャンクヘッダ（v1 の size と next の位置に 32bit の size を置く）
+struct pdani_chunk_v2 {
+    int8_t id[4];
+    uint32_t size;
+    int misc[2];
+};
+
+// v2 のチャンクディレクトリ。ファイルヘッダの直後に chunk_count 個並び、
+// i 番目は enum pdani_chunk_type の i 番目のチャンク（offset が 0 なら無し）
+struct pdani_directory_entry {
+    int8_t id[4];
+    uint32_t offset; //< ファイル先頭からの位置
+};
+
+// 1bit のテクセルとマスク（rowbytes * height ずつ、テクセルが先）
+struct pdani_atlas_misc {
+    uint16_t width, height;
+    uint16_t rowbytes;
+};
+
+// 焼き込み済みの回転・拡大縮小。データは拡大率（256 倍、scale_count 個で 0 番は 1.0）に続けて、
+// 0 番以外のバリエーションごとにフレーム数分のセル番号（int16_t）を並べる。
+// バリエーション番号は 拡大率の番号 * angle_count + 向きの番号（向きは 360 度を angle_count 等分した時計回り）
+struct pdani_variant_misc {
+    uint16_t angle_count;
+    uint16_t scale_count;
+};
+
+enum pdani_variant_cel {
+    PDANI_VARIANT_CEL_NOT_BAKED = -1, //< 焼き込んでいないフレーム（元の絵を描く）
+    PDANI_VARIANT_CEL_EMPTY = -2, //< 何も描かない
+};
+
 struct pdani_info_misc {
     uint16_t width, height;
     uint16_t totalFrame;
@@ -119,13 +211,129 @@ struct pdani_collider_data {
     uint16_t w, h;
 };
 
+struct pdani_span_misc {
+    uint16_t count; //< 画像数
+};
+
+// 画像内の描画矩形。SPAN チャンクは uint16_t の開始位置表（count+1個）に続けてこれを並べる
+struct pdani_span_data {
+    int8_t kind;
+    int8_t reserved;
+    uint16_t x, y;
+    uint16_t w, h;
+};
+
+/// フレームのイベント（レイヤーの userCallback）
+struct pdani_event_data {
+    uint16_t id; //< pdani_intern の ID
+    uint16_t name; //< 文字列の位置
+    uint16_t layer; //< イベントを持つレイヤー番号
+};
+
+/// pdani_player_poll_event で受け取るイベント
+struct pdani_event {
+    int16_t frame;
+    uint16_t id; //< pdani_intern の ID
+};
+
+#define PDANI_EVENT_QUEUE_SIZE 8
+/// プレイヤーごとに隠せるのは先頭からこの数のレイヤーまで
+#define PDANI_LAYER_MASK_BITS 64
+
+/// 前もって解決したセル描画命令（pdani_file_compile_draw_list）
+struct pdani_draw_command {
+    int16_t x, y; //< キャンバス上の位置
+    int16_t flipped_x, flipped_y; //< 反転時のキャンバス上の位置
+    int16_t u, v;
+    uint16_t w, h;
+    uint16_t image;
+    uint16_t layer; //< レイヤー番号（プレイヤーごとに隠すため）
+};
+
+/// メモリ確保関数（realloc と同じ約束: ptr が NULL なら確保、size が 0 なら解放）
+struct pdani_allocator {
+    void* (*realloc)(void *context, void *ptr, size_t size);
+    void *context;
+};
+
+/// レベル単位の一括解放用バンプアロケータ。個別の解放は直前の確保以外は何もせず、reset でまとめて捨てる
+struct pdani_arena {
+    struct pdani_allocator allocator; //< pdani_global_set_allocator に渡す
+    uint8_t *buffer;
+    size_t capacity;
+    size_t used;
+    size_t last; //< 直前の確保の位置（その場で伸縮できる）
+};
+
+#define PDANI_STREAM_CACHE_SLOTS 8
+
+/// ストリーミング読み込み（pdani_file_initialize_streaming）の FRAM キャッシュ
+struct pdani_stream {
+    SDFile *fp;
+    uint32_t frame_data_offset; //< ファイル内での FRAM データの位置
+    uint32_t frame_data_size;
+    uint32_t budget; //< キャッシュの上限バイト数
+    uint32_t used;
+    uint32_t tick;
+    struct {
+        uint8_t *data; //< 未使用ならNULL
+        uint32_t begin, end; //< FRAM データ内のバイト範囲
+        uint32_t last_used;
+    } slots[PDANI_STREAM_CACHE_SLOTS];
+};
+
+/// 合成済みフレーム（pdani_file_enable_frame_cache）
+struct pdani_frame_cache_entry {
+    uint8_t *data; //< テクセル、続けてマスク（未作成なら NULL）
+    int16_t x, y; //< キャンバス上の位置（反転込み）
+    uint16_t w, h;
+    uint16_t rowbytes;
+    uint8_t state; //< @internal
+    uint32_t last_used;
+};
+
+/// 合成済みフレームのキャッシュ（フレームと反転状態ごとに1枚）
+struct pdani_frame_cache {
+    uint32_t budget; //< キャッシュの上限バイト数
+    uint32_t used;
+    uint32_t tick;
+    struct pdani_frame_cache_entry *entries; //< (フレーム - 1) * 4 + 水平反転 + 垂直反転 * 2
+};
+
+#ifdef PDANI_ENABLE_STATS
+/// 計測値（PDANI_ENABLE_STATS を定義してビルドしたときだけ数える。pdani.c と使う側で同じ定義にすること）
+struct pdani_stats_counters {
+    uint32_t draws; //< フレームを描いた回数（pdani_file_draw・pdani_player_draw）
+    uint32_t culled_draws; //< 描画先の外か、描くものがなくて丸ごと捨てた回数
+    uint32_t blits; //< 矩形の転送回数（セル・スパンの矩形・合成済みのフレーム）
+    uint32_t clipped_blits; //< そのうち描画先の端で切り取ったもの
+    uint32_t culled_blits; //< 描画先の外で何も書かなかった転送
+    uint32_t aligned_blits; //< ソースと描画先のビット位置が揃っていてシフトしない転送
+    uint32_t unaligned_blits; //< シフトして合わせる転送
+    uint32_t flipped_blits; //< ビットを反転しながら描く転送（反転キャッシュを使ったものは含まない）
+    uint32_t bytes; //< 書き換えた描画先のバイト数（マスクも含む）
+    uint32_t frames_advanced; //< 進めたフレーム数（累積時間で直接移動したときは 1）
+    uint32_t callbacks; //< 呼んだコールバックとキューに積んだイベントの数
+    uint32_t collider_checks; //< コライダーの判定（コールバック・ワールドへの登録・重なりの判定）の数
+    float draw_ms; //< 描画にかかった時間
+    float update_ms; //< pdani_player_update にかかった時間（コールバックの時間も含む）
+};
+
+/// pdani_stats_end_frame で数えるフレーム時間のヒストグラムの数（1ms 刻み、最後はそれ以上すべて）
+#define PDANI_STATS_HISTOGRAM_BUCKETS 32
+
+struct pdani_stats {
+    struct pdani_stats_counters frame; //< 直前に終えたフレームの値（どのファイルも合わせたもの）
+    float frame_ms; //< 直前のフレームの pdani_stats_begin_frame から pdani_stats_end_frame まで
+    uint32_t frame_count;
+    uint32_t histogram[PDANI_STATS_HISTOGRAM_BUCKETS]; //< frame_ms の分布
+};
+#endif
+
 struct pdani_file {
     enum pdani_file_flags flags;
-    struct {
-        int8_t id[4];
-        uint32_t version;
-        int32_t padding[2];
-    } *header;
+    const struct pdani_allocator *allocator; //< @internal 初期化時の pdani_global_get_allocator
+    struct pdani_header *header;
     const struct pdani_chunk *chunks[PDANI_CHUNK_TYPE_MAX];
     LCDBitmap *bitmap;
     struct {
@@ -133,14 +341,37 @@ struct pdani_file {
         int rowbytes;
         uint8_t *texel;
         uint8_t *mask;
+        uint8_t *flipped_texel; //< 水平反転済みのテクセル（未作成ならNULL）
+        uint8_t *flipped_mask;
     } bitmap_info;
+    struct {
+        uint16_t *slots; //< タグ番号+1 のオープンアドレス表（0は空き）
+        uint32_t mask; //< 表の大きさ-1（タグ数は最大65535なので表は131072まで広がる）
+    } tag_index; //< @internal
+    uint8_t *span_images; //< @internal スパンで描く画像のビット表（NULL ならすべてまとめて描く）
+    struct {
+        struct pdani_draw_command *commands;
+        uint16_t *frame_start; //< フレームごとの commands の開始位置（frame_count+1個）
+    } draw_list; //< @internal
+    struct pdani_stream *stream; //< @internal ストリーミング読み込み時のみ
+    struct {
+        uint16_t *frame_start; //< フレームごとの events の開始位置（frame_count+1個）
+        struct pdani_event_data *events;
+        uint16_t *layer_ids; //< レイヤー名の intern ID
+    } symbols; //< @internal 最初にイベントかレイヤー ID を使うときに作る
+    LCDRect *frame_bounds; //< @internal フレームごとのセルの外接矩形（最初の pdani_file_get_frame_bounds で作る）
+    uint32_t *frame_time; //< @internal 各フレーム終了時刻の累積（frame_count+1個、最初の時間シーク時に作る）
+    struct pdani_frame_cache *frame_cache; //< @internal pdani_file_enable_frame_cache で作る
+#ifdef PDANI_ENABLE_STATS
+    struct pdani_stats_counters stats; //< @internal pdani_file_get_stats
+#endif
 };
 
 struct pdani_player {
     struct pdani_file *file; //< @internal
     uint16_t start_frame;
     uint16_t end_frame;
-    const struct pdani_frame_data *current_frame;
+    const struct pdani_frame_data *current_frame; //< ストリーミング読み込みではキャッシュの追い出しで無効になる
     int16_t frame_number;
     int16_t previous_frame_number;
     int16_t frame_elapsed;
@@ -148,6 +379,44 @@ struct pdani_player {
     bool is_playing;
     enum pdani_player_flags flags;
     enum pdani_player_loop_type loop_type;
+    uint16_t variant; //< 焼き込み済みの回転・拡大縮小（0 なら元の絵。pdani_player_set_rotation / pdani_player_set_scale）
+    uint64_t disabled_layers; //< @internal pdani_player_set_layer_enabled で無効にしたレイヤー（ビットがレイヤー番号）
+    uint64_t hidden_layers; //< @internal 無効にしたグループの子も含めて隠れるレイヤー（0 なら全部描く）
+    struct {
+        struct pdani_event items[PDANI_EVENT_QUEUE_SIZE];
+        uint8_t head;
+        uint8_t count;
+    } events; //< @internal あふれたら古いものから捨てる
+};
+
+/// pdani_player_group_update で発生したイベント
+struct pdani_group_event {
+    uint16_t member; //< メンバー番号
+    int16_t frame;
+    uint16_t id; //< pdani_intern の ID
+};
+
+/// 同じファイルを再生する多数のプレイヤー（鳥の群れ・破片・コインなど）を配列ごとに持ち、まとめて進める
+struct pdani_player_group {
+    const struct pdani_allocator *allocator; //< @internal
+    struct pdani_file *file; //< @internal
+    int count;
+    int capacity;
+    bool events_enabled; //< @internal
+    // メンバーごとの状態（添字がメンバー番号。pdani_player の同名のメンバーと同じ意味）
+    int16_t *frame_number;
+    int16_t *previous_frame_number;
+    int16_t *frame_elapsed;
+    int32_t *total_elapsed;
+    uint16_t *start_frame;
+    uint16_t *end_frame;
+    uint8_t *flags; //< enum pdani_player_group_flags
+    // 直前の pdani_player_group_update の結果
+    uint16_t *changed; //< フレームが変わったメンバー番号
+    int changed_count;
+    struct pdani_group_event *events; //< 発生したイベント（メンバー番号順）
+    int event_count;
+    int event_capacity; //< @internal
 };
 
 struct pdani_sprite {
@@ -156,10 +425,42 @@ struct pdani_sprite {
     LCDSprite *sprite;
     LCDSprite **colliders;
     int origin_x, origin_y;
+    struct {
+        int frame; //< -1 なら未設定
+        int variant;
+        float x, y;
+        bool fliph, flipv;
+        uint64_t hidden_layers;
+    } bounds_state; //< @internal 最後に setBounds したときの状態
+};
+
+/// 衝突判定ワールドに登録したコライダー矩形
+struct pdani_collision_entry {
+    int16_t x, y;
+    uint16_t w, h;
+    const char *name; //< コライダーレイヤー名（@hit など）
+    uint16_t name_id; //< pdani_intern の ID
+    void *owner; //< 同じ owner 同士は組にしない（NULL なら常に組にする）
+};
+
+/// 一様グリッドで引く衝突判定ワールド（フレームごとに begin → add → build → query）
+struct pdani_collision_world {
+    const struct pdani_allocator *allocator; //< @internal
+    LCDRect bounds; //< グリッドの範囲（外側の矩形は端のセルに入る）
+    int cell_shift; //< セルの大きさ（1 << cell_shift ピクセル）
+    int columns, rows;
+    struct pdani_collision_entry *entries;
+    int count, capacity;
+    uint16_t *cell_start; //< @internal セルごとの cell_items の開始位置（columns*rows+2個）
+    uint16_t *cell_items; //< @internal
+    int cell_item_capacity; //< @internal
+    int cell_item_count; //< @internal add で登録したセルの延べ数（65535 まで）
 };
 
 typedef void (*pdani_frame_layer_callback)(const struct pdani_file *file, int framenum, const char *name, void *ptr);
 typedef void (*pdani_collider_callback)(const struct pdani_file *file, const char *name, int x, int y, int w, int h, void *ptr);
+typedef void (*pdani_collision_pair_callback)(const struct pdani_collision_entry *a, const struct pdani_collision_entry *b, void *ptr);
+typedef void (*pdani_collision_query_callback)(const struct pdani_collision_entry *entry, void *ptr);
 
 #ifdef __cplusplus
 extern "C"
@@ -167,20 +468,80 @@ extern "C"
 #endif
 
 void pdani_global_initialize(PlaydateAPI *api);
+/// @fn 以降に初期化するファイル・プレイヤー・バッチが使うアロケータ（NULL なら system->realloc）
+void pdani_global_set_allocator(const struct pdani_allocator *allocator);
+const struct pdani_allocator* pdani_global_get_allocator(void);
+
+// intern
+/// @fn 文字列に 1 から始まる ID を振る（同じ文字列なら同じ ID。ファイルをまたいで共通）
+int pdani_intern(const char *name);
+/// @fn ID の文字列（不明な ID なら NULL）
+const char* pdani_intern_get_name(int id);
+
+// asset
+/// @fn ファイル名で共有ファイルを得る（読み込み済みなら参照カウントを増やしてそれを返す）。bmpfilename が NULL なら .ani 内蔵のアトラスを使う
+/// 読めない・壊れているときは NULL を返し、何も登録しない。共有ファイルは pdani_global_set_allocator によらず system->realloc で持つ
+struct pdani_file* pdani_asset_acquire(const char *anifilename, const char *bmpfilename);
+/// @fn 参照を返す（最後の参照なら予算に応じて捨てる）
+void pdani_asset_release(struct pdani_file *file);
+/// @fn 参照されていないファイルをこのバイト数まで残す（超えたら古いものから捨てる。0 ならすぐ捨てる）
+void pdani_asset_set_budget(size_t bytes);
+/// @fn 参照されていないファイルをすべて捨てる
+void pdani_asset_purge(void);
+
+// arena
+/// @fn capacity は読み込むファイルとその表（ドローリスト・フレームキャッシュなど）がすべて入る大きさにする。
+/// 足りなくなると system->error で止まる（確保に失敗した NULL を受け取る呼び出し側はない）
+void pdani_arena_initialize(struct pdani_arena *arena, void *buffer, size_t capacity);
+/// @fn 確保したものをすべて捨てる（このアリーナで読んだファイルは先に pdani_file_finalize しておく）
+void pdani_arena_reset(struct pdani_arena *arena);
 
 // file2
-/// @fn 初期化
+/// @fn 初期化（bitmap や bmpfilename が NULL なら ATLS チャンクのアトラスを使う。圧縮された .ani はファイル名版でだけ読める）
 void pdani_file_initialize(struct pdani_file *file, void *data, LCDBitmap *bitmap);
 void pdani_file_initialize_with_filename(struct pdani_file *file, const char *anifilename, const char *bmpfilename);
+/// @fn 読み込み時に1回だけ検証してから初期化する（壊れていれば system->error を呼ばずにエラーを返し、file は使えない）。
+/// 検証したファイルは描画・更新でデータの範囲を調べない
+enum pdani_file_error pdani_file_initialize_validated(struct pdani_file *file, void *data, size_t size, LCDBitmap *bitmap);
+enum pdani_file_error pdani_file_initialize_with_filename_validated(struct pdani_file *file, const char *anifilename, const char *bmpfilename);
+/// @fn 初期化せずに検証だけする（atlas_width と atlas_height が 0 なら ATLS チャンクの大きさで調べる）
+enum pdani_file_error pdani_file_validate(const void *data, size_t size, int atlas_width, int atlas_height);
+const char* pdani_file_get_error_name(enum pdani_file_error error);
+/// @fn タグ情報だけ先に読み、フレームデータは再生するタグごとに cache_bytes 以内のキャッシュへ読み込む。
+/// 開けない・見出しが壊れているときはエラーを返し、file は使えない
+enum pdani_file_error pdani_file_initialize_streaming(struct pdani_file *file, const char *anifilename, LCDBitmap *bitmap, int cache_bytes);
 void pdani_file_finalize(struct pdani_file *file);
+/// @fn 水平反転描画用にアトラスの反転コピーを持つ（lazy なら最初の反転描画時に作る）
+void pdani_file_enable_flip_cache(struct pdani_file *file, bool lazy);
+/// @fn 2枚以上のセルを重ねるフレームを反転状態ごとに1枚へ合成して持ち、以降は1回の転送で描く（budget_bytes を超えたら最も長く使っていないものから捨てる。0 なら無効にする）
+void pdani_file_enable_frame_cache(struct pdani_file *file, int budget_bytes);
 int pdani_file_get_width(const struct pdani_file *file);
 int pdani_file_get_height(const struct pdani_file *file);
 int pdani_file_get_tag_count(const struct pdani_file *file);
 const char* pdani_file_get_tag_name(const struct pdani_file *file, int index);
+/// @fn タグ名からタグ番号を引く（見つからなければ -1）
+int pdani_file_find_tag(const struct pdani_file *file, const char *tagname);
 int pdani_file_get_layer_count(const struct pdani_file *file);
 const char* pdani_file_get_layer_name(const struct pdani_file *file, int index);
+/// @fn レイヤー名からレイヤー番号を引く（見つからなければ -1）
+int pdani_file_find_layer(const struct pdani_file *file, const char *layername);
+/// @fn レイヤー名の pdani_intern の ID
+int pdani_file_get_layer_name_id(struct pdani_file *file, int index);
 int pdani_file_get_frame_count(const struct pdani_file *file);
+/// @fn フレームで描かれるセルの外接矩形（キャンバス座標、反転込み。何も描かなければ空の矩形）
+void pdani_file_get_frame_bounds(struct pdani_file *file, int frame, bool fliph, bool flipv, LCDRect *rect);
+/// @fn 全フレームの描画命令を前もって解決し、以降の pdani_file_draw で使う
+void pdani_file_compile_draw_list(struct pdani_file *file);
+/// @fn target が NULL なら画面。ビットマップなら大きさで切り抜き、マスクがあれば描いた画素を不透明にする（行は32bit境界に揃っていること）
 void pdani_file_draw(const struct pdani_file *file, LCDBitmap *target, int x, int y, int frame, bool fliph, bool flipv);
+/// @fn 焼き込まれた向きの数（無ければ 1）
+int pdani_file_get_rotation_count(const struct pdani_file *file);
+/// @fn 焼き込まれた拡大率の数（無ければ 1）
+int pdani_file_get_scale_count(const struct pdani_file *file);
+/// @fn 角度（度、時計回り）と拡大率に最も近い焼き込み済みのバリエーション番号（0 なら元の絵）
+int pdani_file_find_variant(const struct pdani_file *file, float degrees, float scale);
+/// @fn 焼き込み済みのバリエーションを1枚のセルとして描く（焼き込まれていないフレームは元の絵。反転は回した後の絵にかかる）
+void pdani_file_draw_variant(const struct pdani_file *file, LCDBitmap *target, int x, int y, int frame, int variant, bool fliph, bool flipv);
 void pdani_file_check_collision(const struct pdani_file *file, int x, int y, int framenum, bool fliph, bool flipv, pdani_collider_callback callback, void *ptr);
 void pdani_file_dump(const struct pdani_file *file);
 
@@ -190,21 +551,111 @@ void pdani_player_initialize_with_filename(struct pdani_player *player, const ch
 void pdani_player_finalize(struct pdani_player *player);
 static inline const struct pdani_file* pdani_player_get_file(const struct pdani_player *player) { return player->file; }
 void pdani_player_play(struct pdani_player *player, const char *tagname);
+/// @fn pdani_file_find_tag で得たタグ番号で再生する（-1 なら全フレーム）
+void pdani_player_play_tag_index(struct pdani_player *player, int tag_index);
 void pdani_player_stop(struct pdani_player *player);
 void pdani_player_resume(struct pdani_player *player);
 void pdani_player_seek_frame(struct pdani_player *player, int frame_number);
+/// @fn 再生中のタグの先頭から ms 経過した位置へ移動する（ループならタグの長さで周回する）
+void pdani_player_seek_time(struct pdani_player *player, int ms);
 bool pdani_player_get_flip_horizontally(const struct pdani_player *player);
 bool pdani_player_get_flip_vertically(const struct pdani_player *player);
 void pdani_player_set_flip(struct pdani_player *player, bool fliph, bool flipv);
+/// @fn 描く向き（度、時計回り）。最も近い焼き込み済みの向きを選ぶ（コライダーは回らない）
+void pdani_player_set_rotation(struct pdani_player *player, float degrees);
+/// @fn 描く大きさ。最も近い焼き込み済みの拡大率を選ぶ
+void pdani_player_set_scale(struct pdani_player *player, float scale);
+/// @fn レイヤーを描くかどうか（グループを無効にすると子も隠れる）。隠したレイヤーのセル・コライダー・イベントは描画・当たり判定・イベントで飛ばす
+/// 焼き込み済みの回転・拡大縮小とフレームキャッシュは全レイヤーを重ねた絵なので、隠したレイヤーがある間は使わずにセルを1枚ずつ描く
+void pdani_player_set_layer_enabled(struct pdani_player *player, int index, bool enabled);
+/// @fn レイヤー名で pdani_player_set_layer_enabled する（見つからなければ false）
+bool pdani_player_set_layer_enabled_by_name(struct pdani_player *player, const char *layername, bool enabled);
+/// @fn 親のグループも含めて有効で、描かれるレイヤーかどうか
+bool pdani_player_is_layer_visible(const struct pdani_player *player, int index);
+/// @fn 有効にすると pdani_player_update が通過したフレームのイベントを ID でキューに積む
+void pdani_player_enable_event_queue(struct pdani_player *player, bool enable);
+/// @fn キューからイベントを取り出す（空なら false）
+bool pdani_player_poll_event(struct pdani_player *player, struct pdani_event *event);
 void pdani_player_check_collision(const struct pdani_player *player, int x, int y, pdani_collider_callback callback, void *ptr);
 void pdani_player_update(struct pdani_player *player, int ms, pdani_frame_layer_callback callback, void *ptr);
 void pdani_player_draw(const struct pdani_player *player, LCDBitmap *target, int x, int y);
 
+// player group
+// 同じファイルの多数のプレイヤーを配列で持ち、ひとつのループで進めて変化をまとめて返す
+void pdani_player_group_initialize(struct pdani_player_group *group, struct pdani_file *file, int capacity);
+void pdani_player_group_finalize(struct pdani_player_group *group);
+/// @fn メンバーを追加して番号を返す（停止状態・全フレーム・ループ）
+int pdani_player_group_add(struct pdani_player_group *group);
+/// @fn メンバーを取り除く（最後のメンバーがこの番号に移る）
+void pdani_player_group_remove(struct pdani_player_group *group, int member);
+void pdani_player_group_play(struct pdani_player_group *group, int member, const char *tagname);
+/// @fn pdani_file_find_tag で得たタグ番号で再生する（-1 なら全フレーム）
+void pdani_player_group_play_tag_index(struct pdani_player_group *group, int member, int tag_index);
+void pdani_player_group_stop(struct pdani_player_group *group, int member);
+void pdani_player_group_resume(struct pdani_player_group *group, int member);
+void pdani_player_group_seek_frame(struct pdani_player_group *group, int member, int frame_number);
+void pdani_player_group_set_loop_type(struct pdani_player_group *group, int member, enum pdani_player_loop_type loop_type);
+void pdani_player_group_set_frame_skippable(struct pdani_player_group *group, int member, bool skippable);
+void pdani_player_group_set_flip(struct pdani_player_group *group, int member, bool fliph, bool flipv);
+/// @fn 有効にすると pdani_player_group_update が通過したフレームのイベントを events に集める
+void pdani_player_group_enable_events(struct pdani_player_group *group, bool enable);
+/// @fn 全メンバーを ms 進め、changed と events を作り直す
+void pdani_player_group_update(struct pdani_player_group *group, int ms);
+/// @fn 描画するフレーム（停止中なら 1）
+int pdani_player_group_get_frame(const struct pdani_player_group *group, int member);
+void pdani_player_group_draw(const struct pdani_player_group *group, int member, LCDBitmap *target, int x, int y);
+
+// collision world
+/// @fn bounds が NULL なら画面の範囲。cell_size は 2 の累乗に切り上げる
+void pdani_collision_world_initialize(struct pdani_collision_world *world, const LCDRect *bounds, int cell_size);
+void pdani_collision_world_finalize(struct pdani_collision_world *world);
+void pdani_collision_world_begin(struct pdani_collision_world *world);
+/// @fn プレイヤーの現在フレームのコライダーをすべて登録する。登録できなかったものがあれば false
+bool pdani_collision_world_add_player(struct pdani_collision_world *world, const struct pdani_player *player, int x, int y, void *owner);
+/// @fn 矩形と、またがるセルの延べ数が 65535 を超えるときは登録せずに false を返す
+bool pdani_collision_world_add_rect(struct pdani_collision_world *world, const char *name, int x, int y, int w, int h, void *owner);
+/// @fn 登録した矩形をグリッドに振り分ける（query の前に呼ぶ）
+void pdani_collision_world_build(struct pdani_collision_world *world);
+/// @fn 名前が name_a と name_b の重なっている組を列挙する（NULL ならどの名前でもよい）。a が name_a 側
+void pdani_collision_world_query_pairs(const struct pdani_collision_world *world, const char *name_a, const char *name_b, pdani_collision_pair_callback callback, void *ptr);
+void pdani_collision_world_query_rect(const struct pdani_collision_world *world, const char *name, int x, int y, int w, int h, pdani_collision_query_callback callback, void *ptr);
+void pdani_collision_world_query_point(const struct pdani_collision_world *world, const char *name, int x, int y, pdani_collision_query_callback callback, void *ptr);
+
+// dirty
+// 画面（target == NULL）への描画で書き換えた行を記録し、その行だけを LCD に反映する
+void pdani_dirty_mark(const LCDRect *rect);
+/// @fn このフレームで書き換えた範囲の外接矩形（何も書いていなければ false）
+bool pdani_dirty_get_bounds(LCDRect *rect);
+/// @fn このフレームと前フレームで書き換えた行を markUpdatedRows に渡し、次のフレームへ進める
+void pdani_dirty_flush(void);
+void pdani_dirty_clear(void);
+
 // sprite
 void pdani_sprite_initialize(struct pdani_sprite *anisprite, void *data, LCDBitmap *bitmap, LCDSprite *sprite);
 void pdani_sprite_finalize(struct pdani_sprite *anisprite);
 static inline LCDSprite* pdani_sprite_get_sprite(struct pdani_sprite *anisprite) { return anisprite->sprite; }
 
+#ifdef PDANI_ENABLE_STATS
+// stats
+// どのアセットがフレームの予算を食っているかを調べるための計測。時間は system->getElapsedTime で測るので、pdani_stats_begin_frame が resetElapsedTime を呼ぶ
+/// @fn フレームの最初に呼ぶ（このフレームの値を 0 にして時間を測り始める）
+void pdani_stats_begin_frame(void);
+/// @fn フレームの最後に呼ぶ（このフレームの値を pdani_stats_get に移し、かかった時間をヒストグラムに入れる）
+void pdani_stats_end_frame(void);
+const struct pdani_stats* pdani_stats_get(void);
+/// @fn フレーム数とヒストグラムを 0 にする
+void pdani_stats_reset(void);
+/// @fn ファイルごとの累計（pdani_file_reset_stats からの合計）
+const struct pdani_stats_counters* pdani_file_get_stats(const struct pdani_file *file);
+void pdani_file_reset_stats(struct pdani_file *file);
+/// @fn 直前のフレームの値とヒストグラムを logToConsole に出す
+void pdani_stats_log(void);
+/// @fn ファイルの累計を name を付けて logToConsole に出す
+void pdani_stats_log_file(const struct pdani_file *file, const char *name);
+/// @fn 直前のフレームの値を画面の (x, y) から1行 line_height ずつ現在のフォントで描く
+void pdani_stats_draw_overlay(int x, int y, int line_height);
+#endif
+
 
 
 